@@ -14,6 +14,9 @@ LICENSE file.
 #pragma once
 
 class ESDConnectionManager;
+namespace asio {
+class io_context;
+}
 
 class ESDBasePlugin {
  public:
@@ -26,6 +29,11 @@ class ESDBasePlugin {
     mConnectionManager = inConnectionManager;
   }
 
+  // Called from ESDConnectionManager::Run() once the event loop has been
+  // created, just before it starts - the loop runs on the calling thread
+  virtual void WillRunEventLoop(asio::io_context& /*inIOContext*/) {
+  }
+
   virtual void DidReceiveGlobalSettings(const json& inPayload) = 0;
 
   virtual void DidReceiveSettings(
@@ -134,6 +134,10 @@ void ESDConnectionManager::Run() {
     // Initialize ASIO
     mWebsocket.init_asio();
 
+    // Let the plugin schedule its own work on the same loop
+    if (mPlugin != nullptr)
+      mPlugin->WillRunEventLoop(mWebsocket.get_io_service());
+
     // Register our message handler
     mWebsocket.set_open_handler(websocketpp::lib::bind(
       &ESDConnectionManager::OnOpen, this, &mWebsocket,
@@ -219,6 +223,33 @@ void ESDConnectionManager::SetImage(
     mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
 }
 
+void ESDConnectionManager::SetImage(
+  const std::shared_ptr<const std::string>& inDataURI,
+  const std::string& inContext,
+  ESDSDKTarget inTarget) {
+  if (!inDataURI) {
+    SetImage(std::string(), inContext, inTarget);
+    return;
+  }
+
+  // The URI is base64 so it never needs escaping - only the context goes
+  // through json
+  const std::string context = json(inContext).dump();
+  std::string frame;
+  frame.reserve(inDataURI->size() + context.size() + 80);
+  frame.append("{\"" kESDSDKCommonEvent "\":\"" kESDSDKEventSetImage "\",\"" kESDSDKCommonContext "\":");
+  frame.append(context);
+  frame.append(",\"" kESDSDKCommonPayload "\":{\"" kESDSDKPayloadTarget "\":");
+  frame.append(std::to_string(inTarget));
+  frame.append(",\"" kESDSDKPayloadImage "\":\"");
+  frame.append(*inDataURI);
+  frame.append("\"}}");
+
+  websocketpp::lib::error_code ec;
+  mWebsocket.send(
+    mConnectionHandle, frame, websocketpp::frame::opcode::text, ec);
+}
+
 void ESDConnectionManager::SendToPropertyInspector(
   const std::string& inAction,
   const std::string& inContext,
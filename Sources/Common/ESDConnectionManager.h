@@ -46,6 +46,12 @@ class ESDConnectionManager {
     const std::string& inBase64ImageString,
     const std::string& inContext,
     ESDSDKTarget inTarget);
+  // Send an image that's already a complete "data:image/png;base64,..." URI
+  // (see IconCache) - written straight into the frame without a json copy
+  void SetImage(
+    const std::shared_ptr<const std::string>& inDataURI,
+    const std::string& inContext,
+    ESDSDKTarget inTarget);
   void SendToPropertyInspector(
     const std::string& inAction,
     const std::string& inContext,
@@ -144,4 +144,4 @@ enum {
 };
 
 typedef int ESDSDKDeviceType;
-enum { kESDSDKDeviceType_StreamDeck = 0, kESDSDKDeviceType_StreamDeckMini = 1 };
+enum { kESDSDKDeviceType_StreamDeck = 0, kESDSDKDeviceType_StreamDeckMini = 1, kESDSDKDeviceType_StreamDeckXL = 2, kESDSDKDeviceType_StreamDeckMobile = 3 };
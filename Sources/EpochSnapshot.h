@@ -0,0 +1,122 @@
+//==============================================================================
+/**
+@file       EpochSnapshot.h
+
+@brief      Immutable versions of a value, published through an atomic pointer and freed by epoch
+
+            One thread publishes new versions, and the other threads read the current one without taking
+            a lock or touching a reference count - a reader pins the epoch it started in, and an old version
+            is only freed once every reader that could still be looking at it has let go.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class EpochSnapshot
+{
+public:
+    //readers that can hold a version at the same time - a reader spins if they're all taken
+    static constexpr size_t MAX_READERS = 8;
+
+    //pins the version that was current when it was made - keep it on the stack for the length of one callback
+    class Reader
+    {
+    public:
+        explicit Reader(const EpochSnapshot& snapshot)
+        {
+            //start from the slot this thread had last time, so the compare-exchange normally succeeds first go
+            static thread_local size_t slotHint = 0;
+            size_t index = slotHint;
+            for (;;)
+            {
+                uint64_t expected = FREE;
+                const uint64_t epoch = snapshot.mEpoch.load(std::memory_order_seq_cst);
+                if (snapshot.mSlots[index].compare_exchange_strong(expected, epoch, std::memory_order_seq_cst)) break;
+                index = (index + 1) % MAX_READERS;
+            }
+            slotHint = index;
+            mSlot = &snapshot.mSlots[index];
+            //after the slot is pinned - the publisher can't free anything this load returns
+            mVersion = snapshot.mCurrent.load(std::memory_order_seq_cst);
+        }
+        ~Reader() { mSlot->store(FREE, std::memory_order_release); }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        const T& operator*() const { return *mVersion; }
+        const T* operator->() const { return mVersion; }
+
+    private:
+        std::atomic<uint64_t>* mSlot;
+        const T* mVersion;
+    };
+
+    explicit EpochSnapshot(std::unique_ptr<const T> initial)
+    : mCurrent(initial.release())
+    {
+        for (auto& slot : mSlots) slot.store(FREE, std::memory_order_relaxed);
+    }
+
+    //every reader has to have finished by now
+    ~EpochSnapshot() { delete mCurrent.load(std::memory_order_acquire); }
+
+    EpochSnapshot(const EpochSnapshot&) = delete;
+    EpochSnapshot& operator=(const EpochSnapshot&) = delete;
+
+    //publisher thread only - no pin needed, as only the publisher frees versions, but don't hold on to it across Publish()
+    const T& Current() const { return *mCurrent.load(std::memory_order_relaxed); }
+
+    //publisher thread only - swap in the new version, and free the old ones no reader can still see
+    void Publish(std::unique_ptr<const T> version)
+    {
+        const T* previous = mCurrent.exchange(version.release(), std::memory_order_seq_cst);
+        //a reader that pins an epoch from here on can only load the new version
+        const uint64_t epoch = mEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        mRetired.emplace_back(epoch, std::unique_ptr<const T>(previous));
+        Reclaim();
+    }
+
+    //publisher thread only - Publish() calls this, so it's only needed to let go of the last old version early
+    void Reclaim()
+    {
+        uint64_t oldestPinned = UINT64_MAX;
+        for (const auto& slot : mSlots)
+        {
+            const uint64_t epoch = slot.load(std::memory_order_seq_cst);
+            if (epoch != FREE && epoch < oldestPinned) oldestPinned = epoch;
+        }
+        size_t kept = 0;
+        for (auto& retired : mRetired)
+        {
+            //retired in epoch n, so it can only be held by readers pinned before n
+            if (retired.first > oldestPinned) mRetired[kept++] = std::move(retired);
+        }
+        mRetired.resize(kept);
+    }
+
+    //publisher thread only - old versions still waiting for a reader to finish
+    size_t GetRetiredCount() const { return mRetired.size(); }
+
+private:
+    //slot value for no reader - epochs start at 1
+    static constexpr uint64_t FREE = 0;
+
+    std::atomic<const T*> mCurrent;
+    mutable std::atomic<uint64_t> mEpoch{1};
+    mutable std::atomic<uint64_t> mSlots[MAX_READERS];
+
+    //publisher thread only - each old version with the epoch it was retired in
+    std::vector<std::pair<uint64_t, std::unique_ptr<const T>>> mRetired;
+};
@@ -0,0 +1,87 @@
+//==============================================================================
+/**
+@file       IconCache.cpp
+
+@brief      Icons loaded and encoded once, as ready-to-send data URIs
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "IconCache.h"
+#include "base64.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <dirent.h>
+
+namespace {
+const char* DATA_URI_PREFIX = "data:image/png;base64,";
+const std::string PNG_EXTENSION = ".png";
+
+bool ReadWholeFile(const std::string& path, std::vector<unsigned char>& contents)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0)
+    {
+        fclose(file);
+        return false;
+    }
+    contents.resize((size_t)size);
+    const bool ok = fread(contents.data(), 1, contents.size(), file) == contents.size();
+    fclose(file);
+    return ok;
+}
+}
+
+bool IconCache::Load(const std::string& directory)
+{
+    const auto start = std::chrono::steady_clock::now();
+    mDirectory = directory;
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return false;
+
+    std::vector<unsigned char> contents;
+    while (struct dirent* entry = readdir(dir))
+    {
+        const std::string fileName = entry->d_name;
+        if (fileName.size() <= PNG_EXTENSION.size() || fileName.compare(fileName.size() - PNG_EXTENSION.size(), PNG_EXTENSION.size(), PNG_EXTENSION) != 0) continue;
+        if (!ReadWholeFile(directory + "/" + fileName, contents)) continue;
+
+        //encode straight into the URI, after the prefix
+        const size_t prefixLength = strlen(DATA_URI_PREFIX);
+        auto dataURI = std::make_shared<std::string>(prefixLength + base64_encoded_size(contents.size()), '\0');
+        memcpy(&(*dataURI)[0], DATA_URI_PREFIX, prefixLength);
+        base64_encode_into(contents.data(), contents.size(), &(*dataURI)[prefixLength]);
+
+        mFileBytes += contents.size();
+        mEncodedBytes += dataURI->size();
+        mIcons[fileName.substr(0, fileName.size() - PNG_EXTENSION.size())] = std::move(dataURI);
+    }
+    closedir(dir);
+
+    mLoadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return !mIcons.empty();
+}
+
+std::shared_ptr<const std::string> IconCache::Get(const std::string& name) const
+{
+    auto it = mIcons.find(name);
+    if (it == mIcons.end()) return nullptr;
+    return it->second;
+}
+
+std::string IconCache::GetLoadReport() const
+{
+    char report[256];
+    snprintf(report, sizeof(report), "%zu icons from %s: %zu bytes of PNG, %zu bytes of data URI, built in %.2f ms", mIcons.size(), mDirectory.c_str(), mFileBytes, mEncodedBytes, mLoadMilliseconds);
+    return report;
+}
@@ -0,0 +1,38 @@
+//==============================================================================
+/**
+@file       IconCache.h
+
+@brief      Icons loaded and encoded once, as ready-to-send data URIs
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class IconCache
+{
+public:
+    //read every .png in the directory and encode it as "data:image/png;base64,..." - call once, before any Get()
+    bool Load(const std::string& directory);
+
+    //the icon's data URI, keyed by file name without the extension (e.g. "stop_inactive") - nullptr if there isn't one
+    //safe to call from any thread once Load() has returned, as the cache is never changed after that
+    std::shared_ptr<const std::string> Get(const std::string& name) const;
+
+    //one-line summary of the last Load(), for the log
+    std::string GetLoadReport() const;
+
+private:
+    std::unordered_map<std::string, std::shared_ptr<const std::string>> mIcons;
+    size_t mFileBytes = 0;
+    size_t mEncodedBytes = 0;
+    double mLoadMilliseconds = 0;
+    std::string mDirectory;
+};
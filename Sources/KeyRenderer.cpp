@@ -0,0 +1,212 @@
+//==============================================================================
+/**
+@file       KeyRenderer.cpp
+
+@brief      Live key images - level bars drawn in-process and sent at a capped frame rate
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "KeyRenderer.h"
+#include "base64.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+const char* DATA_URI_PREFIX = "data:image/png;base64,";
+
+//RGBA
+const unsigned char BACKGROUND_COLOUR[4] = {0x1A, 0x1A, 0x1A, 0xFF};
+const unsigned char TRACK_COLOUR[4] = {0x38, 0x38, 0x38, 0xFF};
+const unsigned char BAR_COLOUR[4] = {0x2E, 0xA3, 0xF2, 0xFF};
+
+//background either side of the track, and the track or bar in the middle
+void FillRow(unsigned char* row, int keySize, int margin, const unsigned char* colour)
+{
+    for (int x = 0; x < keySize; x++)
+    {
+        memcpy(row + x * 4, (x < margin || x >= keySize - margin) ? BACKGROUND_COLOUR : colour, 4);
+    }
+}
+}
+
+KeyRenderer::KeyRenderer(uint32_t maxContexts, Sink sink, int framesPerSecond, int imagesPerFrame)
+    : mSink(std::move(sink)),
+      mFrameInterval(std::chrono::nanoseconds(1000000000 / (framesPerSecond > 0 ? framesPerSecond : 1))),
+      mImagesPerFrame(imagesPerFrame > 0 ? imagesPerFrame : 1),
+      mRequests(maxContexts),
+      mImages(maxContexts)
+{
+    mThread = std::thread([this]() {this->Run();});
+}
+
+KeyRenderer::~KeyRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWake.notify_one();
+    if (mThread.joinable()) mThread.join();
+}
+
+void KeyRenderer::SetLevel(uint32_t contextId, int level)
+{
+    if (contextId >= mRequests.size()) return;
+    if (level < 0) level = 0;
+    if (level > MAX_LEVEL) level = MAX_LEVEL;
+    mRequests[contextId].level.store(level, std::memory_order_relaxed);
+    MarkDirty(contextId);
+}
+
+void KeyRenderer::SetKeySize(uint32_t contextId, int keySize)
+{
+    if (contextId >= mRequests.size()) return;
+    mRequests[contextId].keySize.store(keySize == KEY_SIZE_HIGH_DPI ? KEY_SIZE_HIGH_DPI : KEY_SIZE, std::memory_order_relaxed);
+    MarkDirty(contextId);
+}
+
+void KeyRenderer::Clear(uint32_t contextId)
+{
+    if (contextId >= mRequests.size()) return;
+    mRequests[contextId].level.store(NO_LEVEL, std::memory_order_relaxed);
+    MarkDirty(contextId);
+}
+
+void KeyRenderer::Repaint(uint32_t contextId)
+{
+    if (contextId >= mRequests.size()) return;
+    mRequests[contextId].repaint.store(true, std::memory_order_relaxed);
+    MarkDirty(contextId);
+}
+
+void KeyRenderer::MarkDirty(uint32_t contextId)
+{
+    //already waiting for a frame - the render thread will pick up the value we just stored
+    if (mRequests[contextId].dirty.exchange(true, std::memory_order_acq_rel))
+    {
+        mRequestsMerged.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint32_t limit = mContextLimit.load(std::memory_order_relaxed);
+    while (limit <= contextId && !mContextLimit.compare_exchange_weak(limit, contextId + 1, std::memory_order_release, std::memory_order_relaxed)) {}
+
+    //only the first dirty key has to wake the render thread
+    if (mDirtyCount.fetch_add(1, std::memory_order_acq_rel) == 0)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWake.notify_one();
+    }
+}
+
+void KeyRenderer::Run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto nextFrame = std::chrono::steady_clock::now();
+    while (true)
+    {
+        mWake.wait(lock, [this]() {return mStop || mDirtyCount.load(std::memory_order_acquire) > 0;});
+        if (mStop) break;
+
+        //frame-rate cap - anything that changes before the next frame slot is merged into it
+        if (mWake.wait_until(lock, nextFrame, [this]() {return mStop;})) break;
+        lock.unlock();
+
+        const uint32_t limit = mContextLimit.load(std::memory_order_acquire);
+        int imagesSent = 0;
+        uint32_t visited = 0;
+        for (; visited < limit && imagesSent < mImagesPerFrame; visited++)
+        {
+            const uint32_t contextId = (mNextContext + visited) % limit;
+            //clear the flag before reading the request, so a newer value re-dirties the key rather than getting lost
+            if (!mRequests[contextId].dirty.load(std::memory_order_relaxed) || !mRequests[contextId].dirty.exchange(false, std::memory_order_acq_rel)) continue;
+            mDirtyCount.fetch_sub(1, std::memory_order_acq_rel);
+            if (RenderKey(contextId)) imagesSent++;
+        }
+        //over budget - carry on from here next frame
+        mNextContext = limit > 0 ? (mNextContext + visited) % limit : 0;
+        mFrames.fetch_add(1, std::memory_order_relaxed);
+
+        nextFrame = std::chrono::steady_clock::now() + mFrameInterval;
+        lock.lock();
+    }
+}
+
+bool KeyRenderer::RenderKey(uint32_t contextId)
+{
+    Request& request = mRequests[contextId];
+    KeyImage& image = mImages[contextId];
+    const int level = request.level.load(std::memory_order_relaxed);
+    const int keySize = request.keySize.load(std::memory_order_relaxed);
+    const bool repaintRequested = request.repaint.exchange(false, std::memory_order_relaxed);
+
+    if (level == NO_LEVEL)
+    {
+        if (image.drawnLevel == NO_LEVEL) return false;
+        image.drawnLevel = NO_LEVEL;
+        mSink(contextId, nullptr);
+        mImagesSent.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //new key, a new size or asked for - paint the empty track and draw the bar from nothing
+    const bool repaint = repaintRequested || image.drawnLevel == NO_LEVEL || image.keySize != keySize;
+    if (repaint)
+    {
+        const int margin = keySize / 8;
+        const size_t stride = (size_t)keySize * 4;
+        image.keySize = keySize;
+        image.pixels.resize(stride * keySize);
+        for (int y = 0; y < keySize; y++)
+        {
+            FillRow(&image.pixels[y * stride], keySize, margin, (y < margin || y >= keySize - margin) ? BACKGROUND_COLOUR : TRACK_COLOUR);
+        }
+        image.drawnLevel = 0;
+    }
+    else if (level == image.drawnLevel) return false; //went somewhere and came back before the frame
+
+    DrawLevel(image, level);
+
+    mPngEncoder.Encode(image.pixels.data(), keySize, keySize, mPng);
+    const size_t prefixLength = strlen(DATA_URI_PREFIX);
+    auto dataURI = std::make_shared<std::string>(prefixLength + base64_encoded_size(mPng.size()), '\0');
+    memcpy(&(*dataURI)[0], DATA_URI_PREFIX, prefixLength);
+    base64_encode_into(mPng.data(), mPng.size(), &(*dataURI)[prefixLength]);
+
+    mImagesSent.fetch_add(1, std::memory_order_relaxed);
+    mBytesSent.fetch_add(dataURI->size(), std::memory_order_relaxed);
+    mSink(contextId, dataURI);
+    return true;
+}
+
+void KeyRenderer::DrawLevel(KeyImage& image, int level)
+{
+    const int keySize = image.keySize;
+    const int margin = keySize / 8;
+    const int trackHeight = keySize - 2 * margin;
+    const size_t stride = (size_t)keySize * 4;
+
+    //only the rows between the old and new top of the bar change
+    const int oldRows = (image.drawnLevel * trackHeight + MAX_LEVEL / 2) / MAX_LEVEL;
+    const int newRows = (level * trackHeight + MAX_LEVEL / 2) / MAX_LEVEL;
+    const int from = oldRows < newRows ? oldRows : newRows;
+    const int to = oldRows < newRows ? newRows : oldRows;
+    const unsigned char* colour = newRows > oldRows ? BAR_COLOUR : TRACK_COLOUR;
+    for (int row = from; row < to; row++)
+    {
+        const int y = keySize - margin - 1 - row;
+        FillRow(&image.pixels[y * stride], keySize, margin, colour);
+    }
+    image.drawnLevel = level;
+}
+
+std::string KeyRenderer::GetStats() const
+{
+    char stats[256];
+    snprintf(stats, sizeof(stats), "%llu frames, %llu images, %llu bytes of data URI, %llu updates merged", (unsigned long long)mFrames.load(std::memory_order_relaxed), (unsigned long long)mImagesSent.load(std::memory_order_relaxed), (unsigned long long)mBytesSent.load(std::memory_order_relaxed), (unsigned long long)mRequestsMerged.load(std::memory_order_relaxed));
+    return stats;
+}
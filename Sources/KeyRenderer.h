@@ -0,0 +1,106 @@
+//==============================================================================
+/**
+@file       KeyRenderer.h
+
+@brief      Live key images - level bars drawn in-process and sent at a capped frame rate
+
+            Each key has a cached RGBA buffer that only has the rows between the old and new level
+            redrawn. SetLevel() just stores the latest value and marks the key dirty, so a fade running
+            at the timer rate costs the caller an exchange; the render thread wakes once per frame,
+            encodes only the dirty keys whose level actually moved and hands the data URI to the sink.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include "PngEncoder.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class KeyRenderer
+{
+public:
+    //called from the render thread - a null image means "go back to the action's own image"
+    using Sink = std::function<void(uint32_t contextId, const std::shared_ptr<const std::string>& dataURI)>;
+
+    static const int KEY_SIZE = 72;
+    static const int KEY_SIZE_HIGH_DPI = 144;
+    static const int MAX_LEVEL = 127;
+
+    KeyRenderer(uint32_t maxContexts, Sink sink, int framesPerSecond = 30, int imagesPerFrame = 8);
+    ~KeyRenderer();
+
+    //show a level bar (0 - MAX_LEVEL) on the key - any thread, latest value wins
+    void SetLevel(uint32_t contextId, int level);
+
+    //72 or 144 pixels - takes effect on the next frame
+    void SetKeySize(uint32_t contextId, int keySize);
+
+    //stop drawing on the key and hand it back to the Stream Deck
+    void Clear(uint32_t contextId);
+
+    //send the key's image again on the next frame even if the level hasn't moved - e.g. when it comes back into view
+    void Repaint(uint32_t contextId);
+
+    //frames, images and bytes sent so far, for the log
+    std::string GetStats() const;
+
+private:
+    static const int NO_LEVEL = -1;
+
+    //written by any thread
+    struct Request
+    {
+        std::atomic<int> level{NO_LEVEL};
+        std::atomic<int> keySize{KEY_SIZE};
+        std::atomic<bool> repaint{false};
+        std::atomic<bool> dirty{false};
+    };
+
+    //only touched by the render thread
+    struct KeyImage
+    {
+        std::vector<unsigned char> pixels;
+        int keySize = 0;
+        int drawnLevel = NO_LEVEL;
+    };
+
+    void MarkDirty(uint32_t contextId);
+    void Run();
+    bool RenderKey(uint32_t contextId);
+    void DrawLevel(KeyImage& image, int level);
+
+    Sink mSink;
+    const std::chrono::nanoseconds mFrameInterval;
+    const int mImagesPerFrame;
+
+    std::vector<Request> mRequests;
+    std::vector<KeyImage> mImages;
+    std::atomic<uint32_t> mContextLimit{0}; //one past the highest context id ever marked dirty
+    std::atomic<uint32_t> mDirtyCount{0};
+    uint32_t mNextContext = 0; //round-robin start, so a busy frame doesn't always favour the low ids
+
+    PngEncoder mPngEncoder;
+    std::vector<unsigned char> mPng;
+
+    std::atomic<uint64_t> mFrames{0};
+    std::atomic<uint64_t> mImagesSent{0};
+    std::atomic<uint64_t> mBytesSent{0};
+    std::atomic<uint64_t> mRequestsMerged{0};
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    bool mStop = false;
+    std::thread mThread;
+};
@@ -0,0 +1,310 @@
+//==============================================================================
+/**
+@file       Logger.cpp
+
+@brief      Asynchronous leveled logger
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "Logger.h"
+#include <algorithm>
+#include <ctime>
+
+namespace {
+const char* LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+const auto FLUSH_INTERVAL = std::chrono::milliseconds(20);
+
+//set once this thread's ring has been retired - anything it logs after that (from other thread_local destructors) is dropped
+thread_local bool tRingRetired = false;
+}
+
+Logger& Logger::Instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+: mRateWindowStart(std::chrono::steady_clock::now())
+{
+    mThread = std::thread([this]() { Run(); });
+}
+
+Logger::~Logger()
+{
+    {
+        std::unique_lock<std::mutex> lock(mFlushMutex);
+        mStop = true;
+    }
+    mFlushCondition.notify_all();
+    if (mThread.joinable()) mThread.join();
+
+    std::lock_guard<std::mutex> lock(mSinkMutex);
+    mStreamDeckSink = nullptr;
+    if (mFile != nullptr)
+    {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+void Logger::SetStreamDeckSink(Sink sink)
+{
+    std::lock_guard<std::mutex> lock(mSinkMutex);
+    mStreamDeckSink = std::move(sink);
+}
+
+bool Logger::SetFileSink(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mSinkMutex);
+    if (mFile != nullptr)
+    {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+    if (path.empty()) return true;
+    mFile = fopen(path.c_str(), "a");
+    return mFile != nullptr;
+}
+
+void Logger::SetStreamDeckRateLimit(uint32_t messagesPerSecond)
+{
+    std::lock_guard<std::mutex> lock(mSinkMutex);
+    mRateLimit = messagesPerSecond;
+}
+
+void Logger::Flush()
+{
+    std::unique_lock<std::mutex> lock(mFlushMutex);
+    if (mStop) return;
+    const uint64_t request = ++mFlushRequests;
+    mFlushCondition.notify_all();
+    mFlushedCondition.wait(lock, [this, request]() { return mFlushesDone >= request || mStop; });
+}
+
+Logger::RingOwner::~RingOwner()
+{
+    //the ring is shared with the logger's list, so this is safe even if the logger has already gone
+    if (ring) ring->retired.store(true, std::memory_order_release);
+    tRingRetired = true;
+}
+
+Logger::ThreadRing* Logger::GetThreadRing()
+{
+    thread_local ThreadRing* threadRing = nullptr;
+    if (tRingRetired) return nullptr;
+    if (threadRing == nullptr)
+    {
+        thread_local RingOwner owner;
+        owner.ring = std::make_shared<ThreadRing>();
+        {
+            std::lock_guard<std::mutex> lock(mRingsMutex);
+            mRings.push_back(owner.ring);
+        }
+        threadRing = owner.ring.get();
+    }
+    return threadRing;
+}
+
+Logger::Record* Logger::BeginRecord()
+{
+    ThreadRing* ring = GetThreadRing();
+    if (ring == nullptr) return nullptr;
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= RING_SIZE)
+    {
+        //the flusher has fallen behind - never block the caller, just count it
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &ring->records[head & (RING_SIZE - 1)];
+}
+
+void Logger::CommitRecord()
+{
+    ThreadRing* ring = GetThreadRing();
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Logger::AddText(Record& record, uint8_t index, const char* text, size_t length)
+{
+    if (record.textSize + length <= TEXT_SIZE)
+    {
+        record.types[index] = ArgType::TEXT;
+        record.args[index].textOffset = record.textSize;
+        record.textLength[index] = (uint16_t)length;
+        std::memcpy(record.text + record.textSize, text, length);
+        record.textSize += (uint16_t)length;
+    }
+    else
+    {
+        //only long messages (JSON dumps and the like) pay for an allocation
+        record.types[index] = ArgType::HEAP_TEXT;
+        record.args[index].heapText = new std::string(text, length);
+    }
+}
+
+void Logger::Run()
+{
+    std::string scratch;
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    while (true)
+    {
+        uint64_t request;
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(mFlushMutex);
+            mFlushCondition.wait_for(lock, FLUSH_INTERVAL, [this]() { return mStop || mFlushRequests > mFlushesDone; });
+            request = mFlushRequests;
+            stop = mStop;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mRingsMutex);
+            rings = mRings;
+        }
+        bool anyRetired = false;
+        for (auto& ring : rings)
+        {
+            //read the flag first - once it's set the thread has stopped writing, so this flush empties the ring
+            const bool retired = ring->retired.load(std::memory_order_acquire);
+            FlushRing(*ring, scratch);
+            anyRetired |= retired;
+        }
+        if (anyRetired)
+        {
+            //drop the rings of threads that have exited, now they're empty
+            std::lock_guard<std::mutex> lock(mRingsMutex);
+            for (auto& ring : rings)
+            {
+                if (!ring->retired.load(std::memory_order_acquire) || ring->tail.load(std::memory_order_relaxed) != ring->head.load(std::memory_order_acquire)) continue;
+                mRings.erase(std::remove(mRings.begin(), mRings.end(), ring), mRings.end());
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mSinkMutex);
+            if (mFile != nullptr) fflush(mFile);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mFlushMutex);
+            mFlushesDone = request;
+        }
+        mFlushedCondition.notify_all();
+        if (stop) return;
+    }
+}
+
+void Logger::FlushRing(ThreadRing& ring, std::string& scratch)
+{
+    const uint64_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        Record record{};
+        record.level = LogLevel::WARN;
+        record.timestamp = std::chrono::system_clock::now().time_since_epoch().count();
+        Write(record, "Logger: dropped " + std::to_string(dropped) + " messages - a thread's log ring was full");
+    }
+
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    const uint64_t head = ring.head.load(std::memory_order_acquire);
+    while (tail != head)
+    {
+        Record& record = ring.records[tail & (RING_SIZE - 1)];
+        scratch.clear();
+        Format(record, scratch);
+        Write(record, scratch);
+
+        //the heap strings belong to the record, so free them before handing the slot back
+        for (uint8_t i = 0; i < record.argCount; i++)
+        {
+            if (record.types[i] == ArgType::HEAP_TEXT) delete record.args[i].heapText;
+        }
+        tail++;
+        ring.tail.store(tail, std::memory_order_release);
+    }
+}
+
+void Logger::Format(const Record& record, std::string& out)
+{
+    const char* format = record.format != nullptr ? record.format : "";
+    uint8_t arg = 0;
+    for (const char* c = format; *c != '\0'; c++)
+    {
+        if (c[0] == '{' && c[1] == '}' && arg < record.argCount)
+        {
+            switch (record.types[arg])
+            {
+                case ArgType::INT:
+                    out.append(std::to_string(record.args[arg].i));
+                    break;
+                case ArgType::UINT:
+                    out.append(std::to_string(record.args[arg].u));
+                    break;
+                case ArgType::DOUBLE:
+                    out.append(std::to_string(record.args[arg].d));
+                    break;
+                case ArgType::BOOL:
+                    out.append(record.args[arg].i ? "true" : "false");
+                    break;
+                case ArgType::TEXT:
+                    out.append(record.text + record.args[arg].textOffset, record.textLength[arg]);
+                    break;
+                case ArgType::HEAP_TEXT:
+                    out.append(*record.args[arg].heapText);
+                    break;
+            }
+            arg++;
+            c++;
+        }
+        else
+        {
+            out.push_back(*c);
+        }
+    }
+}
+
+void Logger::Write(const Record& record, const std::string& message)
+{
+    std::lock_guard<std::mutex> lock(mSinkMutex);
+
+    if (mFile != nullptr)
+    {
+        const auto timestamp = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(record.timestamp));
+        const std::time_t seconds = std::chrono::system_clock::to_time_t(timestamp);
+        const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(timestamp.time_since_epoch()).count() % 1000;
+        std::tm tm = *std::localtime(&seconds);
+        char timeString[32];
+        strftime(timeString, sizeof(timeString), "%H:%M:%S", &tm);
+        fprintf(mFile, "%s.%03d [%s] %s\n", timeString, (int)millis, LEVEL_NAMES[(int)record.level], message.c_str());
+    }
+
+    if (mStreamDeckSink)
+    {
+        //the Stream Deck log goes over the websocket, so cap how much we push at it
+        const auto now = std::chrono::steady_clock::now();
+        if (now - mRateWindowStart >= std::chrono::seconds(1))
+        {
+            mRateWindowStart = now;
+            mSentThisSecond = 0;
+            if (mSuppressed > 0)
+            {
+                mStreamDeckSink("Logger: suppressed " + std::to_string(mSuppressed) + " messages over the rate limit");
+                mSuppressed = 0;
+            }
+        }
+        if (mRateLimit == 0 || mSentThisSecond < mRateLimit)
+        {
+            mSentThisSecond++;
+            mStreamDeckSink(message);
+        }
+        else
+        {
+            mSuppressed++;
+        }
+    }
+}
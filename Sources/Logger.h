@@ -0,0 +1,232 @@
+//==============================================================================
+/**
+@file       Logger.h
+
+@brief      Asynchronous leveled logger
+
+            Each thread writes fixed-size records into its own lock-free ring; the arguments are copied in
+            unformatted and a background thread does the "{}" formatting and the writing to the sinks.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//DBG and ERR rather than DEBUG and ERROR - both are defined as macros in some builds (Xcode sets DEBUG=1)
+enum class LogLevel : uint8_t
+{
+    TRACE,
+    DBG,
+    INFO,
+    WARN,
+    ERR,
+    OFF,
+};
+
+//lowest level compiled in - anything below it is stripped by the preprocessor-constant check in the LOG_ macros
+#ifndef MIDIBUTTON_LOG_COMPILE_LEVEL
+#if defined (NDEBUG)
+#define MIDIBUTTON_LOG_COMPILE_LEVEL 1 //DBG
+#else
+#define MIDIBUTTON_LOG_COMPILE_LEVEL 0 //TRACE
+#endif
+#endif
+
+//a function rather than a comparison in the macro, so a compile level of 0 doesn't warn (-Wtype-limits) wherever we log
+constexpr bool LogLevelCompiledIn(LogLevel level)
+{
+    return level >= static_cast<LogLevel>(MIDIBUTTON_LOG_COMPILE_LEVEL);
+}
+
+//the arguments are only evaluated if the level is both compiled in and enabled at runtime
+#define MIDIBUTTON_LOG(level, ...) do { if (LogLevelCompiledIn(level) && Logger::Instance().IsEnabled(level)) Logger::Instance().Log(level, __VA_ARGS__); } while (0)
+#define LOG_TRACE(...) MIDIBUTTON_LOG(LogLevel::TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) MIDIBUTTON_LOG(LogLevel::DBG, __VA_ARGS__)
+#define LOG_INFO(...) MIDIBUTTON_LOG(LogLevel::INFO, __VA_ARGS__)
+#define LOG_WARN(...) MIDIBUTTON_LOG(LogLevel::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) MIDIBUTTON_LOG(LogLevel::ERR, __VA_ARGS__)
+
+class Logger
+{
+public:
+    using Sink = std::function<void(const std::string& message)>;
+
+    static Logger& Instance();
+
+    bool IsEnabled(LogLevel level) const
+    {
+        return level >= mLevel.load(std::memory_order_relaxed);
+    }
+    void SetLevel(LogLevel level) { mLevel.store(level, std::memory_order_relaxed); }
+    LogLevel GetLevel() const { return mLevel.load(std::memory_order_relaxed); }
+
+    //sinks - both are only ever called from the flusher thread
+    void SetStreamDeckSink(Sink sink);
+    bool SetFileSink(const std::string& path); //empty path closes the file
+    void SetStreamDeckRateLimit(uint32_t messagesPerSecond);
+
+    //format is a literal with "{}" placeholders - it's stored as a pointer, so it has to outlive the flush
+    template<typename... Args>
+    void Log(LogLevel level, const char* format, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many arguments for a log record");
+        Record* record = BeginRecord();
+        if (record == nullptr) return;
+        record->level = level;
+        record->timestamp = std::chrono::system_clock::now().time_since_epoch().count();
+        record->format = format;
+        record->argCount = 0;
+        record->textSize = 0;
+        int unused[] = {0, (AddArg(*record, args), 0)...};
+        (void)unused;
+        CommitRecord();
+    }
+
+    //block until everything logged so far has been written out
+    void Flush();
+
+    ~Logger();
+
+private:
+    static const size_t MAX_ARGS = 8;
+    static const size_t TEXT_SIZE = 184;
+    static const size_t RING_SIZE = 512; //records per thread - must be a power of two
+
+    enum class ArgType : uint8_t
+    {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        TEXT, //copied into the record's text area
+        HEAP_TEXT, //too long for the text area - a std::string the flusher deletes
+    };
+
+    struct Record
+    {
+        int64_t timestamp;
+        const char* format;
+        union
+        {
+            int64_t i;
+            uint64_t u;
+            double d;
+            uint16_t textOffset;
+            std::string* heapText;
+        } args[MAX_ARGS];
+        uint16_t textLength[MAX_ARGS];
+        ArgType types[MAX_ARGS];
+        LogLevel level;
+        uint8_t argCount;
+        uint16_t textSize;
+        char text[TEXT_SIZE];
+    };
+
+    //single producer (the owning thread), single consumer (the flusher)
+    struct ThreadRing
+    {
+        std::atomic<uint64_t> head{0}; //written by the producer
+        std::atomic<uint64_t> tail{0}; //written by the flusher
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> retired{false}; //set when the owning thread exits - the flusher drains the ring and drops it
+        Record records[RING_SIZE];
+    };
+
+    //owns the calling thread's ring and retires it when the thread exits
+    struct RingOwner
+    {
+        std::shared_ptr<ThreadRing> ring;
+        ~RingOwner();
+    };
+
+    Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    ThreadRing* GetThreadRing();
+    Record* BeginRecord();
+    void CommitRecord();
+
+    template<typename T>
+    void AddArg(Record& record, const T& value)
+    {
+        const uint8_t index = record.argCount++;
+        if constexpr (std::is_same<T, bool>::value)
+        {
+            record.types[index] = ArgType::BOOL;
+            record.args[index].i = value;
+        }
+        else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value)
+        {
+            record.types[index] = ArgType::INT;
+            record.args[index].i = value;
+        }
+        else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value)
+        {
+            record.types[index] = ArgType::UINT;
+            record.args[index].u = (uint64_t)value;
+        }
+        else if constexpr (std::is_floating_point<T>::value)
+        {
+            record.types[index] = ArgType::DOUBLE;
+            record.args[index].d = value;
+        }
+        else if constexpr (std::is_same<T, std::string>::value)
+        {
+            AddText(record, index, value.data(), value.size());
+        }
+        else
+        {
+            //anything else has to be a C string
+            const char* text = value;
+            AddText(record, index, text, text != nullptr ? std::strlen(text) : 0);
+        }
+    }
+    void AddText(Record& record, uint8_t index, const char* text, size_t length);
+
+    void Run();
+    void FlushRing(ThreadRing& ring, std::string& scratch);
+    static void Format(const Record& record, std::string& out);
+    void Write(const Record& record, const std::string& message);
+
+    std::atomic<LogLevel> mLevel{LogLevel::INFO};
+
+    //one ring per thread that has logged - the flusher works on a copy of the list, and drops a ring once its
+    //thread has exited and it's been drained
+    std::mutex mRingsMutex;
+    std::vector<std::shared_ptr<ThreadRing>> mRings;
+
+    //sinks and rate limit, guarded by mSinkMutex
+    std::mutex mSinkMutex;
+    Sink mStreamDeckSink;
+    FILE* mFile = nullptr;
+    uint32_t mRateLimit = 50;
+    uint32_t mSentThisSecond = 0;
+    uint64_t mSuppressed = 0;
+    std::chrono::steady_clock::time_point mRateWindowStart;
+
+    //flusher thread
+    std::mutex mFlushMutex;
+    std::condition_variable mFlushCondition;
+    std::condition_variable mFlushedCondition;
+    uint64_t mFlushRequests = 0;
+    uint64_t mFlushesDone = 0;
+    bool mStop = false;
+    std::thread mThread;
+};
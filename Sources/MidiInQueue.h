@@ -0,0 +1,97 @@
+//==============================================================================
+/**
+@file       MidiInQueue.h
+
+@brief      Lock-free queue that hands incoming MIDI from the input threads to the plugin's strand
+
+            Bounded, multiple producer (the old and new input ports can both be delivering for a moment
+            while the pool swaps them), single consumer. Each cell carries a sequence number, so a push
+            is one compare-exchange on the write position and a pop doesn't touch any shared counter.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include "MidiOutQueue.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+//an incoming MIDI message - only the first 6 bytes of a longer sysex are kept, the buttons only match on the first 3
+struct MidiInFrame
+{
+    MidiFrame frame;
+    int64_t timeNs = 0; //when it arrived, on rtmidi::monotonic_ns()'s clock
+};
+
+class MidiInQueue
+{
+public:
+    MidiInQueue()
+    {
+        for (size_t i = 0; i < QUEUE_SIZE; i++) mCells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MidiInQueue(const MidiInQueue&) = delete;
+    MidiInQueue& operator=(const MidiInQueue&) = delete;
+
+    //any input thread - false if the consumer has fallen a full queue behind, in which case the message is dropped
+    bool Push(const unsigned char* bytes, size_t size, int64_t timeNs)
+    {
+        size_t position = mWritePosition.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;)
+        {
+            cell = &mCells[position % QUEUE_SIZE];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0)
+            {
+                if (mWritePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0)
+            {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else position = mWritePosition.load(std::memory_order_relaxed);
+        }
+        cell->message.frame = MidiFrame();
+        for (size_t i = 0; i < size && i < cell->message.frame.bytes.size(); i++) cell->message.frame.bytes[cell->message.frame.size++] = bytes[i];
+        cell->message.timeNs = timeNs;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer only - false if there's nothing waiting
+    bool Pop(MidiInFrame& message)
+    {
+        Cell& cell = mCells[mReadPosition % QUEUE_SIZE];
+        if (cell.sequence.load(std::memory_order_acquire) != mReadPosition + 1) return false;
+        message = cell.message;
+        cell.sequence.store(mReadPosition + QUEUE_SIZE, std::memory_order_release);
+        mReadPosition++;
+        return true;
+    }
+
+    //messages dropped because the queue was full
+    uint64_t GetDroppedCount() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t QUEUE_SIZE = 1024;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        MidiInFrame message;
+    };
+
+    std::array<Cell, QUEUE_SIZE> mCells;
+    std::atomic<size_t> mWritePosition{0};
+    size_t mReadPosition = 0; //consumer only
+    std::atomic<uint64_t> mDropped{0};
+};
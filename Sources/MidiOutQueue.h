@@ -0,0 +1,149 @@
+//==============================================================================
+/**
+@file       MidiOutQueue.h
+
+@brief      Fixed-size MIDI frames and the queue that hands them to the MIDI sender thread
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+
+//a ready-to-send MIDI message - the longest thing we send is the 6 byte MMC sysex
+struct MidiFrame
+{
+    std::array<unsigned char, 6> bytes{};
+    uint8_t size = 0;
+
+    MidiFrame() = default;
+    MidiFrame(std::initializer_list<int> inBytes)
+    {
+        for (int byte : inBytes)
+        {
+            if (size == bytes.size()) break;
+            bytes[size++] = (unsigned char)byte;
+        }
+    }
+};
+
+//single consumer ring of MidiFrames - Push() is a copy of the frame, the sender thread does the actual send
+class MidiOutQueue
+{
+public:
+    using SendFunction = std::function<void(const unsigned char* bytes, size_t size)>;
+
+    explicit MidiOutQueue(SendFunction inSend)
+    : mSend(std::move(inSend)), mThread([this]() { Run(); })
+    {}
+
+    ~MidiOutQueue()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mNotEmpty.notify_one();
+        mThread.join();
+    }
+
+    MidiOutQueue(const MidiOutQueue&) = delete;
+    MidiOutQueue& operator=(const MidiOutQueue&) = delete;
+
+    //copy the frame into the ring - waits if the sender has fallen a full ring behind, as dropping MIDI is worse than waiting
+    void Push(const MidiFrame& frame)
+    {
+        if (frame.size == 0) return;
+        bool wakeSender;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mNotFull.wait(lock, [this]() { return mCount < QUEUE_SIZE || mStop; });
+            if (mStop) return;
+            wakeSender = Insert(frame);
+        }
+        //only pay for the notify if the sender is actually asleep
+        if (wakeSender) mNotEmpty.notify_one();
+    }
+
+    //as Push(), but never waits - false (and counted) if the ring is full, for callers that mustn't stall on a slow sender
+    bool TryPush(const MidiFrame& frame)
+    {
+        if (frame.size == 0) return true;
+        bool wakeSender;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mStop) return true;
+            if (mCount == QUEUE_SIZE)
+            {
+                mDropped++;
+                return false;
+            }
+            wakeSender = Insert(frame);
+        }
+        if (wakeSender) mNotEmpty.notify_one();
+        return true;
+    }
+
+    //frames TryPush() has dropped so far
+    uint64_t GetDroppedCount() const
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mDropped;
+    }
+
+private:
+    static const size_t QUEUE_SIZE = 256;
+
+    //mMutex held - returns whether the sender needs waking
+    bool Insert(const MidiFrame& frame)
+    {
+        std::memcpy(&mFrames[(mHead + mCount) % QUEUE_SIZE], &frame, sizeof(MidiFrame));
+        mCount++;
+        return mSenderWaiting;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            mSenderWaiting = true;
+            mNotEmpty.wait(lock, [this]() { return mCount > 0 || mStop; });
+            mSenderWaiting = false;
+            if (mStop && mCount == 0) return;
+
+            MidiFrame frame = mFrames[mHead];
+            mHead = (mHead + 1) % QUEUE_SIZE;
+            mCount--;
+
+            //send outside the lock so a slow driver doesn't hold up the websocket and Timer threads
+            const bool wakePusher = (mCount == QUEUE_SIZE - 1);
+            lock.unlock();
+            if (wakePusher) mNotFull.notify_all();
+            mSend(frame.bytes.data(), frame.size);
+            lock.lock();
+        }
+    }
+
+    SendFunction mSend;
+    std::array<MidiFrame, QUEUE_SIZE> mFrames;
+    size_t mHead = 0;
+    size_t mCount = 0;
+    bool mStop = false;
+    bool mSenderWaiting = false;
+    uint64_t mDropped = 0;
+    mutable std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    std::thread mThread;
+};
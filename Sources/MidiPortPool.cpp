@@ -0,0 +1,502 @@
+//==============================================================================
+/**
+@file       MidiPortPool.cpp
+
+@brief      Double-buffered MIDI ports, swapped in without a gap
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "MidiPortPool.h"
+#include "Logger.h"
+#include <chrono>
+
+namespace {
+//how often the worker looks at the retired ports while something is still holding one
+const std::chrono::milliseconds RETIRE_POLL_INTERVAL(10);
+//how often the worker looks for a lost port coming back - hotplug events wake it sooner where there are any
+const std::chrono::milliseconds RECONNECT_POLL_INTERVAL(250);
+//how often the worker lists the ports again to notice one going, on backends without hotplug events (CoreMIDI) - a
+//send to an unplugged CoreMIDI endpoint doesn't fail, so this is the only way it's seen
+const std::chrono::milliseconds PORT_POLL_INTERVAL(1000);
+//output held while the device is gone - the oldest goes first when it's full, and anything older than this isn't replayed
+const size_t MAX_BUFFERED_MESSAGES = 512;
+const std::chrono::seconds MAX_BUFFERED_AGE(3);
+}
+
+MidiPortPool::MidiPortPool(MidiPortRegistry& registry, InputCallback inputCallback)
+    : mRegistry(registry), mInputCallback(std::move(inputCallback))
+{
+    mControllerValues.fill(-1);
+    mOutput = std::make_shared<rtmidi::midi_out>(mRegistry.GetApi(), "RtMidi client");
+    mInput = std::make_shared<rtmidi::midi_in>(mRegistry.GetApi());
+    mThread = std::thread([this]() {this->Run();});
+
+    //a port coming or going - the worker checks whether it's one of ours
+    mRegistry.SetChangeCallback([this]() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCheckConnection = true;
+        }
+        mWake.notify_one();
+    });
+}
+
+MidiPortPool::~MidiPortPool()
+{
+    mRegistry.SetChangeCallback(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWake.notify_one();
+    if (mThread.joinable()) mThread.join();
+
+    //anyone still using a port has gone by now
+    std::atomic_store(&mInput, std::shared_ptr<rtmidi::midi_in>());
+    std::atomic_store(&mOutput, std::shared_ptr<rtmidi::midi_out>());
+    mRetiredInputs.clear();
+    mRetiredOutputs.clear();
+}
+
+void MidiPortPool::Reconfigure(const MidiPortConfig& config)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPendingConfig = config;
+        mPending = true;
+    }
+    mWake.notify_one();
+}
+
+void MidiPortPool::Send(const unsigned char* bytes, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mSendMutex);
+    if (mOutputLost)
+    {
+        BufferMessage(bytes, size);
+        return;
+    }
+
+    //a reference for the length of the send, so a port being swapped out is only closed once we're done with it
+    const std::shared_ptr<rtmidi::midi_out> output = GetOutput();
+    if (!output) return;
+    try
+    {
+        output->send_message(bytes, size);
+    }
+    catch (const rtmidi::midi_exception& error)
+    {
+        LOG_ERROR("void MidiPortPool::Send(): problem with RtMidi: {}", error.what());
+        mSendFailed.store(true, std::memory_order_relaxed);
+    }
+    if (mSendFailed.load(std::memory_order_relaxed))
+    {
+        //nothing to reconnect on a virtual port, or with nothing open
+        if (GetOutputPortIndex() < 0)
+        {
+            mSendFailed.store(false, std::memory_order_relaxed);
+            return;
+        }
+        //the device has probably gone - hold this and everything after it until the worker has had a look
+        mOutputLost = true;
+        BufferMessage(bytes, size);
+        {
+            std::lock_guard<std::mutex> wakeLock(mMutex);
+            mCheckConnection = true;
+        }
+        mWake.notify_one();
+        return;
+    }
+
+    //the last value of each controller, to send again if the device is replugged
+    if (size == 3 && (bytes[0] & 0xF0) == 0xB0) mControllerValues[(bytes[0] & 0x0F) * 128 + (bytes[1] & 0x7F)] = bytes[2];
+}
+
+void MidiPortPool::BufferMessage(const unsigned char* bytes, size_t size)
+{
+    uint32_t buffered = 0;
+    uint32_t dropped = 0;
+    BufferedMessage message;
+    if (size > message.frame.bytes.size())
+    {
+        dropped++;
+    }
+    else
+    {
+        message.time = Clock::now();
+        std::copy(bytes, bytes + size, message.frame.bytes.begin());
+        message.frame.size = (uint8_t)size;
+        if (mBuffer.size() == MAX_BUFFERED_MESSAGES)
+        {
+            mBuffer.pop_front();
+            dropped++;
+        }
+        mBuffer.push_back(message);
+        buffered++;
+    }
+
+    std::lock_guard<std::mutex> statsLock(mStatsMutex);
+    mStats.buffered += buffered;
+    mStats.dropped += dropped;
+}
+
+MidiPortStats MidiPortPool::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    return mStats;
+}
+
+void MidiPortPool::WaitUntilIdle()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [this]() {return mStop || (!mPending && !mBusy);});
+}
+
+void MidiPortPool::Run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    Clock::time_point lastPoll = Clock::now();
+    while (true)
+    {
+        //wake for a request or a port change, and every so often while there are ports waiting to be retired or a lost port to look
+        //for - or, without hotplug events, to list the ports again
+        const auto wakeUp = [this]() {return mStop || mPending || mCheckConnection;};
+        const bool lost = !mLostOutputName.empty() || !mLostInputName.empty();
+        const bool poll = !mRegistry.IsLive();
+        if (!mRetiredInputs.empty() || !mRetiredOutputs.empty()) mWake.wait_for(lock, RETIRE_POLL_INTERVAL, wakeUp);
+        else if (lost) mWake.wait_for(lock, RECONNECT_POLL_INTERVAL, wakeUp);
+        else if (poll) mWake.wait_for(lock, PORT_POLL_INTERVAL, wakeUp);
+        else mWake.wait(lock, wakeUp);
+        if (mStop) break;
+
+        if (mPending)
+        {
+            const MidiPortConfig config = std::move(mPendingConfig);
+            mPending = false;
+            mCheckConnection = false;
+            mBusy = true;
+            lock.unlock();
+            //a new choice of ports - nothing held for the old ones is any use
+            mLostOutputName.clear();
+            mLostInputName.clear();
+            {
+                std::lock_guard<std::mutex> sendLock(mSendMutex);
+                if (!mBuffer.empty())
+                {
+                    std::lock_guard<std::mutex> statsLock(mStatsMutex);
+                    mStats.dropped += (uint32_t)mBuffer.size();
+                }
+                mBuffer.clear();
+                mOutputLost = false;
+                mSendFailed.store(false, std::memory_order_relaxed);
+                mControllerValues.fill(-1);
+            }
+            Apply(config);
+            Retire();
+            lock.lock();
+            mBusy = false;
+            if (!mPending) mIdle.notify_all();
+        }
+        else
+        {
+            const auto now = Clock::now();
+            const bool pollDue = poll && now - lastPoll >= PORT_POLL_INTERVAL;
+            if (pollDue) lastPoll = now;
+            const bool check = mCheckConnection || lost || pollDue;
+            mCheckConnection = false;
+            lock.unlock();
+            if (check) CheckConnection();
+            Retire();
+            lock.lock();
+        }
+    }
+    mIdle.notify_all();
+}
+
+template<typename Port>
+int MidiPortPool::OpenPort(Port& port, const MidiPortList& ports, int index, const std::string& name, const char* direction)
+{
+    const int portCount = (int)ports.ports.size();
+    if (portCount == 0)
+    {
+        LOG_INFO("void MidiPortPool::OpenPort(): no midi {} device available", direction);
+        return -1;
+    }
+    if (index < 0 || index >= portCount || ports.ports[index].name != name)
+    {
+        //the ports have moved since the PI saw them - find it by name, or stay on the index if it's gone
+        LOG_INFO("void MidiPortPool::OpenPort(): {} port name and index DON'T match - looking for {}", direction, name);
+        const int found = ports.Find(name);
+        if (found >= 0) index = found;
+        if (index < 0 || index >= portCount)
+        {
+            LOG_WARN("void MidiPortPool::OpenPort(): {} port index {} is out of range - something has gone wrong", direction, index);
+            return -1;
+        }
+    }
+    LOG_DEBUG("void MidiPortPool::OpenPort(): opening {} port index {} called {}", direction, index, ports.ports[index].name);
+    port.open_port((unsigned int)index);
+    return index;
+}
+
+std::shared_ptr<rtmidi::midi_in> MidiPortPool::MakeInput(const uint32_t generation)
+{
+    auto input = std::make_shared<rtmidi::midi_in>(mRegistry.GetApi());
+    //a batch at a time, so the generation check and whatever the plugin does per wake-up happen once for the lot
+    input->set_batch_callback([this, generation](const rtmidi::message* messages, size_t count) {
+        if (mInputGeneration.load(std::memory_order_acquire) == generation) mInputCallback(messages, count);
+    });
+    //don't ignore sysex, timing or active sensing messages
+    input->ignore_types(false, false, false);
+    return input;
+}
+
+void MidiPortPool::WatchOutput(rtmidi::midi_out& output)
+{
+    //send errors mean the device may have gone
+    output.set_error_callback([this](rtmidi::midi_error type, std::string_view errorText) {
+        LOG_WARN("MidiPortPool: RtMidi reported a problem with the OUTPUT port ({}): {}", (int)type, std::string(errorText));
+        mSendFailed.store(true, std::memory_order_relaxed);
+    });
+}
+
+void MidiPortPool::SwapInput(std::shared_ptr<rtmidi::midi_in> input, const int index, std::string name, const uint32_t generation)
+{
+    //the generation moves with the input pointer, so input switches from the old port to the new one with no gap and no doubles
+    mRetiredInputs.push_back(std::atomic_exchange_explicit(&mInput, std::move(input), std::memory_order_acq_rel));
+    mInputGeneration.store(generation, std::memory_order_release);
+    mInputPortIndex.store(index, std::memory_order_relaxed);
+    mInputPortName = std::move(name);
+}
+
+void MidiPortPool::SwapOutput(std::shared_ptr<rtmidi::midi_out> output, const int index, std::string name)
+{
+    mRetiredOutputs.push_back(std::atomic_exchange_explicit(&mOutput, std::move(output), std::memory_order_acq_rel));
+    mOutputPortIndex.store(index, std::memory_order_relaxed);
+    mOutputPortName = std::move(name);
+}
+
+void MidiPortPool::Apply(const MidiPortConfig& config)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t generation = mInputGeneration.load(std::memory_order_relaxed) + 1;
+
+    //build and open the new pair while the old one is still live
+    std::shared_ptr<rtmidi::midi_in> input;
+    std::shared_ptr<rtmidi::midi_out> output;
+    std::shared_ptr<const MidiPortList> inputs;
+    std::shared_ptr<const MidiPortList> outputs;
+    int inputIndex = -1;
+    int outputIndex = -1;
+    bool inputOpen = false;
+    bool outputOpen = false;
+    try
+    {
+        input = MakeInput(generation);
+        output = std::make_shared<rtmidi::midi_out>(mRegistry.GetApi(), "RtMidi client");
+#if defined (__APPLE__)
+        if (config.useVirtualPort)
+        {
+            LOG_DEBUG("void MidiPortPool::Apply(): opening virtual ports called {}", config.portName);
+            input->open_virtual_port(config.portName);
+            output->open_virtual_port(config.portName);
+            inputOpen = outputOpen = true;
+        }
+        else
+#endif
+        {
+            //the cached lists - listed again first if hotplug events don't keep them up to date
+            mRegistry.Refresh();
+            inputs = mRegistry.GetInputs();
+            outputs = mRegistry.GetOutputs();
+            inputIndex = OpenPort(*input, *inputs, config.selectedInPortIndex, config.selectedInPortName, "INPUT");
+            outputIndex = OpenPort(*output, *outputs, config.selectedOutPortIndex, config.selectedOutPortName, "OUTPUT");
+            inputOpen = inputIndex >= 0;
+            outputOpen = outputIndex >= 0;
+            //set after the open, so open errors still throw
+            WatchOutput(*output);
+        }
+    }
+    catch (const rtmidi::midi_exception& error)
+    {
+        LOG_ERROR("void MidiPortPool::Apply(): problem with RtMidi - keeping the current ports: {}", error.what());
+        if (input) mRetiredInputs.push_back(std::move(input));
+        if (output) mRetiredOutputs.push_back(std::move(output));
+        return;
+    }
+    const auto opened = std::chrono::steady_clock::now();
+
+    //swap
+    if (inputOpen) SwapInput(std::move(input), inputIndex, inputIndex >= 0 ? inputs->ports[inputIndex].name : std::string(), generation);
+    else mRetiredInputs.push_back(std::move(input));
+    if (outputOpen) SwapOutput(std::move(output), outputIndex, outputIndex >= 0 ? outputs->ports[outputIndex].name : std::string());
+    else mRetiredOutputs.push_back(std::move(output));
+    if (inputOpen || outputOpen) mCurrentConfig = config;
+    const auto swapped = std::chrono::steady_clock::now();
+
+    LOG_INFO("void MidiPortPool::Apply(): MIDI input {}, output {} - opened in {} ms with the old ports still live, swapped in {} us", inputOpen ? "swapped" : "NOT changed", outputOpen ? "swapped" : "NOT changed", std::chrono::duration<double, std::milli>(opened - start).count(), std::chrono::duration<double, std::micro>(swapped - opened).count());
+}
+
+void MidiPortPool::CheckConnection()
+{
+    //only lists the ports again where there are no hotplug events - done even on a virtual port, to keep the PI's list current
+    mRegistry.Refresh();
+    //nothing to lose on a virtual port
+    if (mCurrentConfig.useVirtualPort) return;
+    const std::shared_ptr<const MidiPortList> inputs = mRegistry.GetInputs();
+    const std::shared_ptr<const MidiPortList> outputs = mRegistry.GetOutputs();
+
+    //gone since the last look - the send side may have started buffering already, if a send failed
+    const bool sendFailed = mSendFailed.exchange(false, std::memory_order_relaxed);
+    const auto now = Clock::now();
+    if (!mOutputPortName.empty() && (sendFailed || outputs->Find(mOutputPortName) < 0))
+    {
+        LOG_WARN("void MidiPortPool::CheckConnection(): OUTPUT port {} has gone{} - buffering output until it's back", mOutputPortName, sendFailed ? " (a send failed)" : "");
+        mLostOutputName = std::move(mOutputPortName);
+        mOutputPortName.clear();
+        mOutputLostTime = now;
+        {
+            std::lock_guard<std::mutex> sendLock(mSendMutex);
+            mOutputLost = true;
+        }
+        std::lock_guard<std::mutex> statsLock(mStatsMutex);
+        mStats.disconnects++;
+    }
+    if (!mInputPortName.empty() && inputs->Find(mInputPortName) < 0)
+    {
+        LOG_WARN("void MidiPortPool::CheckConnection(): INPUT port {} has gone", mInputPortName);
+        mLostInputName = std::move(mInputPortName);
+        mInputPortName.clear();
+        std::lock_guard<std::mutex> statsLock(mStatsMutex);
+        mStats.disconnects++;
+    }
+
+    //back again under the same name - open just the ports that went, leaving the other direction alone
+    const bool outputBack = !mLostOutputName.empty() && outputs->Find(mLostOutputName) >= 0;
+    const bool inputBack = !mLostInputName.empty() && inputs->Find(mLostInputName) >= 0;
+    if (!outputBack && !inputBack) return;
+    Reopen(*outputs, outputBack, *inputs, inputBack);
+    if (outputBack && mOutputPortName == mLostOutputName)
+    {
+        Replay();
+        const auto replayed = Clock::now();
+        const MidiPortStats stats = [&]() {
+            std::lock_guard<std::mutex> statsLock(mStatsMutex);
+            mStats.reconnects++;
+            mStats.lastOutageMs = std::chrono::duration<double, std::milli>(replayed - mOutputLostTime).count();
+            mStats.lastReconnectMs = std::chrono::duration<double, std::milli>(replayed - now).count();
+            return mStats;
+        }();
+        LOG_INFO("void MidiPortPool::CheckConnection(): OUTPUT port {} is back after {} ms - reopened and replayed in {} ms ({} reconnects, {} messages replayed, {} dropped, {} controllers sent again so far)", mLostOutputName, stats.lastOutageMs, stats.lastReconnectMs, stats.reconnects, stats.replayed, stats.dropped, stats.controllersReasserted);
+        mLostOutputName.clear();
+    }
+    if (inputBack && mInputPortName == mLostInputName)
+    {
+        LOG_INFO("void MidiPortPool::CheckConnection(): INPUT port {} is back", mLostInputName);
+        mLostInputName.clear();
+        std::lock_guard<std::mutex> statsLock(mStatsMutex);
+        mStats.reconnects++;
+    }
+}
+
+void MidiPortPool::Reopen(const MidiPortList& outputs, const bool openOutput, const MidiPortList& inputs, const bool openInput)
+{
+    //by name only - whatever now sits at the old index may be another device
+    const int outputFound = openOutput ? outputs.Find(mLostOutputName) : -1;
+    const int inputFound = openInput ? inputs.Find(mLostInputName) : -1;
+    const uint32_t generation = mInputGeneration.load(std::memory_order_relaxed) + 1;
+    std::shared_ptr<rtmidi::midi_in> input;
+    std::shared_ptr<rtmidi::midi_out> output;
+    int inputIndex = -1;
+    int outputIndex = -1;
+    try
+    {
+        if (inputFound >= 0)
+        {
+            input = MakeInput(generation);
+            inputIndex = OpenPort(*input, inputs, inputFound, mLostInputName, "INPUT");
+        }
+        if (outputFound >= 0)
+        {
+            output = std::make_shared<rtmidi::midi_out>(mRegistry.GetApi(), "RtMidi client");
+            outputIndex = OpenPort(*output, outputs, outputFound, mLostOutputName, "OUTPUT");
+            WatchOutput(*output);
+        }
+    }
+    catch (const rtmidi::midi_exception& error)
+    {
+        LOG_ERROR("void MidiPortPool::Reopen(): problem with RtMidi - still waiting for the lost ports: {}", error.what());
+        if (input) mRetiredInputs.push_back(std::move(input));
+        if (output) mRetiredOutputs.push_back(std::move(output));
+        return;
+    }
+
+    if (inputIndex >= 0) SwapInput(std::move(input), inputIndex, mLostInputName, generation);
+    else if (input) mRetiredInputs.push_back(std::move(input));
+    if (outputIndex >= 0) SwapOutput(std::move(output), outputIndex, mLostOutputName);
+    else if (output) mRetiredOutputs.push_back(std::move(output));
+}
+
+void MidiPortPool::Replay()
+{
+    std::lock_guard<std::mutex> lock(mSendMutex);
+    const std::shared_ptr<rtmidi::midi_out> output = GetOutput();
+    uint32_t reasserted = 0;
+    uint32_t replayed = 0;
+    uint32_t dropped = 0;
+    try
+    {
+        //the device may have been power cycled - put the controllers back where they were before the buffered messages move them on
+        for (size_t i = 0; i < mControllerValues.size(); i++)
+        {
+            if (mControllerValues[i] < 0) continue;
+            const unsigned char bytes[3] = {(unsigned char)(0xB0 | (i / 128)), (unsigned char)(i % 128), (unsigned char)mControllerValues[i]};
+            output->send_message(bytes, sizeof(bytes));
+            reasserted++;
+        }
+        const auto oldest = Clock::now() - MAX_BUFFERED_AGE;
+        for (const BufferedMessage& message : mBuffer)
+        {
+            if (message.time < oldest)
+            {
+                dropped++;
+                continue;
+            }
+            output->send_message(message.frame.bytes.data(), message.frame.size);
+            const unsigned char* bytes = message.frame.bytes.data();
+            if (message.frame.size == 3 && (bytes[0] & 0xF0) == 0xB0) mControllerValues[(bytes[0] & 0x0F) * 128 + (bytes[1] & 0x7F)] = bytes[2];
+            replayed++;
+        }
+    }
+    catch (const rtmidi::midi_exception& error)
+    {
+        LOG_ERROR("void MidiPortPool::Replay(): problem with RtMidi - the rest of the buffer is lost: {}", error.what());
+    }
+    dropped += (uint32_t)mBuffer.size() - replayed - dropped;
+    mBuffer.clear();
+    mOutputLost = false;
+
+    std::lock_guard<std::mutex> statsLock(mStatsMutex);
+    mStats.controllersReasserted += reasserted;
+    mStats.replayed += replayed;
+    mStats.dropped += dropped;
+}
+
+void MidiPortPool::Retire()
+{
+    //close the old ports here rather than on whichever thread happened to let go last
+    for (auto it = mRetiredInputs.begin(); it != mRetiredInputs.end();)
+    {
+        if (it->use_count() <= 1) it = mRetiredInputs.erase(it);
+        else ++it;
+    }
+    for (auto it = mRetiredOutputs.begin(); it != mRetiredOutputs.end();)
+    {
+        if (it->use_count() <= 1) it = mRetiredOutputs.erase(it);
+        else ++it;
+    }
+}
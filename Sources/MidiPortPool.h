@@ -0,0 +1,168 @@
+//==============================================================================
+/**
+@file       MidiPortPool.h
+
+@brief      Double-buffered MIDI ports, swapped in without a gap
+
+            A port change used to delete the live midi_in/midi_out and build new ones on the websocket
+            thread, with the MIDI mutexes held - nothing went in or out until the new ports were open.
+            Here the new pair is built and opened on a worker thread while the old pair keeps running,
+            then swapped in with an atomic store, and the old pair is closed once nothing is using it.
+
+            The pool also rides out a device being unplugged: output is buffered (up to a limit) while
+            the port is gone, and when a port with the same name comes back it's reopened, the last value
+            of every controller is sent again and the buffer is replayed.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include "MidiPortRegistry.h"
+#include "MidiOutQueue.h"
+#include <rtmidi17.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//the ports to open - a copy of the port part of the global settings
+struct MidiPortConfig
+{
+    std::string portName; //virtual port name
+    bool useVirtualPort = false;
+    int selectedOutPortIndex = 0;
+    std::string selectedOutPortName;
+    int selectedInPortIndex = 0;
+    std::string selectedInPortName;
+};
+
+//what the reconnect logic has been up to - read with MidiPortPool::GetStats()
+struct MidiPortStats
+{
+    uint32_t disconnects = 0; //physical ports that went away
+    uint32_t reconnects = 0; //...and were opened again when they came back
+    uint32_t buffered = 0; //messages held while the output was gone
+    uint32_t replayed = 0; //...and sent once it was back
+    uint32_t dropped = 0; //...or thrown away because the buffer was full or they'd got too old
+    uint32_t controllersReasserted = 0; //CC values sent again after a reconnect
+    double lastOutageMs = 0; //from losing the output to it being back
+    double lastReconnectMs = 0; //from seeing the device again to the replay being done
+};
+
+class MidiPortPool
+{
+public:
+    //called with everything one wake-up of the input thread brought in - the messages only last for the call
+    using InputCallback = std::function<void(const rtmidi::message* messages, size_t count)>;
+
+    //creates an unopened pair straight away - ports are looked up in the registry, which has to outlive the pool
+    MidiPortPool(MidiPortRegistry& registry, InputCallback inputCallback);
+    ~MidiPortPool();
+
+    //open the ports for config in the background and swap them in when they're ready - if several
+    //requests arrive while one is being opened, only the latest is opened next
+    void Reconfigure(const MidiPortConfig& config);
+
+    //the live ports - any thread; hold the pointer only as long as the call that uses it
+    std::shared_ptr<rtmidi::midi_out> GetOutput() const { return std::atomic_load_explicit(&mOutput, std::memory_order_acquire); }
+    std::shared_ptr<rtmidi::midi_in> GetInput() const { return std::atomic_load_explicit(&mInput, std::memory_order_acquire); }
+
+    //index of the open physical port, -1 for a virtual port or nothing open
+    int GetOutputPortIndex() const { return mOutputPortIndex.load(std::memory_order_relaxed); }
+    int GetInputPortIndex() const { return mInputPortIndex.load(std::memory_order_relaxed); }
+
+    //send on the live output - MIDI sender thread. Buffered instead while the output's device is unplugged
+    void Send(const unsigned char* bytes, size_t size);
+
+    //block until every request so far has been swapped in (or has failed)
+    void WaitUntilIdle();
+
+    MidiPortStats GetStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    //a message held while the output is gone
+    struct BufferedMessage
+    {
+        MidiFrame frame;
+        Clock::time_point time;
+    };
+
+    void Run();
+    void Apply(const MidiPortConfig& config);
+    //worker thread - the pieces of a swap, shared by Apply() and Reopen()
+    std::shared_ptr<rtmidi::midi_in> MakeInput(uint32_t generation);
+    void WatchOutput(rtmidi::midi_out& output);
+    void SwapInput(std::shared_ptr<rtmidi::midi_in> input, int index, std::string name, uint32_t generation);
+    void SwapOutput(std::shared_ptr<rtmidi::midi_out> output, int index, std::string name);
+    void Retire();
+
+    //worker thread - notice the open ports going away, and reopen them when they come back
+    void CheckConnection();
+    //worker thread - open the lost ports that are back, by exact name, and swap just those in
+    void Reopen(const MidiPortList& outputs, bool openOutput, const MidiPortList& inputs, bool openInput);
+    //worker thread - send the controller values and the buffer on the new output
+    void Replay();
+    //sender thread, mSendMutex held
+    void BufferMessage(const unsigned char* bytes, size_t size);
+
+    //resolve the port by name in the registry's list if the index has moved, and open it - returns the index, or -1
+    template<typename Port>
+    static int OpenPort(Port& port, const MidiPortList& ports, int index, const std::string& name, const char* direction);
+
+    MidiPortRegistry& mRegistry;
+    InputCallback mInputCallback;
+
+    std::shared_ptr<rtmidi::midi_out> mOutput;
+    std::shared_ptr<rtmidi::midi_in> mInput;
+    std::atomic<int> mOutputPortIndex{-1};
+    std::atomic<int> mInputPortIndex{-1};
+
+    //input that arrives on a port that's been swapped out (or not swapped in yet) is dropped
+    std::atomic<uint32_t> mInputGeneration{0};
+
+    //swapped out and waiting for the last user to let go - worker thread only
+    std::vector<std::shared_ptr<rtmidi::midi_out>> mRetiredOutputs;
+    std::vector<std::shared_ptr<rtmidi::midi_in>> mRetiredInputs;
+
+    //the config that was last applied, and the names of the physical ports it opened - worker thread only
+    MidiPortConfig mCurrentConfig;
+    std::string mOutputPortName;
+    std::string mInputPortName;
+    //the names of ports that have gone, waiting for them to come back - worker thread only
+    std::string mLostOutputName;
+    std::string mLostInputName;
+    Clock::time_point mOutputLostTime;
+
+    //the send side - output buffered while the device is gone, and the last value sent for each channel/controller
+    std::mutex mSendMutex;
+    bool mOutputLost = false;
+    std::atomic<bool> mSendFailed{false}; //set by the output's error callback
+    std::deque<BufferedMessage> mBuffer;
+    std::array<int16_t, 16 * 128> mControllerValues; //-1 if nothing has been sent
+
+    mutable std::mutex mStatsMutex;
+    MidiPortStats mStats;
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mIdle;
+    MidiPortConfig mPendingConfig;
+    bool mPending = false;
+    bool mCheckConnection = false; //the registry changed, or a send failed
+    bool mBusy = false;
+    bool mStop = false;
+    std::thread mThread;
+};
@@ -0,0 +1,132 @@
+//==============================================================================
+/**
+@file       MidiPortRegistry.cpp
+
+@brief      Cached list of the MIDI ports, kept up to date by hotplug events
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "MidiPortRegistry.h"
+#include "Logger.h"
+#include <algorithm>
+
+MidiPortRegistry::MidiPortRegistry()
+{
+    mInputEnumerator.reset(new rtmidi::midi_in());
+    mApi = mInputEnumerator->get_current_api();
+    mOutputEnumerator.reset(new rtmidi::midi_out(mApi, "RtMidi client"));
+
+    //only the ALSA, rawmidi and loopback observers report ports with ids that keep their index order - the others (CoreMIDI,
+    //where the observer is a stub, JACK, WinMM) get listed again by Refresh(): when the PI asks for the ports, and every
+    //second from the port pool's worker, which is how an unplugged device drops out of the list there
+    mLive = mApi == rtmidi::API::LINUX_ALSA || mApi == rtmidi::API::LINUX_ALSA_RAW || mApi == rtmidi::API::LOOPBACK;
+
+    //the observer is started before the first list is made and outside mMutex - an observer may call back with its own
+    //lock held (the loopback bus does), so registering under mMutex could deadlock with a port being plugged. Events
+    //before the first list are ignored, as it's made afterwards; events during it wait for mMutex and are applied on top
+    if (mLive)
+    {
+        rtmidi::observer::callbacks callbacks;
+        callbacks.input_added = [this](int id, std::string name) {this->Add(mInputs, (unsigned int)id, name, "INPUT");};
+        callbacks.input_removed = [this](int id, std::string name) {this->Remove(mInputs, (unsigned int)id, name, "INPUT");};
+        callbacks.output_added = [this](int id, std::string name) {this->Add(mOutputs, (unsigned int)id, name, "OUTPUT");};
+        callbacks.output_removed = [this](int id, std::string name) {this->Remove(mOutputs, (unsigned int)id, name, "OUTPUT");};
+        try
+        {
+            mObserver.reset(new rtmidi::observer(mApi, std::move(callbacks)));
+        }
+        catch (const rtmidi::midi_exception& error)
+        {
+            LOG_WARN("MidiPortRegistry::MidiPortRegistry(): no hotplug events, the ports will be listed each time: {}", error.what());
+            mLive = false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    Snapshot();
+}
+
+MidiPortRegistry::~MidiPortRegistry()
+{
+    //not under mMutex - the observer thread may be waiting for it
+    mObserver.reset();
+}
+
+void MidiPortRegistry::Refresh()
+{
+    if (mLive) return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    Snapshot();
+}
+
+void MidiPortRegistry::SetChangeCallback(std::function<void()> callback)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mChangeCallback = std::move(callback);
+}
+
+void MidiPortRegistry::Snapshot()
+{
+    std::vector<rtmidi::port_information> inputs;
+    std::vector<rtmidi::port_information> outputs;
+    try
+    {
+        inputs = mInputEnumerator->get_ports();
+        outputs = mOutputEnumerator->get_ports();
+    }
+    catch (const rtmidi::midi_exception& error)
+    {
+        LOG_ERROR("void MidiPortRegistry::Snapshot(): problem with RtMidi - keeping the last list: {}", error.what());
+        if (mInputs && mOutputs) return;
+    }
+    LOG_DEBUG("void MidiPortRegistry::Snapshot(): {} input and {} output ports", inputs.size(), outputs.size());
+    //without hotplug events this is how a port coming or going is seen, so tell the listener as an event would
+    const bool changed = !mInputs || !mOutputs || !SamePorts(mInputs->ports, inputs) || !SamePorts(mOutputs->ports, outputs);
+    std::atomic_store_explicit(&mInputs, MakeList(std::move(inputs)), std::memory_order_release);
+    std::atomic_store_explicit(&mOutputs, MakeList(std::move(outputs)), std::memory_order_release);
+    if (changed && mChangeCallback) mChangeCallback();
+}
+
+bool MidiPortRegistry::SamePorts(const std::vector<rtmidi::port_information>& a, const std::vector<rtmidi::port_information>& b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const rtmidi::port_information& x, const rtmidi::port_information& y) {return x.id == y.id && x.name == y.name;});
+}
+
+void MidiPortRegistry::Add(std::shared_ptr<const MidiPortList>& list, unsigned int id, const std::string& name, const char* direction)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!list) return; //came before the first list, which is made afterwards
+    std::vector<rtmidi::port_information> ports = list->ports;
+    const auto it = std::lower_bound(ports.begin(), ports.end(), id, [](const rtmidi::port_information& port, unsigned int id) {return port.id < id;});
+    //already there if it turned up in the first list as well as in an event
+    if (it != ports.end() && it->id == id) it->name = name;
+    else ports.insert(it, rtmidi::port_information{id, name});
+    LOG_INFO("void MidiPortRegistry::Add(): {} port {} added", direction, name);
+    std::atomic_store_explicit(&list, MakeList(std::move(ports)), std::memory_order_release);
+    if (mChangeCallback) mChangeCallback();
+}
+
+void MidiPortRegistry::Remove(std::shared_ptr<const MidiPortList>& list, unsigned int id, const std::string& name, const char* direction)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!list) return; //came before the first list, which is made afterwards
+    std::vector<rtmidi::port_information> ports = list->ports;
+    const auto it = std::lower_bound(ports.begin(), ports.end(), id, [](const rtmidi::port_information& port, unsigned int id) {return port.id < id;});
+    if (it == ports.end() || it->id != id) return;
+    ports.erase(it);
+    LOG_INFO("void MidiPortRegistry::Remove(): {} port {} removed", direction, name);
+    std::atomic_store_explicit(&list, MakeList(std::move(ports)), std::memory_order_release);
+    if (mChangeCallback) mChangeCallback();
+}
+
+std::shared_ptr<const MidiPortList> MidiPortRegistry::MakeList(std::vector<rtmidi::port_information> ports)
+{
+    auto list = std::make_shared<MidiPortList>();
+    list->ports = std::move(ports);
+    list->indexByName.reserve(list->ports.size());
+    for (size_t i = 0; i < list->ports.size(); i++) list->indexByName.emplace(list->ports[i].name, (int)i);
+    return list;
+}
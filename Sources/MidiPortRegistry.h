@@ -0,0 +1,91 @@
+//==============================================================================
+/**
+@file       MidiPortRegistry.h
+
+@brief      Cached list of the MIDI ports, kept up to date by hotplug events
+
+            Listing the ports used to mean get_port_count() and then get_port_name(i) for each one - on
+            ALSA each of those walks every client and port, so N ports cost N² sequencer queries, every
+            time the PI opened. Here the ports are listed once, in one pass, and then kept up to date
+            from rtmidi::observer callbacks, so the PI and the port pool only ever read the cache.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <rtmidi17.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//one direction's ports at one moment - never changed once it's been published
+struct MidiPortList
+{
+    std::vector<rtmidi::port_information> ports; //in port index order, as midi_in/midi_out number them
+    std::unordered_map<std::string, int> indexByName; //the first port with each name
+
+    //index of the port called name, or -1
+    int Find(const std::string& name) const
+    {
+        const auto it = indexByName.find(name);
+        return it != indexByName.end() ? it->second : -1;
+    }
+};
+
+class MidiPortRegistry
+{
+public:
+    //lists the ports for the default API and starts watching for changes
+    MidiPortRegistry();
+    ~MidiPortRegistry();
+
+    //the API the ports were listed with - open the ports with the same one so the indices match
+    rtmidi::API GetApi() const { return mApi; }
+
+    //the current ports - any thread, the list stays valid for as long as the pointer is held
+    std::shared_ptr<const MidiPortList> GetInputs() const { return std::atomic_load_explicit(&mInputs, std::memory_order_acquire); }
+    std::shared_ptr<const MidiPortList> GetOutputs() const { return std::atomic_load_explicit(&mOutputs, std::memory_order_acquire); }
+
+    //true if hotplug events keep the cache up to date (ALSA, rawmidi, loopback) - otherwise it has to be refreshed
+    //before it's used, and only changes when it is
+    bool IsLive() const { return mLive; }
+
+    //list the ports again - a no-op when the cache is live
+    void Refresh();
+
+    //called on the observer's thread after each hotplug change has been published, or on the refreshing thread when
+    //Refresh() finds the ports have changed - pass nullptr to stop, which waits for a call in progress to finish
+    void SetChangeCallback(std::function<void()> callback);
+
+private:
+    //list both directions with the enumerators - mMutex must be held
+    void Snapshot();
+
+    //hotplug events - id is the port's stable id (ALSA client:port), which also orders the ports by index
+    void Add(std::shared_ptr<const MidiPortList>& list, unsigned int id, const std::string& name, const char* direction);
+    void Remove(std::shared_ptr<const MidiPortList>& list, unsigned int id, const std::string& name, const char* direction);
+
+    static std::shared_ptr<const MidiPortList> MakeList(std::vector<rtmidi::port_information> ports);
+    static bool SamePorts(const std::vector<rtmidi::port_information>& a, const std::vector<rtmidi::port_information>& b);
+
+    //unopened, only used to list the ports
+    std::unique_ptr<rtmidi::midi_in> mInputEnumerator;
+    std::unique_ptr<rtmidi::midi_out> mOutputEnumerator;
+    rtmidi::API mApi = rtmidi::API::UNSPECIFIED;
+    bool mLive = false;
+
+    std::shared_ptr<const MidiPortList> mInputs;
+    std::shared_ptr<const MidiPortList> mOutputs;
+
+    //serialises the observer thread with Refresh()
+    std::mutex mMutex;
+    std::function<void()> mChangeCallback; //guarded by mMutex
+    std::unique_ptr<rtmidi::observer> mObserver;
+};
@@ -0,0 +1,262 @@
+//==============================================================================
+/**
+@file       PngEncoder.cpp
+
+@brief      Small, fast PNG encoder for the rendered key images
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "PngEncoder.h"
+#include <cstring>
+
+namespace {
+const unsigned char PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+const uint32_t PNG_FILTER_UP = 2;
+
+//deflate length codes 257..284 - base length and number of extra bits (285 is 258 with none)
+const uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+//a Huffman code ready to go into the bit stream - already reversed, with any extra bits folded in above it
+struct Code
+{
+    uint32_t bits = 0;
+    uint32_t length = 0;
+};
+
+uint32_t Reverse(uint32_t code, uint32_t length)
+{
+    uint32_t reversed = 0;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+//the fixed Huffman literal/length code from RFC 1951 3.2.6
+Code FixedLiteralCode(uint32_t symbol)
+{
+    Code code;
+    if (symbol < 144) code = {0x30 + symbol, 8};
+    else if (symbol < 256) code = {0x190 + (symbol - 144), 9};
+    else if (symbol < 280) code = {symbol - 256, 7};
+    else code = {0xC0 + (symbol - 280), 8};
+    code.bits = Reverse(code.bits, code.length);
+    return code;
+}
+
+struct Tables
+{
+    uint32_t crc[256];
+    Code literal[256];
+    Code length[MAX_MATCH + 1]; //length symbol plus extra bits, indexed by match length
+
+    Tables()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc[n] = c;
+            literal[n] = FixedLiteralCode(n);
+        }
+        for (int matchLength = MIN_MATCH; matchLength <= MAX_MATCH; matchLength++)
+        {
+            int index = 28;
+            if (matchLength < MAX_MATCH)
+            {
+                index = 0;
+                while (index < 27 && LENGTH_BASE[index + 1] <= matchLength) index++;
+            }
+            const Code symbol = FixedLiteralCode(257 + index);
+            length[matchLength].bits = symbol.bits | ((uint32_t)(matchLength - LENGTH_BASE[index]) << symbol.length);
+            length[matchLength].length = symbol.length + LENGTH_EXTRA[index];
+        }
+    }
+};
+
+const Tables& GetTables()
+{
+    static const Tables tables;
+    return tables;
+}
+
+//deflate writes the least significant bit first
+class BitWriter
+{
+public:
+    explicit BitWriter(unsigned char* out) : mOut(out) {}
+
+    void Put(uint32_t bits, uint32_t length)
+    {
+        mBuffer |= (uint64_t)bits << mCount;
+        mCount += length;
+        if (mCount >= 32)
+        {
+            for (int i = 0; i < 4; i++) *mOut++ = (unsigned char)(mBuffer >> (8 * i));
+            mBuffer >>= 32;
+            mCount -= 32;
+        }
+    }
+
+    //pad to a byte and return the end of the output
+    unsigned char* Finish()
+    {
+        while (mCount > 0)
+        {
+            *mOut++ = (unsigned char)mBuffer;
+            mBuffer >>= 8;
+            mCount = mCount > 8 ? mCount - 8 : 0;
+        }
+        return mOut;
+    }
+
+private:
+    unsigned char* mOut;
+    uint64_t mBuffer = 0;
+    uint32_t mCount = 0;
+};
+
+void PutBigEndian(unsigned char* out, uint32_t value)
+{
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+uint32_t Crc32(const unsigned char* data, size_t size)
+{
+    const uint32_t* table = GetTables().crc;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+uint32_t Adler32(const unsigned char* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+        //5552 is the most bytes that can be summed before b could overflow
+        size_t block = size < 5552 ? size : 5552;
+        size -= block;
+        while (block-- > 0)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+//a chunk's length, type and data are already in place at chunk - fill in the length and append the CRC
+unsigned char* FinishChunk(unsigned char* chunk, uint32_t dataLength)
+{
+    PutBigEndian(chunk, dataLength);
+    PutBigEndian(chunk + 8 + dataLength, Crc32(chunk + 4, 4 + dataLength));
+    return chunk + 12 + dataLength;
+}
+
+size_t RunLength(const unsigned char* data, size_t position, size_t size, size_t distance)
+{
+    if (position < distance) return 0;
+    const size_t end = position + MAX_MATCH < size ? position + MAX_MATCH : size;
+    size_t i = position;
+    while (i < end && data[i] == data[i - distance]) i++;
+    return i - position;
+}
+}
+
+size_t PngEncoder::Encode(const unsigned char* rgba, int width, int height, std::vector<unsigned char>& png)
+{
+    const Tables& tables = GetTables();
+    const size_t stride = (size_t)width * 4;
+    const size_t filteredSize = (stride + 1) * height;
+
+    //Up filter - the row above is taken as zero for the first row
+    mFiltered.resize(filteredSize);
+    unsigned char* filtered = mFiltered.data();
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* row = rgba + y * stride;
+        unsigned char* out = filtered + y * (stride + 1);
+        *out++ = PNG_FILTER_UP;
+        if (y == 0) memcpy(out, row, stride);
+        else
+        {
+            const unsigned char* above = row - stride;
+            for (size_t x = 0; x < stride; x++) out[x] = (unsigned char)(row[x] - above[x]);
+        }
+    }
+
+    //worst case is every byte a 9 bit literal
+    png.resize(sizeof(PNG_SIGNATURE) + 25 + 12 + 2 + filteredSize * 9 / 8 + 16 + 4 + 12);
+    unsigned char* out = png.data();
+    memcpy(out, PNG_SIGNATURE, sizeof(PNG_SIGNATURE));
+    out += sizeof(PNG_SIGNATURE);
+
+    //IHDR - 8 bit RGBA, no interlace
+    memcpy(out + 4, "IHDR", 4);
+    PutBigEndian(out + 8, (uint32_t)width);
+    PutBigEndian(out + 12, (uint32_t)height);
+    out[16] = 8;
+    out[17] = 6;
+    out[18] = 0;
+    out[19] = 0;
+    out[20] = 0;
+    out = FinishChunk(out, 13);
+
+    //IDAT - zlib header, one final fixed-Huffman block, Adler-32
+    unsigned char* idat = out;
+    memcpy(idat + 4, "IDAT", 4);
+    unsigned char* stream = idat + 8;
+    stream[0] = 0x78;
+    stream[1] = 0x01;
+    BitWriter writer(stream + 2);
+    writer.Put(3, 3); //BFINAL, BTYPE = 01
+    for (size_t i = 0; i < filteredSize;)
+    {
+        //distance 1 catches flat runs and the zero rows the Up filter makes, distance 4 catches a repeated pixel
+        const size_t byteRun = RunLength(filtered, i, filteredSize, 1);
+        const size_t pixelRun = byteRun == MAX_MATCH ? 0 : RunLength(filtered, i, filteredSize, 4);
+        if (byteRun >= MIN_MATCH && byteRun >= pixelRun)
+        {
+            writer.Put(tables.length[byteRun].bits, tables.length[byteRun].length);
+            writer.Put(0, 5); //distance code 0 - distance 1
+            i += byteRun;
+        }
+        else if (pixelRun >= MIN_MATCH)
+        {
+            writer.Put(tables.length[pixelRun].bits, tables.length[pixelRun].length);
+            writer.Put(24, 5); //distance code 3 - distance 4, reversed
+            i += pixelRun;
+        }
+        else
+        {
+            writer.Put(tables.literal[filtered[i]].bits, tables.literal[filtered[i]].length);
+            i++;
+        }
+    }
+    writer.Put(0, 7); //end of block
+    unsigned char* streamEnd = writer.Finish();
+    PutBigEndian(streamEnd, Adler32(filtered, filteredSize));
+    streamEnd += 4;
+    out = FinishChunk(idat, (uint32_t)(streamEnd - stream));
+
+    memcpy(out + 4, "IEND", 4);
+    out = FinishChunk(out, 0);
+
+    png.resize(out - png.data());
+    return png.size();
+}
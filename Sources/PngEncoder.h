@@ -0,0 +1,32 @@
+//==============================================================================
+/**
+@file       PngEncoder.h
+
+@brief      Small, fast PNG encoder for the rendered key images
+
+            RGBA in, PNG out. Rows use the Up filter and the deflate stream is a single fixed-Huffman
+            block that only looks for runs (distance 1 and distance 4, i.e. one pixel back) - key images
+            are mostly flat colour, so that gets most of what zlib would for a fraction of the time.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class PngEncoder
+{
+public:
+    //encode width x height RGBA pixels (stride = width * 4) into png - the buffers are kept, so reuse the encoder
+    //returns the number of bytes written to png, which is resized to fit
+    size_t Encode(const unsigned char* rgba, int width, int height, std::vector<unsigned char>& png);
+
+private:
+    std::vector<unsigned char> mFiltered; //filter byte + Up-filtered row, for every row
+};
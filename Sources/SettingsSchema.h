@@ -0,0 +1,197 @@
+//==============================================================================
+/**
+@file       SettingsSchema.h
+
+@brief      Table-driven decoding of settings payloads
+
+            A settings struct is described once by a constexpr table of (JSON key, member pointer) entries,
+            sorted by key. DecodeSettings() walks the payload's members once, finds each key in the table
+            with a binary search and stores the value straight into the member - no find/operator[] per key
+            and no strings built along the way. It returns a bit per table entry that was decoded, which the
+            same table can turn back into names for logging or compare between two copies of the struct.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+//json is nlohmann::json, from pch.h
+
+enum class SettingsFieldType : uint8_t
+{
+    INT,
+    FLOAT,
+    BOOL,
+    STRING,
+};
+
+//one entry in a settings table - only the member pointer matching type is set
+template<typename Settings>
+struct SettingsField
+{
+    const char* key;
+    SettingsFieldType type;
+    int Settings::* intMember;
+    float Settings::* floatMember;
+    bool Settings::* boolMember;
+    std::string Settings::* stringMember;
+};
+
+template<typename Settings>
+constexpr SettingsField<Settings> MakeSettingsField(const char* key, int Settings::* member)
+{
+    return {key, SettingsFieldType::INT, member, nullptr, nullptr, nullptr};
+}
+template<typename Settings>
+constexpr SettingsField<Settings> MakeSettingsField(const char* key, float Settings::* member)
+{
+    return {key, SettingsFieldType::FLOAT, nullptr, member, nullptr, nullptr};
+}
+template<typename Settings>
+constexpr SettingsField<Settings> MakeSettingsField(const char* key, bool Settings::* member)
+{
+    return {key, SettingsFieldType::BOOL, nullptr, nullptr, member, nullptr};
+}
+template<typename Settings>
+constexpr SettingsField<Settings> MakeSettingsField(const char* key, std::string Settings::* member)
+{
+    return {key, SettingsFieldType::STRING, nullptr, nullptr, nullptr, member};
+}
+
+constexpr int CompareSettingsKeys(const char* a, const char* b)
+{
+    while (*a != '\0' && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (int)(unsigned char)*a - (int)(unsigned char)*b;
+}
+
+//for a static_assert next to the table - the lookup is a binary search
+template<typename Settings, size_t N>
+constexpr bool SettingsFieldsAreSorted(const SettingsField<Settings> (&fields)[N])
+{
+    for (size_t i = 1; i < N; i++)
+    {
+        if (CompareSettingsKeys(fields[i - 1].key, fields[i].key) >= 0) return false;
+    }
+    return true;
+}
+
+//the bit DecodeSettings() sets for a key - bind it to a constexpr (static constexpr uint32_t X_BIT = ...) so a key that
+//isn't in the table is a compile error; evaluated at runtime it throws
+template<typename Settings, size_t N>
+constexpr uint32_t SettingsFieldBit(const SettingsField<Settings> (&fields)[N], const char* key)
+{
+    static_assert(N <= 32, "a settings table can have at most 32 fields");
+    for (size_t i = 0; i < N; i++)
+    {
+        if (CompareSettingsKeys(fields[i].key, key) == 0) return 1u << i;
+    }
+    throw std::logic_error("not a settings key");
+}
+
+//index of the key in the table, or N
+template<typename Settings, size_t N>
+size_t FindSettingsField(const SettingsField<Settings> (&fields)[N], const char* key)
+{
+    size_t low = 0, high = N;
+    while (low < high)
+    {
+        const size_t middle = (low + high) / 2;
+        const int comparison = CompareSettingsKeys(fields[middle].key, key);
+        if (comparison == 0) return middle;
+        if (comparison < 0) low = middle + 1;
+        else high = middle;
+    }
+    return N;
+}
+
+//store one JSON value - false if it isn't a type we can take for the field, in which case the member is left alone
+template<typename Settings>
+bool DecodeSettingsField(const SettingsField<Settings>& field, const json& value, Settings& settings)
+{
+    switch (field.type)
+    {
+        case SettingsFieldType::INT:
+            if (value.is_number_integer()) settings.*field.intMember = value.get<int>();
+            else if (value.is_number_float()) settings.*field.intMember = (int)value.get<double>();
+            else return false;
+            return true;
+        case SettingsFieldType::FLOAT:
+            if (!value.is_number()) return false;
+            settings.*field.floatMember = value.get<float>();
+            return true;
+        case SettingsFieldType::BOOL:
+            if (value.is_boolean()) settings.*field.boolMember = value.get<bool>();
+            else if (value.is_number()) settings.*field.boolMember = value.get<double>() != 0;
+            else return false;
+            return true;
+        case SettingsFieldType::STRING:
+            if (!value.is_string()) return false;
+            settings.*field.stringMember = value.get_ref<const std::string&>();
+            return true;
+    }
+    return false;
+}
+
+//decode every member of the settings object the table knows about, in one pass - returns a bit per field decoded
+template<typename Settings, size_t N>
+uint32_t DecodeSettings(const SettingsField<Settings> (&fields)[N], const json& settingsObject, Settings& settings)
+{
+    static_assert(N <= 32, "a settings table can have at most 32 fields");
+    uint32_t decoded = 0;
+    if (!settingsObject.is_object()) return decoded;
+    for (auto it = settingsObject.begin(); it != settingsObject.end(); ++it)
+    {
+        const size_t index = FindSettingsField(fields, it.key().c_str());
+        if (index < N && DecodeSettingsField(fields[index], it.value(), settings)) decoded |= 1u << index;
+    }
+    return decoded;
+}
+
+//a bit per field that differs between the two
+template<typename Settings, size_t N>
+uint32_t CompareSettings(const SettingsField<Settings> (&fields)[N], const Settings& a, const Settings& b)
+{
+    uint32_t changed = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        bool same = true;
+        switch (fields[i].type)
+        {
+            case SettingsFieldType::INT: same = a.*fields[i].intMember == b.*fields[i].intMember; break;
+            case SettingsFieldType::FLOAT: same = a.*fields[i].floatMember == b.*fields[i].floatMember; break;
+            case SettingsFieldType::BOOL: same = a.*fields[i].boolMember == b.*fields[i].boolMember; break;
+            case SettingsFieldType::STRING: same = a.*fields[i].stringMember == b.*fields[i].stringMember; break;
+        }
+        if (!same) changed |= 1u << i;
+    }
+    return changed;
+}
+
+//call visitor(key, value) for each field in the mask - value is the member itself, so this is cheap to use for logging
+template<typename Settings, size_t N, typename Visitor>
+void ForEachSettingsField(const SettingsField<Settings> (&fields)[N], const Settings& settings, uint32_t mask, Visitor&& visitor)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        if ((mask & (1u << i)) == 0) continue;
+        switch (fields[i].type)
+        {
+            case SettingsFieldType::INT: visitor(fields[i].key, settings.*fields[i].intMember); break;
+            case SettingsFieldType::FLOAT: visitor(fields[i].key, settings.*fields[i].floatMember); break;
+            case SettingsFieldType::BOOL: visitor(fields[i].key, settings.*fields[i].boolMember); break;
+            case SettingsFieldType::STRING: visitor(fields[i].key, settings.*fields[i].stringMember); break;
+        }
+    }
+}
@@ -14,9 +14,19 @@
 #include "StreamDeckMidiButton.h"
 #include "Common/ESDConnectionManager.h"
 #include "Common/EPLJSONUtils.h"
+#include "Logger.h"
+#include "TraceLog.h"
 
-#define Message(x) {mConnectionManager->LogMessage(x);}
-#define DebugMessage(x) { if (mGlobalSettings->printDebug) mConnectionManager->LogMessage(x); }
+//the argument is only built if the level is enabled - see Logger.h
+#define Message(x) LOG_INFO("{}", x)
+#define DebugMessage(x) LOG_DEBUG("{}", x)
+
+//names of the log and binary trace files written next to the plugin when printDebug is on
+#define LOG_FILE_NAME "midibutton.log"
+#define TRACE_FILE_NAME "midibutton.trace"
+
+//the MMC icons, relative to the plugin
+#define ICONS_DIRECTORY "./Icons"
 
 //using this for debugging
 inline std::string const BoolToString(bool b)
@@ -38,47 +48,70 @@ StreamDeckMidiButton::StreamDeckMidiButton()
 {
     //instantiate a new GlobalSettings object
     mGlobalSettings = new GlobalSettings;
+    
+    //send log messages to the Stream Deck log - the logger calls this from its own thread
+    Logger::Instance().SetLevel(LogLevel::INFO);
+    Logger::Instance().SetStreamDeckSink([this](const std::string& message) {if (mConnectionManager != nullptr) mConnectionManager->LogMessage(message);});
+    
+    //size the per-context tables up front - ids index straight into them
+    mContextNames.resize(MAX_CONTEXTS);
+    mContextDevices.resize(MAX_CONTEXTS);
+    mVisibleContexts.resize(MAX_CONTEXTS, false);
+    mButtonRuntime.reset(new ButtonRuntime[MAX_CONTEXTS]);
     try
     {
-        if (midiOut != nullptr)
-        {
-            delete midiOut;
-        }
-        //midiOut = new RtMidiOut();
-        midiOut = new rtmidi::midi_out();
-        if (midiIn != nullptr)
-        {
-            delete midiIn;
-        }
-        //midiIn = new RtMidiIn();
-        midiIn = new rtmidi::midi_in();
+        //list the ports once - hotplug events keep the list up to date from here on
+        mMidiPortRegistry.reset(new MidiPortRegistry());
+        //an unopened pair to start with - the ports are opened when the global settings arrive
+#if MIDIBUTTON_STRAND_MODE
+        mMidiPortPool.reset(new MidiPortPool(*mMidiPortRegistry, [this](const rtmidi::message* messages, size_t count) {this->QueueMidiInput(messages, count);}));
+#else
+        mMidiPortPool.reset(new MidiPortPool(*mMidiPortRegistry, [this](const rtmidi::message* messages, size_t count) {this->HandleMidiInput(messages, count);}));
+#endif
     }
     catch (std::exception e)
     {
         exit(EXIT_FAILURE);
     }
     
+    //start the MIDI sender thread
+    mMidiOutQueue.reset(new MidiOutQueue([this](const unsigned char* bytes, size_t size) {this->SendQueuedMidiMessage(bytes, size);}));
+    
+    //start the key renderer - capped at 30 frames a second, and no more than 8 images in a frame
+    mKeyRenderer.reset(new KeyRenderer(MAX_CONTEXTS, [this](uint32_t contextId, const std::shared_ptr<const std::string>& dataURI) {this->SetKeyImage(contextId, dataURI);}, 30, 8));
+    
+#if !MIDIBUTTON_STRAND_MODE
     //start the timer with 1ms resolution
     eTimer = new Timer(std::chrono::milliseconds(mGlobalSettings->sampleInterval));
     
     //add an event to the timer and use it to update the fades - replace this with individual timer increments
     auto mTimerUpdate = eTimer->set_interval(std::chrono::milliseconds(mGlobalSettings->sampleInterval), [this]() {this->UpdateTimer();});
+#endif
 }
 
 StreamDeckMidiButton::~StreamDeckMidiButton()
 {
     try
     {
-        if (midiOut != nullptr)
-        {
-            delete midiOut;
-            midiOut = nullptr;
-        }
-        if (midiIn != nullptr)
+        //stop logging to the Stream Deck before mConnectionManager goes away
+        Logger::Instance().Flush();
+        Logger::Instance().SetStreamDeckSink(nullptr);
+        
+        //stop the fades and drain the sender thread before the ports go away
+        if (eTimer != nullptr)
         {
-            delete midiIn;
-            midiIn = nullptr;
+            delete eTimer;
+            eTimer = nullptr;
         }
+#if MIDIBUTTON_STRAND_MODE
+        //the loop has stopped by now - Run() has returned
+        if (mFadeTimer) mFadeTimer->cancel();
+#endif
+        mMidiOutQueue.reset();
+        mKeyRenderer.reset();
+        
+        mMidiPortPool.reset();
+        mMidiPortRegistry.reset();
         if(mGlobalSettings != nullptr)
         {
             delete mGlobalSettings;
@@ -92,224 +125,227 @@ StreamDeckMidiButton::~StreamDeckMidiButton()
     }
 }
 
-bool StreamDeckMidiButton::InitialiseMidi(Direction direction)
+uint32_t StreamDeckMidiButton::InternContext(const std::string& inContext)
 {
-    switch (direction)
+    auto it = mContextIds.find(inContext);
+    if (it != mContextIds.end())
+    {
+        return it->second;
+    }
+    
+    uint32_t contextId = mContextCount.load(std::memory_order_relaxed);
+    if (contextId < MAX_CONTEXTS)
     {
-        case Direction::OUT:
+        mContextCount.store(contextId + 1, std::memory_order_release);
+    }
+    else
+    {
+        //the table's full - reuse the id of a context that's gone off the page
+        contextId = ReleaseHiddenContext();
+        if (contextId == INVALID_CONTEXT_ID)
         {
-            Message("bool MidiButton::InitialiseMidi(Direction OUT)");
-            try
-            {
-                if (midiOut != nullptr)
-                {
-                    Message("bool MidiButton::InitialiseMidi(Direction OUT): midiOut is already initialised - deleting");
-                    delete midiOut;
-                    Message("bool MidiButton::InitialiseMidi(Direction OUT): creating a new midiOut");
-                    midiOut = new rtmidi::midi_out();
-                }
-#if defined (__APPLE__)
-                if (mGlobalSettings->useVirtualPort)
-                {
-                    DebugMessage("bool MidiButton::InitialiseMidi(Direction OUT): opening virtual OUTPUT port called: " + mGlobalSettings->portName);
-                    midiOut->open_virtual_port(mGlobalSettings->portName);
-                }
-                else
-                {
-#endif
-                    //idiot check - are there any OUTPUT ports?
-                    if (midiOut->get_port_count() == 0)
-                    {
-                        Message("bool MidiButton::InitialiseMidi(Direction OUT): no midi OUT device available");
-                        return false;
-                    }
-                    else
-                    {
-                        if (mGlobalSettings->selectedOutPortName == midiOut->get_port_name(mGlobalSettings->selectedOutPortIndex))
-                        {
-                            //the portname and index match - open the port
-                            DebugMessage("bool MidiButton::InitialiseMidi(Direction OUT): portName and portIndex match - opening OUTPUT port index: " + std::to_string(mGlobalSettings->selectedOutPortIndex) + " called: " + midiOut->get_port_name(mGlobalSettings->selectedOutPortIndex));
-                            midiOut->open_port(mGlobalSettings->selectedOutPortIndex);
-                        }
-                        else if (mGlobalSettings->selectedOutPortName != midiOut->get_port_name(mGlobalSettings->selectedOutPortIndex))
-                        {
-                            Message("bool MidiButton::InitialiseMidi(Direction OUT): selectedOutPortName and selectedOutPortIndex DON'T match - setting selectedOutPortIndex to the correct name");
-                            for (int i = 0; i < midiOut->get_port_count(); i++)
-                            {
-                                if (midiOut->get_port_name(i) == mGlobalSettings->selectedOutPortName) mGlobalSettings->selectedOutPortIndex = i;
-                            }
-                            DebugMessage("bool MidiButton::InitialiseMidi(Direction OUT): opening OUTPUT port index: " + std::to_string(mGlobalSettings->selectedOutPortIndex) + " called: " + midiOut->get_port_name(mGlobalSettings->selectedOutPortIndex));
-                            midiOut->open_port(mGlobalSettings->selectedOutPortIndex);
-                        }
-                        else
-                        {
-                            Message("bool MidiButton::InitialiseMidi(Direction OUT): selectedOutPortIndex is out of range - something has gone wrong");
-                            return false;
-                        }
-                    }
-#if defined (__APPLE__)
-                }
-#endif
-            }
-            //catch (RtMidiError &error)
-            catch (const rtmidi::midi_exception& error)
-            {
-                Message("bool MidiButton::InitialiseMidi(Direction OUT): problem with RtMidi - exiting with prejudice");
-                Message(error.what());
-                exit(EXIT_FAILURE);
-            }
-        return true;
+            LOG_ERROR("uint32_t MidiButton::InternContext(): all {} contexts are on a page - ignoring {}", MAX_CONTEXTS, inContext);
+            return INVALID_CONTEXT_ID;
         }
-        case Direction::IN:
+    }
+    
+    //the Timer and MIDI threads only see the new context once its entry is published below
+    mContextNames[contextId] = inContext;
+    mContextIds.emplace(inContext, contextId);
+    DebugMessage("uint32_t MidiButton::InternContext(): context " + inContext + " has id " + std::to_string(contextId));
+    
+    //an empty entry until the settings arrive, so the table always has one for each id
+    PublishButton(contextId, ButtonEntry());
+    return contextId;
+}
+
+void StreamDeckMidiButton::HideContext(const uint32_t contextId)
+{
+    if (!mVisibleContexts[contextId]) return;
+    mVisibleContexts[contextId] = false;
+    mHiddenContextIds.push_back(contextId);
+}
+
+uint32_t StreamDeckMidiButton::ReleaseHiddenContext()
+{
+    //oldest first, and once round at most - a context that's still fading is put back for next time
+    for (size_t tries = mHiddenContextIds.size(); tries > 0; tries--)
+    {
+        const uint32_t contextId = mHiddenContextIds.front();
+        mHiddenContextIds.pop_front();
+        if (mVisibleContexts[contextId]) continue;//it's come back since
+        if (mButtonRuntime[contextId].fade.load(std::memory_order_acquire).Is(FadeState::ACTIVE))
         {
-            Message("bool MidiButton::InitialiseMidi(Direction IN)");
-            midiUpdateMutex.lock();
-            try
-            {
-                if (midiIn != nullptr)
-                {
-                    Message("bool MidiButton::InitialiseMidi(Direction IN): midiIn is already initialised - deleting");
-                    delete midiIn;
-                    Message("bool MidiButton::InitialiseMidi(Direction IN): creating a new midiIn");
-                    midiIn = new rtmidi::midi_in();
-                    midiIn->set_callback([this] (const auto& message) { HandleMidiInput(message); });
-                }
-                
-                // don't ignore sysex, timing or active sensing messages
-                midiIn->ignore_types(false, false, false);
-#if defined (__APPLE__)
-                if (mGlobalSettings->useVirtualPort)
-                {
-                    DebugMessage("bool MidiButton::InitialiseMidi(Direction IN): opening virtual INPUT port called: " + mGlobalSettings->portName);
-                    midiIn->open_virtual_port(mGlobalSettings->portName);
-                }
-                else
-                {
-#endif
-                    //idiot check - are there any INPUT ports?
-                    if (midiIn->get_port_count() == 0)
-                    {
-                        Message("bool MidiButton::InitialiseMidi(Direction IN): no midi IN device available");
-                        midiUpdateMutex.unlock();
-                        return false;
-                    }
-                    else
-                    {
-                        if (mGlobalSettings->selectedInPortName == midiIn->get_port_name(mGlobalSettings->selectedInPortIndex))
-                        {
-                            //the portname and index match - open the port
-                            DebugMessage("bool MidiButton::InitialiseMidi(Direction IN): portName and portIndex match - opening INPUT port index: " + std::to_string(mGlobalSettings->selectedInPortIndex) + " called: " + midiIn->get_port_name(mGlobalSettings->selectedInPortIndex));
-                            midiIn->open_port(mGlobalSettings->selectedInPortIndex);
-                        }
-                        else if (mGlobalSettings->selectedInPortName != midiIn->get_port_name(mGlobalSettings->selectedInPortIndex))
-                        {
-                            Message("bool MidiButton::InitialiseMidi(Direction IN): selectedInPortName and selectedInPortIndex DON'T match - setting selectedInPortIndex to the correct name");
-                            for (int i = 0; i < midiIn->get_port_count(); i++)
-                            {
-                                if (midiIn->get_port_name(i) == mGlobalSettings->selectedInPortName) mGlobalSettings->selectedInPortIndex = i;
-                            }
-                            DebugMessage("bool MidiButton::InitialiseMidi(Direction IN): opening INPUT port index: " + std::to_string(mGlobalSettings->selectedInPortIndex) + " called: " + midiIn->get_port_name(mGlobalSettings->selectedInPortIndex));
-                            midiIn->open_port(mGlobalSettings->selectedInPortIndex);
-                        }
-                        else
-                        {
-                            Message("bool MidiButton::InitialiseMidi(Direction IN): selectedInPortIndex is out of range - something has gone wrong");
-                            midiUpdateMutex.unlock();
-                            return false;
-                        }
-                    }
-                }
-            }
-            //catch (RtMidiError &error)
-            catch (const rtmidi::midi_exception& error)
-            {
-                Message("bool MidiButton::InitialiseMidi(Direction IN): problem with RtMidi - exiting with prejudice");
-                Message(error.what());
-                exit(EXIT_FAILURE);
-            }
-            midiUpdateMutex.unlock();
-            return true;
-#if defined (__APPLE__)
+            mHiddenContextIds.push_back(contextId);
+            continue;
         }
-#endif
+        
+        //the old context is forgotten - if it comes back it's interned again and its settings arrive with willAppear
+        LOG_INFO("uint32_t MidiButton::ReleaseHiddenContext(): giving id {} of hidden context {} to a new context", contextId, mContextNames[contextId]);
+        mContextIds.erase(mContextNames[contextId]);
+        mContextNames[contextId].clear();
+        mContextDevices[contextId].clear();
+        PublishButton(contextId, ButtonEntry());
+        
+        //wait for the Timer and MIDI threads to let go of every table with the old context in it, before its state is reset
+        while (mButtonTable.GetRetiredCount() > 0)
+        {
+            std::this_thread::yield();
+            mButtonTable.Reclaim();
+        }
+        mButtonRuntime[contextId].state.store(0, std::memory_order_relaxed);
+        mButtonRuntime[contextId].fade.store(FadeState(), std::memory_order_release);
+        mKeyRenderer->Clear(contextId);
+        return contextId;
     }
+    return INVALID_CONTEXT_ID;
+}
+
+void StreamDeckMidiButton::PublishButton(const uint32_t contextId, ButtonEntry entry)
+{
+    const ButtonTable& current = mButtonTable.Current();
+    std::unique_ptr<ButtonTable> table(new ButtonTable(current));
+    table->version = current.version + 1;
+    if (contextId >= table->buttons.size()) table->buttons.resize(contextId + 1);
+    table->buttons[contextId] = std::move(entry);
+    table->buttons[contextId].context = mContextNames[contextId];
+    
+    //the old version is freed once the Timer and MIDI threads have finished with it
+    mButtonTable.Publish(std::move(table));
+    LOG_TRACE("void MidiButton::PublishButton(): button table version {}, {} old versions waiting for readers", mButtonTable.Current().version, mButtonTable.GetRetiredCount());
 }
 
-void StreamDeckMidiButton::HandleMidiInput(const rtmidi::message &message)
+ActionType StreamDeckMidiButton::InternAction(const std::string& inAction)
 {
-    Message("void StreamDeckMidiButton::HandleMidiInput()");
+    if (inAction == SEND_NOTE_ON) return ActionType::NOTE_ON;
+    if (inAction == SEND_NOTE_ON_TOGGLE) return ActionType::NOTE_ON_TOGGLE;
+    if (inAction == SEND_CC) return ActionType::CC;
+    if (inAction == SEND_CC_TOGGLE) return ActionType::CC_TOGGLE;
+    if (inAction == SEND_MMC) return ActionType::MMC;
+    if (inAction == SEND_PROGRAM_CHANGE) return ActionType::PROGRAM_CHANGE;
+    return ActionType::UNKNOWN;
+}
+
+void StreamDeckMidiButton::InitialiseMidi()
+{
+    Message("void MidiButton::InitialiseMidi()");
+    MidiPortConfig config;
+    config.portName = mGlobalSettings->portName;
+    config.useVirtualPort = mGlobalSettings->useVirtualPort;
+    config.selectedOutPortIndex = mGlobalSettings->selectedOutPortIndex;
+    config.selectedOutPortName = mGlobalSettings->selectedOutPortName;
+    config.selectedInPortIndex = mGlobalSettings->selectedInPortIndex;
+    config.selectedInPortName = mGlobalSettings->selectedInPortName;
+    
+    //returns straight away - the pool logs when the new ports have been swapped in
+    mMidiPortPool->Reconfigure(config);
+}
+
+void StreamDeckMidiButton::HandleMidiInput(const rtmidi::message* messages, size_t count)
+{
+    //deal with midi input - the table stays pinned until we return, so the settings can't change underneath us
+    EpochSnapshot<ButtonTable>::Reader table(mButtonTable);
+    for (size_t i = 0; i < count; i++) HandleMidiInput(*table, messages[i].bytes.data(), messages[i].size(), messages[i].time_ns);
+}
+
+void StreamDeckMidiButton::HandleMidiInput(const ButtonTable& table, const unsigned char* bytes, const size_t nBytes, const int64_t timeNs)
+{
+    LOG_TRACE("void StreamDeckMidiButton::HandleMidiInput()");
     /*if(message.is_note_on_or_off())
     {
         mConnectionManager->LogMessage(std::to_string(message.bytes[0]) + " " + std::to_string(message.bytes[1]) + " " + std::to_string(message.bytes[2]));
     }*/
 
-    //deal with midi input
-    
-    midiUpdateMutex.lock();//lock the mutex to make sure we're not trying to access from more than one place
-    
-    if (midiIn != nullptr)
+    if (mConnectionManager != nullptr)
     {
-        if (mConnectionManager != nullptr)
+        if (nBytes > 0)
         {
-            std::string debugMessage = "void StreamDeckMidiButton::GetMidiInput()";
-            std::string logMessage;
-            int nBytes;
-            
-            auto message = midiIn->get_message();
-            nBytes = message.size();
-            if (nBytes > 0)
-            {
-                if (mGlobalSettings->printDebug) debugMessage.append(": received a midi message with " + std::to_string(nBytes) + " bytes, with ");
-                for (int i = 0; i < nBytes; i++)
-                {
-                    debugMessage.append("byte " + std::to_string(i) + " = " + std::to_string((int)message[i]) + ", ");
-                }
-                debugMessage.append(", stamp = " + std::to_string(message.timestamp));
-                Message(debugMessage);
+            TraceLog::Instance().Trace(TraceEvent::MIDI_IN, INVALID_CONTEXT_ID, bytes, nBytes);
+            LOG_TRACE("void StreamDeckMidiButton::GetMidiInput(): received a midi message with {} bytes, starting {} {} {}, {} us after it arrived", nBytes, (int)bytes[0], nBytes > 1 ? (int)bytes[1] : -1, nBytes > 2 ? (int)bytes[2] : -1, (rtmidi::monotonic_ns() - timeNs) / 1000);
 
-                std::map<std::string, ButtonSettings>::iterator storedButtonSettingsIterator = storedButtonSettings.begin();
-                
-                while (storedButtonSettingsIterator != storedButtonSettings.end())
+            for (uint32_t contextId = 0; contextId < table.buttons.size(); contextId++)
+            {
+                const ButtonSettings& settings = table.buttons[contextId].settings;
+                if (settings.statusByte == (int)bytes[0])//matching status byte
                 {
-                    if (storedButtonSettings[storedButtonSettingsIterator->first].statusByte == (int)message[0])//matching status byte
+                    if (nBytes > 1 && settings.dataByte1 > 0 && settings.dataByte1 == (int)bytes[1])//matching data byte 1
                     {
-                        if (storedButtonSettings[storedButtonSettingsIterator->first].dataByte1 > 0 && storedButtonSettings[storedButtonSettingsIterator->first].dataByte1 == (int)message[1])//matching data byte 1
-                        {
-                            if (mGlobalSettings->printDebug)
-                            {
-                                debugMessage.clear();
-                                debugMessage = ("void StreamDeckMidiButton::GetMidiInput(): storedButtonSettings status byte for button " + storedButtonSettingsIterator->first + " is " + std::to_string(storedButtonSettings[storedButtonSettingsIterator->first].statusByte) + " which matches incoming status byte of " + std::to_string((int)message[0]) + " and data byte 1 of " + std::to_string((int)message[1]));
-                                Message(debugMessage);
-                            }
+                        LOG_DEBUG("void StreamDeckMidiButton::GetMidiInput(): status byte for button {} is {} which matches incoming status byte of {} and data byte 1 of {}", table.buttons[contextId].context, settings.statusByte, (int)bytes[0], (int)bytes[1]);
 
-                            if (storedButtonSettings[storedButtonSettingsIterator->first].inAction == SEND_NOTE_ON_TOGGLE)
+                        std::atomic<uint8_t>& state = mButtonRuntime[contextId].state;
+                        if (settings.action == ActionType::NOTE_ON_TOGGLE)
+                        {
+                            state.fetch_xor(1, std::memory_order_relaxed);
+                            ChangeButtonState(contextId, table.buttons[contextId].context);
+                        }
+                        else if (settings.action == ActionType::CC_TOGGLE && nBytes > 2)
+                        {
+                            if (settings.dataByte2 == (int)bytes[2])//incoming message matches the main CC value selected
                             {
-                                storedButtonSettings[storedButtonSettingsIterator->first].state = !storedButtonSettings[storedButtonSettingsIterator->first].state;
-                                ChangeButtonState(storedButtonSettingsIterator->first);
+                                state.store(0, std::memory_order_relaxed);
+                                ChangeButtonState(contextId, table.buttons[contextId].context);
+                                if (settings.showLevel) mKeyRenderer->SetLevel(contextId, bytes[2]);
                             }
-                            else if (storedButtonSettings[storedButtonSettingsIterator->first].inAction == SEND_CC_TOGGLE)
+                            else if (settings.dataByte2Alt == (int)bytes[2])//incoming message matches the alternate CC value selected)
                             {
-                                if (storedButtonSettings[storedButtonSettingsIterator->first].dataByte2 == (int)message[2])//incoming message matches the main CC value selected
-                                {
-                                    storedButtonSettings[storedButtonSettingsIterator->first].state = 0;
-                                    ChangeButtonState(storedButtonSettingsIterator->first);
-                                }
-                                else if (storedButtonSettings[storedButtonSettingsIterator->first].dataByte2Alt == (int)message[2])//incoming message matches the alternate CC value selected)
-                                {
-                                    storedButtonSettings[storedButtonSettingsIterator->first].state = 1;
-                                    ChangeButtonState(storedButtonSettingsIterator->first);
-                                }
+                                state.store(1, std::memory_order_relaxed);
+                                ChangeButtonState(contextId, table.buttons[contextId].context);
+                                if (settings.showLevel) mKeyRenderer->SetLevel(contextId, bytes[2]);
                             }
                         }
                     }
-                    storedButtonSettingsIterator++;
                 }
             }
         }
     }
-    midiUpdateMutex.unlock();
 }
 
+#if MIDIBUTTON_STRAND_MODE
+void StreamDeckMidiButton::WillRunEventLoop(asio::io_context& inIOContext)
+{
+    Message("void MidiButton::WillRunEventLoop(): running the plugin on a strand of the websocket loop");
+    mStrand.reset(new asio::io_context::strand(inIOContext));
+    
+    //the Stream Deck log and the rendered key images go out from the loop's thread as well
+    Logger::Instance().SetStreamDeckSink([this](const std::string& message) {asio::post(*mStrand, [this, message]() {if (mConnectionManager != nullptr) mConnectionManager->LogMessage(message);});});
+    
+    mFadeTimer.reset(new asio::steady_timer(inIOContext));
+    mFadeTimer->expires_after(std::chrono::milliseconds(mGlobalSettings->sampleInterval));
+    mFadeTimer->async_wait(asio::bind_executor(*mStrand, [this](const std::error_code& error) {if (!error) {this->UpdateTimer(); this->ScheduleFadeTick();}}));
+}
+
+void StreamDeckMidiButton::ScheduleFadeTick()
+{
+    //from the last expiry rather than now, so a slow tick doesn't push the rest of the fade back
+    mFadeTimer->expires_at(mFadeTimer->expiry() + std::chrono::milliseconds(mGlobalSettings->sampleInterval));
+    mFadeTimer->async_wait(asio::bind_executor(*mStrand, [this](const std::error_code& error) {if (!error) {this->UpdateTimer(); this->ScheduleFadeTick();}}));
+}
+
+void StreamDeckMidiButton::QueueMidiInput(const rtmidi::message* messages, size_t count)
+{
+    //the ports are only opened once the global settings have arrived, so the strand is there by now
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!mMidiInQueue.Push(messages[i].bytes.data(), messages[i].size(), messages[i].time_ns))
+        {
+            LOG_WARN("void MidiButton::QueueMidiInput(): the strand is {} messages behind - dropping a message", mMidiInQueue.GetDroppedCount());
+        }
+    }
+    //one post for the whole batch, and one drain in flight at a time - it picks up everything queued before it clears the flag
+    if (!mMidiInputPosted.exchange(true, std::memory_order_acq_rel)) asio::post(*mStrand, [this]() {this->DrainMidiInput();});
+}
+
+void StreamDeckMidiButton::DrainMidiInput()
+{
+    //cleared first, so a message pushed after this point posts another drain rather than being left behind
+    mMidiInputPosted.store(false, std::memory_order_release);
+    //one pin for the whole drain rather than one a message
+    EpochSnapshot<ButtonTable>::Reader table(mButtonTable);
+    MidiInFrame message;
+    while (mMidiInQueue.Pop(message)) HandleMidiInput(*table, message.frame.bytes.data(), message.frame.size, message.timeNs);
+}
+#endif
+
 /*void StreamDeckMidiButton::UpdateFade()
 {
     std::map<std::string, FadeSet>::iterator it = this->storedFadeSettings.begin();
@@ -327,35 +363,35 @@ void StreamDeckMidiButton::HandleMidiInput(const rtmidi::message &message)
 void StreamDeckMidiButton::UpdateTimer()
 {
     //check each button and see if we need to do a fade
-    // Create a map iterator and point to beginning of map
-    
-    std::map<std::string, FadeSet>::iterator it = this->storedFadeSettings.begin();
+    EpochSnapshot<ButtonTable>::Reader table(mButtonTable);
     
-    // Iterate over the map using Iterator till end.
-    while (it != this->storedFadeSettings.end())
+    for (uint32_t contextId = 0; contextId < table->buttons.size(); contextId++)
     {
-        if (this->storedFadeSettings[it->first].fadeActive)//it->first is the same as inContext
+        const ButtonEntry& button = table->buttons[contextId];
+        if (!button.fadeCurve) continue;
+        std::atomic<FadeState>& fade = mButtonRuntime[contextId].fade;
+        
+        if (fade.load(std::memory_order_acquire).Is(FadeState::ACTIVE))
         {
-            if (this->storedFadeSettings[it->first].UpdateFade())
+            FadeState updated;
+            if (ChangeFadeState(fade, [&](FadeState& state) {return UpdateFade(*button.fadeCurve, state);}, &updated))
             {
+                const unsigned char value = updated.currentValue;
+                TraceLog::Instance().Trace(TraceEvent::FADE_STEP, contextId, &value, 1);
                 //we have an updated value - send it out as a MIDI CC message
-                midiMessageMutex.lock();
-                midiMessage.clear();
-                midiMessage.push_back(storedButtonSettings[it->first].statusByte);
-                midiMessage.push_back(storedButtonSettings[it->first].dataByte1);
-                midiMessage.push_back(storedFadeSettings[it->first].currentValue);
-                SendMidiMessage(midiMessage);
-                midiMessageMutex.unlock();
+                SendMidiMessage({button.settings.statusByte, button.settings.dataByte1, updated.currentValue});
+                //and move the level bar - the renderer only keeps the latest value, so this is cheap at the timer rate
+                if (button.settings.showLevel) mKeyRenderer->SetLevel(contextId, updated.currentValue);
             }
         }
-        if (this->storedFadeSettings[it->first].fadeFinished)
+        if (fade.load(std::memory_order_acquire).Is(FadeState::FINISHED))
         {
-            //we have a finished fade - print a TICK to the button
-            mConnectionManager->ShowOKForContext(it->first);
-            this->storedFadeSettings[it->first].fadeFinished = !this->storedFadeSettings[it->first].fadeFinished;
+            //we have a finished fade - print a TICK to the button, once, even if a key press gets in at the same time
+            if (ChangeFadeState(fade, [](FadeState& state) {const bool finished = state.Is(FadeState::FINISHED); state.Set(FadeState::FINISHED, false); return finished;}))
+            {
+                mConnectionManager->ShowOKForContext(button.context);
+            }
         }
-        // Increment the Iterator to point to next entry
-        it++;
     }
 }
 
@@ -364,25 +400,27 @@ void StreamDeckMidiButton::WillAppearForAction(const std::string& inAction, cons
     Message("void MidiButton::WillAppearForAction()");
     this->InitialSetup();
 
-    //lock the context
-    mVisibleContextsMutex.lock();
-    mVisibleContexts.insert(inContext);
+    const uint32_t contextId = InternContext(inContext);
+    if (contextId == INVALID_CONTEXT_ID) return;
+
+    mVisibleContexts[contextId] = true;
+    mContextDevices[contextId] = inDeviceID;
     
     //store the button settings
     DebugMessage("void MidiButton::WillAppearForAction(): setting the storedButtonSettings for button: " + inContext);
-    StoreButtonSettings(inAction, inContext, inPayload, inDeviceID);
-    
-    //unlock the context
-    mVisibleContextsMutex.unlock();
+    StoreButtonSettings(inAction, contextId, inPayload, inDeviceID);
 }
 
 void StreamDeckMidiButton::WillDisappearForAction(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
     Message("void StreamDeckMidiButton::WillDisappearForAction()");
-    //remove the context
-    mVisibleContextsMutex.lock();
-    mVisibleContexts.erase(inContext);
-    mVisibleContextsMutex.unlock();
+    const uint32_t contextId = InternContext(inContext);
+    if (contextId == INVALID_CONTEXT_ID) return;
+
+    if (mButtonTable.Current().buttons[contextId].settings.showLevel) DebugMessage("void StreamDeckMidiButton::WillDisappearForAction(): key renderer " + mKeyRenderer->GetStats());
+    
+    //the id stays interned, as the same context comes back when the page is shown again - it's only given up if the table fills
+    HideContext(contextId);
 }
 
 void StreamDeckMidiButton::InitialSetup()
@@ -409,88 +447,37 @@ void StreamDeckMidiButton::DidReceiveGlobalSettings(const json& inPayload)
     {
         Message("void MidiButton::DidReceiveGlobalSettings()");
     }
-    //boolean to say settings have changed
-    bool midiSettingsChanged = false;
-    
-    //check to see that the payload has the necessary information, and set the midiSettingsChanged flag if so
+    //decode into a copy in one pass over the settings object, and see what's actually changed - see GLOBAL_SETTINGS_FIELDS
+    GlobalSettings updatedSettings = *mGlobalSettings;
+    auto settingsObject = inPayload.find("settings");
+    if (settingsObject != inPayload.end()) DecodeSettings(GLOBAL_SETTINGS_FIELDS, *settingsObject, updatedSettings);
+    const uint32_t changed = CompareSettings(GLOBAL_SETTINGS_FIELDS, *mGlobalSettings, updatedSettings);
+    *mGlobalSettings = updatedSettings;
     
-    //see if the printDebug flag has been set
-    if (inPayload["settings"].find("printDebug") != inPayload["settings"].end())
+    //see if the printDebug flag has changed
+    //constexpr, so a key that isn't in the table doesn't compile
+    static constexpr uint32_t PRINT_DEBUG_BIT = SettingsFieldBit(GLOBAL_SETTINGS_FIELDS, "printDebug");
+    if (changed & PRINT_DEBUG_BIT)
     {
-        if (mGlobalSettings->printDebug != inPayload["settings"]["printDebug"])//printDebug has changed
+        if (mGlobalSettings->printDebug)
         {
-            mGlobalSettings->printDebug = inPayload["settings"]["printDebug"];
-            if (mGlobalSettings->printDebug)
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): mGlobalSettings->printDebug is set to " + BoolToString(mGlobalSettings->printDebug) + " - will print all debug messages");
-            }
-            else if (!mGlobalSettings->printDebug)
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): mGlobalSettings->printDebug is set to " + BoolToString(mGlobalSettings->printDebug) + " - won't print verbose debug messages");
-            }
+            Logger::Instance().SetLevel(LogLevel::DBG);
+            if (!Logger::Instance().SetFileSink(LOG_FILE_NAME)) Message("void MidiButton::DidReceiveGlobalSettings(): couldn't open " LOG_FILE_NAME);
+            if (!TraceLog::Instance().Open(TRACE_FILE_NAME)) Message("void MidiButton::DidReceiveGlobalSettings(): couldn't open " TRACE_FILE_NAME);
+            Message("void MidiButton::DidReceiveGlobalSettings(): mGlobalSettings->printDebug is set to " + BoolToString(mGlobalSettings->printDebug) + " - will print all debug messages");
         }
-    }
-    //see if the virtual port flag has been set
-    if (inPayload["settings"].find("useVirtualPort") != inPayload["settings"].end())
-    {
-        if (mGlobalSettings->useVirtualPort != inPayload["settings"]["useVirtualPort"])//useVirtualPort flag has changed
-        {
-            Message("void MidiButton::DidReceiveGlobalSettings(): useVirtualPort has changed");
-            mGlobalSettings->useVirtualPort = inPayload["settings"]["useVirtualPort"];//update the useVirtualPort flag
-            midiSettingsChanged = true;
-        }
-    }
-    //get the portName, if that's been set
-    if (inPayload["settings"].find("portName") != inPayload["settings"].end())
-    {
-        std::string portName = mGlobalSettings->portName;
-        if (portName.compare(inPayload["settings"]["portName"]) != 0)//portName has changed
-        {
-            Message("void MidiButton::DidReceiveGlobalSettings(): portName has changed");
-            mGlobalSettings->portName = inPayload["settings"]["portName"];
-            midiSettingsChanged = true;
-        }
-    }
-    //get the selectedPortIndexes, if set
-    if (inPayload["settings"].find("selectedOutPortIndex") != inPayload["settings"].end())
-    {
-        if (mGlobalSettings->selectedOutPortIndex != inPayload["settings"]["selectedOutPortIndex"])
-        {
-            Message("void MidiButton::DidReceiveGlobalSettings(): selectedOutPortIndex has changed");
-            mGlobalSettings->selectedOutPortIndex = inPayload["settings"]["selectedOutPortIndex"];
-            midiSettingsChanged = true;
-        }
-    }
-    if (inPayload["settings"].find("selectedInPortIndex") != inPayload["settings"].end())
-    {
-        if (mGlobalSettings->selectedInPortIndex != inPayload["settings"]["selectedInPortIndex"])
-        {
-            Message("void MidiButton::DidReceiveGlobalSettings(): selectedInPortIndex has changed");
-            mGlobalSettings->selectedInPortIndex = inPayload["settings"]["selectedInPortIndex"];
-            midiSettingsChanged = true;
-        }
-    }
-    //get the selectedPortNames, if set
-    if (inPayload["settings"].find("selectedOutPortName") != inPayload["settings"].end())
-    {
-        std::string selectedOutPortName = mGlobalSettings->selectedOutPortName;
-        if (selectedOutPortName.compare(inPayload["settings"]["selectedOutPortName"]) != 0)//portName has changed
-        {
-            Message("void MidiButton::DidReceiveGlobalSettings(): selectedOutPortName has changed");
-            mGlobalSettings->selectedOutPortName = inPayload["settings"]["selectedOutPortName"];
-            midiSettingsChanged = true;
-        }
-    }
-    if (inPayload["settings"].find("selectedInPortName") != inPayload["settings"].end())
-    {
-        std::string selectedInPortName = mGlobalSettings->selectedInPortName;
-        if (selectedInPortName.compare(inPayload["settings"]["selectedInPortName"]) != 0)//portName has changed
+        else
         {
-            Message("void MidiButton::DidReceiveGlobalSettings(): selectedInPortName has changed");
-            mGlobalSettings->selectedInPortName = inPayload["settings"]["selectedInPortName"];
-            midiSettingsChanged = true;
+            Logger::Instance().SetLevel(LogLevel::INFO);
+            Logger::Instance().SetFileSink("");
+            TraceLog::Instance().Close();
+            Message("void MidiButton::DidReceiveGlobalSettings(): mGlobalSettings->printDebug is set to " + BoolToString(mGlobalSettings->printDebug) + " - won't print verbose debug messages");
         }
     }
+    
+    //anything else that's changed means the MIDI ports have to be opened again
+    const bool midiSettingsChanged = (changed & ~PRINT_DEBUG_BIT) != 0;
+    ForEachSettingsField(GLOBAL_SETTINGS_FIELDS, *mGlobalSettings, changed & ~PRINT_DEBUG_BIT, [](const char* key, const auto& value) {LOG_INFO("void MidiButton::DidReceiveGlobalSettings(): {} has changed to {}", key, value);});
 
     if (!midiSettingsChanged)
     {
@@ -499,52 +486,9 @@ void StreamDeckMidiButton::DidReceiveGlobalSettings(const json& inPayload)
     }
     else if (midiSettingsChanged)
     {
-        if (mGlobalSettings->useVirtualPort)
-        {
-            DebugMessage("void MidiButton::DidReceiveGlobalSettings(): opening the virtual port with portName " + mGlobalSettings->portName);
-            if (InitialiseMidi(Direction::IN))
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): MIDI input initialised successfully");
-            }
-            else
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): something went wrong initialising MIDI input");
-                return;
-            }
-            if (InitialiseMidi(Direction::OUT))
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): MIDI output initialised successfully");
-            }
-            else
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): something went wrong initialising MIDI output");
-                return;
-            }
-        }
-        else if (!mGlobalSettings->useVirtualPort)
-        {
-            DebugMessage("void MidiButton::DidReceiveGlobalSettings(): opening the physical OUTPUT port with index " + std::to_string(mGlobalSettings->selectedOutPortIndex) + " & port name " + midiOut->get_port_name(mGlobalSettings->selectedOutPortIndex));
-            DebugMessage("void MidiButton::DidReceiveGlobalSettings(): opening the physical INPUT port with index " + std::to_string(mGlobalSettings->selectedInPortIndex) + " & port name " + midiOut->get_port_name(mGlobalSettings->selectedInPortIndex));
-            
-            if (InitialiseMidi(Direction::IN))
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): MIDI input initialised successfully");
-            }
-            else
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): something went wrong initialising MIDI input");
-                return;
-            }
-            if (InitialiseMidi(Direction::OUT))
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): MIDI output initialised successfully");
-            }
-            else
-            {
-                Message("void MidiButton::DidReceiveGlobalSettings(): something went wrong initialising MIDI output");
-                return;
-            }
-        }
+        if (mGlobalSettings->useVirtualPort) DebugMessage("void MidiButton::DidReceiveGlobalSettings(): opening the virtual port with portName " + mGlobalSettings->portName);
+        else DebugMessage("void MidiButton::DidReceiveGlobalSettings(): opening the physical OUTPUT port " + mGlobalSettings->selectedOutPortName + " & INPUT port " + mGlobalSettings->selectedInPortName);
+        InitialiseMidi();
     }
 }
 
@@ -558,11 +502,15 @@ void StreamDeckMidiButton::DidReceiveSettings(const std::string& inAction, const
     {
         Message("void MidiButton::DidReceiveSettings()");
     }
-    StoreButtonSettings(inAction, inContext, inPayload, inDeviceID);
+    const uint32_t contextId = InternContext(inContext);
+    if (contextId == INVALID_CONTEXT_ID) return;
+    StoreButtonSettings(inAction, contextId, inPayload, inDeviceID);
 }
 
-void StreamDeckMidiButton::StoreButtonSettings(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
+void StreamDeckMidiButton::StoreButtonSettings(const std::string& inAction, const uint32_t contextId, const json &inPayload, const std::string& inDeviceID)
 {
+    const std::string& inContext = mContextNames[contextId];
+    
     if (mGlobalSettings->printDebug)
     {
         Message("void MidiButton::StoreButtonSettings(): received button settings for " + inContext + ", with action " + inAction + ": " + inPayload.dump().c_str());
@@ -573,143 +521,77 @@ void StreamDeckMidiButton::StoreButtonSettings(const std::string& inAction, cons
     }
     
     ButtonSettings thisButtonSettings;
+    const bool wasShowingLevel = mButtonTable.Current().buttons[contextId].settings.showLevel;
     
-    //should iterate through the JSON payload here and store everything into a struct
+    thisButtonSettings.action = InternAction(inAction);
     
-    thisButtonSettings.inAction = inAction;
-    thisButtonSettings.inContext = inContext;
-    
-    //STATUS BYTE
-    if (inPayload["settings"].find("statusByte") != inPayload["settings"].end())
+    //one pass over the settings object - see BUTTON_SETTINGS_FIELDS
+    auto settingsObject = inPayload.find("settings");
+    const uint32_t decoded = settingsObject != inPayload.end() ? DecodeSettings(BUTTON_SETTINGS_FIELDS, *settingsObject, thisButtonSettings) : 0;
+    if (Logger::Instance().IsEnabled(LogLevel::DBG))
     {
-        thisButtonSettings.statusByte = inPayload["settings"]["statusByte"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting statusByte to " + std::to_string(thisButtonSettings.statusByte));
+        ForEachSettingsField(BUTTON_SETTINGS_FIELDS, thisButtonSettings, decoded, [](const char* key, const auto& value) {LOG_DEBUG("void MidiButton::StoreButtonSettings(): Setting {} to {}", key, value);});
     }
     
-    //COMMON
-    if (inPayload["settings"].find("dataByte1") != inPayload["settings"].end())
-    {
-        thisButtonSettings.dataByte1 = inPayload["settings"]["dataByte1"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting dataByte1 to " + std::to_string(thisButtonSettings.dataByte1));
-    }
-    if (inPayload["settings"].find("dataByte2") != inPayload["settings"].end())
-    {
-        thisButtonSettings.dataByte2 = inPayload["settings"]["dataByte2"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting dataByte2 to " + std::to_string(thisButtonSettings.dataByte2));
-    }
-    if (inPayload["settings"].find("dataByte2Alt") != inPayload["settings"].end())
-    {
-        thisButtonSettings.dataByte2Alt = inPayload["settings"]["dataByte2Alt"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting dataByte2Alt to " + std::to_string(thisButtonSettings.dataByte2Alt));
-    }
-    if (inPayload["settings"].find("dataByte5") != inPayload["settings"].end())
+    //if ccMode is 2 or 3 set the toggleFade flag, otherwise clear it
+    static constexpr uint32_t CC_MODE_BIT = SettingsFieldBit(BUTTON_SETTINGS_FIELDS, "ccMode");
+    if (decoded & CC_MODE_BIT)
     {
-        thisButtonSettings.dataByte5 = inPayload["settings"]["dataByte5"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting dataByte5 to " + std::to_string(thisButtonSettings.dataByte5));
-    }
-    
-    //NOTE OFF mode
-    if (inPayload["settings"].find("noteOffMode") != inPayload["settings"].end())
-    {
-        thisButtonSettings.noteOffMode = inPayload["settings"]["noteOffMode"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting noteOffMode to " + std::to_string(thisButtonSettings.noteOffMode));
-    }
-
-    //VARIOUS
-    if (inPayload["settings"].find("toggleFade") != inPayload["settings"].end())
-    {
-        thisButtonSettings.toggleFade = inPayload["settings"]["toggleFade"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting toggleFade to " + BoolToString(thisButtonSettings.toggleFade));
-    }
-    if (inPayload["settings"].find("fadeTime") != inPayload["settings"].end())
-    {
-        thisButtonSettings.fadeTime = inPayload["settings"]["fadeTime"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting fadeTime to " + std::to_string(thisButtonSettings.fadeTime));
-    }
-    if (inPayload["settings"].find("fadeCurve") != inPayload["settings"].end())
-    {
-        thisButtonSettings.fadeCurve = inPayload["settings"]["fadeCurve"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting fadeCurve to " + std::to_string(thisButtonSettings.fadeCurve));
-    }
-    if (inPayload["settings"].find("ccMode") != inPayload["settings"].end())
-    {
-        thisButtonSettings.ccMode = inPayload["settings"]["ccMode"];
-        DebugMessage("void MidiButton::StoreButtonSettings(): Setting ccMode to " + std::to_string(thisButtonSettings.ccMode));
-        //if ccMode is 2 or 3 set the toggleFade flag
-        if (thisButtonSettings.ccMode == 2 || thisButtonSettings.ccMode == 3)
-        {
-            thisButtonSettings.toggleFade = true;
-            DebugMessage("void MidiButton::StoreButtonSettings(): ccMode is 2 or 3 - setting toggleFade to " + BoolToString(thisButtonSettings.toggleFade));
-        }
-        else
-        {
-            thisButtonSettings.toggleFade = false;
-            DebugMessage("void MidiButton::StoreButtonSettings(): ccMode is 0 or 1 - setting toggleFade to " + BoolToString(thisButtonSettings.toggleFade));
-        }
-    }
-    
-    //store everything into the map
-    if (storedButtonSettings.insert(std::make_pair(inContext, thisButtonSettings)).second == false)
-    {
-        //key already exists, so replace it
-        DebugMessage("void MidiButton::StoreButtonSettings(): Key already exists - replacing");
-        storedButtonSettings[inContext] = thisButtonSettings;
+        thisButtonSettings.toggleFade = thisButtonSettings.ccMode == 2 || thisButtonSettings.ccMode == 3;
+        DebugMessage("void MidiButton::StoreButtonSettings(): ccMode is " + std::to_string(thisButtonSettings.ccMode) + " - setting toggleFade to " + BoolToString(thisButtonSettings.toggleFade));
     }
+    //only the CC buttons have a level to show
+    thisButtonSettings.showLevel = thisButtonSettings.showLevel && (thisButtonSettings.action == ActionType::CC || thisButtonSettings.action == ActionType::CC_TOGGLE);
     
     // NEED TO CHANGE THIS DEBUG SECTION
     if (mGlobalSettings->printDebug)//check it's been stored correctly
     {
         //iterate through settings and log messages - should be a way to do this in a loop
-        if (inAction == SEND_NOTE_ON || SEND_NOTE_ON_TOGGLE)
+        if (thisButtonSettings.action == ActionType::NOTE_ON || thisButtonSettings.action == ActionType::NOTE_ON_TOGGLE)
         {
-            Message("void MidiButton::StoreButtonSettings(): midiChannel for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].statusByte - NOTE_ON));
-            Message("void MidiButton::StoreButtonSettings(): dataByte1 for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte1));
-            Message("void MidiButton::StoreButtonSettings(): dataByte2 for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte2));
-            if (inAction == SEND_NOTE_ON) Message("void MidiButton::StoreButtonSettings(): noteOffMode for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].noteOffMode));
+            Message("void MidiButton::StoreButtonSettings(): midiChannel for " + inContext + " is set to: " + std::to_string(thisButtonSettings.statusByte - NOTE_ON));
+            Message("void MidiButton::StoreButtonSettings(): dataByte1 for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte1));
+            Message("void MidiButton::StoreButtonSettings(): dataByte2 for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte2));
+            if (thisButtonSettings.action == ActionType::NOTE_ON) Message("void MidiButton::StoreButtonSettings(): noteOffMode for " + inContext + " is set to: " + std::to_string(thisButtonSettings.noteOffMode));
         }
-        else if (inAction == SEND_CC || SEND_CC_TOGGLE)
+        else if (thisButtonSettings.action == ActionType::CC || thisButtonSettings.action == ActionType::CC_TOGGLE)
         {
-            Message("void MidiButton::StoreButtonSettings(): midiChannel for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].statusByte - CC));
-            Message("void MidiButton::StoreButtonSettings(): dataByte1 for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte1));
-            Message("void MidiButton::StoreButtonSettings(): dataByte2 for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte2));
-            if (inAction == SEND_CC_TOGGLE) Message("void MidiButton::StoreButtonSettings(): dataByte2Alt for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte2Alt));
-            Message("void MidiButton::StoreButtonSettings(): toggleFade for " + inContext + " is set to: " + BoolToString(storedButtonSettings[inContext].toggleFade));
-            if (storedButtonSettings[inContext].toggleFade)
+            Message("void MidiButton::StoreButtonSettings(): midiChannel for " + inContext + " is set to: " + std::to_string(thisButtonSettings.statusByte - CC));
+            Message("void MidiButton::StoreButtonSettings(): dataByte1 for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte1));
+            Message("void MidiButton::StoreButtonSettings(): dataByte2 for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte2));
+            if (thisButtonSettings.action == ActionType::CC_TOGGLE) Message("void MidiButton::StoreButtonSettings(): dataByte2Alt for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte2Alt));
+            Message("void MidiButton::StoreButtonSettings(): toggleFade for " + inContext + " is set to: " + BoolToString(thisButtonSettings.toggleFade));
+            if (thisButtonSettings.toggleFade)
             {
-                Message("void MidiButton::StoreButtonSettings(): fadeTime for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].fadeTime));
-                Message("void MidiButton::StoreButtonSettings(): fadeCurve for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].fadeCurve));
+                Message("void MidiButton::StoreButtonSettings(): fadeTime for " + inContext + " is set to: " + std::to_string(thisButtonSettings.fadeTime));
+                Message("void MidiButton::StoreButtonSettings(): fadeCurve for " + inContext + " is set to: " + std::to_string(thisButtonSettings.fadeCurve));
             }
         }
-        else if (inAction == SEND_PROGRAM_CHANGE)
+        else if (thisButtonSettings.action == ActionType::PROGRAM_CHANGE)
         {
-            Message("void MidiButton::StoreButtonSettings(): midiChannel for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].statusByte - PC));
-            Message("void MidiButton::StoreButtonSettings(): dataByte1 for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte1));
+            Message("void MidiButton::StoreButtonSettings(): midiChannel for " + inContext + " is set to: " + std::to_string(thisButtonSettings.statusByte - PC));
+            Message("void MidiButton::StoreButtonSettings(): dataByte1 for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte1));
         }
-        else if (inAction == SEND_MMC)
+        else if (thisButtonSettings.action == ActionType::MMC)
         {
-            Message("void MidiButton::StoreButtonSettings(): dataByte5 for " + inContext + " is set to: " + std::to_string(storedButtonSettings[inContext].dataByte5));
+            Message("void MidiButton::StoreButtonSettings(): dataByte5 for " + inContext + " is set to: " + std::to_string(thisButtonSettings.dataByte5));
         }
     }
 
-    //if it's an MMC button set the icon
-    if (inAction == SEND_MMC)
+    //if it's a CC Toggle button generate the fade curve, if required
+    ButtonEntry entry;
+    FadeState fadeState;
+    if (thisButtonSettings.toggleFade)//create the fadeSet for the button
     {
-        DebugMessage("void MidiButton::StoreButtonSettings(): inAction == SEND_MMC -> SetActionIcon()");
-        SetActionIcon(inAction, inContext, inPayload, inDeviceID);
-    }
-    
-    //if it's a CC Toggle button generate the fadeSet, if required
-    if (storedButtonSettings[inContext].toggleFade)//create the fadeSet for the button
-    {
-        if (storedButtonSettings[inContext].fadeTime == 0)
+        if (thisButtonSettings.fadeTime == 0)
         {
             DebugMessage("void MidiButton::StoreButtonSettings(): fadeTime of 0! - divide by zero error, so ignoring by switching toggleFade off");
-            storedButtonSettings[inContext].toggleFade = false; //to avoid divide by zero problem
+            thisButtonSettings.toggleFade = false; //to avoid divide by zero problem
         }
         else
         {
             DebugMessage("void MidiButton::StoreButtonSettings(): Generating the fade lookup table");
-            FadeSet thisButtonFadeSet(storedButtonSettings[inContext].dataByte2, storedButtonSettings[inContext].dataByte2Alt, storedButtonSettings[inContext].fadeTime, storedButtonSettings[inContext].fadeCurve, mGlobalSettings->sampleInterval);
+            auto fadeCurve = std::make_shared<const FadeCurve>(thisButtonSettings.dataByte2, thisButtonSettings.dataByte2Alt, thisButtonSettings.fadeTime, thisButtonSettings.fadeCurve, mGlobalSettings->sampleInterval);
             
             if (mGlobalSettings->printDebug)
             {
@@ -719,18 +601,18 @@ void StreamDeckMidiButton::StoreButtonSettings(const std::string& inAction, cons
                 auto timenow = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
                 outString.append(ctime(&timenow));
                 outString.append("\n");
-                outString.append("dumping FadeSet for button " + inContext + " with parameters dataByte2 " + std::to_string(storedButtonSettings[inContext].dataByte2) + ", dataByte2Alt " + std::to_string(storedButtonSettings[inContext].dataByte2Alt) + ", fadeTime " + std::to_string(storedButtonSettings[inContext].fadeTime) + ", fadeCurve " + std::to_string(storedButtonSettings[inContext].fadeCurve) + " with sampleInterval " +  std::to_string(mGlobalSettings->sampleInterval) + "\n");
+                outString.append("dumping FadeCurve for button " + inContext + " with parameters dataByte2 " + std::to_string(thisButtonSettings.dataByte2) + ", dataByte2Alt " + std::to_string(thisButtonSettings.dataByte2Alt) + ", fadeTime " + std::to_string(thisButtonSettings.fadeTime) + ", fadeCurve " + std::to_string(thisButtonSettings.fadeCurve) + " with sampleInterval " +  std::to_string(mGlobalSettings->sampleInterval) + "\n");
                 outString.append("Index\tValue\tDelta\n");
 
-                for(std::size_t i = 0; i < storedFadeSettings[inContext].inSet.size(); i++)
+                for(std::size_t i = 0; i < fadeCurve->inSet.size(); i++)
                 {
-                    if (floor(storedFadeSettings[inContext].inSet[i]) != previousValue)
+                    if (floor(fadeCurve->inSet[i]) != previousValue)
                     {
-                        //Message(std::to_string(i) + "," + std::to_string(floor(storedFadeSettings[inContext].inSet[i])) + "," + std::to_string((i - previousI)));
-                        //outString.append(std::to_string(i) + "," + std::to_string(floor(storedFadeSettings[inContext].inSet[i])) + "," + std::to_string((i - previousI)) + "\n");
-                        outString.append(std::to_string(i) + "\t" + std::to_string(floor(storedFadeSettings[inContext].inSet[i])) + "\t" + std::to_string((i - previousI)) + "\n");
+                        //Message(std::to_string(i) + "," + std::to_string(floor(fadeCurve->inSet[i])) + "," + std::to_string((i - previousI)));
+                        //outString.append(std::to_string(i) + "," + std::to_string(floor(fadeCurve->inSet[i])) + "," + std::to_string((i - previousI)) + "\n");
+                        outString.append(std::to_string(i) + "\t" + std::to_string(floor(fadeCurve->inSet[i])) + "\t" + std::to_string((i - previousI)) + "\n");
 
-                        previousValue = floor(storedFadeSettings[inContext].inSet[i]);
+                        previousValue = floor(fadeCurve->inSet[i]);
                         previousI = i;
                     }
                 }
@@ -754,360 +636,292 @@ void StreamDeckMidiButton::StoreButtonSettings(const std::string& inAction, cons
                 }
             }
 
-            if (storedFadeSettings.insert(std::make_pair(inContext, thisButtonFadeSet)).second == false)
-            {
-                //key already exists, so replace it
-                DebugMessage("void MidiButton::StoreButtonSettings(): FadeSet already exists - replacing");
-                storedFadeSettings[inContext] = thisButtonFadeSet;
-            }
+            Direction direction = Direction::IN;
             switch (thisButtonSettings.ccMode)
             {
                 case 0: case 1://single CC value, or momentary without fade
                     break;
                 case 2://fade IN until button is released, and then fade IN - KeyUpForAction()
-                    storedFadeSettings[inContext].currentDirection = Direction::IN;
+                    direction = Direction::IN;
                     break;
                 case 3://fade OUT until button is released, and then fade IN - KeyUpForAction()
-                    storedFadeSettings[inContext].currentDirection = Direction::OUT;
+                    direction = Direction::OUT;
                     break;
             }
+            fadeState = StartFadeState(*fadeCurve, direction);
+            entry.fadeCurve = std::move(fadeCurve);
+        }
+    }
+    //compile the settings into the program the key presses will run
+    entry.settings = thisButtonSettings;
+    entry.program = CompileActionProgram(thisButtonSettings);
+    
+    //the fade starts again from the beginning before the Timer can see the new curve - then publish the new table
+    mButtonRuntime[contextId].fade.store(fadeState, std::memory_order_release);
+    PublishButton(contextId, std::move(entry));
+    
+    //if it's an MMC button set the icon
+    if (thisButtonSettings.action == ActionType::MMC)
+    {
+        DebugMessage("void MidiButton::StoreButtonSettings(): inAction == SEND_MMC -> SetActionIcon()");
+        SetActionIcon(contextId);
+    }
+    
+    //start the level bar at the value the key sends in its current state - presses and fades move it from there
+    if (thisButtonSettings.showLevel)
+    {
+        auto keySize = mDeviceKeySizes.find(inDeviceID);
+        mKeyRenderer->SetKeySize(contextId, keySize != mDeviceKeySizes.end() ? keySize->second : KeyRenderer::KEY_SIZE);
+        mKeyRenderer->SetLevel(contextId, mButtonRuntime[contextId].state.load(std::memory_order_relaxed) ? thisButtonSettings.dataByte2Alt : thisButtonSettings.dataByte2);
+        mKeyRenderer->Repaint(contextId);
+    }
+    else if (wasShowingLevel)
+    {
+        mKeyRenderer->Clear(contextId);
+    }
+}
+
+StreamDeckMidiButton::ActionProgram StreamDeckMidiButton::CompileActionProgram(const ButtonSettings& settings)
+{
+    switch (settings.action)
+    {
+        case ActionType::NOTE_ON:
+        {
+            NoteOnProgram program;
+            program.noteOn = {settings.statusByte, settings.dataByte1, settings.dataByte2};
+            program.noteOff = {settings.statusByte, settings.dataByte1, 0}; //note on with velocity 0 - same thing
+            program.noteOffMode = settings.noteOffMode;
+            return program;
+        }
+        case ActionType::NOTE_ON_TOGGLE:
+        {
+            NoteOnToggleProgram program;
+            program.noteOn = {settings.statusByte, settings.dataByte1, settings.dataByte2};
+            program.noteOff = {settings.statusByte, settings.dataByte1, 0};
+            return program;
+        }
+        case ActionType::CC:
+        {
+            CCProgram program;
+            program.value = {settings.statusByte, settings.dataByte1, settings.dataByte2};
+            program.altValue = {settings.statusByte, settings.dataByte1, settings.dataByte2Alt};
+            program.ccMode = settings.ccMode;
+            program.showLevel = settings.showLevel;
+            return program;
+        }
+        case ActionType::CC_TOGGLE:
+        {
+            CCToggleProgram program;
+            program.value = {settings.statusByte, settings.dataByte1, settings.dataByte2};
+            program.altValue = {settings.statusByte, settings.dataByte1, settings.dataByte2Alt};
+            program.toggleFade = settings.toggleFade;
+            program.showLevel = settings.showLevel;
+            return program;
+        }
+        case ActionType::PROGRAM_CHANGE:
+        {
+            ProgramChangeProgram program;
+            program.programChange = {settings.statusByte, settings.dataByte1};
+            return program;
+        }
+        case ActionType::MMC:
+        {
+            MMCProgram program;
+            //F0 7F 7F(device-id all devices) 06(sub-id #1 command) <MMC command> F7
+            program.sysex = {240, 127, 127, 6, settings.dataByte5, 247};
+            return program;
         }
+        default:
+            return std::monostate();
     }
 }
 
 void StreamDeckMidiButton::KeyDownForAction(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
-    Message("void MidiButton::KeyDownForAction()");
+    LOG_TRACE("void MidiButton::KeyDownForAction()");
     DebugMessage("void MidiButton::KeyDownForAction(): dumping the JSON payload: " + inPayload.dump());
     //Message(inPayload.dump().c_str());//REALLY USEFUL for debugging
     
-    if (storedButtonSettings.find(inContext) == storedButtonSettings.end())//something's gone wrong - no settings stored, so the PI probably hasn't been opened
+    //the one hash lookup for this event - everything after this works on the id
+    const uint32_t contextId = InternContext(inContext);
+    if (contextId == INVALID_CONTEXT_ID) return;
+    TraceLog::Instance().Trace(TraceEvent::KEY_DOWN, contextId);
+    
+    if (mButtonTable.Current().buttons[contextId].settings.action == ActionType::UNKNOWN)//something's gone wrong - no settings stored, so the PI probably hasn't been opened
     {
         DebugMessage("void MidiButton::KeyDownForAction(): No storedButtonSettings - something went wrong");
-        StoreButtonSettings(inAction, inContext, inPayload, inDeviceID);
+        StoreButtonSettings(inAction, contextId, inPayload, inDeviceID);
     }
 
     try
     {
-        if (inAction == SEND_NOTE_ON)
+        KeyState keyState;
+        if (inPayload.contains("userDesiredState"))
         {
-            DebugMessage("void MidiButton::KeyDownForAction(): inAction " + inAction + " for inContext " + inContext);
-            midiMessageMutex.lock();
-            midiMessage.clear();
-            midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-            midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-            midiMessage.push_back(storedButtonSettings[inContext].dataByte2);
-            SendMidiMessage(midiMessage);
-            midiMessageMutex.unlock();
-            
-            switch (storedButtonSettings[inContext].noteOffMode)
-            {
-                case 0://no note off message
-                {
-                    DebugMessage("void MidiButton::SendNoteOn(noteOffMode = 0): no note off message");
-                    break;
-                }
-                case PUSH_NOTE_OFF://1: {//send note off message immediately
-                {
-                    DebugMessage("void MidiButton::SendNoteOn(noteOffMode = 1): send note off immediately");
-                    
-                    //send a note on message with velocity 0 - same thing
-                    midiMessageMutex.lock();
-                    midiMessage.clear();
-                    midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                    midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                    midiMessage.push_back(0);
-                    SendMidiMessage(midiMessage);
-                    midiMessageMutex.unlock();
-                    break;
-                }
-                case RELEASE_NOTE_OFF://2: {//send note off on KeyUp
-                {
-                    DebugMessage("void MidiButton::SendNoteOn(noteOffMode = 2): send note off on KeyUp");
-                    break;
-                }
-                default:
-                {
-                    break;
-                }
-            }
+            keyState.state = inPayload["userDesiredState"].get<int>();
+            keyState.userDesired = true;
         }
-        else if (inAction == SEND_NOTE_ON_TOGGLE)
+        else if (inPayload.contains("state"))
         {
-            if (mGlobalSettings->printDebug)
-            {
-                Message("void MidiButton::KeyDownForAction(): inAction " + inAction + " for inContext " + inContext);
-                if (inPayload.contains("state")) Message("void MidiButton::KeyDownForAction(): we have a state of " + std::to_string(inPayload["state"].get<int>()));
-                if (inPayload.contains("userDesiredState")) Message("void MidiButton::KeyDownForAction(): we have a userDesiredState of " + std::to_string(inPayload["userDesiredState"].get<int>()));
-            }
-            if (inPayload.contains("state"))
-            {
-                if (inPayload.contains("userDesiredState"))
-                {
-                    if (inPayload["userDesiredState"].get<int>() == 0)
-                    {
-                        midiMessageMutex.lock();
-                        midiMessage.clear();
-                        midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                        midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                        midiMessage.push_back(storedButtonSettings[inContext].dataByte2);
-                        SendMidiMessage(midiMessage);
-                        midiMessageMutex.unlock();
-                        storedButtonSettings[inContext].state = 0;
-                    }
-                    else if (inPayload["userDesiredState"].get<int>() == 1)
-                    {
-                        //send a note on message with velocity 0 - same thing
-                        midiMessageMutex.lock();
-                        midiMessage.clear();
-                        midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                        midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                        midiMessage.push_back(0);
-                        SendMidiMessage(midiMessage);
-                        midiMessageMutex.unlock();
-                        storedButtonSettings[inContext].state = 1;
-                    }
-                }
-                else
-                {
-                    if (inPayload["state"].get<int>() == 0)
-                    {
-                        midiMessageMutex.lock();
-                        midiMessage.clear();
-                        midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                        midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                        midiMessage.push_back(storedButtonSettings[inContext].dataByte2);
-                        SendMidiMessage(midiMessage);
-                        midiMessageMutex.unlock();
-                        storedButtonSettings[inContext].state = 0;
-                    }
-                    else if (inPayload["state"].get<int>() == 1)
-                    {
-                        //send a note on message with velocity 0 - same thing
-                        midiMessageMutex.lock();
-                        midiMessage.clear();
-                        midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                        midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                        midiMessage.push_back(0);
-                        SendMidiMessage(midiMessage);
-                        midiMessageMutex.unlock();
-                        storedButtonSettings[inContext].state = 1;
-                    }
-                }
-            }
-            else Message("void MidiButton::KeyDownForAction(): something went wrong - should have a state, and we don't have");
+            keyState.state = inPayload["state"].get<int>();
         }
-        else if (inAction == SEND_CC)
-        {
-            DebugMessage("void MidiButton::KeyDownForAction(): inAction " + inAction + " for inContext " + inContext);
-            switch (storedButtonSettings[inContext].ccMode)
-            {
-                case 0: case 1://single CC value, or momentary without fade
-                    midiMessageMutex.lock();
-                    midiMessage.clear();
-                    midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                    midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                    midiMessage.push_back(storedButtonSettings[inContext].dataByte2);
-                    SendMidiMessage(midiMessage);
-                    midiMessageMutex.unlock();
-                    break;
-                case 2: case 3:
-                    storedFadeSettings[inContext].FadeButtonPressed();
-                    break;
-            }
-        }
-        else if (inAction == SEND_CC_TOGGLE)
+        
+        LOG_DEBUG("void MidiButton::KeyDownForAction(): inAction {} for inContext {}, state {}, userDesiredState {}", inAction, inContext, keyState.state, keyState.userDesired);
+        
+        //the websocket thread is the one that publishes the table, so it can read the current version without pinning it
+        std::visit([&](const auto& program) {this->KeyDownForProgram(contextId, program, keyState);}, mButtonTable.Current().buttons[contextId].program);
+    }
+    catch (std::exception e)
+    {
+        Message("void MidiButton::KeyDownForAction(): Something's gone wrong - an unknown error has occurred as below");
+        Message(e.what());
+    }
+}
+
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t /*contextId*/, const std::monostate& /*program*/, const KeyState& /*keyState*/)
+{
+    //something has gone wrong
+    Message("void MidiButton::KeyDownForAction(): Something's gone wrong - no inAction sent, which shouldn't be possible");
+}
+
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t /*contextId*/, const NoteOnProgram& program, const KeyState& /*keyState*/)
+{
+    SendMidiMessage(program.noteOn);
+    
+    switch (program.noteOffMode)
+    {
+        case 0://no note off message
         {
-            if (mGlobalSettings->printDebug)
-            {
-                Message("void MidiButton::KeyDownForAction(): inAction " + inAction + " for inContext " + inContext);
-                if (inPayload.contains("state")) Message("void MidiButton::KeyDownForAction(): we have a state of " + std::to_string(inPayload["state"].get<int>()));
-                if (inPayload.contains("userDesiredState")) Message("void MidiButton::KeyDownForAction(): we have a userDesiredState of " + std::to_string(inPayload["userDesiredState"].get<int>()));
-            }
-            if (inPayload.contains("state"))
-            {
-                if (inPayload.contains("userDesiredState"))
-                {
-                    if (inPayload["userDesiredState"].get<int>() == 0)
-                    {
-                        if (!storedButtonSettings[inContext].toggleFade)
-                        {
-                            midiMessageMutex.lock();
-                            midiMessage.clear();
-                            midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte2);
-                            SendMidiMessage(midiMessage);
-                            midiMessageMutex.unlock();
-                            storedButtonSettings[inContext].state = 0;
-                        }
-                            
-                        else if (storedButtonSettings[inContext].toggleFade)
-                        {
-                            if (storedFadeSettings[inContext].fadeActive) storedFadeSettings[inContext].FadeButtonPressed();
-                            else
-                            {
-                                storedFadeSettings[inContext].currentDirection = Direction::IN;
-                                storedFadeSettings[inContext].fadeActive = true;
-                            }
-                            storedFadeSettings[inContext].FadeButtonPressed();
-                        }
-                    }
-                    else if (inPayload["userDesiredState"].get<int>() == 1)
-                    {
-                        if (!storedButtonSettings[inContext].toggleFade)
-                        {
-                            midiMessageMutex.lock();
-                            midiMessage.clear();
-                            midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte2Alt);
-                            SendMidiMessage(midiMessage);
-                            midiMessageMutex.unlock();
-                            storedButtonSettings[inContext].state = 1;
-                        }
-                        else if (storedButtonSettings[inContext].toggleFade)
-                        {
-                            if (storedFadeSettings[inContext].fadeActive) storedFadeSettings[inContext].FadeButtonPressed();
-                            else
-                            {
-                                storedFadeSettings[inContext].currentDirection = Direction::OUT;
-                                storedFadeSettings[inContext].fadeActive = true;
-                            }
-                            storedFadeSettings[inContext].FadeButtonPressed();
-                        }
-                    }
-                }
-                else
-                {
-                    if (inPayload["state"].get<int>() == 0)
-                    {
-                        if (!storedButtonSettings[inContext].toggleFade)
-                        {
-                            midiMessageMutex.lock();
-                            midiMessage.clear();
-                            midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte2);
-                            SendMidiMessage(midiMessage);
-                            midiMessageMutex.unlock();
-                            storedButtonSettings[inContext].state = 0;
-                        }
-                        else if (storedButtonSettings[inContext].toggleFade)
-                        {
-                            if (storedFadeSettings[inContext].fadeActive) storedFadeSettings[inContext].FadeButtonPressed();
-                            else
-                            {
-                                storedFadeSettings[inContext].currentDirection = Direction::IN;
-                                storedFadeSettings[inContext].fadeActive = true;
-                            }
-                        }
-                    }
-                    else if (inPayload["state"].get<int>() == 1)
-                    {
-                        if (!storedButtonSettings[inContext].toggleFade)
-                        {
-                            midiMessageMutex.lock();
-                            midiMessage.clear();
-                            midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                            midiMessage.push_back(storedButtonSettings[inContext].dataByte2Alt);
-                            SendMidiMessage(midiMessage);
-                            midiMessageMutex.unlock();
-                            storedButtonSettings[inContext].state = 1;
-                        }
-                        else if (storedButtonSettings[inContext].toggleFade)
-                        {
-                            if (storedFadeSettings[inContext].fadeActive) storedFadeSettings[inContext].FadeButtonPressed();
-                            else
-                            {
-                                storedFadeSettings[inContext].currentDirection = Direction::OUT;
-                                storedFadeSettings[inContext].fadeActive = true;
-                            }
-                        }
-                    }
-                }
-            }
-            else Message("void MidiButton::KeyDownForAction(): Something's gone wrong - should have a state, and we don't have");
+            DebugMessage("void MidiButton::SendNoteOn(noteOffMode = 0): no note off message");
+            break;
         }
-        else if (inAction == SEND_PROGRAM_CHANGE)
+        case PUSH_NOTE_OFF://1: {//send note off message immediately
         {
-            DebugMessage("void MidiButton::KeyDownForAction(): inAction " + inAction + " for inContext " + inContext);
-            midiMessageMutex.lock();
-            midiMessage.clear();
-            midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-            midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-            SendMidiMessage(midiMessage);
-            midiMessageMutex.unlock();
+            DebugMessage("void MidiButton::SendNoteOn(noteOffMode = 1): send note off immediately");
+            SendMidiMessage(program.noteOff);
+            break;
         }
-        else if (inAction == SEND_MMC)
+        case RELEASE_NOTE_OFF://2: {//send note off on KeyUp
         {
-            DebugMessage("void MidiButton::KeyDownForAction(): inAction " + inAction + " for inContext " + inContext);
-            midiMessageMutex.lock();
-            midiMessage.clear();
-            midiMessage.push_back(240); //F0 hex
-            midiMessage.push_back(127); //7F hex
-            midiMessage.push_back(127); //7F hex - device-id all devices
-            midiMessage.push_back(6); //6 - sub-id #1 command
-            midiMessage.push_back(storedButtonSettings[inContext].dataByte5); //send the MMC command
-            midiMessage.push_back(247); //F7 - message end
-            SendMidiMessage(midiMessage);
-            midiMessageMutex.unlock();
+            DebugMessage("void MidiButton::SendNoteOn(noteOffMode = 2): send note off on KeyUp");
+            break;
         }
-        else
+        default:
         {
-            //something has gone wrong
-            Message("void MidiButton::KeyDownForAction(): Something's gone wrong - no inAction sent, which shouldn't be possible");
+            break;
         }
     }
-    catch (std::exception e)
+}
+
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t contextId, const NoteOnToggleProgram& program, const KeyState& keyState)
+{
+    if (keyState.state == 0)
     {
-        Message("void MidiButton::KeyDownForAction(): Something's gone wrong - an unknown error has occurred as below");
-        Message(e.what());
+        SendMidiMessage(program.noteOn);
+        mButtonRuntime[contextId].state.store(0, std::memory_order_relaxed);
+    }
+    else if (keyState.state == 1)
+    {
+        SendMidiMessage(program.noteOff);
+        mButtonRuntime[contextId].state.store(1, std::memory_order_relaxed);
+    }
+    else Message("void MidiButton::KeyDownForAction(): something went wrong - should have a state, and we don't have");
+}
+
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t contextId, const CCProgram& program, const KeyState& /*keyState*/)
+{
+    switch (program.ccMode)
+    {
+        case 0: case 1://single CC value, or momentary without fade
+            SendMidiMessage(program.value);
+            if (program.showLevel) mKeyRenderer->SetLevel(contextId, program.value.bytes[2]);
+            break;
+        case 2: case 3:
+            ChangeFadeState(mButtonRuntime[contextId].fade, [](FadeState& fade) {FadeButtonPressed(fade); return true;});
+            break;
+    }
+}
+
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t contextId, const CCToggleProgram& program, const KeyState& keyState)
+{
+    if (keyState.state != 0 && keyState.state != 1)
+    {
+        Message("void MidiButton::KeyDownForAction(): Something's gone wrong - should have a state, and we don't have");
+        return;
+    }
+    
+    if (!program.toggleFade)
+    {
+        const MidiFrame& frame = keyState.state == 0 ? program.value : program.altValue;
+        SendMidiMessage(frame);
+        mButtonRuntime[contextId].state.store(keyState.state, std::memory_order_relaxed);
+        if (program.showLevel) mKeyRenderer->SetLevel(contextId, frame.bytes[2]);
+    }
+    else
+    {
+        //one step, so a Timer tick can't land between the checks
+        ChangeFadeState(mButtonRuntime[contextId].fade, [&](FadeState& fade) {
+            if (fade.Is(FadeState::ACTIVE)) FadeButtonPressed(fade);
+            else
+            {
+                fade.SetDirection((keyState.state == 0) ? Direction::IN : Direction::OUT);
+                fade.Set(FadeState::ACTIVE, true);
+            }
+            if (keyState.userDesired) FadeButtonPressed(fade);
+            return true;
+        });
     }
 }
 
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t /*contextId*/, const ProgramChangeProgram& program, const KeyState& /*keyState*/)
+{
+    SendMidiMessage(program.programChange);
+}
+
+void StreamDeckMidiButton::KeyDownForProgram(const uint32_t /*contextId*/, const MMCProgram& program, const KeyState& /*keyState*/)
+{
+    SendMidiMessage(program.sysex);
+}
+
 void StreamDeckMidiButton::KeyUpForAction(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
-    Message("void MidiButton::KeyUpForAction()");
+    LOG_TRACE("void MidiButton::KeyUpForAction()");
+    
+    const uint32_t contextId = InternContext(inContext);
+    if (contextId == INVALID_CONTEXT_ID) return;
+    TraceLog::Instance().Trace(TraceEvent::KEY_UP, contextId);
+    const ButtonEntry& button = mButtonTable.Current().buttons[contextId];
+    const ActionProgram& actionProgram = button.program;
+    
     try
     {
-        if (inAction == SEND_NOTE_ON)
+        if (const NoteOnProgram* program = std::get_if<NoteOnProgram>(&actionProgram))
         {
-            if (storedButtonSettings[inContext].noteOffMode == 2)//(noteOffMode == 2)
+            if (program->noteOffMode == RELEASE_NOTE_OFF)
             {
                 DebugMessage("void MidiButton::KeyUpForAction(): send note off");
-                midiMessageMutex.lock();
-                midiMessage.clear();
-                midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                midiMessage.push_back(0);
-                SendMidiMessage(midiMessage);
-                midiMessageMutex.unlock();
-
-                //SendNoteOff(storedButtonSettings[inContext].midiChannel, storedButtonSettings[inContext].midiNote, storedButtonSettings[inContext].midiVelocity);
+                SendMidiMessage(program->noteOff);
             }
         }
-        else if (inAction == SEND_CC)
+        else if (const CCProgram* program = std::get_if<CCProgram>(&actionProgram))
         {
-            switch (storedButtonSettings[inContext].ccMode)
+            switch (program->ccMode)
             {
                 case 0://single CC value only
                     break;
                 case 1://momentary without fade
                     DebugMessage("void MidiButton::KeyUpForAction(): send secondary CC value");
-                    midiMessageMutex.lock();
-                    midiMessage.clear();
-                    midiMessage.push_back(storedButtonSettings[inContext].statusByte);
-                    midiMessage.push_back(storedButtonSettings[inContext].dataByte1);
-                    midiMessage.push_back(storedButtonSettings[inContext].dataByte2Alt);
-                    SendMidiMessage(midiMessage);
-                    midiMessageMutex.unlock();
+                    SendMidiMessage(program->altValue);
+                    if (program->showLevel) mKeyRenderer->SetLevel(contextId, program->altValue.bytes[2]);
                     break;
                 case 2: case 3://fade OUT after fading IN
                     DebugMessage("void MidiButton::KeyUpForAction(): ReverseFade()");
-                    if (storedFadeSettings[inContext].fadeActive) storedFadeSettings[inContext].ReverseFade();
-                    else if (!storedFadeSettings[inContext].fadeActive) storedFadeSettings[inContext].fadeActive = true;
+                    if (!button.fadeCurve) break;
+                    ChangeFadeState(mButtonRuntime[contextId].fade, [&](FadeState& fade) {
+                        if (fade.Is(FadeState::ACTIVE)) ReverseFade(*button.fadeCurve, fade);
+                        else fade.Set(FadeState::ACTIVE, true);
+                        return true;
+                    });
                     break;
             }
         }
@@ -1123,24 +937,29 @@ void StreamDeckMidiButton::KeyUpForAction(const std::string& inAction, const std
 void StreamDeckMidiButton::DeviceDidConnect(const std::string& inDeviceID, const json &inDeviceInfo)
 {
     Message("void MidiButton::DeviceDidConnect()");
+    
+    //the XL keys are drawn at 144 - everything else at 72
+    const int deviceType = EPLJSONUtils::GetIntByName(inDeviceInfo, kESDSDKDeviceInfoType, kESDSDKDeviceType_StreamDeck);
+    mDeviceKeySizes[inDeviceID] = deviceType == kESDSDKDeviceType_StreamDeckXL ? KeyRenderer::KEY_SIZE_HIGH_DPI : KeyRenderer::KEY_SIZE;
 }
 
 void StreamDeckMidiButton::DeviceDidDisconnect(const std::string& inDeviceID)
 {
     Message("void MidiButton::DeviceDidDisconnect()");
+    
+    //its keys are all off the page now, whether or not a willDisappear arrives for each of them
+    for (uint32_t contextId = 0; contextId < mContextCount.load(std::memory_order_relaxed); contextId++)
+    {
+        if (mContextDevices[contextId] == inDeviceID) HideContext(contextId);
+    }
 }
 
-void StreamDeckMidiButton::ChangeButtonState(const std::string& inContext)
+void StreamDeckMidiButton::ChangeButtonState(const uint32_t contextId, const std::string& inContext)
 {
-    if (mGlobalSettings->printDebug)
-    {
-        Message("void MidiButton::ChangeButtonState(): inContext" + inContext + ", and required state " + std::to_string(storedButtonSettings[inContext].state));
-    }
-    else
-    {
-        Message("void MidiButton::ChangeButtonState()");
-    }
-    mConnectionManager->SetState(storedButtonSettings[inContext].state, inContext);
+    const unsigned char state = mButtonRuntime[contextId].state.load(std::memory_order_relaxed);
+    TraceLog::Instance().Trace(TraceEvent::STATE_CHANGE, contextId, &state, 1);
+    LOG_DEBUG("void MidiButton::ChangeButtonState(): inContext {}, and required state {}", inContext, state);
+    mConnectionManager->SetState(state, inContext);
 }
 
 void StreamDeckMidiButton::SendToPlugin(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
@@ -1157,12 +976,25 @@ void StreamDeckMidiButton::SendToPlugin(const std::string& inAction, const std::
     if (inAction == SEND_MMC)
     {
         DebugMessage("void MidiButton::SendToPlugin(): new MMC action - set the action icon");
-        SetActionIcon(inAction, inContext, inPayload, inDeviceID);
+        const uint32_t contextId = InternContext(inContext);
+        if (contextId != INVALID_CONTEXT_ID) SetActionIcon(contextId);
     }
     
     const auto event = EPLJSONUtils::GetStringByName(inPayload, "event");
     if (event == "getMidiPorts")
     {
+        //the ports that actually got opened, if they've moved since the PI last looked
+        if (mMidiPortPool->GetOutputPortIndex() >= 0) mGlobalSettings->selectedOutPortIndex = mMidiPortPool->GetOutputPortIndex();
+        if (mMidiPortPool->GetInputPortIndex() >= 0) mGlobalSettings->selectedInPortIndex = mMidiPortPool->GetInputPortIndex();
+        
+        //only lists the ports again on backends without hotplug events
+        mMidiPortRegistry->Refresh();
+        if (mGlobalSettings->printDebug)
+        {
+            const MidiPortStats stats = mMidiPortPool->GetStats();
+            DebugMessage("void MidiButton::SendToPlugin(): MIDI port reconnects - " + json({{"disconnects", stats.disconnects},{"reconnects", stats.reconnects},{"buffered", stats.buffered},{"replayed", stats.replayed},{"dropped", stats.dropped},{"controllersReasserted", stats.controllersReasserted},{"lastOutageMs", stats.lastOutageMs},{"lastReconnectMs", stats.lastReconnectMs}}).dump());
+        }
+        
         std::map <std::string, std::string> midiPortList = GetMidiPortList(Direction::OUT);
         DebugMessage("void MidiButton::SendToPlugin(): get list of MIDI OUT ports - " + json({{"event", "midiOutPorts"},{"midiOutPortList", midiPortList}}).dump());
         mConnectionManager->SendToPropertyInspector(inAction, inContext,json({{"event", "midiOutPorts"},{"midiOutPortList", midiPortList}}));
@@ -1182,201 +1014,126 @@ void StreamDeckMidiButton::SendToPlugin(const std::string& inAction, const std::
     else Message("void MidiButton::SendToPlugin(): something went wrong - not expecting this message to be sent. Dumping payload: " + inPayload.dump());
 }
 
-void StreamDeckMidiButton::SendMidiMessage(const std::vector<unsigned char>& midiMessage)
+void StreamDeckMidiButton::SendMidiMessage(const MidiFrame& midiFrame)
 {
-    std::string debugMessage = "void MidiButton::SendMidiMessage()";
-    if (mGlobalSettings->printDebug)
+#if MIDIBUTTON_STRAND_MODE
+    //the strand runs the websocket and the timers too, so it mustn't wait on a stalled sender - drop the message instead
+    if (!mMidiOutQueue->TryPush(midiFrame))
     {
-        int nBytes = midiMessage.size();
-        debugMessage.append(": sending MIDI message with ");
-        for (int i=0; i<nBytes; i++)
-        {
-            debugMessage.append("byte " + std::to_string(i+1) + ": " + std::to_string((int)midiMessage[i]) + " ");
-        }
+        LOG_WARN("void MidiButton::SendMidiMessage(): the MIDI sender is a full queue behind - {} messages dropped so far", mMidiOutQueue->GetDroppedCount());
     }
-    Message(debugMessage);
-    //midiOut->sendMessage(&midiMessage);
-    midiOut->send_message(midiMessage);
+#else
+    mMidiOutQueue->Push(midiFrame);
+#endif
 }
 
-void StreamDeckMidiButton::SetActionIcon(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
+void StreamDeckMidiButton::SendQueuedMidiMessage(const unsigned char* bytes, size_t size)
 {
-    Message("void MidiButton::SetActionIcon()");
-    //get the MMC message
-    try
-    {
-        switch (storedButtonSettings[inContext].dataByte5)
-        {
-            case 1: //STOP
-                if (storedButtonSettings[inContext].midiMMCIsActive) mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/stop_active.png"), inContext, 0);
-                else mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/stop_inactive.png"), inContext, 0);
-                break;
-            case 2: //PLAY
-                if (storedButtonSettings[inContext].midiMMCIsActive) mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/play_active.png"), inContext, 0);
-                else mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/play_inactive.png"), inContext, 0);
-                break;
-            case 4://FFWD
-                if (storedButtonSettings[inContext].midiMMCIsActive) mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/fastforward_active.png"), inContext, 0);
-                else mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/fastforward_inactive.png"), inContext, 0);
-                break;
-            case 5://RWD
-                if (storedButtonSettings[inContext].midiMMCIsActive) mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/fastrewind_active.png"), inContext, 0);
-                else mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/fastrewind_inactive.png"), inContext, 0);
-                break;
-            case 6://RECORD
-                if (storedButtonSettings[inContext].midiMMCIsActive) mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/record_active.png"), inContext, 0);
-                else mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/record_inactive.png"), inContext, 0);
-                break;
-            case 9://PAUSE
-                if (storedButtonSettings[inContext].midiMMCIsActive) mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/pause_active.png"), inContext, 0);
-                else mConnectionManager->SetImage("data:image/png;base64," + GetPngAsString("./Icons/pause_inactive.png"), inContext, 0);
-                break;
-            default:
-                break;
-        }
+    TraceLog::Instance().Trace(TraceEvent::MIDI_OUT, INVALID_CONTEXT_ID, bytes, size);
+    LOG_TRACE("void MidiButton::SendMidiMessage(): sending MIDI message with {} bytes: {} {} {} {} {} {}", size, (int)bytes[0], size > 1 ? (int)bytes[1] : -1, size > 2 ? (int)bytes[2] : -1, size > 3 ? (int)bytes[3] : -1, size > 4 ? (int)bytes[4] : -1, size > 5 ? (int)bytes[5] : -1);
+    
+    //the pool holds it back if the device has been unplugged, and replays it when it's back
+    mMidiPortPool->Send(bytes, size);
+}
+
+void StreamDeckMidiButton::SetActionIcon(const uint32_t contextId)
+{
+    const std::string& inContext = mContextNames[contextId];
+    LOG_TRACE("void MidiButton::SetActionIcon()");
+    
+    std::call_once(mIconCacheLoaded, [this]() {
+        if (mIconCache.Load(ICONS_DIRECTORY)) Message("void MidiButton::SetActionIcon(): loaded " + mIconCache.GetLoadReport());
+        else Message("void MidiButton::SetActionIcon(): couldn't load any icons from " ICONS_DIRECTORY);
+    });
+    
+    //get the MMC message - only called on the websocket thread, so the current table can be read without pinning it
+    const ButtonSettings& settings = mButtonTable.Current().buttons[contextId].settings;
+    const char* iconName = nullptr;
+    switch (settings.dataByte5)
+    {
+        case 1: //STOP
+            iconName = "stop";
+            break;
+        case 2: //PLAY
+            iconName = "play";
+            break;
+        case 4://FFWD
+            iconName = "fastforward";
+            break;
+        case 5://RWD
+            iconName = "fastrewind";
+            break;
+        case 6://RECORD
+            iconName = "record";
+            break;
+        case 9://PAUSE
+            iconName = "pause";
+            break;
+        default:
+            return;
     }
-    catch (...)
+    
+    //only the _inactive icons ship at the moment, so fall back to them if there's no _active one
+    std::shared_ptr<const std::string> icon;
+    if (settings.midiMMCIsActive) icon = mIconCache.Get(std::string(iconName) + "_active");
+    if (!icon) icon = mIconCache.Get(std::string(iconName) + "_inactive");
+    if (!icon)
     {
         Message("void MidiButton::SetActionIcon(): something went wrong setting the action icon - the file is probably missing/unreadable");
+        return;
     }
+    mConnectionManager->SetImage(icon, inContext, 0);
 }
 
-std::map <std::string, std::string> StreamDeckMidiButton::GetMidiPortList(Direction direction)
+void StreamDeckMidiButton::SetKeyImage(const uint32_t contextId, const std::shared_ptr<const std::string>& dataURI)
 {
-    switch (direction)
-    {
-        case Direction::OUT:
-        {
-            Message("std::map <std::string, std::string> MidiButton::GetMidiPortList(Direction OUT)");
-            std::map <std::string, std::string> midiPortList;
-            std::string portName;
-            //unsigned int nPorts = midiOut->getPortCount();
-            unsigned int nPorts = midiOut->get_port_count();
-            if (nPorts == 0)
-            {
-                midiPortList.insert(std::make_pair("ERROR - no MIDI output port available", std::to_string(0)));
-                return midiPortList;
-            }
-            if (nPorts == 1)
-            {
-                midiPortList.insert(std::make_pair(portName, std::to_string(1)));
-                return midiPortList;
-            }
-            else
-            {
-                int count = 0;
-                for (unsigned int i = 0; i < nPorts; i++)
-                {
-                    //portName = midiOut->getPortName(i);
-                    portName = midiOut->get_port_name(i);
-                    midiPortList.insert(std::make_pair(portName, std::to_string(i)));
-                    count++;
-                }
-            }
-            
-            if (mGlobalSettings->printDebug)
-            {
-                std::map<std::string, std::string>::iterator it = midiPortList.begin();
-                while(it != midiPortList.end())
-                {
-                    Message("std::map <std::string, std::string> MidiButton::GetMidiPortList(Direction OUT): " + it->first + " has port index: " + it->second);
-                    it++;
-                }
-            }
-            return midiPortList;
-        }
-        case Direction::IN:
-        {
-            Message("std::map <std::string, std::string> MidiButton::GetMidiPortList(Direction IN)");
-            std::map <std::string, std::string> midiPortList;
-            std::string portName;
-            //unsigned int nPorts = midiIn->getPortCount();
-            unsigned int nPorts = midiIn->get_port_count();
-            if (nPorts == 0)
-            {
-                midiPortList.insert(std::make_pair("ERROR - no MIDI input port available", std::to_string(0)));
-                return midiPortList;
-            }
-            if (nPorts == 1)
-            {
-                midiPortList.insert(std::make_pair(portName, std::to_string(1)));
-                return midiPortList;
-            }
-            else
-            {
-                int count = 0;
-                for (unsigned int i = 0; i < nPorts; i++)
-                {
-                    //portName = midiIn->getPortName(i);
-                    portName = midiIn->get_port_name(i);
-                    midiPortList.insert(std::make_pair(portName, std::to_string(i)));
-                    count++;
-                }
-            }
-            
-            if (mGlobalSettings->printDebug)
-            {
-                std::map<std::string, std::string>::iterator it = midiPortList.begin();
-                while(it != midiPortList.end())
-                {
-                    Message("std::map <std::string, std::string> MidiButton::GetMidiPortList(Direction IN): " + it->first + " has port index: " + it->second);
-                    it++;
-                }
-            }
-            return midiPortList;
-        }
+    //the name from the table rather than mContextNames, as the id may have been given to a new context since - dropped if it's been released
+    const auto send = [this, contextId, dataURI]() {
+        EpochSnapshot<ButtonTable>::Reader table(mButtonTable);
+        if (mConnectionManager == nullptr || contextId >= table->buttons.size() || table->buttons[contextId].context.empty()) return;
+        //a null image hands the key back to the action's own image
+        mConnectionManager->SetImage(dataURI, table->buttons[contextId].context, 0);
+    };
+#if MIDIBUTTON_STRAND_MODE
+    //the renderer's thread - send it from the strand along with everything else
+    if (mStrand)
+    {
+        asio::post(*mStrand, send);
+        return;
     }
+#endif
+    send();
 }
 
-std::string StreamDeckMidiButton::GetPngAsString(const char* filename)
+std::map <std::string, std::string> StreamDeckMidiButton::GetMidiPortList(Direction direction)
 {
-    Message("std::string MidiButton::GetPngAsString()");
-    //try reading the file
-    std::vector<unsigned char> imageFile = ReadFile(filename);
-    if (imageFile.empty())
+    const bool output = direction == Direction::OUT;
+    const char* directionName = output ? "OUT" : "IN";
+    Message(std::string("std::map <std::string, std::string> MidiButton::GetMidiPortList(Direction ") + directionName + ")");
+    
+    //the cached list - no sequencer queries here
+    const std::shared_ptr<const MidiPortList> ports = output ? mMidiPortRegistry->GetOutputs() : mMidiPortRegistry->GetInputs();
+    std::map <std::string, std::string> midiPortList;
+    if (ports->ports.empty())
     {
-        Message("std::string MidiButton::GetPngAsString(): empty image file");
-        return NULL;
+        midiPortList.insert(std::make_pair(output ? "ERROR - no MIDI output port available" : "ERROR - no MIDI input port available", std::to_string(0)));
+        return midiPortList;
     }
-    else
+    for (size_t i = 0; i < ports->ports.size(); i++)
     {
-        std::string imageFileAsString(imageFile.begin(), imageFile.end());
-        return base64_encode(reinterpret_cast<const unsigned char*>(imageFileAsString.c_str()), imageFileAsString.length());
+        midiPortList.insert(std::make_pair(ports->ports[i].name, std::to_string(i)));
     }
-}
-
-std::vector<unsigned char> StreamDeckMidiButton::ReadFile(const char* filename)
-{
-    Message("std::vector<unsigned char> MidiButton::ReadFile()");
-    // open the file:
-    std::ifstream file(filename, std::ios::binary);
-    std::vector<unsigned char> vec;
     
-    if (!filename)
+    if (mGlobalSettings->printDebug)
     {
-        Message("std::vector<unsigned char> MidiButton::ReadFile(): couldn't open file " + std::string(filename));
-        return vec;
+        std::map<std::string, std::string>::iterator it = midiPortList.begin();
+        while(it != midiPortList.end())
+        {
+            Message(std::string("std::map <std::string, std::string> MidiButton::GetMidiPortList(Direction ") + directionName + "): " + it->first + " has port index: " + it->second);
+            it++;
+        }
     }
-    // Stop eating new lines in binary mode!!!
-    file.unsetf(std::ios::skipws);
-
-    // get its size:
-    std::streampos fileSize;
-
-    file.seekg(0, std::ios::end);
-    fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    // reserve capacity
-    
-    vec.reserve(fileSize);
-
-    // read the data:
-    vec.insert(vec.begin(),
-               std::istream_iterator<unsigned char>(file),
-               std::istream_iterator<unsigned char>());
-
-    return vec;
+    return midiPortList;
 }
 
 bool StreamDeckMidiButton::WriteFile(const char* filename, std::string string)
@@ -1402,24 +1159,19 @@ bool StreamDeckMidiButton::WriteFile(const char* filename, std::string string)
 }
 
 
-StreamDeckMidiButton::FadeSet::FadeSet()
-{
-
-}
-
-StreamDeckMidiButton::FadeSet::FadeSet(const int fromValue, const int toValue, const float fadeTime, const float fadeCurve, const int sampleInterval)
+StreamDeckMidiButton::FadeCurve::FadeCurve(const int fromValue, const int toValue, const float fadeTime, const float fadeCurve, const int sampleInterval)
 {
     //set up the initial values
     this->fromValue = fromValue;
     this->toValue = toValue;
     this->setSize = (fadeTime * (1000 / sampleInterval));
-    this->intervalSize = (fadeTime/setSize);
+    const float intervalSize = (fadeTime/setSize);
     
-    //calculate the look-up tables
+    //calculate the look-up tables - setSize + 1 values, as a reversed fade starts from the last one
     if (fadeCurve == 0)
     {
-        // create a vector of length setSize
-        std::vector<float> set(setSize);
+        // create a vector of length setSize + 1
+        std::vector<float> set(setSize + 1);
         
         // now assign the values to the vector
         for (int i = 0; i < setSize + 1; i++)
@@ -1427,19 +1179,17 @@ StreamDeckMidiButton::FadeSet::FadeSet(const int fromValue, const int toValue, c
                  set[i] = (float)fromValue + i * ( ((float)toValue - (float)fromValue) / setSize);
             }
         this->inSet = set;
-        this->inPrevValue = (fromValue - 1);
         
         for (int i = 0; i < setSize + 1; i++)
         {
              set[i] = (float)toValue + i * ( ((float)fromValue - (float)toValue) / setSize);
         }
         this->outSet = set;
-        this->outPrevValue = (toValue + 1);
     }
     else
     {
-        // create a vector of length setSize
-        std::vector<float> set(setSize);
+        // create a vector of length setSize + 1
+        std::vector<float> set(setSize + 1);
         
         // now assign the values to the vector
         for (int i = 0; i < setSize + 1; i++)
@@ -1451,7 +1201,6 @@ StreamDeckMidiButton::FadeSet::FadeSet(const int fromValue, const int toValue, c
                                     );
             }
         this->inSet = set;
-        this->inPrevValue = (fromValue - 1);
         for (int i = 0; i < setSize + 1; i++)
         {
              set[i] = toValue + (
@@ -1461,135 +1210,141 @@ StreamDeckMidiButton::FadeSet::FadeSet(const int fromValue, const int toValue, c
                                 );
         }
         this->outSet = set;
-        this->outPrevValue = (toValue + 1);
     }
 }
 
-bool StreamDeckMidiButton::FadeSet::UpdateFade()
+StreamDeckMidiButton::FadeState StreamDeckMidiButton::StartFadeState(const FadeCurve& curve, const Direction direction)
 {
-    if (this->fadeActive && this->currentDirection == Direction::IN)
+    FadeState fade;
+    fade.inPrevValue = (curve.fromValue - 1);
+    fade.outPrevValue = (curve.toValue + 1);
+    fade.SetDirection(direction);
+    return fade;
+}
+
+bool StreamDeckMidiButton::UpdateFade(const FadeCurve& curve, FadeState& fade)
+{
+    //>= and <= rather than ==, so a fade that was part way through when the settings changed can't run off the end of the new set
+    if (fade.Is(FadeState::ACTIVE) && fade.GetDirection() == Direction::IN)
     {
-        if (!this->reverseFade)
+        if (!fade.Is(FadeState::REVERSE))
         {
-            if (this->currentIndex == this->setSize)
+            if (fade.currentIndex >= curve.setSize)
             {
-                this->currentIndex = 0;//reset the currentIndex of the fadeSet
-                this->inPrevValue = (this->fromValue - 1);//reset inPrevValue
-                this->currentValue = this->toValue;
-                this->fadeActive = false;
-                this->fadeFinished = true;
+                fade.currentIndex = 0;//reset the currentIndex of the fadeSet
+                fade.inPrevValue = (curve.fromValue - 1);//reset inPrevValue
+                fade.currentValue = curve.toValue;
+                fade.Set(FadeState::ACTIVE, false);
+                fade.Set(FadeState::FINISHED, true);
                 return true;
             }
-            else if (this->inPrevValue != floor(this->inSet[this->currentIndex]))
+            else if (fade.inPrevValue != floor(curve.inSet[fade.currentIndex]))
             {
-                this->currentValue = floor(this->inSet[this->currentIndex]);
-                this->inPrevValue = floor(this->inSet[this->currentIndex]);
-                this->currentIndex++;
+                fade.currentValue = floor(curve.inSet[fade.currentIndex]);
+                fade.inPrevValue = floor(curve.inSet[fade.currentIndex]);
+                fade.currentIndex++;
                 return true;
             }
             else
             {
-                this->currentIndex++;
+                fade.currentIndex++;
                 return false;
             }
         }
-        else if (this->reverseFade)
+        else
         {
-            if (this->currentIndex == 0)
+            if (fade.currentIndex <= 0)
             {
-                this->inPrevValue = (this->fromValue - 1);//reset inPrevValue
-                //this->currentValue = this->fromValue;
-                this->fadeActive = false;
-                this->fadeFinished = true;
-                this->reverseFade = false;
+                fade.inPrevValue = (curve.fromValue - 1);//reset inPrevValue
+                //fade.currentValue = curve.fromValue;
+                fade.Set(FadeState::ACTIVE, false);
+                fade.Set(FadeState::FINISHED, true);
+                fade.Set(FadeState::REVERSE, false);
                 return false;
             }
-            else if (this->inPrevValue != floor(this->inSet[this->currentIndex]))
+            else if (fade.inPrevValue != floor(curve.inSet[fade.currentIndex]))
             {
-                this->currentValue = floor(this->inSet[this->currentIndex]);
-                this->inPrevValue = floor(this->inSet[this->currentIndex]);
-                this->currentIndex--;
+                fade.currentValue = floor(curve.inSet[fade.currentIndex]);
+                fade.inPrevValue = floor(curve.inSet[fade.currentIndex]);
+                fade.currentIndex--;
                 return true;
             }
             else
             {
-                this->currentIndex--;
+                fade.currentIndex--;
                 return false;
             }
         }
     }
-    else if (this->fadeActive && this->currentDirection == Direction::OUT)
+    else if (fade.Is(FadeState::ACTIVE) && fade.GetDirection() == Direction::OUT)
     {
-        if (!this->reverseFade)
+        if (!fade.Is(FadeState::REVERSE))
         {
-            if (this->currentIndex == this->setSize)
+            if (fade.currentIndex >= curve.setSize)
             {
-                this->currentIndex = 0;//reset the currentIndex of the fadeSet
-                this->outPrevValue = (this->toValue + 1);//reset outPrevValue
-                //std::cout << this->fromValue << std::endl;
-                this->currentValue = this->fromValue;
-                this->fadeActive = false;
-                this->fadeFinished = true;
+                fade.currentIndex = 0;//reset the currentIndex of the fadeSet
+                fade.outPrevValue = (curve.toValue + 1);//reset outPrevValue
+                fade.currentValue = curve.fromValue;
+                fade.Set(FadeState::ACTIVE, false);
+                fade.Set(FadeState::FINISHED, true);
                 return true;
             }
-            else if (this->outPrevValue != ceil(this->outSet[this->currentIndex]))
+            else if (fade.outPrevValue != ceil(curve.outSet[fade.currentIndex]))
             {
-                //std::cout << ceil(this->outSet[this->currentIndex]) << std::endl;
-                this->currentValue = ceil(this->outSet[this->currentIndex]);
-                this->outPrevValue = ceil(this->outSet[this->currentIndex]);
-                this->currentIndex++;
+                fade.currentValue = ceil(curve.outSet[fade.currentIndex]);
+                fade.outPrevValue = ceil(curve.outSet[fade.currentIndex]);
+                fade.currentIndex++;
                 return true;
             }
             else
             {
-                this->currentIndex++;
+                fade.currentIndex++;
                 return false;
             }
         }
-        else if (this->reverseFade)
+        else
         {
-            if (this->currentIndex == 0)
+            if (fade.currentIndex <= 0)
             {
-                this->outPrevValue = (this->toValue + 1);//reset inPrevValue
-                this->currentValue = this->toValue;
-                this->fadeActive = false;
-                this->fadeFinished = true;
-                this->reverseFade = false;
+                fade.outPrevValue = (curve.toValue + 1);//reset inPrevValue
+                fade.currentValue = curve.toValue;
+                fade.Set(FadeState::ACTIVE, false);
+                fade.Set(FadeState::FINISHED, true);
+                fade.Set(FadeState::REVERSE, false);
                 return true;
             }
-            else if (this->outPrevValue != floor(this->outSet[this->currentIndex]))
+            else if (fade.outPrevValue != floor(curve.outSet[fade.currentIndex]))
             {
-                this->currentValue = floor(this->outSet[this->currentIndex]);
-                this->outPrevValue = floor(this->outSet[this->currentIndex]);
-                this->currentIndex--;
+                fade.currentValue = floor(curve.outSet[fade.currentIndex]);
+                fade.outPrevValue = floor(curve.outSet[fade.currentIndex]);
+                fade.currentIndex--;
                 return true;
             }
             else
             {
-                this->currentIndex--;
+                fade.currentIndex--;
                 return false;
             }
-        }    }
+        }
+    }
     return false;
 }
 
-void StreamDeckMidiButton::FadeSet::ReverseFade()
+void StreamDeckMidiButton::ReverseFade(const FadeCurve& curve, FadeState& fade)
 {
-    if (!this->fadeActive)
+    if (!fade.Is(FadeState::ACTIVE))
     {
-        this->currentIndex = this->setSize;
-        this->reverseFade = true;
-        this->fadeActive = true;
+        fade.currentIndex = curve.setSize;
+        fade.Set(FadeState::REVERSE, true);
+        fade.Set(FadeState::ACTIVE, true);
     }
-    else if (this->fadeActive)
+    else
     {
-        this->reverseFade = true;
+        fade.Set(FadeState::REVERSE, true);
     }
 }
 
-void StreamDeckMidiButton::FadeSet::FadeButtonPressed()
+void StreamDeckMidiButton::FadeButtonPressed(FadeState& fade)
 {
-    this->fadeActive = !this->fadeActive;
-    //if (this->fadeActive) this->fadeActive = false;
-    //else this->fadeActive = true;
+    fade.Set(FadeState::ACTIVE, !fade.Is(FadeState::ACTIVE));
 }
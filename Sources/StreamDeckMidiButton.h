@@ -16,11 +16,37 @@
 //#include "RtMidi.h"
 #include <rtmidi17.hpp>
 #include "base64.h"
+#include "EpochSnapshot.h"
+#include "MidiOutQueue.h"
+#include "MidiPortPool.h"
+#include "MidiPortRegistry.h"
+#include "IconCache.h"
+#include "KeyRenderer.h"
+#include "SettingsSchema.h"
 #include "timer.h" //written by Martin Vorbrodt - https://vorbrodt.blog/
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <variant>
 #include <fstream>
 #include <CoreServices/CoreServices.h>
 
+//1 runs every change to the plugin's state on one strand of the websocket's asio loop - the fades on an asio timer and
+//the MIDI input posted across from a lock-free queue - instead of on the websocket, Timer and MIDI input threads
+#ifndef MIDIBUTTON_STRAND_MODE
+#define MIDIBUTTON_STRAND_MODE 0
+#endif
+
+#if MIDIBUTTON_STRAND_MODE
+#include "MidiInQueue.h"
+#include <asio/bind_executor.hpp>
+#include <asio/io_context_strand.hpp>
+#include <asio/post.hpp>
+#include <asio/steady_timer.hpp>
+#endif
+
 #define DEFAULT_PORT_NAME "Streamdeck MIDI"
 
 // namespace
@@ -37,6 +63,8 @@ const int NOTE_ON = 143;
 const int NOTE_OFF = 127;
 const int CC = 175;
 const int PC = 191;
+const uint32_t MAX_CONTEXTS = 1024; //size of the flat per-context tables
+const uint32_t INVALID_CONTEXT_ID = UINT32_MAX;
 }
 
 //enum Direction for MIDI In/Out
@@ -46,6 +74,18 @@ enum class Direction
     IN,
 };
 
+//enum ActionType - the action UUID is interned to one of these when the context is first seen
+enum class ActionType : uint8_t
+{
+    UNKNOWN,
+    NOTE_ON,
+    NOTE_ON_TOGGLE,
+    CC,
+    CC_TOGGLE,
+    MMC,
+    PROGRAM_CHANGE,
+};
+
 class StreamDeckMidiButton : public ESDBasePlugin
 {
 public:
@@ -72,36 +112,63 @@ public:
     void DidReceiveSettings(const std::string& inAction, const std::string& inContext, const json& inPayload, const std::string& inDeviceID) override;
 
     //set an action icon
-    void SetActionIcon(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID);
+    void SetActionIcon(const uint32_t contextId);
+    
+    //set a rendered key image - called from the KeyRenderer thread
+    void SetKeyImage(const uint32_t contextId, const std::shared_ptr<const std::string>& dataURI);
+    
+#if MIDIBUTTON_STRAND_MODE
+    //make the strand and start the fades on it - everything after this runs on the loop's thread
+    void WillRunEventLoop(asio::io_context& inIOContext) override;
+#endif
         
 private:
-    //deal with initialising MIDI
-    bool InitialiseMidi(Direction direction);
+    //map the context string to a dense id, and the action UUID to an ActionType - only called from the websocket thread
+    uint32_t InternContext(const std::string& inContext);
+    //a context has gone off the page - its id can be given to a new context if the table fills up
+    void HideContext(const uint32_t contextId);
+    //take back the id of the context that's been off the page longest - INVALID_CONTEXT_ID if they're all in use
+    uint32_t ReleaseHiddenContext();
+    static ActionType InternAction(const std::string& inAction);
     
-    //get a map of the available input & output MIDI ports
+    //open the ports in the global settings - in the background, the current ports stay live until the new ones are ready
+    void InitialiseMidi();
+    
+    //get a map of the available input & output MIDI ports - from the registry's cached list
     std::map<std::string, std::string> GetMidiPortList(Direction direction);
     
     //does what it says on the tin
     void InitialSetup();
     
-    //MIDI input callback function
-    void HandleMidiInput(const rtmidi::message &message);
+    //MIDI input callback function - pins the button table once for the whole batch
+    void HandleMidiInput(const rtmidi::message* messages, size_t count);
+    
+    //match one message against the buttons in a table the caller has pinned
+    struct ButtonTable;
+    void HandleMidiInput(const ButtonTable& table, const unsigned char* bytes, const size_t nBytes, const int64_t timeNs);
+    
+#if MIDIBUTTON_STRAND_MODE
+    //the input threads' end of mMidiInQueue, and the strand's end
+    void QueueMidiInput(const rtmidi::message* messages, size_t count);
+    void DrainMidiInput();
+    
+    //run UpdateTimer() every sampleInterval on the strand, measured from when the first tick was due so it doesn't drift
+    void ScheduleFadeTick();
+#endif
     
     //functions to update the fade sets and send midi messages
     void UpdateTimer();
     void UpdateFade();
     
-    //send a midi message
-    void SendMidiMessage(const std::vector<unsigned char>& midiMessage);
+    //queue a midi message, and the sender thread's end of the queue
+    void SendMidiMessage(const MidiFrame& midiFrame);
+    void SendQueuedMidiMessage(const unsigned char* bytes, size_t size);
     
-    void ChangeButtonState(const std::string& inContext);
-    void StoreButtonSettings(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID);
+    void ChangeButtonState(const uint32_t contextId, const std::string& inContext);
+    void StoreButtonSettings(const std::string& inAction, const uint32_t contextId, const json &inPayload, const std::string& inDeviceID);
     
     //reading & writing of files
-    std::vector<unsigned char> ReadFile(const char* filename);
     bool WriteFile(const char* filename, std::string string);
-        
-    std::string GetPngAsString(const char* filename);
     
     //Global Settings
     struct GlobalSettings
@@ -116,12 +183,24 @@ private:
         int sampleInterval = 5;
     };
     
+    //the keys the PI sends for the global settings - sorted by key, see SettingsSchema.h
+    static constexpr SettingsField<GlobalSettings> GLOBAL_SETTINGS_FIELDS[] =
+    {
+        MakeSettingsField("portName", &GlobalSettings::portName),
+        MakeSettingsField("printDebug", &GlobalSettings::printDebug),
+        MakeSettingsField("selectedInPortIndex", &GlobalSettings::selectedInPortIndex),
+        MakeSettingsField("selectedInPortName", &GlobalSettings::selectedInPortName),
+        MakeSettingsField("selectedOutPortIndex", &GlobalSettings::selectedOutPortIndex),
+        MakeSettingsField("selectedOutPortName", &GlobalSettings::selectedOutPortName),
+        MakeSettingsField("useVirtualPort", &GlobalSettings::useVirtualPort),
+    };
+    static_assert(SettingsFieldsAreSorted(GLOBAL_SETTINGS_FIELDS), "GLOBAL_SETTINGS_FIELDS must be sorted by key");
+    
     //Button Settings
     struct ButtonSettings
     {
         //common settings
-        std::string inAction;
-        std::string inContext;
+        ActionType action = ActionType::UNKNOWN; //UNKNOWN until the settings have been stored
         
         int statusByte = 144; //channel and message - defaults to NOTE ON channel 1
         int dataByte1 = 0; //note on, note off, CC, PC, MMC
@@ -133,9 +212,6 @@ private:
         int noteOffMode = 0;
         bool toggleNoteOnOff = true;
         
-        //state settings for multiaction buttons
-        bool state = false;
-        
         //mode for CC buttons
         int ccMode = 0;
         
@@ -144,63 +220,213 @@ private:
         float fadeTime = 0;
         float fadeCurve = 0;
         
+        //live level bar on CC buttons
+        bool showLevel = false;
+        
         //midiMMC settings
         bool midiMMCIsActive = false;//use for MIDI input triggerring MMC state change
     };
     
-    struct FadeSet {
-        public:
-            bool fadeActive = false; //is the fade active
-            bool fadeFinished = false; //is the fade finished - if so, send a green tick to the SD
-            int currentValue = 0;
-            Direction currentDirection;
-            FadeSet ();
-            FadeSet (const int fromValue, const int toValue, const float fadeTime, const float fadeCurve, const int sampleInterval);
-            bool UpdateFade();
-            void ReverseFade();
-            void FadeButtonPressed();
-            int setSize = 0;
-            int fromValue = 0;
-            int toValue = 0;
-            std::vector<float> inSet;
-            std::vector<float> outSet;
-
-        private:
-            int currentIndex = 0;
-            int inPrevValue = 0;
-            int outPrevValue = 0;
-            float intervalSize = 0;
-            bool reverseFade = false;
+    //the keys the PI sends for each button - sorted by key, see SettingsSchema.h
+    static constexpr SettingsField<ButtonSettings> BUTTON_SETTINGS_FIELDS[] =
+    {
+        MakeSettingsField("ccMode", &ButtonSettings::ccMode),
+        MakeSettingsField("dataByte1", &ButtonSettings::dataByte1),
+        MakeSettingsField("dataByte2", &ButtonSettings::dataByte2),
+        MakeSettingsField("dataByte2Alt", &ButtonSettings::dataByte2Alt),
+        MakeSettingsField("dataByte5", &ButtonSettings::dataByte5),
+        MakeSettingsField("fadeCurve", &ButtonSettings::fadeCurve),
+        MakeSettingsField("fadeTime", &ButtonSettings::fadeTime),
+        MakeSettingsField("noteOffMode", &ButtonSettings::noteOffMode),
+        MakeSettingsField("showLevel", &ButtonSettings::showLevel),
+        MakeSettingsField("statusByte", &ButtonSettings::statusByte),
+        MakeSettingsField("toggleFade", &ButtonSettings::toggleFade),
+    };
+    static_assert(SettingsFieldsAreSorted(BUTTON_SETTINGS_FIELDS), "BUTTON_SETTINGS_FIELDS must be sorted by key");
+    
+    //Action programs - compiled from the ButtonSettings when they're stored, so a key press only has to pick a ready-made frame and queue it
+    struct NoteOnProgram
+    {
+        MidiFrame noteOn;
+        MidiFrame noteOff; //note on with velocity 0
+        int noteOffMode = 0;
+    };
+    struct NoteOnToggleProgram
+    {
+        MidiFrame noteOn;
+        MidiFrame noteOff;
+    };
+    struct CCProgram
+    {
+        MidiFrame value;
+        MidiFrame altValue;
+        int ccMode = 0;
+        bool showLevel = false;
+    };
+    struct CCToggleProgram
+    {
+        MidiFrame value;
+        MidiFrame altValue;
+        bool toggleFade = false;
+        bool showLevel = false;
+    };
+    struct ProgramChangeProgram
+    {
+        MidiFrame programChange;
+    };
+    struct MMCProgram
+    {
+        MidiFrame sysex;
     };
+    using ActionProgram = std::variant<std::monostate, NoteOnProgram, NoteOnToggleProgram, CCProgram, CCToggleProgram, ProgramChangeProgram, MMCProgram>;
     
-    //global MIDI message
-    std::vector<unsigned char> midiMessage;
+    //state requested by the Stream Deck for multi-state actions - taken from the payload once, before the program runs
+    struct KeyState
+    {
+        int state = -1; //-1 if the payload doesn't have one
+        bool userDesired = false; //true if it came from userDesiredState (multi-action) rather than state
+    };
+    
+    static ActionProgram CompileActionProgram(const ButtonSettings& settings);
+    
+    //run the compiled programs - one overload per action type
+    void KeyDownForProgram(const uint32_t contextId, const std::monostate& program, const KeyState& keyState);
+    void KeyDownForProgram(const uint32_t contextId, const NoteOnProgram& program, const KeyState& keyState);
+    void KeyDownForProgram(const uint32_t contextId, const NoteOnToggleProgram& program, const KeyState& keyState);
+    void KeyDownForProgram(const uint32_t contextId, const CCProgram& program, const KeyState& keyState);
+    void KeyDownForProgram(const uint32_t contextId, const CCToggleProgram& program, const KeyState& keyState);
+    void KeyDownForProgram(const uint32_t contextId, const ProgramChangeProgram& program, const KeyState& keyState);
+    void KeyDownForProgram(const uint32_t contextId, const MMCProgram& program, const KeyState& keyState);
+    
+    //the fade lookup tables - built when the settings are stored, and never changed after that
+    struct FadeCurve
+    {
+        FadeCurve (const int fromValue, const int toValue, const float fadeTime, const float fadeCurve, const int sampleInterval);
+        int setSize = 0;
+        int fromValue = 0;
+        int toValue = 0;
+        std::vector<float> inSet; //setSize + 1 values, from fromValue to toValue
+        std::vector<float> outSet;
+    };
+    
+    //where a fade has got to - packed into 8 bytes so the Timer and websocket threads can both move it on with one compare-exchange
+    struct FadeState
+    {
+        static const uint8_t ACTIVE = 1; //is the fade active
+        static const uint8_t FINISHED = 2; //is the fade finished - if so, send a green tick to the SD
+        static const uint8_t REVERSE = 4;
+        static const uint8_t OUT = 8; //currentDirection is Direction::OUT
+        
+        int32_t currentIndex = 0;
+        int8_t currentValue = 0;
+        int8_t inPrevValue = 0; //toValue + 1 can be 128, which wraps to -128 - neither ever matches a value in the set
+        int8_t outPrevValue = 0;
+        uint8_t flags = 0;
+        
+        bool Is(const uint8_t flag) const { return (flags & flag) != 0; }
+        void Set(const uint8_t flag, const bool on) { flags = on ? (flags | flag) : (flags & ~flag); }
+        Direction GetDirection() const { return Is(OUT) ? Direction::OUT : Direction::IN; }
+        void SetDirection(const Direction direction) { Set(OUT, direction == Direction::OUT); }
+    };
+    static_assert(std::atomic<FadeState>::is_always_lock_free, "FadeState has to fit in a lock-free atomic");
+    
+    //a fresh fade for the curve, not yet started
+    static FadeState StartFadeState(const FadeCurve& curve, const Direction direction);
+    
+    //step the fade on - true if there's a new currentValue to send
+    static bool UpdateFade(const FadeCurve& curve, FadeState& fade);
+    static void ReverseFade(const FadeCurve& curve, FadeState& fade);
+    static void FadeButtonPressed(FadeState& fade);
+    
+    //apply change to the fade in one step - it runs again if another thread moved the fade on in the meantime
+    template <typename Change>
+    static bool ChangeFadeState(std::atomic<FadeState>& fade, Change change, FadeState* updated = nullptr)
+    {
+        FadeState current = fade.load(std::memory_order_acquire);
+        for (;;)
+        {
+            FadeState next = current;
+            const bool result = change(next);
+            if (fade.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                if (updated != nullptr) *updated = next;
+                return result;
+            }
+        }
+    }
+    
+    //one button in one version of the table
+    struct ButtonEntry
+    {
+        ButtonSettings settings;
+        ActionProgram program;
+        std::shared_ptr<const FadeCurve> fadeCurve; //null unless the button fades
+        std::string context; //the Stream Deck's context, for the threads that can't read mContextNames - empty once the id is released
+    };
+    
+    //the configuration of every button - never changed once it's published, StoreButtonSettings() publishes a new version
+    struct ButtonTable
+    {
+        uint64_t version = 0;
+        std::vector<ButtonEntry> buttons; //indexed by context id, one for each interned context
+    };
+    
+    //the parts of a button that change as it's used - changed from any thread, with atomics
+    struct ButtonRuntime
+    {
+        std::atomic<uint8_t> state{0}; //state for multiaction buttons
+        std::atomic<FadeState> fade{FadeState()};
+    };
+    
+    //copy the current table with the one entry replaced, and publish it - websocket thread only
+    void PublishButton(const uint32_t contextId, ButtonEntry entry);
+    
+    //outgoing MIDI - key presses and fades are copied in here and sent from its own thread
+    std::unique_ptr<MidiOutQueue> mMidiOutQueue;
 
     //PortSettings stored globally
     GlobalSettings *mGlobalSettings;
     
-    // MUTEXES //
-    //button mutexes
-    std::mutex mVisibleContextsMutex;
-	std::set<std::string> mVisibleContexts;
-
-    //mutex to lock the midi message so we don't overwrite things
-    std::mutex midiMessageMutex;
-        
-    //mutex to lock the midi input so we don't crash
-    std::mutex midiUpdateMutex;
+    //which contexts are on a page at the moment, indexed by context id - websocket thread only
+    std::vector<char> mVisibleContexts;
     
-    //Rtmidi17
-    rtmidi::midi_out *midiOut = nullptr;
-    rtmidi::midi_in *midiIn = nullptr;
+    //Rtmidi17 - the cached port lists, and the live midi_in/midi_out pair, swapped for a new one when the port settings change
+    std::unique_ptr<MidiPortRegistry> mMidiPortRegistry;
+    std::unique_ptr<MidiPortPool> mMidiPortPool;
 
-    //Timer
-    Timer *eTimer;
+    //Timer - null in strand mode
+    Timer *eTimer = nullptr;
+    
+#if MIDIBUTTON_STRAND_MODE
+    //made by WillRunEventLoop() - the websocket callbacks run on the same single-threaded loop, so they're serialised with it too
+    std::unique_ptr<asio::io_context::strand> mStrand;
+    std::unique_ptr<asio::steady_timer> mFadeTimer;
+    
+    //incoming MIDI on its way to the strand - mMidiInputPosted is set while a DrainMidiInput() is waiting to run
+    MidiInQueue mMidiInQueue;
+    std::atomic<bool> mMidiInputPosted{false};
+#endif
+    
+    //interned contexts - ids are dense and handed out in order, then once all MAX_CONTEXTS are taken a context that's
+    //off the page gives its id up to the new one - websocket thread only, the other threads get the name from mButtonTable
+    std::unordered_map<std::string, uint32_t> mContextIds;
+    std::vector<std::string> mContextNames; //indexed by context id, for talking back to the Stream Deck
+    std::vector<std::string> mContextDevices; //indexed by context id, so a disconnected device's contexts can be hidden
+    std::deque<uint32_t> mHiddenContextIds; //in the order they went off the page - may hold ids that have come back since
+    std::atomic<uint32_t> mContextCount{0};
+    
+    //the button configuration, read by the Timer and MIDI threads without a lock - published from the websocket thread
+    EpochSnapshot<ButtonTable> mButtonTable{std::unique_ptr<const ButtonTable>(new ButtonTable())};
+    //toggle state and fade position, indexed by context id - MAX_CONTEXTS of them, made up front so they never move
+    std::unique_ptr<ButtonRuntime[]> mButtonRuntime;
+    
+    //the MMC icons - loaded and encoded the first time an icon is needed
+    IconCache mIconCache;
+    std::once_flag mIconCacheLoaded;
     
-    //maps of the various structs
-    std::map<std::string, ButtonSettings> storedButtonSettings;
-    std::map<int, std::string> storedStatusBytes;
-    std::map<std::string, FadeSet> storedFadeSettings;
+    //live key images for CC buttons with showLevel set, and the key size for each device - 144 for the high DPI ones
+    std::unique_ptr<KeyRenderer> mKeyRenderer;
+    std::unordered_map<std::string, int> mDeviceKeySizes; //websocket thread only
     
     //initial setup flag - doesn't work properly yet
     std::once_flag initialSetup;
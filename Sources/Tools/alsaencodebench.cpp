@@ -0,0 +1,139 @@
+//==============================================================================
+/**
+@file       alsaencodebench.cpp
+
+@brief      Per-message cost of building ALSA sequencer events directly, against snd_midi_event_encode()
+
+            First checks rtmidi::encodeEvent() against libasound's own encoder for every status byte at
+            every length up to three, with a spread of data bytes - each message it takes has to give
+            exactly the event the encoder does, and each one it leaves has to be one the encoder doesn't
+            take whole. Then times both over a mix of notes, controllers, pitch bend and clock, the way
+            midi_out_alsa::send_message() sets up each event. Needs libasound but no sequencer or device.
+            Exits non-zero if any of the checks fail.
+
+            Build:  c++ -std=c++17 -O2 -DRTMIDI17_HEADER_ONLY=1 -DRTMIDI17_ALSA=1 -I../include -I../include/rtmidi17 alsaencodebench.cpp -o alsaencodebench -lasound -lpthread
+            Usage:  alsaencodebench [messages]
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include <rtmidi17.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+//an event as send_message() starts it
+void Clear(snd_seq_event_t& ev)
+{
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_source(&ev, 1);
+    snd_seq_ev_set_subs(&ev);
+    snd_seq_ev_set_direct(&ev);
+}
+
+//ns per message to turn every message in messages into an event, over at least total messages
+template <typename Encode>
+double Time(const std::vector<std::vector<unsigned char>>& messages, const int total, Encode encode)
+{
+    snd_seq_event_t ev;
+    unsigned long long sink = 0;
+    int done = 0;
+    const auto start = Clock::now();
+    while (done < total)
+    {
+        for (const auto& message : messages)
+        {
+            Clear(ev);
+            encode(message.data(), message.size(), ev);
+            sink += ev.type;
+        }
+        done += (int)messages.size();
+    }
+    const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / done;
+    if (sink == 1) std::printf(" ");
+    return ns;
+}
+}
+
+int main(int argc, const char* argv[])
+{
+    const int messages = argc > 1 ? std::atoi(argv[1]) : 10000000;
+    if (messages < 1)
+    {
+        std::fprintf(stderr, "usage: alsaencodebench [messages >= 1]\n");
+        return 1;
+    }
+
+    snd_midi_event_t* coder = nullptr;
+    if (snd_midi_event_new(32, &coder) < 0)
+    {
+        std::fprintf(stderr, "can't create an ALSA MIDI event encoder\n");
+        return 1;
+    }
+    snd_midi_event_init(coder);
+
+    //every status byte, at every length, with data bytes from both ends of the range
+    int checked = 0;
+    int direct = 0;
+    int failures = 0;
+    const unsigned char data[][2] = {{0, 0}, {1, 2}, {64, 0}, {0x7f, 0x7f}, {0x45, 0x12}, {0x80, 0}, {0, 0xf7}};
+    for (int status = 0x80; status <= 0xff; status++)
+    {
+        for (size_t size = 1; size <= 3; size++)
+        {
+            for (const auto& bytes : data)
+            {
+                const unsigned char message[3] = {(unsigned char)status, bytes[0], bytes[1]};
+                snd_seq_event_t fast;
+                snd_seq_event_t slow;
+                Clear(fast);
+                Clear(slow);
+                snd_midi_event_reset_encode(coder);
+                const bool took = rtmidi::encodeEvent(message, size, fast);
+                const long used = snd_midi_event_encode(coder, message, (long)size, &slow);
+                const bool whole = used == (long)size && slow.type != SND_SEQ_EVENT_NONE;
+                //SysEx is meant for the encoder, as is anything with a status byte where the data should be, and the
+                //undefined status bytes - the encoder skips those and reads what follows as running status
+                const bool undefined = status == 0xf4 || status == 0xf5 || status == 0xf9 || status == 0xfd;
+                const bool encoderOnly = status == 0xf0 || status == 0xf7 || undefined || (size > 1 && message[1] & 0x80) || (size > 2 && message[2] & 0x80);
+                checked++;
+                if (took) direct++;
+                if (took ? !whole || std::memcmp(&fast, &slow, sizeof(fast)) != 0 : whole && !encoderOnly)
+                {
+                    std::printf("FAILED: %02x", status);
+                    for (size_t i = 1; i < size; i++) std::printf(" %02x", message[i]);
+                    std::printf(" - %s\n", took ? "event differs from the encoder's" : "left to the encoder, which takes it whole");
+                    failures++;
+                }
+            }
+        }
+    }
+
+    //what a control surface sends
+    std::vector<std::vector<unsigned char>> mix;
+    for (int i = 0; i < 16; i++)
+    {
+        mix.push_back({(unsigned char)(0x90 | (i & 0x0f)), (unsigned char)(36 + i), 100});
+        mix.push_back({(unsigned char)(0x80 | (i & 0x0f)), (unsigned char)(36 + i), 0});
+        mix.push_back({0xb0, (unsigned char)i, (unsigned char)(i * 8)});
+        mix.push_back({0xe0, (unsigned char)(i * 8), 0x40});
+        mix.push_back({0xf8});
+    }
+    const double encoderNs = Time(mix, messages, [&](const unsigned char* message, size_t size, snd_seq_event_t& ev) {snd_midi_event_encode(coder, message, (long)size, &ev);});
+    const double directNs = Time(mix, messages, [](const unsigned char* message, size_t size, snd_seq_event_t& ev) {rtmidi::encodeEvent(message, size, ev);});
+    snd_midi_event_free(coder);
+
+    std::printf("checked %d messages, %d built directly\n", checked, direct);
+    std::printf("snd_midi_event_encode()  %8.1f ns a message\n", encoderNs);
+    std::printf("encodeEvent()            %8.1f ns a message, over %d\n", directNs, messages);
+    std::printf("%s\n", failures == 0 ? "all checks passed" : "some checks FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+//==============================================================================
+/**
+@file       base64bench.cpp
+
+@brief      Encode and decode throughput of base64.cpp over the plugin's own PNGs
+
+            Loads the PNGs the plugin sends as data URIs (or the files given), checks that the codec
+            base64.cpp picked for this CPU gives exactly what a plain scalar codec does - for each whole
+            file and for every length up to a few hundred bytes, so each tail case is covered - and that
+            each decodes back to the file. Then times encode and decode over the files with both codecs,
+            in MB/s of PNG. Exits non-zero if any of the checks fail.
+
+            Build:  c++ -std=c++17 -O2 -I.. base64bench.cpp ../base64.cpp -o base64bench
+            Usage:  base64bench [repeats [file.png ...]]    (run from Sources/Tools for the default files)
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "base64.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const char* DEFAULT_FILES[] = {
+    "../../co.uk.clarionmusic.midibutton.sdPlugin/midibuttonnote.png",
+    "../../co.uk.clarionmusic.midibutton.sdPlugin/midibuttoncc.png",
+    "../../co.uk.clarionmusic.midibutton.sdPlugin/midibuttonmmc.png",
+    "../../co.uk.clarionmusic.midibutton.sdPlugin/category-midibutton.png",
+    "../../co.uk.clarionmusic.midibutton.sdPlugin/Icons/play_inactive.png",
+    "../../co.uk.clarionmusic.midibutton.sdPlugin/Icons/stop_inactive.png",
+};
+
+const char CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//the reference - one character at a time, nothing clever
+size_t EncodeScalar(const unsigned char* in, size_t len, char* out)
+{
+    size_t written = 0;
+    for (size_t i = 0; i < len; i += 3)
+    {
+        const size_t left = len - i;
+        const unsigned int triple = (in[i] << 16) | (left > 1 ? in[i + 1] << 8 : 0) | (left > 2 ? in[i + 2] : 0);
+        out[written++] = CHARS[(triple >> 18) & 0x3f];
+        out[written++] = CHARS[(triple >> 12) & 0x3f];
+        out[written++] = left > 1 ? CHARS[(triple >> 6) & 0x3f] : '=';
+        out[written++] = left > 2 ? CHARS[triple & 0x3f] : '=';
+    }
+    return written;
+}
+
+//the value of each character, or -1 if it isn't one of the 64
+struct Values
+{
+    int value[256];
+    Values()
+    {
+        for (int& v : value) v = -1;
+        for (int i = 0; i < 64; i++) value[(unsigned char)CHARS[i]] = i;
+    }
+};
+const Values VALUES;
+
+size_t DecodeScalar(const char* in, size_t len, unsigned char* out)
+{
+    size_t written = 0;
+    unsigned int bits = 0;
+    int count = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        const int value = VALUES.value[(unsigned char)in[i]];
+        if (value < 0) break;
+        bits = (bits << 6) | (unsigned int)value;
+        count += 6;
+        if (count >= 8)
+        {
+            count -= 8;
+            out[written++] = (unsigned char)(bits >> count);
+        }
+    }
+    return written;
+}
+
+bool Load(const char* path, std::vector<unsigned char>& contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+//MB/s of PNG for codec run over every file, repeats times
+template <typename Codec>
+double Time(const std::vector<std::vector<unsigned char>>& files, const int repeats, Codec codec)
+{
+    size_t bytes = 0;
+    unsigned long long sink = 0;
+    const auto start = Clock::now();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            sink += codec(i);
+            bytes += files[i].size();
+        }
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (sink == 1) std::printf(" ");
+    return bytes / seconds / 1e6;
+}
+}
+
+int main(int argc, const char* argv[])
+{
+    const int repeats = argc > 1 ? std::atoi(argv[1]) : 2000;
+    if (repeats < 1)
+    {
+        std::fprintf(stderr, "usage: base64bench [repeats >= 1 [file.png ...]]\n");
+        return 1;
+    }
+    std::vector<const char*> paths(argv + std::min(argc, 2), argv + argc);
+    if (paths.empty()) paths.assign(std::begin(DEFAULT_FILES), std::end(DEFAULT_FILES));
+
+    std::vector<std::vector<unsigned char>> files;
+    for (const char* path : paths)
+    {
+        files.emplace_back();
+        if (!Load(path, files.back()) || files.back().empty())
+        {
+            std::fprintf(stderr, "can't read %s\n", path);
+            return 1;
+        }
+    }
+
+    //the picked codec against the reference, on every length up to 300 bytes of the first file and on each whole file
+    int failures = 0;
+    std::vector<char> encoded;
+    std::vector<char> expected;
+    std::vector<unsigned char> decoded;
+    const auto check = [&](const unsigned char* bytes, size_t size, const char* what) {
+        encoded.assign(base64_encoded_size(size), '\0');
+        expected.assign(base64_encoded_size(size), '\0');
+        decoded.assign(base64_decoded_max_size(encoded.size()), 0);
+        const size_t written = base64_encode_into(bytes, size, encoded.data());
+        EncodeScalar(bytes, size, expected.data());
+        const size_t read = base64_decode_into(encoded.data(), encoded.size(), decoded.data());
+        if (written != encoded.size() || encoded != expected)
+        {
+            std::printf("FAILED: %s, %zu bytes - encoding differs from the scalar codec\n", what, size);
+            failures++;
+        }
+        else if (read != size || std::memcmp(decoded.data(), bytes, size) != 0
+                 || DecodeScalar(encoded.data(), encoded.size(), decoded.data()) != size || std::memcmp(decoded.data(), bytes, size) != 0)
+        {
+            std::printf("FAILED: %s, %zu bytes - doesn't decode back to the original\n", what, size);
+            failures++;
+        }
+    };
+    for (size_t size = 0; size <= 300 && size <= files[0].size(); size++) check(files[0].data(), size, paths[0]);
+    for (size_t i = 0; i < files.size(); i++) check(files[i].data(), files[i].size(), paths[i]);
+
+    //each file's encoding, for the decode runs, and somewhere to put the results
+    std::vector<std::string> encodings;
+    size_t smallest = files[0].size();
+    size_t largest = 0;
+    for (const auto& file : files)
+    {
+        encodings.push_back(base64_encode(file.data(), (unsigned int)file.size()));
+        smallest = std::min(smallest, file.size());
+        largest = std::max(largest, file.size());
+    }
+    std::vector<char> text(base64_encoded_size(largest));
+    std::vector<unsigned char> bytes(base64_decoded_max_size(text.size()));
+
+    const double encodeMBs = Time(files, repeats, [&](size_t i) {return base64_encode_into(files[i].data(), files[i].size(), text.data());});
+    const double encodeScalarMBs = Time(files, repeats, [&](size_t i) {return EncodeScalar(files[i].data(), files[i].size(), text.data());});
+    const double decodeMBs = Time(files, repeats, [&](size_t i) {return base64_decode_into(encodings[i].data(), encodings[i].size(), bytes.data());});
+    const double decodeScalarMBs = Time(files, repeats, [&](size_t i) {return DecodeScalar(encodings[i].data(), encodings[i].size(), bytes.data());});
+
+    std::printf("%zu files, %zu to %zu bytes, codec %s\n", files.size(), smallest, largest, base64_codec_name());
+    for (size_t i = 0; i < files.size(); i++) std::printf("  %7zu  %s\n", files[i].size(), paths[i]);
+    std::printf("encode  %-7s %8.1f MB/s\n", base64_codec_name(), encodeMBs);
+    std::printf("encode  scalar  %8.1f MB/s\n", encodeScalarMBs);
+    std::printf("decode  %-7s %8.1f MB/s\n", base64_codec_name(), decodeMBs);
+    std::printf("decode  scalar  %8.1f MB/s\n", decodeScalarMBs);
+    std::printf("%s\n", failures == 0 ? "all checks passed" : "some checks FAILED");
+    return failures == 0 ? 0 : 1;
+}
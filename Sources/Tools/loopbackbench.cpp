@@ -0,0 +1,148 @@
+//==============================================================================
+/**
+@file       loopbackbench.cpp
+
+@brief      Checks and times the rtmidi17 LOOPBACK backend, with no MIDI devices or sound server
+
+            Plugs a port and checks the observer sees it come and go, pushes a million messages through a
+            zero-latency port to time the path from send_message() to the input callback, then turns on
+            latency and jitter and checks each message arrives when it was due, in order, with delta
+            timestamps that add up. Exits non-zero if any of the checks fail.
+
+            Build:  c++ -std=c++17 -O2 -DRTMIDI17_HEADER_ONLY=1 -DRTMIDI17_LOOPBACK=1 -I../include -I../include/rtmidi17 loopbackbench.cpp -o loopbackbench -lpthread
+            Usage:  loopbackbench [messages]
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include <rtmidi17.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+int failures = 0;
+
+void Check(bool ok, const char* what)
+{
+    if (ok) return;
+    std::printf("FAILED: %s\n", what);
+    failures++;
+}
+
+//index of the port with this id in the current list, as midi_in/midi_out number them
+unsigned int IndexOf(rtmidi::midi_in& input, unsigned int id)
+{
+    const auto ports = input.get_ports();
+    for (unsigned int i = 0; i < ports.size(); i++) if (ports[i].id == id) return i;
+    return (unsigned int)ports.size();
+}
+}
+
+int main(int argc, const char* argv[])
+{
+    const int messages = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    if (messages < 1)
+    {
+        std::fprintf(stderr, "usage: loopbackbench [messages >= 1]\n");
+        return 1;
+    }
+
+    //hotplug, as the port registry sees it
+    std::mutex eventsMutex;
+    std::vector<std::string> events;
+    rtmidi::observer::callbacks callbacks;
+    auto record = [&](const char* what) {return [&, what](int id, std::string name) {std::lock_guard<std::mutex> lock(eventsMutex); events.push_back(std::string(what) + " " + std::to_string(id) + " " + name);};};
+    callbacks.input_added = record("input+");
+    callbacks.input_removed = record("input-");
+    callbacks.output_added = record("output+");
+    callbacks.output_removed = record("output-");
+    rtmidi::observer observer(rtmidi::API::LOOPBACK, std::move(callbacks));
+    const unsigned int unplugged = rtmidi::loopback::plug("Unplugged");
+    rtmidi::loopback::unplug(unplugged);
+    const std::string id = std::to_string(unplugged);
+    Check(events == std::vector<std::string>{"input+ " + id + " Unplugged", "output+ " + id + " Unplugged", "input- " + id + " Unplugged", "output- " + id + " Unplugged"}, "observer sees the port plugged and unplugged");
+
+    const unsigned int port = rtmidi::loopback::plug("Loop A");
+    rtmidi::midi_in input(rtmidi::API::LOOPBACK, "loopbackbench");
+    rtmidi::midi_out output(rtmidi::API::LOOPBACK, "loopbackbench");
+    int warnings = 0;
+    output.set_error_callback([&](rtmidi::midi_error, std::string_view) {warnings++;});
+    input.ignore_types(false, false, false);
+
+    //zero latency - delivered in the sending thread, so this is the whole path
+    std::atomic<long> received{0};
+    input.set_callback([&](const rtmidi::message&) {received.fetch_add(1, std::memory_order_relaxed);});
+    input.open_port(IndexOf(input, port));
+    output.open_port(IndexOf(input, port));
+    const unsigned char noteOn[3] = {0x90, 60, 100};
+    const auto start = Clock::now();
+    for (int i = 0; i < messages; i++) output.send_message(noteOn, sizeof(noteOn));
+    const double sendNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / messages;
+    Check(received == messages, "every message delivered with no latency");
+
+    //latency and jitter - each message is timestamped with when it was due, and arrives then
+    const int timed = 200;
+    const auto latency = std::chrono::milliseconds(2);
+    const auto jitter = std::chrono::microseconds(500);
+    rtmidi::loopback::set_latency(latency, jitter, 42);
+    std::mutex arrivalsMutex;
+    std::vector<std::pair<int, Clock::time_point>> arrivals;
+    double timestampTotal = 0;
+    input.set_callback([&](const rtmidi::message& m) {
+        std::lock_guard<std::mutex> lock(arrivalsMutex);
+        if (!arrivals.empty()) timestampTotal += m.timestamp;
+        arrivals.emplace_back(m.bytes[1], Clock::now());
+    });
+    std::vector<rtmidi::message> batch(timed);
+    for (int i = 0; i < timed; i++)
+    {
+        batch[i].bytes = {0x90, (unsigned char)(i & 0x7f), 1};
+        batch[i].timestamp = i == 0 ? 0 : 0.001;
+    }
+    const auto sent = Clock::now();
+    output.send_messages(batch);
+    std::this_thread::sleep_for(std::chrono::milliseconds(timed) + latency + jitter + std::chrono::milliseconds(50));
+    double lateMean = 0;
+    double lateMax = 0;
+    bool early = false;
+    bool ordered = true;
+    {
+        std::lock_guard<std::mutex> lock(arrivalsMutex);
+        Check(arrivals.size() == (size_t)timed, "every scheduled message delivered");
+        for (size_t i = 0; i < arrivals.size(); i++)
+        {
+            ordered = ordered && arrivals[i].first == (int)(i & 0x7f);
+            //due no earlier than i ms after the send, plus the latency
+            const double late = std::chrono::duration<double, std::micro>(arrivals[i].second - sent - std::chrono::milliseconds(i) - latency).count();
+            early = early || late < 0;
+            lateMean += late / arrivals.size();
+            if (late > lateMax) lateMax = late;
+        }
+        //the last one is due (timed - 1) ms after the first, plus the difference in their jitter
+        Check(std::fabs(timestampTotal - (timed - 1) * 0.001) <= 0.0005 + 1e-9, "delta timestamps add up to the spacing of the batch");
+    }
+    Check(ordered, "jitter never reorders a port");
+    Check(!early, "nothing arrives before it was due");
+
+    //sends to a port that's gone fail, so the port pool treats them as a lost device
+    rtmidi::loopback::set_latency(std::chrono::nanoseconds(0));
+    rtmidi::loopback::unplug(port);
+    output.send_message(noteOn, sizeof(noteOn));
+    Check(warnings == 1, "sending to an unplugged port reports an error");
+
+    std::printf("send_message() to input callback   %8.1f ns a message, over %d\n", sendNs, messages);
+    std::printf("2ms latency, 0.5ms jitter           %8.1f us late on average, %.1f us at most, over %d\n", lateMean, lateMax, timed);
+    std::printf("%s\n", failures == 0 ? "all checks passed" : "some checks FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+//==============================================================================
+/**
+@file       midilatency.cpp
+
+@brief      Round-trip latency of an rtmidi17 backend, from send_message() to the input callback
+
+            Opens the first output and the first input whose names contain the given text, then sends
+            one note-on at a time and waits for it to come back before sending the next, so each round
+            trip is timed on its own. Wire the two ports together to compare backends on the same path -
+            e.g. load snd-virmidi, then either run the seq API with `aconnect` linking the virmidi
+            client's ports, or the raw API on the same card, whose rawmidi devices loop back to the
+            sequencer side. The loopback API plugs its own port and needs no device at all.
+            Each trip is also split at the message's time_ns, to show how much of it is the backend's
+            own input thread.
+
+            Build:  c++ -std=c++17 -O2 -DRTMIDI17_HEADER_ONLY=1 -DRTMIDI17_ALSA=1 -DRTMIDI17_ALSA_RAW=1 -DRTMIDI17_LOOPBACK=1 -I../include -I../include/rtmidi17 midilatency.cpp -o midilatency -lasound -lpthread
+            Usage:  midilatency seq|raw|loopback [output name] [input name] [messages]
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include <rtmidi17.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+//index of the first port whose name contains part, or the port count if there isn't one
+unsigned int Find(const std::vector<rtmidi::port_information>& ports, const std::string& part)
+{
+    for (unsigned int i = 0; i < ports.size(); i++) if (ports[i].name.find(part) != std::string::npos) return i;
+    return (unsigned int)ports.size();
+}
+
+void List(const char* what, const std::vector<rtmidi::port_information>& ports)
+{
+    std::fprintf(stderr, "%s:\n", what);
+    for (const auto& port : ports) std::fprintf(stderr, "    %s\n", port.name.c_str());
+}
+
+void Print(const char* what, std::vector<double> us)
+{
+    std::sort(us.begin(), us.end());
+    double mean = 0;
+    for (const double u : us) mean += u / us.size();
+    std::printf("%-11s %8.1f us mean, %.1f us median, %.1f us 99th percentile, %.1f us max\n",
+        what, mean, us[us.size() / 2], us[std::min(us.size() - 1, us.size() * 99 / 100)], us.back());
+}
+}
+
+int main(int argc, const char* argv[])
+{
+    const std::string which = argc > 1 ? argv[1] : "";
+    rtmidi::API api;
+    if (which == "seq") api = rtmidi::API::LINUX_ALSA;
+    else if (which == "raw") api = rtmidi::API::LINUX_ALSA_RAW;
+    else if (which == "loopback") api = rtmidi::API::LOOPBACK;
+    else
+    {
+        std::fprintf(stderr, "usage: midilatency seq|raw|loopback [output name] [input name] [messages]\n");
+        return 1;
+    }
+    const int messages = argc > 4 ? std::atoi(argv[4]) : 1000;
+    if (messages < 1)
+    {
+        std::fprintf(stderr, "usage: midilatency seq|raw|loopback [output name] [input name] [messages >= 1]\n");
+        return 1;
+    }
+    if (api == rtmidi::API::LOOPBACK) rtmidi::loopback::plug("midilatency");
+    const std::string outputName = argc > 2 ? argv[2] : "";
+    const std::string inputName = argc > 3 ? argv[3] : outputName;
+
+    try
+    {
+        rtmidi::midi_in input(api, "midilatency");
+        rtmidi::midi_out output(api, "midilatency");
+        const auto inputs = input.get_ports();
+        const auto outputs = output.get_ports();
+        const unsigned int in = Find(inputs, inputName);
+        const unsigned int out = Find(outputs, outputName);
+        if (in == inputs.size() || out == outputs.size())
+        {
+            std::fprintf(stderr, "no matching %s\n", in == inputs.size() ? "input" : "output");
+            List("inputs", inputs);
+            List("outputs", outputs);
+            return 1;
+        }
+
+        //the callback only records the arrival - the sender waits for it
+        std::mutex mutex;
+        std::condition_variable arrived;
+        int received = -1;
+        Clock::time_point arrival;
+        int64_t stamped = 0;
+        input.set_callback([&](const rtmidi::message& m) {
+            if (m.bytes.size() != 3 || (m.bytes[0] & 0xf0) != 0x90) return;
+            const auto now = Clock::now();
+            std::lock_guard<std::mutex> lock(mutex);
+            received = m.bytes[1];
+            arrival = now;
+            stamped = m.time_ns;
+            arrived.notify_one();
+        });
+        input.open_port(in);
+        output.open_port(out);
+
+        std::vector<double> trips;
+        std::vector<double> toStamp;
+        int lost = 0;
+        for (int i = 0; i < messages; i++)
+        {
+            const unsigned char note = (unsigned char)(i & 0x7f);
+            const unsigned char noteOn[3] = {0x90, note, 100};
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                received = -1;
+            }
+            //not under the lock - the loopback delivers in this thread
+            const auto sent = Clock::now();
+            output.send_message(noteOn, sizeof(noteOn));
+            std::unique_lock<std::mutex> lock(mutex);
+            if (arrived.wait_for(lock, std::chrono::milliseconds(100), [&]() {return received == note;}))
+            {
+                trips.push_back(std::chrono::duration<double, std::micro>(arrival - sent).count());
+                //time_ns is on the steady clock too
+                toStamp.push_back((stamped - std::chrono::duration_cast<std::chrono::nanoseconds>(sent.time_since_epoch()).count()) / 1000.0);
+            }
+            else lost++;
+        }
+        if (trips.empty())
+        {
+            std::fprintf(stderr, "nothing came back from %s to %s - are they connected?\n", outputs[out].name.c_str(), inputs[in].name.c_str());
+            return 1;
+        }
+
+        std::printf("%s: %s -> %s\n", which.c_str(), outputs[out].name.c_str(), inputs[in].name.c_str());
+        Print("round trip", trips);
+        Print("to time_ns", toStamp);
+        std::printf("over %zu (%d lost)\n", trips.size(), lost);
+        return lost == 0 ? 0 : 1;
+    }
+    catch (const rtmidi::midi_exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,111 @@
+//==============================================================================
+/**
+@file       sendbench.cpp
+
+@brief      Per-send overhead of rtmidi::midi_out against rtmidi::basic_midi_out<Backend>
+
+            Sends the same mix of notes, controllers, pitch bend and clock through the type-erased
+            midi_out, which calls the backend through a pointer to midi_out_api, and through
+            basic_midi_out, which holds the backend by value so the call can inline. Built without a
+            backend define it uses the dummy API, whose send does nothing, so the times are the
+            call overhead alone; built with RTMIDI17_ALSA it sends to an ALSA virtual port with no
+            subscribers, so they're the whole cost of a send with the overhead as part of it.
+
+            Build:  c++ -std=c++17 -O2 -DRTMIDI17_HEADER_ONLY=1 -I../include -I../include/rtmidi17 sendbench.cpp -o sendbench -lpthread
+                    (add -DRTMIDI17_ALSA=1 ... -lasound for the ALSA sequencer)
+            Usage:  sendbench [messages]
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include <rtmidi17.hpp>
+#include <rtmidi17/basic_midi_out.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+#if defined(RTMIDI17_ALSA)
+using Backend = rtmidi::alsa_backend;
+#else
+using Backend = rtmidi::dummy_backend;
+#endif
+
+//ns per send to send every message in messages, over at least total messages
+template <typename Send>
+double Time(const std::vector<std::vector<unsigned char>>& messages, const int total, Send send)
+{
+    int done = 0;
+    const auto start = Clock::now();
+    while (done < total)
+    {
+        for (const auto& message : messages)
+        {
+            //read back through a volatile so a send that inlines to nothing still leaves a loop to time
+            const unsigned char* volatile bytes = message.data();
+            send(bytes, message.size());
+        }
+        done += (int)messages.size();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / done;
+}
+}
+
+int main(int argc, const char* argv[])
+{
+    const int messages = argc > 1 ? std::atoi(argv[1]) : 10000000;
+    if (messages < 1)
+    {
+        std::fprintf(stderr, "usage: sendbench [messages >= 1]\n");
+        return 1;
+    }
+
+    //what a control surface sends
+    std::vector<std::vector<unsigned char>> mix;
+    for (int i = 0; i < 16; i++)
+    {
+        mix.push_back({(unsigned char)(0x90 | (i & 0x0f)), (unsigned char)(36 + i), 100});
+        mix.push_back({(unsigned char)(0x80 | (i & 0x0f)), (unsigned char)(36 + i), 0});
+        mix.push_back({0xb0, (unsigned char)i, (unsigned char)(i * 8)});
+        mix.push_back({0xe0, (unsigned char)(i * 8), 0x40});
+        mix.push_back({0xf8});
+    }
+
+    double erasedNs = 0;
+    double directNs = 0;
+    try
+    {
+        rtmidi::midi_out erased{Backend::API, "sendbench"};
+        erased.open_virtual_port("sendbench erased");
+        rtmidi::basic_midi_out<Backend> direct{"sendbench"};
+        direct.open_virtual_port("sendbench direct");
+
+        //once through each first, so neither pays for warming up
+        Time(mix, (int)mix.size(), [&](const unsigned char* bytes, size_t size) {erased.send_message(bytes, size);});
+        Time(mix, (int)mix.size(), [&](const unsigned char* bytes, size_t size) {direct.send_message(bytes, size);});
+
+        erasedNs = Time(mix, messages, [&](const unsigned char* bytes, size_t size) {erased.send_message(bytes, size);});
+        directNs = Time(mix, messages, [&](const unsigned char* bytes, size_t size) {direct.send_message(bytes, size);});
+    }
+    catch (const rtmidi::midi_exception& e)
+    {
+        std::fprintf(stderr, "can't open the outputs: %s\n", e.what());
+        return 1;
+    }
+
+#if defined(RTMIDI17_ALSA)
+    std::printf("ALSA sequencer, virtual port\n");
+#else
+    std::printf("dummy API, send does nothing\n");
+#endif
+    std::printf("midi_out                 %8.2f ns a send\n", erasedNs);
+    std::printf("basic_midi_out<Backend>  %8.2f ns a send, over %d\n", directNs, messages);
+    std::printf("difference               %8.2f ns a send\n", erasedNs - directNs);
+    return 0;
+}
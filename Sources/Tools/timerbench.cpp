@@ -0,0 +1,96 @@
+//==============================================================================
+/**
+@file       timerbench.cpp
+
+@brief      Uncontended cost of a Timer tick, and of the event and semaphore polls under it
+
+            Schedules 1000 interval events on a 1ms Timer - the first one stamps the start of the
+            tick and the last one the end, so the time between them is what the tick spent walking
+            the events, polling each one's manual_event on the way.
+
+            Build:  c++ -std=c++17 -O2 -I../macOS -I../include/rtmidi17 timerbench.cpp -o timerbench -lpthread
+            Usage:  timerbench [events] [seconds]
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "timer.h"
+#include "detail/semaphore.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+//ns per call of poll, over iterations calls
+template <typename Poll>
+double TimePoll(const size_t iterations, Poll poll)
+{
+    const auto start = Clock::now();
+    for (size_t i = 0; i < iterations; i++) poll();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+}
+}
+
+int main(int argc, const char* argv[])
+{
+    const int events = argc > 1 ? std::atoi(argv[1]) : 1000;
+    const int seconds = argc > 2 ? std::atoi(argv[2]) : 3;
+    if (events < 2 || seconds < 1)
+    {
+        std::fprintf(stderr, "usage: timerbench [events >= 2] [seconds]\n");
+        return 1;
+    }
+
+    //the polls on their own
+    std::atomic<bool> sink{false};
+    manual_event event;
+    const double eventPoll = TimePoll(1000000, [&]() {sink.store(event.wait_for(std::chrono::seconds(0)), std::memory_order_relaxed);});
+    rtmidi::semaphore semaphore;
+    const double semaphoreTryWait = TimePoll(1000000, [&]() {sink.store(semaphore.try_wait(), std::memory_order_relaxed);});
+    const double semaphoreNotifyWait = TimePoll(1000000, [&]() {semaphore.notify(); semaphore.wait();});
+
+    //the Timer's own thread runs the ticks - the events only ever touch these from there
+    Clock::time_point tickStart;
+    double tickTotal = 0;
+    double tickMax = 0;
+    unsigned long long ticks = 0;
+    {
+        //Timer doesn't lock its event set, so they're all scheduled well inside the first 1ms sleep, as the plugin does
+        Timer timer(std::chrono::milliseconds(1));
+        std::vector<std::shared_ptr<manual_event>> handles;
+        handles.reserve(events);
+        for (int i = 0; i < events; i++)
+        {
+            if (i == 0) handles.push_back(timer.set_interval(std::chrono::milliseconds(1), [&]() {tickStart = Clock::now();}));
+            else if (i == events - 1) handles.push_back(timer.set_interval(std::chrono::milliseconds(1), [&]() {
+                const double tick = std::chrono::duration<double, std::micro>(Clock::now() - tickStart).count();
+                tickTotal += tick;
+                if (tick > tickMax) tickMax = tick;
+                ticks++;
+            }));
+            else handles.push_back(timer.set_interval(std::chrono::milliseconds(1), []() {}));
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        //cancel the two that write the results before the Timer goes away
+        handles.front()->signal();
+        handles.back()->signal();
+    }
+
+    std::printf("manual_event::wait_for(0s)    %8.1f ns\n", eventPoll);
+    std::printf("semaphore::try_wait() (empty) %8.1f ns\n", semaphoreTryWait);
+    std::printf("semaphore notify() + wait()   %8.1f ns\n", semaphoreNotifyWait);
+    if (ticks == 0)
+    {
+        std::printf("no complete ticks measured\n");
+        return 1;
+    }
+    std::printf("Timer tick, %d events         %8.1f us mean, %.1f us max, over %llu ticks (%.1f ns an event)\n", events, tickTotal / ticks, tickMax, ticks, tickTotal * 1000 / ticks / events);
+    return 0;
+}
@@ -0,0 +1,132 @@
+//==============================================================================
+/**
+@file       tracedecode.cpp
+
+@brief      Offline decoder for the binary trace written by TraceLog
+
+            Build:  c++ -std=c++17 -I.. tracedecode.cpp -o tracedecode
+            Usage:  tracedecode [--csv] midibutton.trace
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "TraceLog.h"
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <vector>
+
+namespace {
+const char* EventName(TraceEvent event)
+{
+    switch (event)
+    {
+        case TraceEvent::MIDI_IN: return "MIDI_IN";
+        case TraceEvent::MIDI_OUT: return "MIDI_OUT";
+        case TraceEvent::KEY_DOWN: return "KEY_DOWN";
+        case TraceEvent::KEY_UP: return "KEY_UP";
+        case TraceEvent::STATE_CHANGE: return "STATE_CHANGE";
+        case TraceEvent::FADE_STEP: return "FADE_STEP";
+        default: return "NONE";
+    }
+}
+}
+
+int main(int argc, char* argv[])
+{
+    bool csv = false;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--csv") == 0) csv = true;
+        else path = argv[i];
+    }
+    if (path == nullptr)
+    {
+        fprintf(stderr, "usage: %s [--csv] <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        fprintf(stderr, "couldn't open %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    //the header holds an atomic, so read it as raw bytes and pull the fields out
+    char headerBytes[sizeof(TraceFileHeader)];
+    if (!file.read(headerBytes, sizeof(headerBytes)) || memcmp(headerBytes, TRACE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s isn't a trace file\n", path);
+        return EXIT_FAILURE;
+    }
+    uint32_t version, recordSize, capacity;
+    int64_t wallClockAtOpen;
+    uint64_t steadyClockAtOpen, writeIndex;
+    memcpy(&version, headerBytes + offsetof(TraceFileHeader, version), sizeof(version));
+    memcpy(&recordSize, headerBytes + offsetof(TraceFileHeader, recordSize), sizeof(recordSize));
+    memcpy(&capacity, headerBytes + offsetof(TraceFileHeader, capacity), sizeof(capacity));
+    memcpy(&wallClockAtOpen, headerBytes + offsetof(TraceFileHeader, wallClockAtOpen), sizeof(wallClockAtOpen));
+    memcpy(&steadyClockAtOpen, headerBytes + offsetof(TraceFileHeader, steadyClockAtOpen), sizeof(steadyClockAtOpen));
+    memcpy(&writeIndex, headerBytes + offsetof(TraceFileHeader, writeIndex), sizeof(writeIndex));
+    if (version != TRACE_VERSION || recordSize != sizeof(TraceRecord) || capacity == 0)
+    {
+        fprintf(stderr, "%s: unsupported trace version %u / record size %u\n", path, version, recordSize);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<TraceRecord> records(capacity);
+    file.read(reinterpret_cast<char*>(records.data()), (std::streamsize)capacity * sizeof(TraceRecord));
+
+    //oldest surviving record first
+    const uint64_t first = writeIndex > capacity ? writeIndex - capacity : 0;
+    uint64_t skipped = 0;
+    uint64_t previous = 0;
+
+    if (csv) printf("index,time_ns,delta_us,event,context,size,bytes\n");
+    for (uint64_t index = first; index < writeIndex; index++)
+    {
+        const TraceRecord& record = records[index & (capacity - 1)];
+        if (record.sequence != (uint32_t)(index + 1))
+        {
+            //overwritten or half written when the file was taken
+            skipped++;
+            continue;
+        }
+
+        const int64_t wallClock = wallClockAtOpen + (int64_t)(record.timestamp - steadyClockAtOpen);
+        const double delta = previous != 0 ? (record.timestamp - previous) / 1000.0 : 0.0;
+        previous = record.timestamp;
+
+        std::string bytes;
+        for (int i = 0; i < record.size && i < 8; i++)
+        {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "%02X", record.bytes[i]);
+            if (!bytes.empty()) bytes += ' ';
+            bytes += hex;
+        }
+
+        if (csv)
+        {
+            printf("%llu,%lld,%.3f,%s,%d,%u,%s\n", (unsigned long long)index, (long long)wallClock, delta, EventName(record.event), record.contextId == UINT32_MAX ? -1 : (int)record.contextId, record.size, bytes.c_str());
+        }
+        else
+        {
+            const time_t seconds = (time_t)(wallClock / 1000000000);
+            std::tm tm = *std::localtime(&seconds);
+            char timeString[32];
+            strftime(timeString, sizeof(timeString), "%H:%M:%S", &tm);
+            printf("%s.%06lld +%10.3fus %-12s ctx %-5d %s\n", timeString, (long long)((wallClock / 1000) % 1000000), delta, EventName(record.event), record.contextId == UINT32_MAX ? -1 : (int)record.contextId, bytes.c_str());
+        }
+    }
+    if (skipped > 0) fprintf(stderr, "skipped %llu incomplete records\n", (unsigned long long)skipped);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+//==============================================================================
+/**
+@file       TraceLog.cpp
+
+@brief      Binary trace of MIDI and key events
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#include "TraceLog.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+TraceLog& TraceLog::Instance()
+{
+    //never destroyed, and the mapping never unmapped - the MIDI input and pool threads may still be tracing while statics
+    //are torn down at exit. The mapping is shared, so the kernel writes it back to the file when the process goes
+    static TraceLog* traceLog = new TraceLog();
+    return *traceLog;
+}
+
+bool TraceLog::Open(const std::string& path, uint32_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mMapping != nullptr)
+    {
+        //already mapped - the writers may still be holding mRecords, so we only ever re-enable the same file
+        if (path == mPath)
+        {
+            mEnabled.store(true, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    //round the capacity up to a power of two so the index can be masked
+    uint32_t ringSize = 1;
+    while (ringSize < capacity) ringSize <<= 1;
+
+    const size_t mappingSize = sizeof(TraceFileHeader) + (size_t)ringSize * sizeof(TraceRecord);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, (off_t)mappingSize) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    mMapping = mapping;
+    mMappingSize = mappingSize;
+    mPath = path;
+    mHeader = static_cast<TraceFileHeader*>(mapping);
+    mRecords = reinterpret_cast<TraceRecord*>(static_cast<char*>(mapping) + sizeof(TraceFileHeader));
+    mMask = ringSize - 1;
+
+    std::memcpy(mHeader->magic, TRACE_MAGIC, sizeof(mHeader->magic));
+    mHeader->version = TRACE_VERSION;
+    mHeader->recordSize = sizeof(TraceRecord);
+    mHeader->capacity = ringSize;
+    mHeader->wallClockAtOpen = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    mHeader->steadyClockAtOpen = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    mHeader->writeIndex.store(0, std::memory_order_relaxed);
+
+    mEnabled.store(true, std::memory_order_release);
+    return true;
+}
+
+void TraceLog::Close()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEnabled.store(false, std::memory_order_relaxed);
+    if (mMapping != nullptr) msync(mMapping, mMappingSize, MS_ASYNC);
+}
@@ -0,0 +1,107 @@
+//==============================================================================
+/**
+@file       TraceLog.h
+
+@brief      Binary trace of MIDI and key events
+
+            Fixed-size records in a memory-mapped ring file, for looking at timing without the cost of
+            building log strings. Sources/Tools/tracedecode.cpp turns the file into text or CSV.
+
+@copyright  (c) 2020, Clarion Music Ltd
+            This source code is licensed under the MIT-style license found in the LICENSE file.
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#define TRACE_MAGIC "MBTRACE1"
+#define TRACE_VERSION 1
+
+enum class TraceEvent : uint8_t
+{
+    NONE,
+    MIDI_IN,
+    MIDI_OUT, //as handed to the MIDI driver by the sender thread
+    KEY_DOWN,
+    KEY_UP,
+    STATE_CHANGE,
+    FADE_STEP,
+};
+
+//one event - 32 bytes, so two to a cache line
+struct TraceRecord
+{
+    uint64_t timestamp; //steady clock, ns
+    uint32_t sequence; //index + 1, written last - the decoder uses it to skip records that were being written
+    uint32_t contextId; //UINT32_MAX if not tied to a button
+    TraceEvent event;
+    uint8_t size; //number of valid bytes
+    uint8_t bytes[8];
+    uint8_t reserved[6];
+};
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must stay 32 bytes");
+
+//file header - followed by capacity TraceRecords
+struct TraceFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity; //records in the ring - a power of two
+    uint32_t reserved;
+    int64_t wallClockAtOpen; //system clock in ns, to put real times on the steady timestamps
+    uint64_t steadyClockAtOpen;
+    std::atomic<uint64_t> writeIndex; //total records ever claimed
+    uint8_t padding[16];
+};
+static_assert(sizeof(TraceFileHeader) == 64, "TraceFileHeader must stay 64 bytes");
+
+class TraceLog
+{
+public:
+    static TraceLog& Instance();
+
+    //map the ring file and start recording - the mapping is kept until exit, so Close() only stops recording
+    bool Open(const std::string& path, uint32_t capacity = 65536);
+    void Close();
+
+    bool IsEnabled() const { return mEnabled.load(std::memory_order_acquire); }
+
+    //record an event - an acquire load (pairs with the store in Open(), so the mapping is visible) and return when tracing is off
+    void Trace(TraceEvent event, uint32_t contextId, const unsigned char* bytes = nullptr, size_t size = 0)
+    {
+        if (!mEnabled.load(std::memory_order_acquire)) return;
+        const uint64_t index = mHeader->writeIndex.fetch_add(1, std::memory_order_relaxed);
+        TraceRecord& record = mRecords[index & mMask];
+        record.sequence = 0;
+        record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        record.contextId = contextId;
+        record.event = event;
+        record.size = (uint8_t)(size < sizeof(record.bytes) ? size : sizeof(record.bytes));
+        if (record.size > 0) std::memcpy(record.bytes, bytes, record.size);
+        std::atomic_thread_fence(std::memory_order_release);
+        record.sequence = (uint32_t)(index + 1);
+    }
+
+private:
+    TraceLog() = default;
+    TraceLog(const TraceLog&) = delete;
+    TraceLog& operator=(const TraceLog&) = delete;
+
+    std::mutex mMutex; //Open/Close only
+    std::atomic<bool> mEnabled{false};
+    std::string mPath;
+    void* mMapping = nullptr;
+    size_t mMappingSize = 0;
+    TraceFileHeader* mHeader = nullptr;
+    TraceRecord* mRecords = nullptr;
+    uint64_t mMask = 0;
+};
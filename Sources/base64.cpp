@@ -27,96 +27,286 @@
 
    René Nyffenegger rene.nyffenegger@adp-gmbh.ch
 
+   Altered for the MIDI button plugin: the per-character std::string
+   appends and base64_chars.find() lookups are replaced by table-driven
+   scalar code and SSSE3/AVX2 codecs (after Muła and Lemire) that write
+   into caller-supplied buffers, picked at runtime for the CPU.
+
 */
 
 #include "base64.h"
-#include <iostream>
 
-static const std::string base64_chars = 
+// The SIMD codecs use GCC/Clang target attributes and __builtin_cpu_supports,
+// so other compilers (MSVC) get the scalar codec only.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const char base64_chars[] =
              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
              "abcdefghijklmnopqrstuvwxyz"
              "0123456789+/";
 
-
-static inline bool is_base64(unsigned char c) {
-  return (isalnum(c) || (c == '+') || (c == '/'));
+// 0..63 for the alphabet, 0xff for everything else ('=' included)
+struct decode_table {
+  unsigned char values[256];
+  decode_table() {
+    for (int i = 0; i < 256; i++) values[i] = 0xff;
+    for (int i = 0; i < 64; i++) values[(unsigned char)base64_chars[i]] = (unsigned char)i;
+  }
+};
+const decode_table base64_values;
+
+// Scalar codec - also finishes off whatever the SIMD loops leave behind.
+
+size_t encode_scalar(unsigned char const* in, size_t len, char* out) {
+  char* start = out;
+  while (len >= 3) {
+    const unsigned int triple = (in[0] << 16) | (in[1] << 8) | in[2];
+    out[0] = base64_chars[(triple >> 18) & 0x3f];
+    out[1] = base64_chars[(triple >> 12) & 0x3f];
+    out[2] = base64_chars[(triple >> 6) & 0x3f];
+    out[3] = base64_chars[triple & 0x3f];
+    in += 3;
+    len -= 3;
+    out += 4;
+  }
+  if (len) {
+    const unsigned int triple = (in[0] << 16) | (len > 1 ? in[1] << 8 : 0);
+    out[0] = base64_chars[(triple >> 18) & 0x3f];
+    out[1] = base64_chars[(triple >> 12) & 0x3f];
+    out[2] = len > 1 ? base64_chars[(triple >> 6) & 0x3f] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  return out - start;
 }
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-  std::string ret;
-  int i = 0;
-  int j = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-
-  while (in_len--) {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for(i = 0; (i <4) ; i++)
-        ret += base64_chars[char_array_4[i]];
-      i = 0;
-    }
+size_t decode_scalar(char const* in, size_t len, unsigned char* out) {
+  unsigned char* start = out;
+  while (len >= 4) {
+    const unsigned char a = base64_values.values[(unsigned char)in[0]];
+    const unsigned char b = base64_values.values[(unsigned char)in[1]];
+    const unsigned char c = base64_values.values[(unsigned char)in[2]];
+    const unsigned char d = base64_values.values[(unsigned char)in[3]];
+    if ((a | b | c | d) & 0x80) break;
+    out[0] = (unsigned char)((a << 2) | (b >> 4));
+    out[1] = (unsigned char)((b << 4) | (c >> 2));
+    out[2] = (unsigned char)((c << 6) | d);
+    in += 4;
+    len -= 4;
+    out += 3;
   }
 
-  if (i)
-  {
-    for(j = i; j < 3; j++)
-      char_array_3[j] = '\0';
+  // tail: stop at the first character that isn't in the alphabet,
+  // and turn the i characters before it into i - 1 bytes
+  unsigned char quad[4];
+  size_t i = 0;
+  while (i < len && i < 4) {
+    const unsigned char value = base64_values.values[(unsigned char)in[i]];
+    if (value & 0x80) break;
+    quad[i++] = value;
+  }
+  if (i > 1) *out++ = (unsigned char)((quad[0] << 2) | (quad[1] >> 4));
+  if (i > 2) *out++ = (unsigned char)((quad[1] << 4) | (quad[2] >> 2));
+  if (i > 3) *out++ = (unsigned char)((quad[2] << 6) | quad[3]);
+  return out - start;
+}
 
-    char_array_4[0] = ( char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+#if defined(BASE64_X86)
+
+__attribute__((target("ssse3")))
+size_t encode_ssse3(unsigned char const* in, size_t len, char* out) {
+  char* start = out;
+  const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+
+  // 16 bytes are loaded for every 12 consumed
+  while (len >= 16) {
+    // spread each 3 bytes over 4 bytes, then pull the 6 bit fields into place
+    const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    const __m128i shuffled = _mm_shuffle_epi8(input, shuffle);
+    const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(shuffled, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(shuffled, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t0, t1);
+
+    // index -> character: pick an offset per range with one shuffle
+
+    __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, reduced), indices);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+    in += 12;
+    len -= 12;
+    out += 16;
+  }
+  return (out - start) + encode_scalar(in, len, out);
+}
 
-    for (j = 0; (j < i + 1); j++)
-      ret += base64_chars[char_array_4[j]];
+__attribute__((target("avx2")))
+size_t encode_avx2(unsigned char const* in, size_t len, char* out) {
+  char* start = out;
+  const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                          10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+
+  // each lane takes 12 bytes - the second lane's load ends 28 bytes in
+  while (len >= 28) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12));
+    const __m256i input = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+
+    const __m256i shuffled = _mm256_shuffle_epi8(input, shuffle);
+    const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(shuffled, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+    const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(shuffled, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t0, t1);
+
+    __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, reduced), indices);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+    in += 24;
+    len -= 24;
+    out += 32;
+  }
+  return (out - start) + encode_ssse3(in, len, out);
+}
 
-    while((i++ < 3))
-      ret += '=';
+__attribute__((target("ssse3")))
+size_t decode_ssse3(char const* in, size_t len, unsigned char* out) {
+  unsigned char* start = out;
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  // 16 bytes are stored for every 12 produced, so leave room for the overhang
+  while (len >= 24) {
+    const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(input, 4), _mm_set1_epi8(0x0f));
+    const __m128i lo_nibbles = _mm_and_si128(input, _mm_set1_epi8(0x0f));
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0) break; // '=' or junk - let the scalar code find it
+
+    const __m128i eq_2f = _mm_cmpeq_epi8(input, _mm_set1_epi8(0x2f));
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    const __m128i values = _mm_add_epi8(input, roll);
+
+    const __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(packed, pack));
+    in += 16;
+    len -= 16;
+    out += 12;
+  }
+  return (out - start) + decode_scalar(in, len, out);
+}
 
+__attribute__((target("avx2")))
+size_t decode_avx2(char const* in, size_t len, unsigned char* out) {
+  unsigned char* start = out;
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                          0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  // 32 bytes are stored for every 24 produced
+  while (len >= 48) {
+    const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+    const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(input, 4), _mm256_set1_epi8(0x0f));
+    const __m256i lo_nibbles = _mm256_and_si256(input, _mm256_set1_epi8(0x0f));
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) break;
+
+    const __m256i eq_2f = _mm256_cmpeq_epi8(input, _mm256_set1_epi8(0x2f));
+    const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    const __m256i values = _mm256_add_epi8(input, roll);
+
+    const __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    const __m256i packed = _mm256_shuffle_epi8(_mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)), pack);
+    const __m256i joined = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), joined);
+    in += 32;
+    len -= 32;
+    out += 24;
   }
+  return (out - start) + decode_ssse3(in, len, out);
+}
 
-  return ret;
+#endif
+
+// Codec picked once for this CPU
+struct codec {
+  size_t (*encode)(unsigned char const*, size_t, char*);
+  size_t (*decode)(char const*, size_t, unsigned char*);
+  const char* name;
+};
+
+codec pick_codec() {
+#if defined(BASE64_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return {encode_avx2, decode_avx2, "avx2"};
+  if (__builtin_cpu_supports("ssse3")) return {encode_ssse3, decode_ssse3, "ssse3"};
+#endif
+  return {encode_scalar, decode_scalar, "scalar"};
+}
 
+const codec& get_codec() {
+  static const codec picked = pick_codec();
+  return picked;
 }
 
-std::string base64_decode(std::string const& encoded_string) {
-  size_t in_len = encoded_string.size();
-  int i = 0;
-  int j = 0;
-  int in_ = 0;
-  unsigned char char_array_4[4], char_array_3[3];
-  std::string ret;
-
-  while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-    char_array_4[i++] = encoded_string[in_]; in_++;
-    if (i ==4) {
-      for (i = 0; i <4; i++)
-        char_array_4[i] = base64_chars.find(char_array_4[i]) & 0xff;
-
-      char_array_3[0] = ( char_array_4[0] << 2       ) + ((char_array_4[1] & 0x30) >> 4);
-      char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) +   char_array_4[3];
-
-      for (i = 0; (i < 3); i++)
-        ret += char_array_3[i];
-      i = 0;
-    }
-  }
+}
 
-  if (i) {
-    for (j = 0; j < i; j++)
-      char_array_4[j] = base64_chars.find(char_array_4[j]) & 0xff;
+size_t base64_encode_into(unsigned char const* in, size_t len, char* out) {
+  return get_codec().encode(in, len, out);
+}
 
-    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-    char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+size_t base64_decode_into(char const* in, size_t len, unsigned char* out) {
+  return get_codec().decode(in, len, out);
+}
 
-    for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
-  }
+const char* base64_codec_name() {
+  return get_codec().name;
+}
 
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+  std::string ret(base64_encoded_size(in_len), '\0');
+  base64_encode_into(bytes_to_encode, in_len, &ret[0]);
+  return ret;
+}
+
+std::string base64_decode(std::string const& encoded_string) {
+  std::string ret(base64_decoded_max_size(encoded_string.size()), '\0');
+  ret.resize(base64_decode_into(encoded_string.data(), encoded_string.size(), reinterpret_cast<unsigned char*>(&ret[0])));
   return ret;
 }
@@ -2,13 +2,36 @@
 //  base64 encoding and decoding with C++.
 //  Version: 1.01.00
 //
+//  Altered for the MIDI button plugin: SSSE3/AVX2 codecs with a scalar
+//  fallback, and encode/decode into caller-supplied buffers.
+//
 
 #ifndef BASE64_H_C0CE2A47_D10E_42C9_A27C_C883944E704A
 #define BASE64_H_C0CE2A47_D10E_42C9_A27C_C883944E704A
 
 #include <string>
+#include <cstddef>
 
 std::string base64_encode(unsigned char const* , unsigned int len);
 std::string base64_decode(std::string const& s);
 
+// Exact number of characters base64_encode_into() writes for len bytes
+// (padded, no terminator).
+inline size_t base64_encoded_size(size_t len) { return (len + 2) / 3 * 4; }
+
+// Upper bound on the bytes base64_decode_into() writes for len characters.
+inline size_t base64_decoded_max_size(size_t len) { return (len + 3) / 4 * 3; }
+
+// Encode len bytes into out, which must hold base64_encoded_size(len)
+// characters. Returns the number of characters written.
+size_t base64_encode_into(unsigned char const* in, size_t len, char* out);
+
+// Decode up to the first '=' or non-base64 character, like base64_decode().
+// out must hold base64_decoded_max_size(len) bytes. Returns the number of
+// bytes written.
+size_t base64_decode_into(char const* in, size_t len, unsigned char* out);
+
+// Name of the codec picked for this CPU ("avx2", "ssse3" or "scalar").
+const char* base64_codec_name();
+
 #endif /* BASE64_H_C0CE2A47_D10E_42C9_A27C_C883944E704A */
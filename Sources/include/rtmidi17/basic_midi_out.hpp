@@ -0,0 +1,153 @@
+#pragma once
+#include <rtmidi17/rtmidi17.hpp>
+#include <rtmidi17/detail/backends.hpp>
+
+namespace rtmidi
+{
+/**********************************************************************/
+/*! \class basic_midi_out
+    \brief A realtime MIDI output bound to one API at compile time.
+
+    Backend is the backend description of an API compiled into this
+    build: alsa_backend, alsa_raw_backend, jack_backend, core_backend,
+    winmm_backend, winuwp_backend, loopback_backend or dummy_backend.
+    Where midi_out picks its API at run time and calls it through a
+    pointer to midi_out_api, basic_midi_out holds the backend's output
+    by value. The backend output classes are all final, so every call
+    here is a direct one and send_message() can inline down to the
+    backend's own encode-and-write code.
+
+    Use it when a build only ever uses one API; midi_out is still there
+    for builds that choose between several.
+*/
+/**********************************************************************/
+
+template <typename Backend>
+class basic_midi_out
+{
+public:
+  using backend = Backend;
+  using api_type = typename Backend::midi_out;
+
+  //! Opens the backend's client. Throws if the MIDI system can't be initialized.
+  explicit basic_midi_out(std::string_view clientName) : api_{clientName}
+  {
+  }
+
+  basic_midi_out() : basic_midi_out{"RtMidi client"}
+  {
+  }
+
+  basic_midi_out(const basic_midi_out&) = delete;
+  basic_midi_out& operator=(const basic_midi_out&) = delete;
+
+  //! Returns the MIDI API this output was built for.
+  static constexpr rtmidi::API get_current_api() noexcept
+  {
+    return Backend::API;
+  }
+
+  //! Open a MIDI output connection. See midi_out::open_port().
+  void open_port(unsigned int portNumber, std::string_view portName)
+  {
+    api_.open_port(portNumber, portName);
+  }
+  void open_port(unsigned int portNumber = 0)
+  {
+    open_port(portNumber, "RtMidi17 Output");
+  }
+
+  //! Create a virtual output port. See midi_out::open_virtual_port().
+  void open_virtual_port(std::string_view portName)
+  {
+    api_.open_virtual_port(portName);
+  }
+  void open_virtual_port()
+  {
+    open_virtual_port("RtMidi17 virtual port");
+  }
+
+  //! Close an open MIDI connection (if one exists).
+  void close_port()
+  {
+    api_.close_port();
+  }
+
+  //! Returns true if a port is open and false if not.
+  bool is_port_open() const noexcept
+  {
+    return api_.is_port_open();
+  }
+
+  //! Return the number of available MIDI output ports.
+  unsigned int get_port_count()
+  {
+    return api_.get_port_count();
+  }
+
+  //! Return a string identifier for the specified MIDI port number.
+  std::string get_port_name(unsigned int portNumber = 0)
+  {
+    return api_.get_port_name(portNumber);
+  }
+
+  //! Return every available MIDI output port, in port number order.
+  std::vector<port_information> get_ports()
+  {
+    return api_.get_ports();
+  }
+
+  //! Immediately send a single message out an open MIDI output port.
+  /*!
+      An exception is thrown if an error occurs during output or an
+      output connection was not previously established.
+
+      \param message A pointer to the MIDI message as raw bytes
+      \param size    Length of the MIDI message in bytes
+  */
+  void send_message(const unsigned char* message, size_t size)
+  {
+    api_.send_message(message, size);
+  }
+
+  void send_message(const std::vector<unsigned char>& message)
+  {
+    send_message(message.data(), message.size());
+  }
+
+  void send_message(const rtmidi::message& message)
+  {
+    send_message(message.bytes.data(), message.bytes.size());
+  }
+
+  //! Send several messages in one go. See midi_out::send_messages().
+  void send_messages(const rtmidi::message* messages, size_t count)
+  {
+    api_.send_messages(messages, count);
+  }
+
+  void send_messages(const std::vector<rtmidi::message>& messages)
+  {
+    send_messages(messages.data(), messages.size());
+  }
+
+  //! Set an error callback function to be invoked when an error has occured.
+  void set_error_callback(midi_error_callback errorCallback) noexcept
+  {
+    api_.set_error_callback(std::move(errorCallback));
+  }
+
+  void set_client_name(std::string_view clientName)
+  {
+    api_.set_client_name(clientName);
+  }
+
+  void set_port_name(std::string_view portName)
+  {
+    api_.set_port_name(portName);
+  }
+
+private:
+  api_type api_;
+};
+}
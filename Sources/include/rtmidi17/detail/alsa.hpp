@@ -1,13 +1,18 @@
 #pragma once
+#include <algorithm>
 #include <alsa/asoundlib.h>
 #include <atomic>
+#include <condition_variable>
 #include <map>
-#include <pthread.h>
+#include <mutex>
+#include <poll.h>
 #include <rtmidi17/detail/midi_api.hpp>
 #include <rtmidi17/rtmidi17.hpp>
 #include <sstream>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <thread>
+#include <unistd.h>
 
 //*********************************************************************//
 //  API: LINUX ALSA SEQUENCER
@@ -28,6 +33,44 @@
 
 namespace rtmidi
 {
+// True if the port is a MIDI port with all of the capabilities in type.
+inline bool portMatches(snd_seq_port_info_t* pinfo, unsigned int type)
+{
+  unsigned int atyp = snd_seq_port_info_get_type(pinfo);
+  if (((atyp & SND_SEQ_PORT_TYPE_MIDI_GENERIC) == 0) && ((atyp & SND_SEQ_PORT_TYPE_SYNTH) == 0)
+      && ((atyp & SND_SEQ_PORT_TYPE_APPLICATION) == 0))
+    return false;
+
+  unsigned int caps = snd_seq_port_info_get_capability(pinfo);
+  return (caps & type) == type;
+}
+
+// The name get_port_name() reports for the port in pinfo.
+inline std::string portName(snd_seq_t* seq, snd_seq_port_info_t* pinfo)
+{
+  snd_seq_client_info_t* cinfo;
+  snd_seq_client_info_alloca(&cinfo);
+
+  int cnum = snd_seq_port_info_get_client(pinfo);
+  snd_seq_get_any_client_info(seq, cnum, cinfo);
+  std::ostringstream os;
+  os << snd_seq_client_info_get_name(cinfo);
+  os << ":";
+  os << snd_seq_port_info_get_name(pinfo);
+  os << " "; // These lines added to make sure devices are listed
+  os << snd_seq_port_info_get_client(pinfo); // with full portnames added to ensure individual
+                                             // device names
+  os << ":";
+  os << snd_seq_port_info_get_port(pinfo);
+  return os.str();
+}
+
+// The port_information::id for an ALSA address - client and port are both 8 bits.
+inline unsigned int portId(int client, int port)
+{
+  return ((unsigned int)client << 8) | (unsigned int)port;
+}
+
 // This function is used to count or get the pinfo structure for a given port
 // number.
 inline unsigned int
@@ -49,13 +92,7 @@ portInfo(snd_seq_t* seq, snd_seq_port_info_t* pinfo, unsigned int type, int port
     snd_seq_port_info_set_port(pinfo, -1);
     while (snd_seq_query_next_port(seq, pinfo) >= 0)
     {
-      unsigned int atyp = snd_seq_port_info_get_type(pinfo);
-      if (((atyp & SND_SEQ_PORT_TYPE_MIDI_GENERIC) == 0) && ((atyp & SND_SEQ_PORT_TYPE_SYNTH) == 0)
-          && ((atyp & SND_SEQ_PORT_TYPE_APPLICATION) == 0))
-        continue;
-
-      unsigned int caps = snd_seq_port_info_get_capability(pinfo);
-      if ((caps & type) != type)
+      if (!portMatches(pinfo, type))
         continue;
       if (count == portNumber)
         return 1;
@@ -69,6 +106,213 @@ portInfo(snd_seq_t* seq, snd_seq_port_info_t* pinfo, unsigned int type, int port
   return 0;
 }
 
+// Every port with the capabilities in type, in port number order, from a
+// single walk of the clients - portInfo() walks them again for each port.
+inline std::vector<port_information> portList(snd_seq_t* seq, unsigned int type)
+{
+  std::vector<port_information> ports;
+  snd_seq_client_info_t* cinfo{};
+  snd_seq_port_info_t* pinfo{};
+  snd_seq_client_info_alloca(&cinfo);
+  snd_seq_port_info_alloca(&pinfo);
+
+  snd_seq_client_info_set_client(cinfo, -1);
+  while (snd_seq_query_next_client(seq, cinfo) >= 0)
+  {
+    int client = snd_seq_client_info_get_client(cinfo);
+    if (client == 0)
+      continue;
+    snd_seq_port_info_set_client(pinfo, client);
+    snd_seq_port_info_set_port(pinfo, -1);
+    while (snd_seq_query_next_port(seq, pinfo) >= 0)
+    {
+      if (!portMatches(pinfo, type))
+        continue;
+      ports.push_back({portId(client, snd_seq_port_info_get_port(pinfo)), portName(seq, pinfo)});
+    }
+  }
+  return ports;
+}
+
+// Fills in ev for a complete channel voice, system common or realtime message,
+// as snd_midi_event_encode() would, without running the byte-stream parser.
+// Returns false for SysEx, running status and anything malformed - those are
+// left to the encoder.
+inline bool encodeEvent(const unsigned char* message, size_t size, snd_seq_event_t& ev)
+{
+  if (size == 0 || size > 3 || message[0] < 0x80)
+    return false;
+  for (size_t i = 1; i < size; i++)
+    if (message[i] & 0x80)
+      return false;
+
+  const unsigned char status = message[0];
+  const unsigned char channel = status & 0x0f;
+  switch (status & 0xf0)
+  {
+    case 0x80:
+      if (size != 3)
+        return false;
+      snd_seq_ev_set_noteoff(&ev, channel, message[1], message[2]);
+      return true;
+    case 0x90:
+      if (size != 3)
+        return false;
+      snd_seq_ev_set_noteon(&ev, channel, message[1], message[2]);
+      return true;
+    case 0xA0:
+      if (size != 3)
+        return false;
+      snd_seq_ev_set_keypress(&ev, channel, message[1], message[2]);
+      return true;
+    case 0xB0:
+      if (size != 3)
+        return false;
+      snd_seq_ev_set_controller(&ev, channel, message[1], message[2]);
+      return true;
+    case 0xC0:
+      if (size != 2)
+        return false;
+      snd_seq_ev_set_pgmchange(&ev, channel, message[1]);
+      return true;
+    case 0xD0:
+      if (size != 2)
+        return false;
+      snd_seq_ev_set_chanpress(&ev, channel, message[1]);
+      return true;
+    case 0xE0:
+      if (size != 3)
+        return false;
+      snd_seq_ev_set_pitchbend(&ev, channel, ((message[2] << 7) | message[1]) - 8192);
+      return true;
+  }
+
+  // System common and realtime - the ones the encoder knows, at the length it expects
+  snd_seq_event_type_t type;
+  size_t expected = 1;
+  switch (status)
+  {
+    case 0xF1:
+      type = SND_SEQ_EVENT_QFRAME;
+      expected = 2;
+      break;
+    case 0xF2:
+      type = SND_SEQ_EVENT_SONGPOS;
+      expected = 3;
+      break;
+    case 0xF3:
+      type = SND_SEQ_EVENT_SONGSEL;
+      expected = 2;
+      break;
+    case 0xF6:
+      type = SND_SEQ_EVENT_TUNE_REQUEST;
+      break;
+    case 0xF8:
+      type = SND_SEQ_EVENT_CLOCK;
+      break;
+    case 0xFA:
+      type = SND_SEQ_EVENT_START;
+      break;
+    case 0xFB:
+      type = SND_SEQ_EVENT_CONTINUE;
+      break;
+    case 0xFC:
+      type = SND_SEQ_EVENT_STOP;
+      break;
+    case 0xFE:
+      type = SND_SEQ_EVENT_SENSING;
+      break;
+    case 0xFF:
+      type = SND_SEQ_EVENT_RESET;
+      break;
+    default:
+      return false;
+  }
+  if (size != expected)
+    return false;
+  ev.type = type;
+  if (size == 2)
+    ev.data.control.value = message[1];
+  else if (size == 3)
+    ev.data.control.value = (message[2] << 7) | message[1];
+  return true;
+}
+
+// The other way - writes the bytes for a channel voice, system common or
+// realtime event to bytes, which has room for three, as snd_midi_event_decode()
+// would with running status off - and 0xF9 for a timing tick, which it has no
+// byte for. Returns how many, or 0 for SysEx and the rest, which are left to
+// the decoder.
+inline size_t decodeEvent(const snd_seq_event_t& ev, unsigned char* bytes)
+{
+  const unsigned char noteChannel = ev.data.note.channel & 0x0f;
+  const unsigned char controlChannel = ev.data.control.channel & 0x0f;
+  switch (ev.type)
+  {
+    case SND_SEQ_EVENT_NOTEOFF:
+    case SND_SEQ_EVENT_NOTEON:
+    case SND_SEQ_EVENT_KEYPRESS:
+      bytes[0] = (ev.type == SND_SEQ_EVENT_NOTEOFF ? 0x80 : ev.type == SND_SEQ_EVENT_NOTEON ? 0x90 : 0xA0)
+                 | noteChannel;
+      bytes[1] = ev.data.note.note & 0x7f;
+      bytes[2] = ev.data.note.velocity & 0x7f;
+      return 3;
+    case SND_SEQ_EVENT_CONTROLLER:
+      bytes[0] = 0xB0 | controlChannel;
+      bytes[1] = ev.data.control.param & 0x7f;
+      bytes[2] = ev.data.control.value & 0x7f;
+      return 3;
+    case SND_SEQ_EVENT_PGMCHANGE:
+    case SND_SEQ_EVENT_CHANPRESS:
+      bytes[0] = (ev.type == SND_SEQ_EVENT_PGMCHANGE ? 0xC0 : 0xD0) | controlChannel;
+      bytes[1] = ev.data.control.value & 0x7f;
+      return 2;
+    case SND_SEQ_EVENT_PITCHBEND:
+    {
+      const int value = ev.data.control.value + 8192;
+      bytes[0] = 0xE0 | controlChannel;
+      bytes[1] = value & 0x7f;
+      bytes[2] = (value >> 7) & 0x7f;
+      return 3;
+    }
+    case SND_SEQ_EVENT_QFRAME:
+    case SND_SEQ_EVENT_SONGSEL:
+      bytes[0] = ev.type == SND_SEQ_EVENT_QFRAME ? 0xF1 : 0xF3;
+      bytes[1] = ev.data.control.value & 0x7f;
+      return 2;
+    case SND_SEQ_EVENT_SONGPOS:
+      bytes[0] = 0xF2;
+      bytes[1] = ev.data.control.value & 0x7f;
+      bytes[2] = (ev.data.control.value >> 7) & 0x7f;
+      return 3;
+    case SND_SEQ_EVENT_TUNE_REQUEST:
+      bytes[0] = 0xF6;
+      return 1;
+    case SND_SEQ_EVENT_CLOCK:
+      bytes[0] = 0xF8;
+      return 1;
+    case SND_SEQ_EVENT_TICK:
+      bytes[0] = 0xF9;
+      return 1;
+    case SND_SEQ_EVENT_START:
+      bytes[0] = 0xFA;
+      return 1;
+    case SND_SEQ_EVENT_CONTINUE:
+      bytes[0] = 0xFB;
+      return 1;
+    case SND_SEQ_EVENT_STOP:
+      bytes[0] = 0xFC;
+      return 1;
+    case SND_SEQ_EVENT_SENSING:
+      bytes[0] = 0xFE;
+      return 1;
+    case SND_SEQ_EVENT_RESET:
+      bytes[0] = 0xFF;
+      return 1;
+  }
+  return 0;
+}
+
 // A structure to hold variables related to the ALSA API
 // implementation.
 struct alsa_data
@@ -78,11 +322,6 @@ struct alsa_data
   snd_seq_port_subscribe_t* subscription{};
   snd_midi_event_t* coder{};
   unsigned int bufferSize{};
-  pthread_t thread{};
-  pthread_t dummy_thread_id{};
-  snd_seq_real_time_t lastTime{};
-  int queue_id{}; // an input queue is needed to get timestamped events
-  int trigger_fds[2]{};
   std::vector<unsigned char> buffer;
 };
 
@@ -91,7 +330,6 @@ class observer_alsa final : public observer_api
 public:
   observer_alsa(observer::callbacks&& c) : observer_api{std::move(c)}
   {
-    using namespace std::literals;
     int err = snd_seq_open(&seq_, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
     if (err < 0)
     {
@@ -100,9 +338,18 @@ public:
 
     client_ = snd_seq_client_id(seq_);
 
+    // The sequencer's descriptors, plus the read end of a pipe that wakes the
+    // poll thread for shutdown
+    if (pipe(trigger_fds_) == -1)
+    {
+      snd_seq_close(seq_);
+      throw driver_error("observer_alsa: error creating pipe objects");
+    }
     auto N = snd_seq_poll_descriptors_count(seq_, POLLIN);
-    descriptors_.resize(N);
+    descriptors_.resize(N + 1);
     snd_seq_poll_descriptors(seq_, descriptors_.data(), N, POLLIN);
+    descriptors_[N].fd = trigger_fds_[0];
+    descriptors_[N].events = POLLIN;
 
     err = snd_seq_set_client_name(seq_, "rtmidi17-observe");
     if (err < 0)
@@ -127,20 +374,28 @@ public:
       throw driver_error("observer_alsa: snd_seq_connect_from failed");
     }
 
+    add_existing_ports();
+
     running = true;
+    dispatch_ = std::thread{[this] { dispatch_notifications(); }};
     poll_ = std::thread{[this] {
       while (this->running)
       {
         int err = poll(descriptors_.data(), descriptors_.size(), -1);
-        if (err > 0)
+        if (err <= 0)
+          continue;
+        if (descriptors_.back().revents & POLLIN)
+          break;
+
+        // Drain everything that's pending, so a burst is handled in one
+        // wakeup - -ENOSPC only means the input buffer overran, and there's
+        // still more to read
+        snd_seq_event_t* ev{};
+        while ((err = snd_seq_event_input(seq_, &ev)) >= 0 || err == -ENOSPC)
         {
-          snd_seq_event_t* ev;
-          while (snd_seq_event_input(seq_, &ev) >= 0)
-          {
+          if (err >= 0 && ev)
             handle_event(ev);
-          }
         }
-        std::this_thread::sleep_for(1s);
       }
     }};
   }
@@ -154,33 +409,46 @@ public:
     bool isOutput{};
   };
 
-  port_info get_info(int client, int port)
+  // Reports the port the way midi_in/midi_out enumerate it - false if it's gone
+  bool get_info(int client, int port, port_info& p)
   {
-    port_info p;
     p.client = client;
     p.port = port;
 
-    snd_seq_client_info_t* cinfo;
-    snd_seq_client_info_alloca(&cinfo);
-    snd_seq_get_any_client_info(seq_, client, cinfo);
-
     snd_seq_port_info_t* pinfo;
     snd_seq_port_info_alloca(&pinfo);
-    snd_seq_get_any_port_info(seq_, client, port, pinfo);
-
-    p.name = std::to_string(p.client) + ":" + std::to_string(p.port);
+    if (snd_seq_get_any_port_info(seq_, client, port, pinfo) < 0)
+      return false;
 
-    if (auto name = snd_seq_client_info_get_name(cinfo))
-      p.name += std::string(" ") + name;
-    p.name += " - ";
-    if (auto name = snd_seq_port_info_get_name(pinfo))
-      p.name += std::string(" ") + name;
+    p.name = portName(seq_, pinfo);
+    p.isInput = portMatches(pinfo, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ);
+    p.isOutput = portMatches(pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+    return true;
+  }
 
-    auto cap = snd_seq_port_info_get_capability(pinfo);
-    p.isInput = (cap & SND_SEQ_PORT_CAP_DUPLEX) | (cap & SND_SEQ_PORT_CAP_READ);
-    p.isOutput = (cap & SND_SEQ_PORT_CAP_DUPLEX) | (cap & SND_SEQ_PORT_CAP_WRITE);
+  // The ports that were there before the observer, so their removal can be reported
+  void add_existing_ports()
+  {
+    snd_seq_client_info_t* cinfo;
+    snd_seq_port_info_t* pinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
 
-    return p;
+    snd_seq_client_info_set_client(cinfo, -1);
+    while (snd_seq_query_next_client(seq_, cinfo) >= 0)
+    {
+      int client = snd_seq_client_info_get_client(cinfo);
+      if (client == 0 || client == client_)
+        continue;
+      snd_seq_port_info_set_client(pinfo, client);
+      snd_seq_port_info_set_port(pinfo, -1);
+      while (snd_seq_query_next_port(seq_, pinfo) >= 0)
+      {
+        port_info p;
+        if (get_info(client, snd_seq_port_info_get_port(pinfo), p))
+          knownClients_[{p.client, p.port}] = p;
+      }
+    }
   }
 
   void handle_event(snd_seq_event_t* ev)
@@ -189,44 +457,30 @@ public:
     {
       case SND_SEQ_EVENT_PORT_START:
       {
-        auto p = get_info(ev->data.addr.client, ev->data.addr.port);
-        if (p.client == client_)
+        port_info p;
+        if (ev->data.addr.client == client_ || !get_info(ev->data.addr.client, ev->data.addr.port, p))
           return;
 
         knownClients_[{p.client, p.port}] = p;
-        if (p.isInput && callbacks_.input_added)
-        {
-          callbacks_.input_added(p.port, p.name);
-        }
-
-        if (p.isOutput && callbacks_.output_added)
-        {
-          callbacks_.output_added(p.port, p.name);
-        }
+        if (p.isInput)
+          notify(notification_type::input_added, p);
+        if (p.isOutput)
+          notify(notification_type::output_added, p);
         break;
       }
       case SND_SEQ_EVENT_PORT_EXIT:
       {
-        auto p = get_info(ev->data.addr.client, ev->data.addr.port);
-        if (p.client == client_)
+        // The port has already gone, so what it was comes from knownClients_
+        auto it = knownClients_.find({ev->data.addr.client, ev->data.addr.port});
+        if (it == knownClients_.end())
           return;
+        port_info p = std::move(it->second);
+        knownClients_.erase(it);
 
-        auto it = knownClients_.find({p.client, p.port});
-        if (it != knownClients_.end())
-        {
-          p = it->second;
-          knownClients_.erase(it);
-        }
-
-        if (p.isInput && callbacks_.input_removed)
-        {
-          callbacks_.input_removed(p.port, p.name);
-        }
-
-        if (p.isOutput && callbacks_.output_added)
-        {
-          callbacks_.output_removed(p.port, p.name);
-        }
+        if (p.isInput)
+          notify(notification_type::input_removed, p);
+        if (p.isOutput)
+          notify(notification_type::output_removed, p);
         break;
       }
       case SND_SEQ_EVENT_PORT_CHANGE:
@@ -241,95 +495,318 @@ public:
   ~observer_alsa()
   {
     running = false;
+    char wake = 0;
+    write(trigger_fds_[1], &wake, sizeof(wake));
     assert(poll_.joinable());
     poll_.join();
 
+    {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      dispatching_ = false;
+    }
+    queueCondition_.notify_one();
+    if (dispatch_.joinable())
+      dispatch_.join();
+
+    close(trigger_fds_[0]);
+    close(trigger_fds_[1]);
     snd_seq_delete_port(seq_, port_);
     snd_seq_close(seq_);
   }
 
 private:
+  enum class notification_type
+  {
+    input_added,
+    input_removed,
+    output_added,
+    output_removed
+  };
+
+  struct notification
+  {
+    notification_type type{};
+    int id{};
+    std::string name;
+  };
+
+  // Callbacks are made from the dispatch thread, so a slow one never holds up
+  // reading the sequencer
+  void notify(notification_type type, const port_info& p)
+  {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      queue_.push_back({type, (int)portId(p.client, p.port), p.name});
+    }
+    queueCondition_.notify_one();
+  }
+
+  void dispatch_notifications()
+  {
+    std::vector<notification> pending;
+    std::unique_lock<std::mutex> lock(queueMutex_);
+    while (true)
+    {
+      queueCondition_.wait(lock, [this] { return !dispatching_ || !queue_.empty(); });
+      if (!dispatching_)
+        break;
+      pending.swap(queue_);
+      lock.unlock();
+
+      for (auto& n : pending)
+      {
+        const std::function<void(int, std::string)>* callback{};
+        switch (n.type)
+        {
+          case notification_type::input_added:
+            callback = &callbacks_.input_added;
+            break;
+          case notification_type::input_removed:
+            callback = &callbacks_.input_removed;
+            break;
+          case notification_type::output_added:
+            callback = &callbacks_.output_added;
+            break;
+          case notification_type::output_removed:
+            callback = &callbacks_.output_removed;
+            break;
+        }
+        if (*callback)
+          (*callback)(n.id, std::move(n.name));
+      }
+      pending.clear();
+      lock.lock();
+    }
+  }
+
   snd_seq_t* seq_{};
   std::atomic_bool running{false};
   std::thread poll_;
   std::vector<pollfd> descriptors_;
+  int trigger_fds_[2]{-1, -1};
   std::map<std::pair<int, int>, port_info> knownClients_;
   int client_{};
   int port_{};
+
+  // Notifications from the poll thread, waiting for the dispatch thread
+  std::thread dispatch_;
+  std::mutex queueMutex_;
+  std::condition_variable queueCondition_;
+  std::vector<notification> queue_;
+  bool dispatching_{true};
 };
 
-class midi_in_alsa final : public midi_in_api
+class midi_in_alsa;
+
+// The sequencer client and the thread behind every ALSA input in the process.
+// Each midi_in_alsa has a port of its own on the one client. The thread waits
+// on the client with epoll, reads everything pending, and hands each event to
+// the input that owns the port it was delivered to, so opening more inputs
+// adds ports and subscriptions but no clients or threads.
+class alsa_input_reactor : public std::enable_shared_from_this<alsa_input_reactor>
 {
 public:
-  midi_in_alsa(std::string_view clientName, unsigned int queueSizeLimit)
-      : midi_in_api{&data, queueSizeLimit}
+  // The running reactor, or a new one whose client is called clientName
+  static std::shared_ptr<alsa_input_reactor> acquire(std::string_view clientName)
   {
-    // Set up the ALSA sequencer client.
-    snd_seq_t* seq;
-    int result = snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
-    if (result < 0)
+    static std::mutex mutex;
+    static std::weak_ptr<alsa_input_reactor> current;
+    std::lock_guard<std::mutex> lock{mutex};
+    auto reactor = current.lock();
+    if (!reactor)
     {
-      error<driver_error>(
-          "MidiInAlsa::initialize: error creating ALSA sequencer client "
-          "object.");
-      return;
+      reactor = std::make_shared<alsa_input_reactor>(clientName);
+      // Started once it's owned, so the thread can take references to it
+      reactor->thread_ = std::thread{[r = reactor.get()] { r->run(); }};
+      current = reactor;
     }
+    return reactor;
+  }
 
-    // Set client name.
-    snd_seq_set_client_name(seq, clientName.data());
-
-    // Save our api-specific connection information.
-    data.seq = seq;
-    data.vport = -1;
-    data.subscription = nullptr;
-    data.dummy_thread_id = pthread_self();
-    data.thread = data.dummy_thread_id;
-    data.trigger_fds[0] = -1;
-    data.trigger_fds[1] = -1;
-
-    if (pipe(data.trigger_fds) == -1)
+  explicit alsa_input_reactor(std::string_view clientName)
+  {
+    if (snd_seq_open(&seq_, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0)
+      throw driver_error("MidiInAlsa::initialize: error creating ALSA sequencer client object.");
+    snd_seq_set_client_name(seq_, std::string{clientName}.c_str());
+
+    // The sequencer's descriptors, plus the read end of a pipe that wakes the
+    // thread for shutdown
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0 || pipe(trigger_fds_) == -1)
     {
-      error<driver_error>("MidiInAlsa::initialize: error creating pipe objects.");
-      return;
+      cleanup();
+      throw driver_error("MidiInAlsa::initialize: error creating epoll or pipe objects.");
     }
-
-    // Create the input queue
+    const int count = snd_seq_poll_descriptors_count(seq_, POLLIN);
+    std::vector<pollfd> descriptors(count);
+    snd_seq_poll_descriptors(seq_, descriptors.data(), count, POLLIN);
+    for (const pollfd& descriptor : descriptors)
+      watch(descriptor.fd);
+    watch(trigger_fds_[0]);
+
+    // Create and start the input queue, which every port stamps its events from
 #ifndef AVOID_TIMESTAMPING
-    data.queue_id = snd_seq_alloc_named_queue(seq, "RtMidi Queue");
+    queue_id_ = snd_seq_alloc_named_queue(seq_, "RtMidi Queue");
     // Set arbitrary tempo (mm=100) and resolution (240)
     snd_seq_queue_tempo_t* qtempo;
     snd_seq_queue_tempo_alloca(&qtempo);
     snd_seq_queue_tempo_set_tempo(qtempo, 600000);
     snd_seq_queue_tempo_set_ppq(qtempo, 240);
-    snd_seq_set_queue_tempo(data.seq, data.queue_id, qtempo);
-    snd_seq_drain_output(data.seq);
+    snd_seq_set_queue_tempo(seq_, queue_id_, qtempo);
+    snd_seq_start_queue(seq_, queue_id_, nullptr);
+    snd_seq_drain_output(seq_);
+    anchorQueue();
 #endif
+
+    running_ = true;
   }
 
-  ~midi_in_alsa() override
+  ~alsa_input_reactor()
   {
-    // Close a connection if it exists.
-    midi_in_alsa::close_port();
+    running_ = false;
+    bool stop = true;
+    write(trigger_fds_[1], &stop, sizeof(stop));
+    // The last input went during a wake-up - the thread held the reactor
+    // for it and let it go last, after unlocking, and returns without
+    // touching the reactor again. It can't wait for itself.
+    if (thread_.get_id() == std::this_thread::get_id())
+      thread_.detach();
+    else if (thread_.joinable())
+      thread_.join();
 
-    // Shutdown the input thread.
-    if (inputData_.doInput)
+#ifndef AVOID_TIMESTAMPING
+    snd_seq_stop_queue(seq_, queue_id_, nullptr);
+    snd_seq_drain_output(seq_);
+    snd_seq_free_queue(seq_, queue_id_);
+#endif
+    cleanup();
+  }
+
+  alsa_input_reactor(const alsa_input_reactor&) = delete;
+  alsa_input_reactor& operator=(const alsa_input_reactor&) = delete;
+
+  snd_seq_t* seq() const noexcept
+  {
+    return seq_;
+  }
+  int queue() const noexcept
+  {
+    return queue_id_;
+  }
+  int64_t queue_origin() const noexcept
+  {
+    return queueOrigin_;
+  }
+
+  // Events delivered to port go to input from now on
+  void attach(int port, midi_in_alsa* input)
+  {
+    std::lock_guard<std::recursive_mutex> lock{mutex_};
+    inputs_[port] = input;
+  }
+
+  // Once this returns the thread won't hand input anything more - if it's
+  // called from one of input's own callbacks, not after that one returns
+  void detach(int port)
+  {
+    std::lock_guard<std::recursive_mutex> lock{mutex_};
+    auto it = inputs_.find(port);
+    if (it == inputs_.end())
+      return;
+    touched_.erase(std::remove(touched_.begin(), touched_.end(), it->second), touched_.end());
+    inputs_.erase(it);
+  }
+
+private:
+  void watch(int fd)
+  {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  }
+
+#ifndef AVOID_TIMESTAMPING
+  // Events are stamped with the input queue's real time, which the sequencer
+  // reads from the kernel's monotonic clock - find where the queue started on
+  // it, so the stamps can be moved onto the monotonic_ns() clock
+  void anchorQueue()
+  {
+    snd_seq_queue_status_t* status;
+    snd_seq_queue_status_alloca(&status);
+    const int64_t now = monotonic_ns();
+    queueOrigin_ = now;
+    if (snd_seq_get_queue_status(seq_, queue_id_, status) == 0)
     {
-      inputData_.doInput = false;
-      write(data.trigger_fds[1], &inputData_.doInput, sizeof(inputData_.doInput));
+      const snd_seq_real_time_t* elapsed = snd_seq_queue_status_get_real_time(status);
+      queueOrigin_ -= elapsed->tv_sec * 1000000000LL + elapsed->tv_nsec;
+    }
+  }
+#endif
 
-      if (!pthread_equal(data.thread, data.dummy_thread_id))
-        pthread_join(data.thread, nullptr);
+  void cleanup()
+  {
+    if (epoll_fd_ >= 0)
+      close(epoll_fd_);
+    for (int& fd : trigger_fds_)
+      if (fd >= 0)
+        close(fd);
+    snd_seq_close(seq_);
+  }
+
+  void run();
+
+  snd_seq_t* seq_{};
+  int queue_id_{}; // an input queue is needed to get timestamped events
+  int64_t queueOrigin_{}; // where the queue's real time 0 falls on the monotonic_ns() clock
+  int epoll_fd_{-1};
+  int trigger_fds_[2]{-1, -1};
+  std::thread thread_;
+  std::atomic_bool running_{false};
+
+  // Held while the thread hands events on, so detach() waits for it; recursive
+  // so a callback can open or close another input
+  std::recursive_mutex mutex_;
+  std::map<int, midi_in_alsa*> inputs_; // by the port on our client they own
+  std::vector<midi_in_alsa*> touched_;  // inputs with a batch to flush this wake-up
+};
+
+class midi_in_alsa final : public midi_in_api
+{
+public:
+  midi_in_alsa(std::string_view clientName, unsigned int queueSizeLimit)
+      : midi_in_api{&data, queueSizeLimit}
+  {
+    // Every input shares one sequencer client and one input thread
+    reactor_ = alsa_input_reactor::acquire(clientName);
+
+    // Save our api-specific connection information.
+    data.seq = reactor_->seq();
+    data.vport = -1;
+    data.subscription = nullptr;
+
+    // Only needed for the events decodeEvent() doesn't know
+    data.bufferSize = 32;
+    if (snd_midi_event_new(0, &data.coder) < 0)
+    {
+      error<driver_error>("MidiInAlsa::initialize: error initializing MIDI event parser.");
+      return;
     }
+    snd_midi_event_init(data.coder);
+    snd_midi_event_no_status(data.coder, 1); // suppress running status messages
+    data.buffer.resize(data.bufferSize);
+  }
 
-    // Cleanup.
-    close(data.trigger_fds[0]);
-    close(data.trigger_fds[1]);
+  ~midi_in_alsa() override
+  {
+    // Close a connection if it exists.
+    midi_in_alsa::close_port();
+
+    // Cleanup - the client is the reactor's, and goes with the last input.
     if (data.vport >= 0)
       snd_seq_delete_port(data.seq, data.vport);
-#ifndef AVOID_TIMESTAMPING
-    snd_seq_free_queue(data.seq, data.queue_id);
-#endif
-    snd_seq_close(data.seq);
+    if (data.coder)
+      snd_midi_event_free(data.coder);
   }
 
   rtmidi::API get_current_api() const noexcept override
@@ -370,40 +847,20 @@ public:
     sender.port = snd_seq_port_info_get_port(src_pinfo);
     receiver.client = snd_seq_client_id(data.seq);
 
-    snd_seq_port_info_t* pinfo;
-    snd_seq_port_info_alloca(&pinfo);
-    if (data.vport < 0)
-    {
-      snd_seq_port_info_set_client(pinfo, 0);
-      snd_seq_port_info_set_port(pinfo, 0);
-      snd_seq_port_info_set_capability(
-          pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
-      snd_seq_port_info_set_type(
-          pinfo, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
-      snd_seq_port_info_set_midi_channels(pinfo, 16);
-#ifndef AVOID_TIMESTAMPING
-      snd_seq_port_info_set_timestamping(pinfo, 1);
-      snd_seq_port_info_set_timestamp_real(pinfo, 1);
-      snd_seq_port_info_set_timestamp_queue(pinfo, data.queue_id);
-#endif
-      snd_seq_port_info_set_name(pinfo, portName.data());
-      data.vport = snd_seq_create_port(data.seq, pinfo);
-
-      if (data.vport < 0)
-      {
-        error<driver_error>("MidiInAlsa::openPort: ALSA error creating input port.");
-        return;
-      }
-      data.vport = snd_seq_port_info_get_port(pinfo);
-    }
+    if (data.vport < 0 && !createPort(portName, "MidiInAlsa::openPort: ALSA error creating input port."))
+      return;
 
     receiver.port = data.vport;
 
+    // Listening before the subscription, so nothing sent straight after it is missed
+    startInput();
+
     if (!data.subscription)
     {
       // Make subscription
       if (snd_seq_port_subscribe_malloc(&data.subscription) < 0)
       {
+        stopInput();
         error<driver_error>("MidiInAlsa::openPort: ALSA error allocation port subscription.");
         return;
       }
@@ -413,100 +870,21 @@ public:
       {
         snd_seq_port_subscribe_free(data.subscription);
         data.subscription = nullptr;
+        stopInput();
         error<driver_error>("MidiInAlsa::openPort: ALSA error making port connection.");
         return;
       }
     }
 
-    if (inputData_.doInput == false)
-    {
-      // Start the input queue
-#ifndef AVOID_TIMESTAMPING
-      snd_seq_start_queue(data.seq, data.queue_id, nullptr);
-      snd_seq_drain_output(data.seq);
-#endif
-      // Start our MIDI input thread.
-      pthread_attr_t attr;
-      pthread_attr_init(&attr);
-      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-      pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
-
-      inputData_.doInput = true;
-      int err = pthread_create(&data.thread, &attr, alsaMidiHandler, &inputData_);
-      pthread_attr_destroy(&attr);
-      if (err)
-      {
-        snd_seq_unsubscribe_port(data.seq, data.subscription);
-        snd_seq_port_subscribe_free(data.subscription);
-        data.subscription = nullptr;
-        inputData_.doInput = false;
-        error<thread_error>("MidiInAlsa::openPort: error starting MIDI input thread!");
-        return;
-      }
-    }
-
     connected_ = true;
   }
   void open_virtual_port(std::string_view portName) override
   {
-    if (data.vport < 0)
-    {
-      snd_seq_port_info_t* pinfo;
-      snd_seq_port_info_alloca(&pinfo);
-      snd_seq_port_info_set_capability(
-          pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
-      snd_seq_port_info_set_type(
-          pinfo, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
-      snd_seq_port_info_set_midi_channels(pinfo, 16);
-#ifndef AVOID_TIMESTAMPING
-      snd_seq_port_info_set_timestamping(pinfo, 1);
-      snd_seq_port_info_set_timestamp_real(pinfo, 1);
-      snd_seq_port_info_set_timestamp_queue(pinfo, data.queue_id);
-#endif
-      snd_seq_port_info_set_name(pinfo, portName.data());
-      data.vport = snd_seq_create_port(data.seq, pinfo);
-
-      if (data.vport < 0)
-      {
-        error<driver_error>("MidiInAlsa::openVirtualPort: ALSA error creating virtual port.");
-        return;
-      }
-      data.vport = snd_seq_port_info_get_port(pinfo);
-    }
-
-    if (inputData_.doInput == false)
-    {
-      // Wait for old thread to stop, if still running
-      if (!pthread_equal(data.thread, data.dummy_thread_id))
-        pthread_join(data.thread, nullptr);
+    if (data.vport < 0
+        && !createPort(portName, "MidiInAlsa::openVirtualPort: ALSA error creating virtual port."))
+      return;
 
-        // Start the input queue
-#ifndef AVOID_TIMESTAMPING
-      snd_seq_start_queue(data.seq, data.queue_id, nullptr);
-      snd_seq_drain_output(data.seq);
-#endif
-      // Start our MIDI input thread.
-      pthread_attr_t attr;
-      pthread_attr_init(&attr);
-      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-      pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
-
-      inputData_.doInput = true;
-      int err = pthread_create(&data.thread, &attr, alsaMidiHandler, &inputData_);
-      pthread_attr_destroy(&attr);
-      if (err)
-      {
-        if (data.subscription)
-        {
-          snd_seq_unsubscribe_port(data.seq, data.subscription);
-          snd_seq_port_subscribe_free(data.subscription);
-          data.subscription = nullptr;
-        }
-        inputData_.doInput = false;
-        error<thread_error>("MidiInAlsa::openPort: error starting MIDI input thread!");
-        return;
-      }
-    }
+    startInput();
   }
   void close_port() override
   {
@@ -518,25 +896,14 @@ public:
         snd_seq_port_subscribe_free(data.subscription);
         data.subscription = nullptr;
       }
-      // Stop the input queue
-#ifndef AVOID_TIMESTAMPING
-      snd_seq_stop_queue(data.seq, data.queue_id, nullptr);
-      snd_seq_drain_output(data.seq);
-#endif
       connected_ = false;
     }
 
-    // Stop thread to avoid triggering the callback, while the port is intended
-    // to be closed
-    if (inputData_.doInput)
-    {
-      inputData_.doInput = false;
-      write(data.trigger_fds[1], &inputData_.doInput, sizeof(inputData_.doInput));
-
-      if (!pthread_equal(data.thread, data.dummy_thread_id))
-        pthread_join(data.thread, nullptr);
-    }
+    // Stop listening to avoid triggering the callback, while the port is
+    // intended to be closed
+    stopInput();
   }
+  // The client is shared by every input in the process, so this renames it for all of them
   void set_client_name(std::string_view clientName) override
   {
     snd_seq_set_client_name(data.seq, clientName.data());
@@ -558,27 +925,13 @@ public:
   }
   std::string get_port_name(unsigned int portNumber) override
   {
-    snd_seq_client_info_t* cinfo;
     snd_seq_port_info_t* pinfo;
-    snd_seq_client_info_alloca(&cinfo);
     snd_seq_port_info_alloca(&pinfo);
 
     std::string stringName;
-    if (portInfo(
-            data.seq, pinfo, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, (int)portNumber))
+    if (portInfo(data.seq, pinfo, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, (int)portNumber))
     {
-      int cnum = snd_seq_port_info_get_client(pinfo);
-      snd_seq_get_any_client_info(data.seq, cnum, cinfo);
-      std::ostringstream os;
-      os << snd_seq_client_info_get_name(cinfo);
-      os << ":";
-      os << snd_seq_port_info_get_name(pinfo);
-      os << " "; // These lines added to make sure devices are listed
-      os << snd_seq_port_info_get_client(pinfo); // with full portnames added to ensure individual
-                                                 // device names
-      os << ":";
-      os << snd_seq_port_info_get_port(pinfo);
-      stringName = os.str();
+      stringName = portName(data.seq, pinfo);
       return stringName;
     }
 
@@ -587,230 +940,250 @@ public:
     return stringName;
   }
 
-private:
-  static void* alsaMidiHandler(void* ptr)
+  std::vector<port_information> get_ports() override
   {
-    auto& data = *static_cast<midi_in_api::in_data*>(ptr);
-    auto& apidata = *static_cast<alsa_data*>(data.apiData);
-
-    double time{};
-    bool continueSysex = false;
-    bool doDecode = false;
-    message message{};
-    int poll_fd_count{};
-    pollfd* poll_fds{};
+    return portList(data.seq, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ);
+  }
 
-    snd_seq_event_t* ev;
+private:
+  friend class alsa_input_reactor;
 
-    apidata.bufferSize = 32;
-    int result = snd_midi_event_new(0, &apidata.coder);
-    if (result < 0)
+  // Our port on the shared client, which the reactor hands on whatever is delivered to
+  bool createPort(std::string_view portName, std::string_view errorString)
+  {
+    snd_seq_port_info_t* pinfo;
+    snd_seq_port_info_alloca(&pinfo);
+    snd_seq_port_info_set_capability(pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+    snd_seq_port_info_set_type(
+        pinfo, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    snd_seq_port_info_set_midi_channels(pinfo, 16);
+#ifndef AVOID_TIMESTAMPING
+    snd_seq_port_info_set_timestamping(pinfo, 1);
+    snd_seq_port_info_set_timestamp_real(pinfo, 1);
+    snd_seq_port_info_set_timestamp_queue(pinfo, reactor_->queue());
+#endif
+    snd_seq_port_info_set_name(pinfo, std::string{portName}.c_str());
+    if (snd_seq_create_port(data.seq, pinfo) < 0)
     {
-      data.doInput = false;
-      std::cerr << "\nMidiInAlsa::alsaMidiHandler: error initializing MIDI "
-                   "event parser!\n\n";
-      return nullptr;
+      error<driver_error>(errorString);
+      return false;
     }
+    data.vport = snd_seq_port_info_get_port(pinfo);
+    return true;
+  }
 
-    auto& buffer = apidata.buffer;
-    buffer.clear();
-    buffer.resize(apidata.bufferSize);
-
-    snd_midi_event_init(apidata.coder);
-    snd_midi_event_no_status(apidata.coder, 1); // suppress running status messages
-
-    poll_fd_count = snd_seq_poll_descriptors_count(apidata.seq, POLLIN) + 1;
-    poll_fds = (struct pollfd*)alloca(poll_fd_count * sizeof(struct pollfd));
-    snd_seq_poll_descriptors(apidata.seq, poll_fds + 1, poll_fd_count - 1, POLLIN);
-    poll_fds[0].fd = apidata.trigger_fds[0];
-    poll_fds[0].events = POLLIN;
+  void startInput()
+  {
+    if (inputData_.doInput)
+      return;
+    inputData_.doInput = true;
+    reactor_->attach(data.vport, this);
+  }
 
-    while (data.doInput)
-    {
-      if (snd_seq_event_input_pending(apidata.seq, 1) == 0)
-      {
-        // No data pending
-        if (poll(poll_fds, poll_fd_count, -1) >= 0)
-        {
-          if (poll_fds[0].revents & POLLIN)
-          {
-            bool dummy;
-            read(poll_fds[0].fd, &dummy, sizeof(dummy));
-          }
-        }
-        continue;
-      }
+  void stopInput()
+  {
+    if (!inputData_.doInput)
+      return;
+    reactor_->detach(data.vport);
+    inputData_.doInput = false;
+  }
 
-      // If here, there should be data.
-      result = snd_seq_event_input(apidata.seq, &ev);
-      if (result == -ENOSPC)
-      {
-        std::cerr << "\nMidiInAlsa::alsaMidiHandler: MIDI input buffer overrun!\n\n";
-        continue;
-      }
-      else if (result <= 0)
-      {
-        std::cerr << "\nMidiInAlsa::alsaMidiHandler: unknown MIDI input error!\n";
-        perror("System reports");
-        continue;
-      }
+  // Reactor thread, with the reactor's lock held
+  void on_event(const snd_seq_event_t& ev)
+  {
+    midi_in_api::in_data& rtData = inputData_;
 
-      // This is a bit weird, but we now have to decode an ALSA MIDI
-      // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
-      if (!continueSysex)
-        message.bytes.clear();
+    // This is a bit weird, but we now have to decode an ALSA MIDI
+    // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
+    message_.bytes.clear();
 
-      doDecode = false;
-      switch (ev->type)
-      {
+    bool doDecode = false;
+    switch (ev.type)
+    {
 
-        case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+      case SND_SEQ_EVENT_PORT_SUBSCRIBED:
 #if defined(__RTMIDI17_DEBUG__)
-          std::cout << "MidiInAlsa::alsaMidiHandler: port connection made!\n";
+        std::cout << "MidiInAlsa::alsaMidiHandler: port connection made!\n";
 #endif
-          break;
+        break;
 
-        case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+      case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
 #if defined(__RTMIDI17_DEBUG__)
-          std::cerr << "MidiInAlsa::alsaMidiHandler: port connection has closed!\n";
-          std::cout << "sender = " << (int)ev->data.connect.sender.client << ":"
-                    << (int)ev->data.connect.sender.port
-                    << ", dest = " << (int)ev->data.connect.dest.client << ":"
-                    << (int)ev->data.connect.dest.port << std::endl;
+        std::cerr << "MidiInAlsa::alsaMidiHandler: port connection has closed!\n";
+        std::cout << "sender = " << (int)ev.data.connect.sender.client << ":"
+                  << (int)ev.data.connect.sender.port
+                  << ", dest = " << (int)ev.data.connect.dest.client << ":"
+                  << (int)ev.data.connect.dest.port << std::endl;
 #endif
-          break;
+        break;
 
-        case SND_SEQ_EVENT_QFRAME: // MIDI time code
-          if (!(data.ignoreFlags & 0x02))
-            doDecode = true;
-          break;
+      case SND_SEQ_EVENT_QFRAME: // MIDI time code
+        if (!(rtData.ignoreFlags & 0x02))
+          doDecode = true;
+        break;
 
-        case SND_SEQ_EVENT_TICK: // 0xF9 ... MIDI timing tick
-          if (!(data.ignoreFlags & 0x02))
-            doDecode = true;
-          break;
+      case SND_SEQ_EVENT_TICK: // 0xF9 ... MIDI timing tick
+        if (!(rtData.ignoreFlags & 0x02))
+          doDecode = true;
+        break;
 
-        case SND_SEQ_EVENT_CLOCK: // 0xF8 ... MIDI timing (clock) tick
-          if (!(data.ignoreFlags & 0x02))
-            doDecode = true;
-          break;
+      case SND_SEQ_EVENT_CLOCK: // 0xF8 ... MIDI timing (clock) tick
+        if (!(rtData.ignoreFlags & 0x02))
+          doDecode = true;
+        break;
+
+      case SND_SEQ_EVENT_SENSING: // Active sensing
+        if (!(rtData.ignoreFlags & 0x04))
+          doDecode = true;
+        break;
 
-        case SND_SEQ_EVENT_SENSING: // Active sensing
-          if (!(data.ignoreFlags & 0x04))
-            doDecode = true;
+      case SND_SEQ_EVENT_SYSEX:
+      {
+        if ((rtData.ignoreFlags & 0x01))
           break;
 
-        case SND_SEQ_EVENT_SYSEX:
-        {
-          if ((data.ignoreFlags & 0x01))
-            break;
-          if (ev->data.ext.len > apidata.bufferSize)
-          {
-            apidata.bufferSize = ev->data.ext.len;
-            buffer.resize(apidata.bufferSize);
-          }
-          doDecode = true;
+        // The ALSA sequencer has a maximum buffer size for MIDI sysex
+        // events of 256 bytes.  If a device sends sysex messages larger
+        // than this, they are segmented into 256 byte chunks.  So,
+        // we'll watch for this and concatenate sysex chunks into a
+        // single sysex message if necessary.
+        auto bytes = static_cast<const unsigned char*>(ev.data.ext.ptr);
+        const size_t size = ev.data.ext.len;
+        if (size == 0)
+          break;
+        if (bytes[0] == 0xF0)
+          sysex_.start(bytes, size, rtData.sysexLimit.load(std::memory_order_relaxed));
+        else
+          sysex_.append(bytes, size);
+        if (bytes[size - 1] != 0xF7)
           break;
-        }
 
-        default:
-          doDecode = true;
+        if (sysex_.finish())
+          message_.bytes.assign(sysex_.data(), sysex_.data() + sysex_.size());
+        else if (sysex_.overflowed())
+          std::cerr << "\nMidiInAlsa::alsaMidiHandler: sysex message longer than the "
+                       "limit dropped!\n\n";
+        break;
       }
 
-      if (doDecode)
+      default:
+        doDecode = true;
+    }
+
+    // Short messages are written straight into the message; the decoder
+    // is only needed for the odd ones (14-bit controllers, NRPNs...)
+    if (doDecode)
+    {
+      unsigned char bytes[3];
+      if (size_t nBytes = decodeEvent(ev, bytes))
       {
-        uint64_t nBytes
-            = snd_midi_event_decode(apidata.coder, buffer.data(), apidata.bufferSize, ev);
-        if (nBytes > 0)
-        {
-          // The ALSA sequencer has a maximum buffer size for MIDI sysex
-          // events of 256 bytes.  If a device sends sysex messages larger
-          // than this, they are segmented into 256 byte chunks.  So,
-          // we'll watch for this and concatenate sysex chunks into a
-          // single sysex message if necessary.
-          assert(nBytes < buffer.size());
-          if (!continueSysex)
-            message.bytes.assign(buffer.data(), buffer.data() + nBytes);
-          else
-            message.bytes.insert(message.bytes.end(), buffer.data(), buffer.data() + nBytes);
-
-          continueSysex = ((ev->type == SND_SEQ_EVENT_SYSEX) && (message.bytes.back() != 0xF7));
-          if (!continueSysex)
-          {
-
-            // Calculate the time stamp:
-            message.timestamp = 0.0;
-
-            // Method 1: Use the system time.
-            // gettimeofday(&tv, (struct timezone *)nullptr);
-            // time = (tv.tv_sec * 1000000) + tv.tv_usec;
-
-            // Method 2: Use the ALSA sequencer event time data.
-            // (thanks to Pedro Lopez-Cabanillas!).
-
-            // Using method from:
-            // https://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
-
-            // Perform the carry for the later subtraction by updating y.
-            snd_seq_real_time_t& x(ev->time.time);
-            snd_seq_real_time_t& y(apidata.lastTime);
-            if (x.tv_nsec < y.tv_nsec)
-            {
-              int nsec = (y.tv_nsec - x.tv_nsec) / 1000000000 + 1;
-              y.tv_nsec -= 1000000000 * nsec;
-              y.tv_sec += nsec;
-            }
-            if (x.tv_nsec - y.tv_nsec > 1000000000)
-            {
-              int nsec = (x.tv_nsec - y.tv_nsec) / 1000000000;
-              y.tv_nsec += 1000000000 * nsec;
-              y.tv_sec -= nsec;
-            }
-
-            // Compute the time difference.
-            time = x.tv_sec - y.tv_sec + (x.tv_nsec - y.tv_nsec) * 1e-9;
-
-            apidata.lastTime = ev->time.time;
-
-            if (data.firstMessage == true)
-              data.firstMessage = false;
-            else
-              message.timestamp = time;
-          }
-          else
-          {
+        message_.bytes.assign(bytes, bytes + nBytes);
+      }
+      else
+      {
+        long decoded = snd_midi_event_decode(
+            data.coder, data.buffer.data(), (long)data.buffer.size(), &ev);
+        if (decoded > 0)
+          message_.bytes.assign(data.buffer.data(), data.buffer.data() + decoded);
 #if defined(__RTMIDI17_DEBUG__)
-            std::cerr << "\nMidiInAlsa::alsaMidiHandler: event parsing error or "
-                         "not a MIDI event!\n\n";
+        else
+          std::cerr << "\nMidiInAlsa::alsaMidiHandler: event parsing error or "
+                       "not a MIDI event!\n\n";
 #endif
-          }
-        }
       }
+    }
 
-      snd_seq_free_event(ev);
-      if (message.bytes.size() == 0 || continueSysex)
-        continue;
+    if (message_.bytes.empty())
+      return;
 
-      if (data.userCallback)
+#ifndef AVOID_TIMESTAMPING
+    // The queue's real time when the sequencer took the event from the
+    // driver (thanks to Pedro Lopez-Cabanillas!), moved onto our clock
+    const snd_seq_real_time_t& t = ev.time.time;
+    rtData.stamp(message_, reactor_->queue_origin() + t.tv_sec * 1000000000LL + t.tv_nsec);
+#else
+    rtData.stamp(message_, monotonic_ns());
+#endif
+
+    // Hand the message on - if it goes to the queue, as long as we
+    // haven't reached the queue size limit.
+    if (!rtData.deliver(std::move(message_)))
+      std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+  }
+
+  alsa_data data;
+  std::shared_ptr<alsa_input_reactor> reactor_;
+  message message_; // reactor thread only
+  sysex_arena sysex_; // reactor thread only
+};
+
+inline void alsa_input_reactor::run()
+{
+  epoll_event events[8];
+  while (running_)
+  {
+    const int count = epoll_wait(epoll_fd_, events, 8, -1);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "\nMidiInAlsa::alsaMidiHandler: error waiting for input - input stopped.\n\n";
+      return;
+    }
+    if (!running_)
+      break;
+
+    // Keep the reactor for the wake-up, since a callback can close the last
+    // input - none left means it's being destroyed, and waiting for us
+    std::weak_ptr<alsa_input_reactor> weak = weak_from_this();
+    std::shared_ptr<alsa_input_reactor> self = weak.lock();
+    if (!self)
+      break;
+
+    std::unique_lock<std::recursive_mutex> lock{mutex_};
+
+    // Drain everything that's pending, so a burst is handed on in one
+    // wakeup - -ENOSPC only means the input buffer overran, and there's
+    // still more to read
+    snd_seq_event_t* ev{};
+    int result;
+    while ((result = snd_seq_event_input(seq_, &ev)) >= 0 || result == -ENOSPC)
+    {
+      if (result == -ENOSPC)
       {
-        data.userCallback(std::move(message));
+        std::cerr << "\nMidiInAlsa::alsaMidiHandler: MIDI input buffer overrun!\n\n";
+        continue;
       }
-      else
+
+      // The port it was delivered to says whose it is
+      auto it = inputs_.find(ev->dest.port);
+      if (it != inputs_.end())
       {
-        // As long as we haven't reached our queue size limit, push the
-        // message.
-        if (!data.queue.push(std::move(message)))
-          std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+        midi_in_alsa* input = it->second;
+        if (std::find(touched_.begin(), touched_.end(), input) == touched_.end())
+          touched_.push_back(input);
+        input->on_event(*ev);
       }
+      snd_seq_free_event(ev);
+    }
+
+    // Whatever this wake-up brought goes to each batch callback together -
+    // popped first, so a callback that closes another input can't trip us up
+    while (!touched_.empty())
+    {
+      midi_in_alsa* input = touched_.back();
+      touched_.pop_back();
+      input->inputData_.flush();
     }
 
-    snd_midi_event_free(apidata.coder);
-    apidata.coder = nullptr;
-    apidata.thread = apidata.dummy_thread_id;
-    return nullptr;
+    // Let it go unlocked - if it was the last reference, the reactor is gone
+    // when this returns and nothing of it can be touched again
+    lock.unlock();
+    self.reset();
+    if (weak.expired())
+      return;
   }
-  alsa_data data;
-};
+}
 
 class midi_out_alsa final : public midi_out_api
 {
@@ -981,28 +1354,13 @@ public:
 
   std::string get_port_name(unsigned int portNumber) override
   {
-    snd_seq_client_info_t* cinfo;
     snd_seq_port_info_t* pinfo;
-    snd_seq_client_info_alloca(&cinfo);
     snd_seq_port_info_alloca(&pinfo);
 
     std::string stringName;
-    if (portInfo(
-            data.seq, pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-            (int)portNumber))
+    if (portInfo(data.seq, pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE, (int)portNumber))
     {
-      int cnum = snd_seq_port_info_get_client(pinfo);
-      snd_seq_get_any_client_info(data.seq, cnum, cinfo);
-      std::ostringstream os;
-      os << snd_seq_client_info_get_name(cinfo);
-      os << ":";
-      os << snd_seq_port_info_get_name(pinfo);
-      os << " "; // These lines added to make sure devices are listed
-      os << snd_seq_port_info_get_client(pinfo); // with full portnames added to ensure individual
-                                                 // device names
-      os << ":";
-      os << snd_seq_port_info_get_port(pinfo);
-      stringName = os.str();
+      stringName = portName(data.seq, pinfo);
       return stringName;
     }
 
@@ -1011,22 +1369,15 @@ public:
     return stringName;
   }
 
+  std::vector<port_information> get_ports() override
+  {
+    return portList(data.seq, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+  }
+
   void send_message(const unsigned char* message, size_t size) override
   {
     int64_t result{};
     unsigned int nBytes = static_cast<unsigned int>(size);
-    if (nBytes > data.bufferSize)
-    {
-      data.bufferSize = nBytes;
-      result = snd_midi_event_resize_buffer(data.coder, nBytes);
-      if (result != 0)
-      {
-        error<driver_error>(
-            "MidiOutAlsa::sendMessage: ALSA error resizing MIDI event "
-            "buffer.");
-        return;
-      }
-    }
 
     snd_seq_event_t ev;
     snd_seq_ev_clear(&ev);
@@ -1034,11 +1385,28 @@ public:
     snd_seq_ev_set_subs(&ev);
     snd_seq_ev_set_direct(&ev);
 
-    result = snd_midi_event_encode(data.coder, message, nBytes, &ev);
-    if (result < nBytes)
+    // Short messages are built directly; the encoder is only needed for SysEx and the rest
+    if (!encodeEvent(message, size, ev))
     {
-      warning("MidiOutAlsa::sendMessage: event parsing error!");
-      return;
+      if (nBytes > data.bufferSize)
+      {
+        data.bufferSize = nBytes;
+        result = snd_midi_event_resize_buffer(data.coder, nBytes);
+        if (result != 0)
+        {
+          error<driver_error>(
+              "MidiOutAlsa::sendMessage: ALSA error resizing MIDI event "
+              "buffer.");
+          return;
+        }
+      }
+
+      result = snd_midi_event_encode(data.coder, message, nBytes, &ev);
+      if (result < nBytes)
+      {
+        warning("MidiOutAlsa::sendMessage: event parsing error!");
+        return;
+      }
     }
 
     // Send the event.
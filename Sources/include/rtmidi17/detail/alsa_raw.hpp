@@ -0,0 +1,675 @@
+#pragma once
+#include <algorithm>
+#include <alsa/asoundlib.h>
+#include <atomic>
+#include <chrono>
+#include <poll.h>
+#include <rtmidi17/detail/midi_api.hpp>
+#include <rtmidi17/rtmidi17.hpp>
+#include <sstream>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+//*********************************************************************//
+//  API: LINUX ALSA RAWMIDI
+//
+//  Straight to the device through snd_rawmidi, with no sequencer
+//  client in between: bytes are written as they are, and read bytes
+//  are split into messages here rather than by snd_midi_event. There
+//  is no routing and there are no virtual ports - use the sequencer
+//  API (LINUX_ALSA) for those.
+//*********************************************************************//
+
+namespace rtmidi
+{
+// A rawmidi subdevice, and the name to open it by
+struct rawmidi_port
+{
+  port_information info;
+  std::string device; // hw:card,device,subdevice
+};
+
+// The port_information::id for a rawmidi subdevice - in the order the subdevices are listed
+inline unsigned int rawmidiId(int card, int device, int subdevice)
+{
+  return ((unsigned int)card << 16) | ((unsigned int)device << 8) | (unsigned int)subdevice;
+}
+
+// Every subdevice with a stream in this direction, in port number order
+inline std::vector<rawmidi_port> rawmidiList(snd_rawmidi_stream_t stream)
+{
+  std::vector<rawmidi_port> ports;
+  snd_rawmidi_info_t* info;
+  snd_rawmidi_info_alloca(&info);
+
+  int card = -1;
+  while (snd_card_next(&card) >= 0 && card >= 0)
+  {
+    snd_ctl_t* ctl;
+    if (snd_ctl_open(&ctl, ("hw:" + std::to_string(card)).c_str(), 0) < 0)
+      continue;
+    char* cardName{};
+    snd_card_get_name(card, &cardName);
+
+    int device = -1;
+    while (snd_ctl_rawmidi_next_device(ctl, &device) >= 0 && device >= 0)
+    {
+      snd_rawmidi_info_set_device(info, device);
+      snd_rawmidi_info_set_stream(info, stream);
+      snd_rawmidi_info_set_subdevice(info, 0);
+      // Fails if the device has no stream in this direction
+      if (snd_ctl_rawmidi_info(ctl, info) < 0)
+        continue;
+
+      const unsigned int subdevices = snd_rawmidi_info_get_subdevices_count(info);
+      for (unsigned int sub = 0; sub < subdevices; sub++)
+      {
+        snd_rawmidi_info_set_subdevice(info, sub);
+        if (snd_ctl_rawmidi_info(ctl, info) < 0)
+          continue;
+
+        const char* subName = snd_rawmidi_info_get_subdevice_name(info);
+        std::ostringstream name;
+        name << (cardName ? cardName : "") << ":"
+             << (subName && *subName ? subName : snd_rawmidi_info_get_name(info)) << " hw:" << card
+             << "," << device << "," << sub;
+        std::ostringstream hw;
+        hw << "hw:" << card << "," << device << "," << sub;
+        ports.push_back({{rawmidiId(card, device, (int)sub), name.str()}, hw.str()});
+      }
+    }
+
+    free(cardName);
+    snd_ctl_close(ctl);
+  }
+  return ports;
+}
+
+inline std::vector<port_information> rawmidiInfo(const std::vector<rawmidi_port>& ports)
+{
+  std::vector<port_information> info;
+  info.reserve(ports.size());
+  for (const auto& port : ports)
+    info.push_back(port.info);
+  return info;
+}
+
+// Splits a raw MIDI byte stream into whole messages. Running status is
+// expanded, realtime bytes (0xF8-0xFF) come out on their own wherever they
+// turn up, even inside a SysEx, and a SysEx can span any number of reads.
+// A SysEx cut short by another status byte, or longer than the limit, is
+// dropped.
+class midi_stream_parser
+{
+public:
+  void set_sysex_limit(size_t bytes)
+  {
+    sysexLimit_ = bytes;
+  }
+
+  // How many SysEx messages have been dropped for being over the limit
+  size_t oversized() const noexcept
+  {
+    return oversized_;
+  }
+
+  // f(const unsigned char* bytes, size_t size) is called for each message
+  template <typename F>
+  void parse(const unsigned char* bytes, size_t size, F&& f)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      const unsigned char byte = bytes[i];
+      if (byte >= 0xF8)
+      {
+        f(&byte, 1);
+        continue;
+      }
+
+      if (byte & 0x80)
+      {
+        if (sysex_.active())
+        {
+          if (byte == 0xF7)
+          {
+            sysex_.append(&byte, 1);
+            if (sysex_.finish())
+              f(sysex_.data(), sysex_.size());
+            else
+              oversized_++;
+            continue;
+          }
+          sysex_.reset();
+        }
+
+        // Any status but realtime ends running status and a half-finished message
+        count_ = 0;
+        running_ = byte < 0xF0 ? byte : 0;
+        if (byte == 0xF0)
+        {
+          sysex_.start(&byte, 1, sysexLimit_);
+          continue;
+        }
+        if (byte == 0xF7)
+          continue;
+
+        message_[count_++] = byte;
+        expected_ = length(byte);
+        if (count_ == expected_)
+        {
+          f(message_, count_);
+          count_ = 0;
+        }
+        continue;
+      }
+
+      if (sysex_.active())
+      {
+        // The whole run of data bytes up to the next status goes in at once
+        size_t end = i + 1;
+        while (end < size && !(bytes[end] & 0x80))
+          end++;
+        sysex_.append(bytes + i, end - i);
+        i = end - 1;
+        continue;
+      }
+
+      if (count_ == 0)
+      {
+        // A data byte with no status to go with it is dropped
+        if (running_ == 0)
+          continue;
+        message_[count_++] = running_;
+        expected_ = length(running_);
+      }
+
+      message_[count_++] = byte;
+      if (count_ == expected_)
+      {
+        f(message_, count_);
+        count_ = 0;
+      }
+    }
+  }
+
+  void reset()
+  {
+    running_ = 0;
+    count_ = 0;
+    sysex_.reset();
+  }
+
+private:
+  static size_t length(unsigned char status)
+  {
+    switch (status & 0xF0)
+    {
+      case 0xC0:
+      case 0xD0:
+        return 2;
+      case 0xF0:
+        return status == 0xF2 ? 3 : (status == 0xF1 || status == 0xF3) ? 2 : 1;
+      default:
+        return 3;
+    }
+  }
+
+  unsigned char running_{};
+  unsigned char message_[3]{};
+  size_t count_{};
+  size_t expected_{};
+  sysex_arena sysex_;
+  size_t sysexLimit_{sysex_arena::default_limit};
+  size_t oversized_{};
+};
+
+// Devices come and go with their nodes in /dev/snd, so inotify on it is
+// enough to know when to list them again - rawmidi has no announce port.
+class observer_alsa_raw final : public observer_api
+{
+public:
+  observer_alsa_raw(observer::callbacks&& c) : observer_api{std::move(c)}
+  {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0)
+      throw driver_error("observer_alsa_raw: inotify_init1 failed");
+    if (inotify_add_watch(inotify_fd_, "/dev/snd", IN_CREATE | IN_DELETE) < 0)
+    {
+      close(inotify_fd_);
+      throw driver_error("observer_alsa_raw: can't watch /dev/snd");
+    }
+    if (pipe(trigger_fds_) == -1)
+    {
+      close(inotify_fd_);
+      throw driver_error("observer_alsa_raw: error creating pipe objects");
+    }
+
+    // Ports that are already there aren't reported, as with the sequencer observer
+    inputs_ = rawmidiInfo(rawmidiList(SND_RAWMIDI_STREAM_INPUT));
+    outputs_ = rawmidiInfo(rawmidiList(SND_RAWMIDI_STREAM_OUTPUT));
+
+    poll_ = std::thread{[this] { watch(); }};
+  }
+
+  ~observer_alsa_raw()
+  {
+    bool stop = true;
+    write(trigger_fds_[1], &stop, sizeof(stop));
+    poll_.join();
+    close(trigger_fds_[0]);
+    close(trigger_fds_[1]);
+    close(inotify_fd_);
+  }
+
+private:
+  void watch()
+  {
+    pollfd fds[2]{{inotify_fd_, POLLIN, 0}, {trigger_fds_[0], POLLIN, 0}};
+    alignas(inotify_event) char events[4096];
+    for (;;)
+    {
+      if (poll(fds, 2, -1) <= 0)
+        continue;
+      if (fds[1].revents & POLLIN)
+        break;
+
+      // Only the nodes of MIDI devices and cards matter - a card going away takes its
+      // controlC node with it
+      bool changed = false;
+      ssize_t length;
+      while ((length = read(inotify_fd_, events, sizeof(events))) > 0)
+      {
+        for (char* p = events; p < events + length;)
+        {
+          auto event = (const inotify_event*)p;
+          const std::string_view name{event->len ? event->name : ""};
+          if (name.substr(0, 5) == "midiC" || name.substr(0, 8) == "controlC")
+            changed = true;
+          p += sizeof(inotify_event) + event->len;
+        }
+      }
+      if (changed)
+      {
+        update(inputs_, rawmidiInfo(rawmidiList(SND_RAWMIDI_STREAM_INPUT)), callbacks_.input_added, callbacks_.input_removed);
+        update(outputs_, rawmidiInfo(rawmidiList(SND_RAWMIDI_STREAM_OUTPUT)), callbacks_.output_added, callbacks_.output_removed);
+      }
+    }
+  }
+
+  // Both lists are in id order
+  static void update(
+      std::vector<port_information>& known, std::vector<port_information> now,
+      const std::function<void(int, std::string)>& added,
+      const std::function<void(int, std::string)>& removed)
+  {
+    auto same = [](const port_information& a, const port_information& b) {
+      return a.id == b.id && a.name == b.name;
+    };
+    for (const auto& port : known)
+    {
+      if (removed
+          && std::none_of(now.begin(), now.end(), [&](const auto& p) { return same(p, port); }))
+        removed((int)port.id, port.name);
+    }
+    for (const auto& port : now)
+    {
+      if (added
+          && std::none_of(known.begin(), known.end(), [&](const auto& p) { return same(p, port); }))
+        added((int)port.id, port.name);
+    }
+    known = std::move(now);
+  }
+
+  int inotify_fd_{-1};
+  int trigger_fds_[2]{-1, -1};
+  std::vector<port_information> inputs_;
+  std::vector<port_information> outputs_;
+  std::thread poll_;
+};
+
+class midi_in_alsa_raw final : public midi_in_api
+{
+public:
+  midi_in_alsa_raw(std::string_view /*clientName*/, unsigned int queueSizeLimit)
+      : midi_in_api{nullptr, queueSizeLimit}
+  {
+    if (pipe(trigger_fds_) == -1)
+    {
+      error<driver_error>("MidiInAlsaRaw::initialize: error creating pipe objects.");
+      return;
+    }
+  }
+
+  ~midi_in_alsa_raw() override
+  {
+    midi_in_alsa_raw::close_port();
+    close(trigger_fds_[0]);
+    close(trigger_fds_[1]);
+  }
+
+  rtmidi::API get_current_api() const noexcept override
+  {
+    return rtmidi::API::LINUX_ALSA_RAW;
+  }
+
+  void open_port(unsigned int portNumber, std::string_view /*portName*/) override
+  {
+    if (connected_)
+    {
+      warning("MidiInAlsaRaw::openPort: a valid connection already exists!");
+      return;
+    }
+
+    const auto ports = rawmidiList(SND_RAWMIDI_STREAM_INPUT);
+    if (ports.empty())
+    {
+      error<no_devices_found_error>("MidiInAlsaRaw::openPort: no MIDI input sources found!");
+      return;
+    }
+    if (portNumber >= ports.size())
+    {
+      std::ostringstream ost;
+      ost << "MidiInAlsaRaw::openPort: the 'portNumber' argument (" << portNumber
+          << ") is invalid.";
+      error<invalid_parameter_error>(ost.str());
+      return;
+    }
+
+    if (snd_rawmidi_open(&rawmidi_, nullptr, ports[portNumber].device.c_str(), SND_RAWMIDI_NONBLOCK)
+        < 0)
+    {
+      rawmidi_ = nullptr;
+      error<driver_error>("MidiInAlsaRaw::openPort: error opening the rawmidi device.");
+      return;
+    }
+
+    parser_.reset();
+    running_ = true;
+    thread_ = std::thread{[this] { handle_input(); }};
+    connected_ = true;
+  }
+
+  void open_virtual_port(std::string_view /*portName*/) override
+  {
+    warning(
+        "MidiInAlsaRaw::openVirtualPort: rawmidi has no virtual ports - use the LINUX_ALSA "
+        "API, or snd-virmidi.");
+  }
+
+  void close_port() override
+  {
+    if (!connected_)
+      return;
+
+    running_ = false;
+    bool stop = true;
+    write(trigger_fds_[1], &stop, sizeof(stop));
+    thread_.join();
+
+    snd_rawmidi_close(rawmidi_);
+    rawmidi_ = nullptr;
+    connected_ = false;
+  }
+
+  void set_client_name(std::string_view /*clientName*/) override
+  {
+  }
+
+  void set_port_name(std::string_view /*portName*/) override
+  {
+    warning("MidiInAlsaRaw::setPortName: rawmidi ports are named by their driver.");
+  }
+
+  unsigned int get_port_count() override
+  {
+    return (unsigned int)rawmidiList(SND_RAWMIDI_STREAM_INPUT).size();
+  }
+
+  std::string get_port_name(unsigned int portNumber) override
+  {
+    const auto ports = rawmidiList(SND_RAWMIDI_STREAM_INPUT);
+    if (portNumber < ports.size())
+      return ports[portNumber].info.name;
+
+    warning("MidiInAlsaRaw::getPortName: error looking for port name!");
+    return {};
+  }
+
+  std::vector<port_information> get_ports() override
+  {
+    return rawmidiInfo(rawmidiList(SND_RAWMIDI_STREAM_INPUT));
+  }
+
+private:
+  void handle_input()
+  {
+    const int count = snd_rawmidi_poll_descriptors_count(rawmidi_);
+    std::vector<pollfd> fds(count + 1);
+    snd_rawmidi_poll_descriptors(rawmidi_, fds.data(), count);
+    fds[count] = {trigger_fds_[0], POLLIN, 0};
+
+    unsigned char buffer[1024];
+    while (running_)
+    {
+      if (poll(fds.data(), fds.size(), -1) <= 0)
+        continue;
+      if (fds[count].revents & POLLIN)
+      {
+        bool stop;
+        read(trigger_fds_[0], &stop, sizeof(stop));
+        continue;
+      }
+
+      // Everything read at once arrived together, so it shares a time
+      ssize_t result;
+      while ((result = snd_rawmidi_read(rawmidi_, buffer, sizeof(buffer))) > 0)
+      {
+        const int64_t now = monotonic_ns();
+        const size_t oversized = parser_.oversized();
+        parser_.set_sysex_limit(inputData_.sysexLimit.load(std::memory_order_relaxed));
+        parser_.parse(buffer, (size_t)result, [&](const unsigned char* bytes, size_t size) {
+          on_message(bytes, size, now);
+        });
+        if (parser_.oversized() != oversized)
+          std::cerr << "\nMidiInAlsaRaw::alsaMidiHandler: sysex message longer than the "
+                       "limit dropped!\n\n";
+      }
+      // Everything read in this wake-up goes to the batch callback together
+      inputData_.flush();
+      if (result < 0 && result != -EAGAIN)
+      {
+        std::cerr << "\nMidiInAlsaRaw::alsaMidiHandler: error reading from the device ("
+                  << snd_strerror((int)result) << ") - input stopped.\n\n";
+        return;
+      }
+    }
+  }
+
+  void on_message(const unsigned char* bytes, size_t size, int64_t arrived)
+  {
+    midi_in_api::in_data& rtData = inputData_;
+    switch (bytes[0])
+    {
+      case 0xF0:
+        if (rtData.ignoreFlags & 0x01)
+          return;
+        break;
+      case 0xF1:
+      case 0xF8:
+      case 0xF9:
+        if (rtData.ignoreFlags & 0x02)
+          return;
+        break;
+      case 0xFE:
+        if (rtData.ignoreFlags & 0x04)
+          return;
+        break;
+    }
+
+    message m;
+    m.bytes.assign(bytes, bytes + size);
+    rtData.stamp(m, arrived);
+
+    if (!rtData.deliver(std::move(m)))
+      std::cerr << "\nMidiInAlsaRaw: message queue limit reached!!\n\n";
+  }
+
+  snd_rawmidi_t* rawmidi_{};
+  int trigger_fds_[2]{-1, -1};
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+  midi_stream_parser parser_; // input thread only
+};
+
+class midi_out_alsa_raw final : public midi_out_api
+{
+public:
+  explicit midi_out_alsa_raw(std::string_view /*clientName*/)
+  {
+  }
+
+  ~midi_out_alsa_raw() override
+  {
+    midi_out_alsa_raw::close_port();
+  }
+
+  rtmidi::API get_current_api() const noexcept override
+  {
+    return rtmidi::API::LINUX_ALSA_RAW;
+  }
+
+  void open_port(unsigned int portNumber, std::string_view /*portName*/) override
+  {
+    if (connected_)
+    {
+      warning("MidiOutAlsaRaw::openPort: a valid connection already exists!");
+      return;
+    }
+
+    const auto ports = rawmidiList(SND_RAWMIDI_STREAM_OUTPUT);
+    if (ports.empty())
+    {
+      error<no_devices_found_error>("MidiOutAlsaRaw::openPort: no MIDI output destinations found!");
+      return;
+    }
+    if (portNumber >= ports.size())
+    {
+      std::ostringstream ost;
+      ost << "MidiOutAlsaRaw::openPort: the 'portNumber' argument (" << portNumber
+          << ") is invalid.";
+      error<invalid_parameter_error>(ost.str());
+      return;
+    }
+
+    if (snd_rawmidi_open(nullptr, &rawmidi_, ports[portNumber].device.c_str(), SND_RAWMIDI_NONBLOCK)
+        < 0)
+    {
+      rawmidi_ = nullptr;
+      error<driver_error>("MidiOutAlsaRaw::openPort: error opening the rawmidi device.");
+      return;
+    }
+
+    const int count = snd_rawmidi_poll_descriptors_count(rawmidi_);
+    fds_.resize(count);
+    snd_rawmidi_poll_descriptors(rawmidi_, fds_.data(), count);
+    connected_ = true;
+  }
+
+  void open_virtual_port(std::string_view /*portName*/) override
+  {
+    warning(
+        "MidiOutAlsaRaw::openVirtualPort: rawmidi has no virtual ports - use the LINUX_ALSA "
+        "API, or snd-virmidi.");
+  }
+
+  void close_port() override
+  {
+    if (!connected_)
+      return;
+
+    snd_rawmidi_close(rawmidi_);
+    rawmidi_ = nullptr;
+    connected_ = false;
+  }
+
+  void set_client_name(std::string_view /*clientName*/) override
+  {
+  }
+
+  void set_port_name(std::string_view /*portName*/) override
+  {
+    warning("MidiOutAlsaRaw::setPortName: rawmidi ports are named by their driver.");
+  }
+
+  unsigned int get_port_count() override
+  {
+    return (unsigned int)rawmidiList(SND_RAWMIDI_STREAM_OUTPUT).size();
+  }
+
+  std::string get_port_name(unsigned int portNumber) override
+  {
+    const auto ports = rawmidiList(SND_RAWMIDI_STREAM_OUTPUT);
+    if (portNumber < ports.size())
+      return ports[portNumber].info.name;
+
+    warning("MidiOutAlsaRaw::getPortName: error looking for port name!");
+    return {};
+  }
+
+  std::vector<port_information> get_ports() override
+  {
+    return rawmidiInfo(rawmidiList(SND_RAWMIDI_STREAM_OUTPUT));
+  }
+
+  // The device is opened non-blocking, so this only waits if the driver's buffer is full -
+  // and then only for room for the rest of the message, so a message never goes out in part
+  // unless the device stops taking bytes for a whole second.
+  void send_message(const unsigned char* message, size_t size) override
+  {
+    if (!connected_)
+    {
+      warning("MidiOutAlsaRaw::sendMessage: no port is open.");
+      return;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (size > 0)
+    {
+      const ssize_t result = snd_rawmidi_write(rawmidi_, message, size);
+      if (result > 0)
+      {
+        message += result;
+        size -= (size_t)result;
+        continue;
+      }
+      if (result != -EAGAIN && result != 0)
+      {
+        warning("MidiOutAlsaRaw::sendMessage: error sending MIDI message to port.");
+        return;
+      }
+
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0 || poll(fds_.data(), fds_.size(), (int)left.count()) <= 0)
+      {
+        warning("MidiOutAlsaRaw::sendMessage: the device isn't taking any more bytes.");
+        return;
+      }
+    }
+  }
+
+private:
+  snd_rawmidi_t* rawmidi_{};
+  std::vector<pollfd> fds_;
+};
+
+struct alsa_raw_backend
+{
+  using midi_in = midi_in_alsa_raw;
+  using midi_out = midi_out_alsa_raw;
+  using midi_observer = observer_alsa_raw;
+  static const constexpr auto API = rtmidi::API::LINUX_ALSA_RAW;
+};
+}
@@ -0,0 +1,44 @@
+#pragma once
+// The backends compiled into this build, chosen by the RTMIDI17_* defines
+#include <rtmidi17/detail/midi_api.hpp>
+#if !__has_include(<weak_libjack.h>) && !__has_include(<jack/jack.h>)
+#  if defined(RTMIDI17_JACK)
+#    undef RTMIDI17_JACK
+#  endif
+#endif
+#if !defined(RTMIDI17_ALSA) && !defined(RTMIDI17_ALSA_RAW) && !defined(RTMIDI17_JACK) \
+    && !defined(RTMIDI17_COREAUDIO) && !defined(RTMIDI17_WINMM)
+#  define RTMIDI17_DUMMY
+#endif
+
+#if defined(RTMIDI17_ALSA)
+#  include <rtmidi17/detail/alsa.hpp>
+#endif
+
+#if defined(RTMIDI17_ALSA_RAW)
+#  include <rtmidi17/detail/alsa_raw.hpp>
+#endif
+
+#if defined(RTMIDI17_JACK)
+#  include <rtmidi17/detail/jack.hpp>
+#endif
+
+#if defined(RTMIDI17_COREAUDIO)
+#  include <rtmidi17/detail/coreaudio.hpp>
+#endif
+
+#if defined(RTMIDI17_WINMM)
+#  include <rtmidi17/detail/winmm.hpp>
+#endif
+
+#if defined(RTMIDI17_WINUWP)
+#  include <rtmidi17/detail/winuwp.hpp>
+#endif
+
+#if defined(RTMIDI17_LOOPBACK)
+#  include <rtmidi17/detail/loopback.hpp>
+#endif
+
+#if defined(RTMIDI17_DUMMY)
+#  include <rtmidi17/detail/dummy.hpp>
+#endif
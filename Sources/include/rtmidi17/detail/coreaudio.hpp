@@ -168,7 +168,6 @@ struct coremidi_data
   MIDIPortRef port{};
   MIDIEndpointRef endpoint{};
   MIDIEndpointRef destinationId{};
-  unsigned long long lastTime{};
   MIDISysexSendRequest sysexreq{};
 };
 
@@ -369,11 +368,13 @@ private:
   static void midiInputCallback(const MIDIPacketList* list, void* procRef, void* /*srcRef*/)
   {
     auto& data = *static_cast<midi_in_api::in_data*>(procRef);
-    auto apiData = static_cast<coremidi_data*>(data.apiData);
 
     unsigned char status{};
     unsigned short nBytes{}, iByte{}, size{};
-    unsigned long long time{};
+
+    // Host time to our clock - read together, so the difference is only how the two count
+    const int64_t offset
+        = monotonic_ns() - (int64_t)AudioConvertHostTimeToNanos(AudioGetCurrentHostTime());
 
     bool& continueSysex = data.continueSysex;
     message& msg = data.message;
@@ -399,27 +400,12 @@ private:
       }
 
       // Calculate time stamp.
-      if (data.firstMessage)
-      {
-        msg.timestamp = 0.0;
-        data.firstMessage = false;
-      }
-      else
-      {
-        time = packet->timeStamp;
-        if (time == 0)
-        { // this happens when receiving asynchronous sysex messages
-          time = AudioGetCurrentHostTime();
-        }
-        time -= apiData->lastTime;
-        time = AudioConvertHostTimeToNanos(time);
-        if (!continueSysex)
-          msg.timestamp = time * 0.000000001;
+      MIDITimeStamp hostTime = packet->timeStamp;
+      if (hostTime == 0)
+      { // this happens when receiving asynchronous sysex messages
+        hostTime = AudioGetCurrentHostTime();
       }
-
-      // Track whether any non-filtered messages were found in this
-      // packet for timestamp calculation
-      bool foundNonFiltered = false;
+      const int64_t time_ns = (int64_t)AudioConvertHostTimeToNanos(hostTime) + offset;
 
       iByte = 0;
       if (continueSysex)
@@ -513,8 +499,8 @@ private:
           // Copy the MIDI data to our vector.
           if (size)
           {
-            foundNonFiltered = true;
             msg.bytes.assign(&packet->data[iByte], &packet->data[iByte + size]);
+            data.stamp(msg, time_ns);
             if (!continueSysex)
             {
               // If not a continuing sysex message, invoke the user callback
@@ -537,16 +523,6 @@ private:
         }
       }
 
-      // Save the time of the last non-filtered message
-      if (foundNonFiltered)
-      {
-        apiData->lastTime = packet->timeStamp;
-        if (apiData->lastTime == 0)
-        { // this happens when receiving asynchronous sysex messages
-          apiData->lastTime = AudioGetCurrentHostTime();
-        }
-      }
-
       packet = MIDIPacketNext(packet);
     }
   }
@@ -8,6 +8,13 @@
 #    include <jack/midiport.h>
 #    include <jack/ringbuffer.h>
 #  endif
+#  include <algorithm>
+#  include <array>
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstring>
+#  include <mutex>
+#  include <thread>
 #  include <rtmidi17/detail/midi_api.hpp>
 #  include <rtmidi17/detail/semaphore.hpp>
 #  include <rtmidi17/rtmidi17.hpp>
@@ -22,14 +29,56 @@
 
 namespace rtmidi
 {
+// Outgoing messages are framed into a single ringbuffer: a header with the time the message
+// is due and its length, then the bytes. A frame (or a whole batch of them) only becomes
+// visible to the process callback when the write pointer is advanced past all of it, so the
+// reader never sees a header without its bytes.
+struct jack_frame_header
+{
+  jack_time_t time; // usecs, as jack_get_time()
+  uint32_t size;
+};
+
+// Copy into the two halves of a write vector - offset is how far into it we already are
+inline void
+jack_write_vector(jack_ringbuffer_data_t* vec, size_t& offset, const void* src, size_t size)
+{
+  auto bytes = (const char*)src;
+  while (size > 0)
+  {
+    const bool first = offset < vec[0].len;
+    char* dst = first ? vec[0].buf + offset : vec[1].buf + (offset - vec[0].len);
+    const size_t space = first ? vec[0].len - offset : vec[1].len - (offset - vec[0].len);
+    const size_t n = std::min(size, space);
+    std::memcpy(dst, bytes, n);
+    bytes += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+inline void jack_write_frame(
+    jack_ringbuffer_data_t* vec, size_t& offset, jack_time_t time, const unsigned char* message,
+    size_t size)
+{
+  const jack_frame_header header{time, static_cast<uint32_t>(size)};
+  jack_write_vector(vec, offset, &header, sizeof(header));
+  jack_write_vector(vec, offset, message, size);
+}
+
+// Only takes the next frame if all of it is there
+inline bool jack_peek_frame(jack_ringbuffer_t* buffer, jack_frame_header& header)
+{
+  return jack_ringbuffer_peek(buffer, (char*)&header, sizeof(header)) == sizeof(header)
+         && jack_ringbuffer_read_space(buffer) >= sizeof(header) + header.size;
+}
+
 struct jack_data
 {
   static const constexpr auto ringbuffer_size = 16384;
   jack_client_t* client{};
   jack_port_t* port{};
-  jack_ringbuffer_t* buffSize{};
-  jack_ringbuffer_t* buffMessage{};
-  jack_time_t lastTime{};
+  jack_ringbuffer_t* buffMessages{};
 
   rtmidi::semaphore sem_cleanup;
   rtmidi::semaphore sem_needpost{};
@@ -49,6 +98,9 @@ public:
   }
 };
 
+// Nothing but copying happens in the process callback: events go into a ringbuffer that was
+// allocated up front, and a dispatcher thread decodes them and calls the user callback, so a
+// slow callback can't make JACK miss its deadline.
 class midi_in_jack final : public midi_in_api
 {
 public:
@@ -61,6 +113,11 @@ public:
     data.client = nullptr;
     this->clientName = cname;
 
+    ringbuffer_ = jack_ringbuffer_create(jack_data::ringbuffer_size);
+    jack_ringbuffer_mlock(ringbuffer_);
+    dispatching_ = true;
+    dispatcher_ = std::thread{[this] { dispatch(); }};
+
     connect();
   }
 
@@ -68,8 +125,17 @@ public:
   {
     midi_in_jack::close_port();
 
+    // No more process callbacks after this, so nothing writes to the ringbuffer
     if (data.client)
       jack_client_close(data.client);
+
+    dispatching_ = false;
+    {
+      std::lock_guard<std::mutex> lock{dispatch_mutex_};
+    }
+    dispatch_cv_.notify_one();
+    dispatcher_.join();
+    jack_ringbuffer_free(ringbuffer_);
   }
 
   rtmidi::API get_current_api() const noexcept override
@@ -189,6 +255,16 @@ public:
     return retStr;
   }
 
+  input_statistics get_statistics() override
+  {
+    input_statistics stats;
+    stats.xruns = xruns_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < stats.process_durations.size(); i++)
+      stats.process_durations[i] = process_durations_[i].load(std::memory_order_relaxed);
+    return stats;
+  }
+
 private:
   void connect()
   {
@@ -203,109 +279,167 @@ private:
       return;
     }
 
-    jack_set_process_callback(data.client, jackProcessIn, &data);
+    jack_set_process_callback(data.client, jackProcessIn, this);
+    jack_set_xrun_callback(data.client, jackXRun, this);
     jack_activate(data.client);
   }
 
+  static int jackXRun(void* arg)
+  {
+    auto& self = *(midi_in_jack*)arg;
+    self.xruns_.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  // Realtime thread: no locks that can block, no allocation, no calls out to the user
   static int jackProcessIn(jack_nframes_t nframes, void* arg)
   {
-    jack_data& jData = *(jack_data*)arg;
-    midi_in_api::in_data& rtData = *jData.rtMidiIn;
-    jack_midi_event_t event;
-    jack_time_t time;
+    auto& self = *(midi_in_jack*)arg;
+    const jack_time_t start = jack_get_time();
 
     // Is port created?
-    if (jData.port == nullptr)
+    if (self.data.port == nullptr)
       return 0;
-    void* buff = jack_port_get_buffer(jData.port, nframes);
+    void* buff = jack_port_get_buffer(self.data.port, nframes);
+    const jack_nframes_t cycleStart = jack_last_frame_time(self.data.client);
 
-    // We have midi events in buffer
-    uint32_t evCount = jack_midi_get_event_count(buff);
+    // Each event is stamped with the time of its own frame, not the time of the callback
+    jack_midi_event_t event;
+    const uint32_t evCount = jack_midi_get_event_count(buff);
     for (uint32_t j = 0; j < evCount; j++)
     {
-      message m;
-
-      jack_midi_event_get(&event, buff, j);
+      if (jack_midi_event_get(&event, buff, j) != 0 || event.size == 0)
+        continue;
 
-      m.bytes.assign(event.buffer, event.buffer + event.size);
-
-      // Compute the delta time.
-      time = jack_get_time();
-      if (rtData.firstMessage == true)
-      {
-        m.timestamp = 0.;
-        rtData.firstMessage = false;
-      }
-      else
+      const size_t total = sizeof(jack_frame_header) + event.size;
+      if (jack_ringbuffer_write_space(self.ringbuffer_) < total)
       {
-        m.timestamp = (time - jData.lastTime) * 0.000001;
+        self.dropped_.fetch_add(1, std::memory_order_relaxed);
+        continue;
       }
 
-      jData.lastTime = time;
-      if (!rtData.continueSysex)
-        m.clear();
+      jack_ringbuffer_data_t vec[2];
+      jack_ringbuffer_get_write_vector(self.ringbuffer_, vec);
+      size_t offset = 0;
+      jack_write_frame(
+          vec, offset, jack_frames_to_time(self.data.client, cycleStart + event.time),
+          event.buffer, event.size);
+      jack_ringbuffer_write_advance(self.ringbuffer_, total);
+    }
 
-      if (!((rtData.continueSysex || event.buffer[0] == 0xF0) && (rtData.ignoreFlags & 0x01)))
-      {
-        // Unless this is a (possibly continued) SysEx message and we're ignoring SysEx,
-        // copy the event buffer into the MIDI message struct.
-        for (unsigned int i = 0; i < event.size; i++)
-          m.bytes.push_back(event.buffer[i]);
-      }
+    // The dispatcher holds the mutex except while it waits, so getting it means it's waiting.
+    // If it's busy it will look at the ringbuffer again before it waits, and anything that
+    // slips in between is picked up by the next cycle's wake-up.
+    if (jack_ringbuffer_read_space(self.ringbuffer_) > 0)
+    {
+      std::unique_lock<std::mutex> lock{self.dispatch_mutex_, std::try_to_lock};
+      if (lock.owns_lock())
+        self.dispatch_cv_.notify_one();
+    }
+
+    // Bucket i counts callbacks that took under 2^i usecs
+    const jack_time_t duration = jack_get_time() - start;
+    size_t bucket = 0;
+    while (bucket + 1 < self.process_durations_.size() && (duration >> bucket) != 0)
+      bucket++;
+    self.process_durations_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    return 0;
+  }
 
-      switch (event.buffer[0])
+  void dispatch()
+  {
+    std::unique_lock<std::mutex> lock{dispatch_mutex_};
+    while (dispatching_)
+    {
+      // JACK's clock to ours - frame times are in usecs as jack_get_time() gives them
+      const int64_t offset = monotonic_ns() - (int64_t)jack_get_time() * 1000;
+      jack_frame_header header;
+      while (jack_peek_frame(ringbuffer_, header))
       {
-        case 0xF0:
-          // Start of a SysEx message
-          rtData.continueSysex = event.buffer[event.size - 1] != 0xF7;
-          if (rtData.ignoreFlags & 0x01)
-            continue;
-          break;
-        case 0xF1:
-        case 0xF8:
-          // MIDI Time Code or Timing Clock message
-          if (rtData.ignoreFlags & 0x02)
-            continue;
-          break;
-        case 0xFE:
-          // Active Sensing message
-          if (rtData.ignoreFlags & 0x04)
-            continue;
-          break;
-        default:
-          if (rtData.continueSysex)
-          {
-            // Continuation of a SysEx message
-            rtData.continueSysex = event.buffer[event.size - 1] != 0xF7;
-            if (rtData.ignoreFlags & 0x01)
-              continue;
-          }
-          // All other MIDI messages
+        jack_ringbuffer_read_advance(ringbuffer_, sizeof(header));
+        bytes_.resize(header.size);
+        jack_ringbuffer_read(ringbuffer_, (char*)bytes_.data(), header.size);
+        on_event((int64_t)header.time * 1000 + offset, bytes_.data(), bytes_.size());
       }
+      // Everything handed over since the last wake-up goes to the batch callback together
+      inputData_.flush();
+      dispatch_cv_.wait(lock);
+    }
+  }
 
-      if (!rtData.continueSysex)
-      {
-        // If not a continuation of a SysEx message,
-        // invoke the user callback function or queue the message.
-        if (rtData.userCallback)
-        {
-          rtData.userCallback(std::move(m));
-        }
-        else
+  // Dispatcher thread - a SysEx split over several events is put back together here
+  void on_event(int64_t time_ns, const unsigned char* bytes, size_t size)
+  {
+    midi_in_api::in_data& rtData = inputData_;
+    message& m = rtData.message;
+
+    if (!rtData.continueSysex)
+    {
+      m.clear();
+      rtData.stamp(m, time_ns);
+    }
+
+    if (!((rtData.continueSysex || bytes[0] == 0xF0) && (rtData.ignoreFlags & 0x01)))
+    {
+      // Unless this is a (possibly continued) SysEx message and we're ignoring SysEx,
+      // copy the event buffer into the MIDI message struct.
+      m.bytes.insert(m.bytes.end(), bytes, bytes + size);
+    }
+
+    switch (bytes[0])
+    {
+      case 0xF0:
+        // Start of a SysEx message
+        rtData.continueSysex = bytes[size - 1] != 0xF7;
+        if (rtData.ignoreFlags & 0x01)
+          return;
+        break;
+      case 0xF1:
+      case 0xF8:
+        // MIDI Time Code or Timing Clock message
+        if (rtData.ignoreFlags & 0x02)
+          return;
+        break;
+      case 0xFE:
+        // Active Sensing message
+        if (rtData.ignoreFlags & 0x04)
+          return;
+        break;
+      default:
+        if (rtData.continueSysex)
         {
-          // As long as we haven't reached our queue size limit, push the
-          // message.
-          if (!rtData.queue.push(std::move(m)))
-            std::cerr << "\nMidiInJack: message queue limit reached!!\n\n";
+          // Continuation of a SysEx message
+          rtData.continueSysex = bytes[size - 1] != 0xF7;
+          if (rtData.ignoreFlags & 0x01)
+            return;
         }
-      }
+        // All other MIDI messages
     }
 
-    return 0;
+    if (!rtData.continueSysex)
+    {
+      // If not a continuation of a SysEx message,
+      // invoke the user callback function or queue the message.
+      if (!rtData.deliver(std::move(m)))
+        std::cerr << "\nMidiInJack: message queue limit reached!!\n\n";
+    }
   }
 
   std::string clientName;
   jack_data data;
+
+  // Written by the process callback, read by the dispatcher thread
+  jack_ringbuffer_t* ringbuffer_{};
+  std::thread dispatcher_;
+  std::mutex dispatch_mutex_;
+  std::condition_variable dispatch_cv_;
+  std::atomic<bool> dispatching_{false};
+  std::vector<unsigned char> bytes_; // dispatcher only
+
+  std::atomic<uint64_t> xruns_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::array<std::atomic<uint64_t>, 16> process_durations_{};
 };
 
 class midi_out_jack final : public midi_out_api
@@ -325,8 +459,8 @@ public:
     midi_out_jack::close_port();
 
     // Cleanup
-    jack_ringbuffer_free(data.buffSize);
-    jack_ringbuffer_free(data.buffMessage);
+    if (data.buffMessages)
+      jack_ringbuffer_free(data.buffMessages);
     if (data.client)
     {
       jack_client_close(data.client);
@@ -458,11 +592,50 @@ public:
 
   void send_message(const unsigned char* message, size_t size) override
   {
-    int nBytes = static_cast<int>(size);
+    if (!data.buffMessages)
+      return;
+
+    const size_t total = sizeof(jack_frame_header) + size;
+    if (jack_ringbuffer_write_space(data.buffMessages) < total)
+    {
+      warning("MidiOutJack::sendMessage: ringbuffer full - is the JACK server running?");
+      return;
+    }
+
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(data.buffMessages, vec);
+    size_t offset = 0;
+    jack_write_frame(vec, offset, jack_get_time(), message, size);
+    jack_ringbuffer_write_advance(data.buffMessages, total);
+  }
+
+  // Each timestamp is the delay in seconds after the previous message of the batch (the first
+  // one's is after now), as rtmidi timestamps are deltas. The whole batch is handed to the
+  // process callback at once, and each message lands on its own frame offset.
+  void send_messages(const rtmidi::message* messages, size_t count) override
+  {
+    if (!data.buffMessages || count == 0)
+      return;
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+      total += sizeof(jack_frame_header) + messages[i].bytes.size();
+    if (jack_ringbuffer_write_space(data.buffMessages) < total)
+    {
+      warning("MidiOutJack::sendMessages: ringbuffer full - is the JACK server running?");
+      return;
+    }
 
-    // Write full message to buffer
-    jack_ringbuffer_write(data.buffMessage, (const char*)message, nBytes);
-    jack_ringbuffer_write(data.buffSize, (char*)&nBytes, sizeof(nBytes));
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(data.buffMessages, vec);
+    size_t offset = 0;
+    double time = (double)jack_get_time();
+    for (size_t i = 0; i < count; i++)
+    {
+      time += messages[i].timestamp * 1000000.;
+      jack_write_frame(vec, offset, (jack_time_t)time, messages[i].bytes.data(), messages[i].bytes.size());
+    }
+    jack_ringbuffer_write_advance(data.buffMessages, total);
   }
 
 private:
@@ -473,9 +646,9 @@ private:
     if (data.client)
       return;
 
-    // Initialize output ringbuffers
-    data.buffSize = jack_ringbuffer_create(jack_data::ringbuffer_size);
-    data.buffMessage = jack_ringbuffer_create(jack_data::ringbuffer_size);
+    // Initialize output ringbuffer
+    if (!data.buffMessages)
+      data.buffMessages = jack_ringbuffer_create(jack_data::ringbuffer_size);
 
     // Initialize JACK client
     data.client = jack_client_open(clientName.c_str(), JackNoStartServer, nullptr);
@@ -500,13 +673,26 @@ private:
     void* buff = jack_port_get_buffer(data.port, nframes);
     jack_midi_clear_buffer(buff);
 
-    while (jack_ringbuffer_read_space(data.buffSize) > 0)
+    // Messages are played one period after they were sent, so the spacing between them is
+    // kept to the frame: anything sent during the last cycle lands in this one, at the offset
+    // matching when it was sent. Later ones stay in the ringbuffer for their own cycle.
+    const jack_nframes_t cycleStart = jack_last_frame_time(data.client);
+    jack_nframes_t lastOffset = 0;
+    jack_frame_header header;
+    while (jack_peek_frame(data.buffMessages, header))
     {
-      int space{};
-      jack_ringbuffer_read(data.buffSize, (char*)&space, sizeof(int));
-      auto midiData = jack_midi_event_reserve(buff, 0, space);
-
-      jack_ringbuffer_read(data.buffMessage, (char*)midiData, space);
+      const int32_t due = (int32_t)(jack_time_to_frames(data.client, header.time) + nframes - cycleStart);
+      if (due >= (int32_t)nframes)
+        break;
+      // Late ones go at the start, and offsets can't go backwards within a cycle
+      const jack_nframes_t offset = std::max(lastOffset, (jack_nframes_t)std::max(due, 0));
+
+      auto midiData = jack_midi_event_reserve(buff, offset, header.size);
+      if (midiData == nullptr)
+        break; // The port buffer is full - try again next cycle
+      jack_ringbuffer_read_advance(data.buffMessages, sizeof(header));
+      jack_ringbuffer_read(data.buffMessages, (char*)midiData, header.size);
+      lastOffset = offset;
     }
 
     if (!data.sem_needpost.try_wait())
@@ -0,0 +1,571 @@
+#pragma once
+#include <rtmidi17/detail/midi_api.hpp>
+#include <rtmidi17/rtmidi17.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//*********************************************************************//
+//  API: LOOPBACK
+//
+//  In-process ports. A port is a cable: whatever a midi_out sends on it
+//  is delivered to every midi_in that has it open. Nothing leaves the
+//  process, so it works where there is no MIDI hardware or sound
+//  server, and nothing makes a system call unless latency has been
+//  asked for. Ports are plugged and unplugged from code (see
+//  rtmidi::loopback), and observers are told, as for a real device.
+//*********************************************************************//
+
+namespace rtmidi
+{
+class midi_in_loopback;
+class observer_loopback;
+
+struct loopback_port
+{
+  using clock = std::chrono::steady_clock;
+
+  unsigned int id{};
+  std::string name;
+  std::atomic<bool> plugged{true};
+
+  // The inputs that have it open. Recursive, as a callback may send on the port it listens to.
+  std::recursive_mutex mutex;
+  std::vector<midi_in_loopback*> inputs;
+
+  // Latest time anything on this port is due - jitter never reorders a port. Bus mutex.
+  clock::time_point lastDue{};
+};
+
+class loopback_bus
+{
+public:
+  using clock = loopback_port::clock;
+
+  static loopback_bus& instance()
+  {
+    static loopback_bus bus;
+    return bus;
+  }
+
+  ~loopback_bus()
+  {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      running_ = false;
+    }
+    scheduled_cv_.notify_one();
+    if (scheduler_.joinable())
+      scheduler_.join();
+  }
+
+  std::shared_ptr<loopback_port> plug(std::string_view name)
+  {
+    auto port = std::make_shared<loopback_port>();
+    port->name = name;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      port->id = nextId_++;
+      ports_.emplace(port->id, port);
+    }
+    notify(port->id, port->name, true);
+    return port;
+  }
+
+  bool unplug(unsigned int id)
+  {
+    std::shared_ptr<loopback_port> port;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      auto it = ports_.find(id);
+      if (it == ports_.end())
+        return false;
+      port = std::move(it->second);
+      ports_.erase(it);
+    }
+    port->plugged = false;
+    notify(port->id, port->name, false);
+    return true;
+  }
+
+  std::shared_ptr<loopback_port> port_at(unsigned int index)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (index >= ports_.size())
+      return {};
+    return std::next(ports_.begin(), index)->second;
+  }
+
+  std::vector<port_information> get_ports()
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    std::vector<port_information> ports;
+    ports.reserve(ports_.size());
+    for (const auto& [id, port] : ports_)
+      ports.push_back({id, port->name});
+    return ports;
+  }
+
+  void set_latency(std::chrono::nanoseconds latency, std::chrono::nanoseconds jitter, unsigned int seed)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    latency_ = latency;
+    jitter_ = jitter;
+    random_.seed(seed);
+  }
+
+  // When a message sent at sent is due - sent itself, unless latency has been asked for
+  clock::time_point due(loopback_port& port, clock::time_point sent)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    clock::time_point due = sent + latency_;
+    if (jitter_.count() > 0)
+      due += std::chrono::nanoseconds{std::uniform_int_distribution<int64_t>{0, jitter_.count()}(random_)};
+    due = std::max(due, port.lastDue);
+    port.lastDue = due;
+    return due;
+  }
+
+  // Straight to the inputs when it's due now, otherwise the scheduler thread delivers it then
+  void send(
+      const std::shared_ptr<loopback_port>& port, const unsigned char* bytes, size_t size,
+      clock::time_point due, clock::time_point now);
+
+  void add_observer(observer_loopback* observer)
+  {
+    std::lock_guard<std::recursive_mutex> lock{observers_mutex_};
+    observers_.push_back(observer);
+  }
+
+  void remove_observer(observer_loopback* observer)
+  {
+    std::lock_guard<std::recursive_mutex> lock{observers_mutex_};
+    observers_.erase(std::remove(observers_.begin(), observers_.end(), observer), observers_.end());
+  }
+
+private:
+  struct scheduled
+  {
+    clock::time_point due;
+    uint64_t sequence; // keeps messages due at the same time in the order they were sent
+    std::shared_ptr<loopback_port> port;
+    message m;
+
+    bool operator>(const scheduled& other) const
+    {
+      return due != other.due ? due > other.due : sequence > other.sequence;
+    }
+  };
+
+  inline void deliver(loopback_port& port, const unsigned char* bytes, size_t size, clock::time_point due);
+  inline void notify(unsigned int id, const std::string& name, bool added);
+
+  void schedule()
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (running_)
+    {
+      if (scheduled_.empty())
+      {
+        scheduled_cv_.wait(lock);
+        continue;
+      }
+      if (scheduled_.top().due > clock::now())
+      {
+        scheduled_cv_.wait_until(lock, scheduled_.top().due);
+        continue;
+      }
+      scheduled next = scheduled_.top();
+      scheduled_.pop();
+      lock.unlock();
+      deliver(*next.port, next.m.bytes.data(), next.m.bytes.size(), next.due);
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::map<unsigned int, std::shared_ptr<loopback_port>> ports_; // in id order, as they are numbered
+  unsigned int nextId_{};
+  std::chrono::nanoseconds latency_{};
+  std::chrono::nanoseconds jitter_{};
+  std::minstd_rand random_{1};
+
+  std::priority_queue<scheduled, std::vector<scheduled>, std::greater<scheduled>> scheduled_;
+  uint64_t nextSequence_{};
+  std::condition_variable scheduled_cv_;
+  std::thread scheduler_;
+  bool running_{true};
+
+  // Recursive, so an observer callback can plug or unplug a port
+  std::recursive_mutex observers_mutex_;
+  std::vector<observer_loopback*> observers_;
+};
+
+class observer_loopback final : public observer_api
+{
+public:
+  observer_loopback(observer::callbacks&& c) : observer_api{std::move(c)}
+  {
+    loopback_bus::instance().add_observer(this);
+  }
+
+  ~observer_loopback()
+  {
+    loopback_bus::instance().remove_observer(this);
+  }
+
+  void port_changed(unsigned int id, const std::string& name, bool added)
+  {
+    auto& input = added ? callbacks_.input_added : callbacks_.input_removed;
+    auto& output = added ? callbacks_.output_added : callbacks_.output_removed;
+    if (input)
+      input((int)id, name);
+    if (output)
+      output((int)id, name);
+  }
+};
+
+class midi_in_loopback final : public midi_in_api
+{
+public:
+  midi_in_loopback(std::string_view /*clientName*/, unsigned int queueSizeLimit)
+      : midi_in_api{nullptr, queueSizeLimit}
+  {
+  }
+
+  ~midi_in_loopback() override
+  {
+    midi_in_loopback::close_port();
+  }
+
+  rtmidi::API get_current_api() const noexcept override
+  {
+    return rtmidi::API::LOOPBACK;
+  }
+
+  void open_port(unsigned int portNumber, std::string_view /*portName*/) override
+  {
+    if (port_)
+    {
+      warning("MidiInLoopback::openPort: a valid connection already exists!");
+      return;
+    }
+
+    auto port = loopback_bus::instance().port_at(portNumber);
+    if (!port)
+    {
+      std::ostringstream ost;
+      ost << "MidiInLoopback::openPort: the 'portNumber' argument (" << portNumber
+          << ") is invalid.";
+      error<invalid_parameter_error>(ost.str());
+      return;
+    }
+
+    attach(std::move(port));
+    connected_ = true;
+  }
+
+  void open_virtual_port(std::string_view portName) override
+  {
+    if (port_)
+      return;
+
+    attach(loopback_bus::instance().plug(portName));
+    virtual_ = true;
+  }
+
+  void close_port() override
+  {
+    if (!port_)
+      return;
+
+    {
+      std::lock_guard<std::recursive_mutex> lock{port_->mutex};
+      auto& inputs = port_->inputs;
+      inputs.erase(std::remove(inputs.begin(), inputs.end(), this), inputs.end());
+    }
+    if (virtual_)
+      loopback_bus::instance().unplug(port_->id);
+
+    port_.reset();
+    virtual_ = false;
+    connected_ = false;
+  }
+
+  void set_client_name(std::string_view /*clientName*/) override
+  {
+  }
+
+  void set_port_name(std::string_view /*portName*/) override
+  {
+    warning("MidiInLoopback::setPortName: ports keep the name they were plugged with.");
+  }
+
+  unsigned int get_port_count() override
+  {
+    return (unsigned int)loopback_bus::instance().get_ports().size();
+  }
+
+  std::string get_port_name(unsigned int portNumber) override
+  {
+    auto port = loopback_bus::instance().port_at(portNumber);
+    return port ? port->name : std::string{};
+  }
+
+  std::vector<port_information> get_ports() override
+  {
+    return loopback_bus::instance().get_ports();
+  }
+
+  // Under the port's mutex, in the thread that sent it or the scheduler's
+  void on_message(const unsigned char* bytes, size_t size, loopback_port::clock::time_point arrived)
+  {
+    if (size == 0)
+      return;
+
+    midi_in_api::in_data& rtData = inputData_;
+    switch (bytes[0])
+    {
+      case 0xF0:
+        if (rtData.ignoreFlags & 0x01)
+          return;
+        break;
+      case 0xF1:
+      case 0xF8:
+        if (rtData.ignoreFlags & 0x02)
+          return;
+        break;
+      case 0xFE:
+        if (rtData.ignoreFlags & 0x04)
+          return;
+        break;
+    }
+
+    message m;
+    m.bytes.assign(bytes, bytes + size);
+
+    // The time it was due, not the time the thread got to it, so injected latency is exact
+    rtData.stamp(
+        m, std::chrono::duration_cast<std::chrono::nanoseconds>(arrived.time_since_epoch()).count());
+
+    // Each message is a delivery of its own, so a batch is always one
+    if (!rtData.deliver(std::move(m)))
+      std::cerr << "\nMidiInLoopback: message queue limit reached!!\n\n";
+    rtData.flush();
+  }
+
+private:
+  void attach(std::shared_ptr<loopback_port> port)
+  {
+    {
+      std::lock_guard<std::recursive_mutex> lock{port->mutex};
+      port->inputs.push_back(this);
+    }
+    port_ = std::move(port);
+  }
+
+  std::shared_ptr<loopback_port> port_;
+  bool virtual_{};
+};
+
+class midi_out_loopback final : public midi_out_api
+{
+public:
+  explicit midi_out_loopback(std::string_view /*clientName*/)
+  {
+  }
+
+  ~midi_out_loopback() override
+  {
+    midi_out_loopback::close_port();
+  }
+
+  rtmidi::API get_current_api() const noexcept override
+  {
+    return rtmidi::API::LOOPBACK;
+  }
+
+  void open_port(unsigned int portNumber, std::string_view /*portName*/) override
+  {
+    if (port_)
+    {
+      warning("MidiOutLoopback::openPort: a valid connection already exists!");
+      return;
+    }
+
+    port_ = loopback_bus::instance().port_at(portNumber);
+    if (!port_)
+    {
+      std::ostringstream ost;
+      ost << "MidiOutLoopback::openPort: the 'portNumber' argument (" << portNumber
+          << ") is invalid.";
+      error<invalid_parameter_error>(ost.str());
+      return;
+    }
+    connected_ = true;
+  }
+
+  void open_virtual_port(std::string_view portName) override
+  {
+    if (port_)
+      return;
+
+    port_ = loopback_bus::instance().plug(portName);
+    virtual_ = true;
+  }
+
+  void close_port() override
+  {
+    if (!port_)
+      return;
+
+    if (virtual_)
+      loopback_bus::instance().unplug(port_->id);
+
+    port_.reset();
+    virtual_ = false;
+    connected_ = false;
+  }
+
+  void set_client_name(std::string_view /*clientName*/) override
+  {
+  }
+
+  void set_port_name(std::string_view /*portName*/) override
+  {
+    warning("MidiOutLoopback::setPortName: ports keep the name they were plugged with.");
+  }
+
+  unsigned int get_port_count() override
+  {
+    return (unsigned int)loopback_bus::instance().get_ports().size();
+  }
+
+  std::string get_port_name(unsigned int portNumber) override
+  {
+    auto port = loopback_bus::instance().port_at(portNumber);
+    return port ? port->name : std::string{};
+  }
+
+  std::vector<port_information> get_ports() override
+  {
+    return loopback_bus::instance().get_ports();
+  }
+
+  void send_message(const unsigned char* message, size_t size) override
+  {
+    if (!check_port())
+      return;
+
+    auto& bus = loopback_bus::instance();
+    const auto now = loopback_port::clock::now();
+    bus.send(port_, message, size, bus.due(*port_, now), now);
+  }
+
+  // Timestamps are deltas in seconds after the previous message, as for JACK
+  void send_messages(const rtmidi::message* messages, size_t count) override
+  {
+    if (!check_port())
+      return;
+
+    auto& bus = loopback_bus::instance();
+    const auto now = loopback_port::clock::now();
+    auto sent = now;
+    for (size_t i = 0; i < count; i++)
+    {
+      sent += std::chrono::duration_cast<loopback_port::clock::duration>(
+          std::chrono::duration<double>{messages[i].timestamp});
+      bus.send(port_, messages[i].bytes.data(), messages[i].bytes.size(), bus.due(*port_, sent), now);
+    }
+  }
+
+private:
+  bool check_port()
+  {
+    if (!port_)
+    {
+      warning("MidiOutLoopback::sendMessage: no port is open.");
+      return false;
+    }
+    if (!port_->plugged)
+    {
+      warning("MidiOutLoopback::sendMessage: the port has been unplugged.");
+      return false;
+    }
+    return true;
+  }
+
+  std::shared_ptr<loopback_port> port_;
+  bool virtual_{};
+};
+
+inline void loopback_bus::send(
+    const std::shared_ptr<loopback_port>& port, const unsigned char* bytes, size_t size,
+    clock::time_point due, clock::time_point now)
+{
+  if (due <= now)
+  {
+    deliver(*port, bytes, size, due);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    message m;
+    m.bytes.assign(bytes, bytes + size);
+    scheduled_.push({due, nextSequence_++, port, std::move(m)});
+    if (!scheduler_.joinable())
+      scheduler_ = std::thread{[this] { schedule(); }};
+  }
+  scheduled_cv_.notify_one();
+}
+
+inline void
+loopback_bus::deliver(loopback_port& port, const unsigned char* bytes, size_t size, clock::time_point due)
+{
+  if (!port.plugged)
+    return;
+
+  // By index, as a callback may close inputs and so shift the rest down.
+  // Carry on from just after the input that was called, wherever it is now,
+  // or from its old place if it closed itself.
+  std::lock_guard<std::recursive_mutex> lock{port.mutex};
+  for (size_t i = 0; i < port.inputs.size();)
+  {
+    midi_in_loopback* input = port.inputs[i];
+    input->on_message(bytes, size, due);
+    if (i < port.inputs.size() && port.inputs[i] == input)
+    {
+      i++;
+      continue;
+    }
+    auto it = std::find(port.inputs.begin(), port.inputs.end(), input);
+    if (it != port.inputs.end())
+      i = (it - port.inputs.begin()) + 1;
+  }
+}
+
+inline void loopback_bus::notify(unsigned int id, const std::string& name, bool added)
+{
+  std::lock_guard<std::recursive_mutex> lock{observers_mutex_};
+  for (size_t i = 0; i < observers_.size(); i++)
+    observers_[i]->port_changed(id, name, added);
+}
+
+struct loopback_backend
+{
+  using midi_in = midi_in_loopback;
+  using midi_out = midi_out_loopback;
+  using midi_observer = observer_loopback;
+  static const constexpr auto API = rtmidi::API::LOOPBACK;
+};
+}
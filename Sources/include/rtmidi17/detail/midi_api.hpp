@@ -1,5 +1,7 @@
 #pragma once
+#include <atomic>
 #include <iostream>
+#include <rtmidi17/detail/sysex_arena.hpp>
 #include <rtmidi17/rtmidi17.hpp>
 #include <string_view>
 
@@ -38,6 +40,17 @@ public:
   virtual unsigned int get_port_count() = 0;
   virtual std::string get_port_name(unsigned int portNumber) = 0;
 
+  // Backends that can list every port in one pass override this.
+  virtual std::vector<port_information> get_ports()
+  {
+    std::vector<port_information> ports;
+    const unsigned int count = get_port_count();
+    ports.reserve(count);
+    for (unsigned int i = 0; i < count; i++)
+      ports.push_back({i, get_port_name(i)});
+    return ports;
+  }
+
   bool is_port_open() const noexcept
   {
     return connected_;
@@ -132,14 +145,37 @@ public:
     }
   }
 
+  // Read by the input thread at the start of each SysEx message
+  void set_sysex_limit(size_t bytes)
+  {
+    inputData_.sysexLimit.store(bytes, std::memory_order_relaxed);
+  }
+
   void set_callback(midi_in::message_callback callback)
   {
+    inputData_.batchCallback = nullptr;
     inputData_.userCallback = std::move(callback);
   }
+  // Backends that batch look at batchCallback first; the rest get it a message at a time
+  void set_batch_callback(midi_in::batch_callback callback)
+  {
+    if (callback)
+      inputData_.userCallback = [callback](const message& m) { callback(&m, 1); };
+    else
+      inputData_.userCallback = nullptr;
+    inputData_.batchCallback = std::move(callback);
+  }
   void cancel_callback()
   {
+    inputData_.batchCallback = nullptr;
     inputData_.userCallback = nullptr;
   }
+  // Backends whose input runs in a realtime callback (JACK) fill this in.
+  virtual input_statistics get_statistics()
+  {
+    return {};
+  }
+
   message get_message()
   {
     if (inputData_.userCallback)
@@ -218,9 +254,54 @@ public:
     unsigned char ignoreFlags{7};
     bool doInput{false};
     bool firstMessage{true};
+    int64_t lastTime{};
     void* apiData{};
     midi_in::message_callback userCallback{};
     bool continueSysex{false};
+    std::atomic<size_t> sysexLimit{sysex_arena::default_limit};
+    midi_in::batch_callback batchCallback{};
+    std::vector<rtmidi::message> batch; // input thread only
+
+    // Stamps m with when it arrived, and the delta since the previous message
+    void stamp(rtmidi::message& m, int64_t time_ns)
+    {
+      m.time_ns = time_ns;
+      m.timestamp = firstMessage ? 0. : (time_ns - lastTime) * 1e-9;
+      firstMessage = false;
+      lastTime = time_ns;
+    }
+
+    // A wake-up that keeps finding more input is handed over in pieces this size
+    static constexpr size_t max_batch = 256;
+
+    // Hands m to the batch, the callback or the queue, whichever is in use -
+    // false if it went to the queue and the queue was full
+    bool deliver(rtmidi::message&& m)
+    {
+      if (batchCallback)
+      {
+        batch.push_back(std::move(m));
+        if (batch.size() >= max_batch)
+          flush();
+        return true;
+      }
+      if (userCallback)
+      {
+        userCallback(m);
+        return true;
+      }
+      return queue.push(m);
+    }
+
+    // The end of a wake-up - the batch callback gets everything delivered since the last one
+    void flush()
+    {
+      if (batch.empty())
+        return;
+      if (batchCallback)
+        batchCallback(batch.data(), batch.size());
+      batch.clear();
+    }
   };
 
 protected:
@@ -231,6 +312,14 @@ class midi_out_api : public midi_api
 {
 public:
   virtual void send_message(const unsigned char* message, size_t size) = 0;
+
+  // Backends that queue for a process callback (JACK) take the whole batch in one go and
+  // schedule by timestamp; the rest send them one after the other, straight away.
+  virtual void send_messages(const rtmidi::message* messages, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+      send_message(messages[i].bytes.data(), messages[i].bytes.size());
+  }
 };
 
 template <typename T>
@@ -1,8 +1,13 @@
 #pragma once
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
 #include <mutex>
 
 // Based on https://stackoverflow.com/a/27852868/1495627
+// The count is an atomic, so notify() and try_wait() are lock-free when nobody is blocked;
+// the mutex and condition variable are only touched by threads that have to sleep, and by
+// notify() when one of them might be.
 namespace rtmidi
 {
 class semaphore
@@ -19,26 +24,32 @@ public:
 
   void notify()
   {
-    std::lock_guard<std::mutex> lock{mutex_};
-    ++count_;
+    count_.fetch_add(1, std::memory_order_seq_cst);
+    // A waiter registers before it checks the count, so if it isn't counted yet it will see this one
+    if (waiters_.load(std::memory_order_seq_cst) == 0)
+      return;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+    }
     cv_.notify_one();
   }
 
   void wait()
   {
+    if (try_wait())
+      return;
+    waiter_scope waiter{waiters_};
     std::unique_lock<std::mutex> lock{mutex_};
-    cv_.wait(lock, [&] { return count_ > 0; });
-    --count_;
+    cv_.wait(lock, [&] { return try_wait(); });
   }
 
   bool try_wait()
   {
-    std::lock_guard<std::mutex> lock{mutex_};
-
-    if (count_ > 0)
+    size_t count = count_.load(std::memory_order_seq_cst);
+    while (count > 0)
     {
-      --count_;
-      return true;
+      if (count_.compare_exchange_weak(count, count - 1, std::memory_order_seq_cst))
+        return true;
     }
 
     return false;
@@ -47,30 +58,41 @@ public:
   template <typename T>
   bool wait_for(const T& d)
   {
+    if (try_wait())
+      return true;
+    waiter_scope waiter{waiters_};
     std::unique_lock<std::mutex> lock{mutex_};
-    auto finished = cv_.wait_for(lock, d, [&] { return count_ > 0; });
-
-    if (finished)
-      --count_;
-
-    return finished;
+    return cv_.wait_for(lock, d, [&] { return try_wait(); });
   }
 
   template <typename T>
   bool wait_until(const T& t)
   {
+    if (try_wait())
+      return true;
+    waiter_scope waiter{waiters_};
     std::unique_lock<std::mutex> lock{mutex_};
-    auto finished = cv_.wait_until(lock, t, [&] { return count_ > 0; });
-
-    if (finished)
-      --count_;
-
-    return finished;
+    return cv_.wait_until(lock, t, [&] { return try_wait(); });
   }
 
 private:
+  // Counts the threads that are about to sleep, for notify()
+  struct waiter_scope
+  {
+    explicit waiter_scope(std::atomic<size_t>& waiters) : waiters_{waiters}
+    {
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+    }
+    ~waiter_scope()
+    {
+      waiters_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    std::atomic<size_t>& waiters_;
+  };
+
   std::mutex mutex_;
   std::condition_variable cv_;
-  size_t count_;
+  std::atomic<size_t> count_;
+  std::atomic<size_t> waiters_{0};
 };
 }
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace rtmidi
+{
+// Reassembles a SysEx message that arrives in pieces. The buffer is reserved
+// up to the limit the first time it's needed and then kept from one message
+// to the next, so a long run of dumps doesn't reallocate or fragment the
+// heap. A message that would grow past the limit is dropped whole.
+class sysex_arena
+{
+public:
+  static constexpr size_t default_limit = 1024 * 1024;
+
+  // Starts a new message with its first piece, which should begin with 0xF0
+  void start(const unsigned char* bytes, size_t size, size_t limit)
+  {
+    if (limit != limit_)
+    {
+      limit_ = limit;
+      if (bytes_.capacity() > limit_)
+        std::vector<unsigned char>{}.swap(bytes_);
+    }
+    if (bytes_.capacity() < limit_)
+      bytes_.reserve(limit_);
+    bytes_.clear();
+    active_ = true;
+    overflowed_ = false;
+    append(bytes, size);
+  }
+
+  // Adds the next piece; ignored unless a message has been started
+  void append(const unsigned char* bytes, size_t size)
+  {
+    if (!active_ || overflowed_)
+      return;
+    if (size > limit_ - bytes_.size())
+    {
+      overflowed_ = true;
+      bytes_.clear();
+      return;
+    }
+    bytes_.insert(bytes_.end(), bytes, bytes + size);
+  }
+
+  // Ends the message - true if it fitted, in which case data() and size() hold it
+  bool finish()
+  {
+    const bool complete = active_ && !overflowed_;
+    active_ = false;
+    return complete;
+  }
+
+  void reset()
+  {
+    bytes_.clear();
+    active_ = false;
+    overflowed_ = false;
+  }
+
+  bool active() const noexcept
+  {
+    return active_;
+  }
+  bool overflowed() const noexcept
+  {
+    return overflowed_;
+  }
+  const unsigned char* data() const noexcept
+  {
+    return bytes_.data();
+  }
+  size_t size() const noexcept
+  {
+    return bytes_.size();
+  }
+
+private:
+  std::vector<unsigned char> bytes_;
+  size_t limit_{};
+  bool active_{};
+  bool overflowed_{};
+};
+}
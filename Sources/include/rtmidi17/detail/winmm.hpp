@@ -41,7 +41,7 @@ struct WinMidiData
 {
   HMIDIIN inHandle;   // Handle to Midi Input Device
   HMIDIOUT outHandle; // Handle to Midi Output Device
-  DWORD lastTime;
+  int64_t startTime; // monotonic_ns() when the input was started - its timestamps count from there
   rtmidi::message message;
   LPMIDIHDR sysexBuffer[RT_SYSEX_BUFFER_COUNT];
   CRITICAL_SECTION
@@ -298,6 +298,7 @@ public:
       }
     }
 
+    data.startTime = monotonic_ns();
     result = midiInStart(data.inHandle);
     if (result != MMSYSERR_NOERROR)
     {
@@ -404,15 +405,6 @@ private:
     midi_in_api::in_data& data = *(midi_in_api::in_data*)instancePtr;
     WinMidiData& apiData = *static_cast<WinMidiData*>(data.apiData);
 
-    // Calculate time stamp.
-    if (data.firstMessage == true)
-    {
-      apiData.message.timestamp = 0.0;
-      data.firstMessage = false;
-    }
-    else
-      apiData.message.timestamp = (double)(timestamp - apiData.lastTime) * 0.001;
-
     if (inputStatus == MIM_DATA)
     { // Channel or system message
 
@@ -493,8 +485,8 @@ private:
         return;
     }
 
-    // Save the time of the last non-filtered message
-    apiData.lastTime = timestamp;
+    // Calculate time stamp - the driver's, in ms since the input was started
+    data.stamp(apiData.message, apiData.startTime + (int64_t)timestamp * 1000000);
 
     if (data.userCallback)
     {
@@ -320,6 +320,8 @@ public:
     if (!id.empty())
     {
       port_ = get(MidiInPort::FromIdAsync(id));
+      // Message timestamps count from when the port was created
+      const int64_t opened = monotonic_ns();
       if (port_)
       {
         port_.MessageReceived([=](auto&, auto args) {
@@ -329,9 +331,12 @@ public:
           array_view<uint8_t> bs;
           reader.ReadBytes(bs);
 
-          double t = static_cast<double>(msg.Timestamp().count());
-
-          rtmidi::message m{{bs.begin(), bs.end()}, t};
+          rtmidi::message m;
+          m.bytes.assign(bs.begin(), bs.end());
+          inputData_.stamp(
+              m, opened
+                     + std::chrono::duration_cast<std::chrono::nanoseconds>(msg.Timestamp())
+                           .count());
           if (inputData_.userCallback)
           {
             inputData_.userCallback(m);
@@ -4,6 +4,7 @@
 #  define WIN32_LEAN_AND_MEAN
 #endif
 #include <algorithm>
+#include <chrono>
 #include <cinttypes>
 #include <memory>
 #include <stdexcept>
@@ -86,6 +87,16 @@ enum class meta_event_type : uint8_t
   UNKNOWN = 0xFF
 };
 
+// The clock message::time_ns is read from, in nanoseconds - std::chrono::steady_clock,
+// which is CLOCK_MONOTONIC on Linux. Compare it with time_ns to see how long ago a
+// message arrived.
+inline int64_t monotonic_ns() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 constexpr inline uint8_t clamp(uint8_t val, uint8_t min, uint8_t max)
 {
   return std::max(std::min(val, max), min);
@@ -94,7 +105,13 @@ constexpr inline uint8_t clamp(uint8_t val, uint8_t min, uint8_t max)
 struct message
 {
   midi_bytes bytes;
+  // On input, seconds since the previous message from the same port (0 for the
+  // first), worked out from time_ns. On output, the delay before sending.
   double timestamp{};
+  // On input, when the message arrived, on the monotonic_ns() clock - taken from
+  // the driver's own timestamp where the backend has one, so it can be compared
+  // across ports and backends.
+  int64_t time_ns{};
 
   message() noexcept = default;
   message(const midi_bytes& src_bytes, double src_timestamp)
@@ -5,40 +5,7 @@
 #  include <rtmidi17/rtmidi17.hpp>
 #endif
 
-#include <rtmidi17/detail/midi_api.hpp>
-#if !__has_include(<weak_libjack.h>) && !__has_include(<jack/jack.h>)
-#  if defined(RTMIDI17_JACK)
-#    undef RTMIDI17_JACK
-#  endif
-#endif
-#if !defined(RTMIDI17_ALSA) && !defined(RTMIDI17_JACK) && !defined(RTMIDI17_COREAUDIO) \
-    && !defined(RTMIDI17_WINMM)
-#  define RTMIDI17_DUMMY
-#endif
-
-#if defined(RTMIDI17_ALSA)
-#  include <rtmidi17/detail/alsa.hpp>
-#endif
-
-#if defined(RTMIDI17_JACK)
-#  include <rtmidi17/detail/jack.hpp>
-#endif
-
-#if defined(RTMIDI17_COREAUDIO)
-#  include <rtmidi17/detail/coreaudio.hpp>
-#endif
-
-#if defined(RTMIDI17_WINMM)
-#  include <rtmidi17/detail/winmm.hpp>
-#endif
-
-#if defined(RTMIDI17_WINUWP)
-#  include <rtmidi17/detail/winuwp.hpp>
-#endif
-
-#if defined(RTMIDI17_DUMMY)
-#  include <rtmidi17/detail/dummy.hpp>
-#endif
+#include <rtmidi17/detail/backends.hpp>
 
 namespace rtmidi
 {
@@ -56,6 +23,10 @@ static constexpr auto available_backends = make_tl(
     ,
     alsa_backend {}
 #endif
+#if defined(RTMIDI17_ALSA_RAW)
+    ,
+    alsa_raw_backend {}
+#endif
 #if defined(RTMIDI17_COREAUDIO)
     ,
     core_backend {}
@@ -72,6 +43,10 @@ static constexpr auto available_backends = make_tl(
     ,
     winuwp_backend {}
 #endif
+#if defined(RTMIDI17_LOOPBACK)
+    ,
+    loopback_backend {}
+#endif
 #if defined(RTMIDI17_DUMMY)
     ,
     dummy_backend {}
@@ -196,6 +171,12 @@ void midi_in::set_callback(message_callback callback)
   (static_cast<midi_in_api*>(rtapi_.get()))->set_callback(std::move(callback));
 }
 
+RTMIDI17_INLINE
+void midi_in::set_batch_callback(batch_callback callback)
+{
+  (static_cast<midi_in_api*>(rtapi_.get()))->set_batch_callback(std::move(callback));
+}
+
 RTMIDI17_INLINE
 void midi_in::cancel_callback()
 {
@@ -214,12 +195,30 @@ std::string midi_in::get_port_name(unsigned int portNumber)
   return rtapi_->get_port_name(portNumber);
 }
 
+RTMIDI17_INLINE
+std::vector<port_information> midi_in::get_ports()
+{
+  return rtapi_->get_ports();
+}
+
+RTMIDI17_INLINE
+input_statistics midi_in::get_statistics()
+{
+  return (static_cast<midi_in_api*>(rtapi_.get()))->get_statistics();
+}
+
 RTMIDI17_INLINE
 void midi_in::ignore_types(bool midiSysex, bool midiTime, bool midiSense)
 {
   (static_cast<midi_in_api*>(rtapi_.get()))->ignore_types(midiSysex, midiTime, midiSense);
 }
 
+RTMIDI17_INLINE
+void midi_in::set_sysex_limit(size_t bytes)
+{
+  (static_cast<midi_in_api*>(rtapi_.get()))->set_sysex_limit(bytes);
+}
+
 RTMIDI17_INLINE
 message midi_in::get_message()
 {
@@ -274,6 +273,12 @@ std::string midi_out::get_port_name(unsigned int portNumber)
   return rtapi_->get_port_name(portNumber);
 }
 
+RTMIDI17_INLINE
+std::vector<port_information> midi_out::get_ports()
+{
+  return rtapi_->get_ports();
+}
+
 RTMIDI17_INLINE
 void midi_out::send_message(const std::vector<unsigned char>& message)
 {
@@ -292,12 +297,39 @@ void midi_out::send_message(const unsigned char* message, size_t size)
   (static_cast<midi_out_api*>(rtapi_.get()))->send_message(message, size);
 }
 
+RTMIDI17_INLINE
+void midi_out::send_messages(const rtmidi::message* messages, size_t count)
+{
+  (static_cast<midi_out_api*>(rtapi_.get()))->send_messages(messages, count);
+}
+
 RTMIDI17_INLINE
 void midi_out::set_error_callback(midi_error_callback errorCallback) noexcept
 {
   rtapi_->set_error_callback(std::move(errorCallback));
 }
 
+#if defined(RTMIDI17_LOOPBACK)
+RTMIDI17_INLINE
+unsigned int loopback::plug(std::string_view name)
+{
+  return loopback_bus::instance().plug(name)->id;
+}
+
+RTMIDI17_INLINE
+bool loopback::unplug(unsigned int id)
+{
+  return loopback_bus::instance().unplug(id);
+}
+
+RTMIDI17_INLINE
+void loopback::set_latency(
+    std::chrono::nanoseconds latency, std::chrono::nanoseconds jitter, unsigned int seed)
+{
+  loopback_bus::instance().set_latency(latency, jitter, seed);
+}
+#endif
+
 RTMIDI17_INLINE
 std::string get_version() noexcept
 {
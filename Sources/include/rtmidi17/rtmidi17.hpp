@@ -57,7 +57,10 @@
  POSSIBILITY OF SUCH DAMAGE.
 */
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -170,7 +173,9 @@ enum class API
   UNIX_JACK,   /*!< The JACK Low-Latency MIDI Server API. */
   WINDOWS_MM,  /*!< The Microsoft Multimedia MIDI API. */
   WINDOWS_UWP, /*!< The Microsoft WinRT MIDI API. */
-  DUMMY        /*!< A compilable but non-functional API. */
+  DUMMY,         /*!< A compilable but non-functional API. */
+  LOOPBACK,      /*!< In-process ports, for testing without devices. */
+  LINUX_ALSA_RAW /*!< ALSA rawmidi devices, without the sequencer. */
 };
 
 /**
@@ -185,8 +190,66 @@ std::vector<rtmidi::API> available_apis() noexcept;
 //! A static function to determine the current version.
 std::string get_version() noexcept;
 
+//! A port as seen by a single enumeration pass.
+struct port_information
+{
+  //! Backend-specific id that stays the same while the port exists.
+  //! ALSA: (client << 8) | port. Backends without one use the port index.
+  unsigned int id{};
+  //! The same string get_port_name() returns for this port.
+  std::string name;
+};
+
+//! How the realtime side of an input has been doing since it was created.
+/*!
+  Only filled in by backends whose input runs in a realtime callback
+  (JACK); the others leave everything at zero.
+*/
+struct input_statistics
+{
+  //! Times the server reported an xrun.
+  uint64_t xruns{};
+  //! Messages lost because the dispatcher thread had fallen a whole
+  //! ringbuffer behind.
+  uint64_t dropped{};
+  //! Bucket i counts process callbacks that took under 2^i usecs (and
+  //! at least 2^(i-1)); the last one also counts everything longer.
+  std::array<uint64_t, 16> process_durations{};
+};
+
+#if defined(RTMIDI17_LOOPBACK)
+//! Control of the in-process ports of API::LOOPBACK.
+/*!
+  A loopback port is listed as both an input and an output: whatever is
+  sent to it is delivered to every midi_in that has it open. Virtual
+  ports opened with the LOOPBACK API are loopback ports too.
+*/
+namespace loopback
+{
+//! Add a port, as if a device had been plugged in, and return its
+//! port_information::id. Observers see an input and an output added.
+unsigned int plug(std::string_view name);
+
+//! Remove a port, as if its device had been unplugged. Messages sent
+//! to it from then on fail with a warning. Returns false if there is no
+//! port with this id.
+bool unplug(unsigned int id);
+
+//! Delay every message sent from now on by latency, plus a random
+//! amount up to jitter. The random numbers start again from seed, so a
+//! run can be repeated. Messages on one port are never reordered.
+void set_latency(
+    std::chrono::nanoseconds latency, std::chrono::nanoseconds jitter = {},
+    unsigned int seed = 1);
+}
+#endif
+
 //! The callbacks will be called whenever a device is added or removed
 //! for a given API.
+/*!
+  The int is the port_information::id of the port and the string its
+  port_information::name, where the backend can report them (ALSA).
+*/
 class RTMIDI17_EXPORT observer
 {
 public:
@@ -227,6 +290,9 @@ public:
   //! User callback function type definition.
   using message_callback = std::function<void(const message& message)>;
 
+  //! Batch callback function type definition - count messages, in the order they arrived.
+  using batch_callback = std::function<void(const message* messages, size_t count)>;
+
   //! Default constructor that allows an optional api, client name and queue
   //! size.
   /*!
@@ -304,6 +370,19 @@ public:
   */
   void set_callback(message_callback callback);
 
+  //! Set a callback function to be invoked with every message that arrived together.
+  /*!
+    Instead of a call per message, the callback gets everything the
+    input thread picked up in one wake-up: all the events pending on the
+    ALSA sequencer or rawmidi device, or all those the JACK process
+    callback handed over since the last time, in pieces of at most 256
+    if input keeps arriving. The messages are only valid for the
+    duration of the call. Backends that don't batch call
+    it with one message at a time. Replaces any callback set with
+    set_callback(), and the other way round.
+  */
+  void set_batch_callback(batch_callback callback);
+
   //! Cancel use of the current callback function (if one exists).
   /*!
     Subsequent incoming MIDI messages will be written to the queue
@@ -335,6 +414,14 @@ public:
   */
   std::string get_port_name(unsigned int portNumber = 0);
 
+  //! Return every available MIDI input port, in port number order.
+  /*!
+    Equivalent to calling get_port_name() for each port number, but
+    backends that have to walk the whole system for each name (ALSA)
+    only walk it once.
+  */
+  std::vector<port_information> get_ports();
+
   //! Specify whether certain MIDI message types should be queued or ignored
   //! during input.
   /*!
@@ -346,6 +433,15 @@ public:
   */
   void ignore_types(bool midiSysex = true, bool midiTime = true, bool midiSense = true);
 
+  //! Set the longest SysEx message, in bytes, that input will reassemble.
+  /*!
+    The ALSA backends put a SysEx message back together from its pieces
+    in a buffer reserved up to this size and reused for every message, so
+    sustained dumps don't reallocate. A message longer than this is
+    dropped whole. The default is 1MB.
+  */
+  void set_sysex_limit(size_t bytes);
+
   //! Fill the user-provided vector with the data bytes for the next available
   //! MIDI message in the input queue and return the event delta-time in
   //! seconds.
@@ -358,6 +454,15 @@ public:
   */
   message get_message();
 
+  //! Return the xrun, dropped message and callback duration counts.
+  /*!
+    With JACK, incoming events are only copied in the process callback;
+    a separate thread decodes them and calls the callback set with
+    set_callback(). These counters show whether the process callback is
+    keeping to its deadline. See input_statistics.
+  */
+  input_statistics get_statistics();
+
   //! Set an error callback function to be invoked when an error has occured.
   /*!
     The callback function will be called whenever an error has occured. It is
@@ -466,6 +571,14 @@ public:
   */
   std::string get_port_name(unsigned int portNumber = 0);
 
+  //! Return every available MIDI output port, in port number order.
+  /*!
+    Equivalent to calling get_port_name() for each port number, but
+    backends that have to walk the whole system for each name (ALSA)
+    only walk it once.
+  */
+  std::vector<port_information> get_ports();
+
   //! Immediately send a single message out an open MIDI output port.
   /*!
       An exception is thrown if an error occurs during output or an
@@ -485,6 +598,25 @@ public:
   */
   void send_message(const unsigned char* message, size_t size);
 
+  //! Send several messages out an open MIDI output port in one go.
+  /*!
+      Each message's timestamp is the delay in seconds after the previous
+      message of the batch (the first one's is after now), like the delta
+      times on incoming messages. The JACK API schedules each message on
+      the matching frame of the process cycle, and the LOOPBACK API
+      delivers each one when it is due; the other APIs ignore the
+      timestamps and send the messages immediately, in order.
+
+      \param messages A pointer to the first message
+      \param count    Number of messages
+  */
+  void send_messages(const rtmidi::message* messages, size_t count);
+
+  void send_messages(const std::vector<rtmidi::message>& messages)
+  {
+    send_messages(messages.data(), messages.size());
+  }
+
   //! Set an error callback function to be invoked when an error has occured.
   /*!
     The callback function will be called whenever an error has occured. It is
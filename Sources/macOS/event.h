@@ -1,51 +1,74 @@
 #pragma once
- 
+
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
- 
+
+//the flag is an atomic, so polling it (wait_for(0s), as the Timer does for every event on every tick) is a load - the
+//mutex and condition variable are only used when a thread actually has to block, and signal() only touches them if one is
 class manual_event
 {
 public:
     explicit manual_event(bool signaled = false) noexcept
     : m_signaled(signaled) {}
- 
+
     void signal() noexcept
     {
+        m_signaled.store(true, std::memory_order_seq_cst);
+        //a waiter registers before it checks the flag, so if it isn't counted yet it will see the flag
+        if (m_waiters.load(std::memory_order_seq_cst) == 0) return;
         {
             std::unique_lock<std::mutex> lock(m_mutex);
-            m_signaled = true;
         }
         m_cv.notify_all();
     }
- 
+
     void wait() noexcept
     {
+        if (is_signaled()) return;
+        waiter_scope waiter(m_waiters);
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_cv.wait(lock, [&](){ return m_signaled != false; });
+        m_cv.wait(lock, [&](){ return is_signaled(); });
     }
- 
+
     template<typename T>
     bool wait_for(T t) noexcept
     {
+        if (is_signaled()) return true;
+        if (t <= T::zero()) return false;
+        waiter_scope waiter(m_waiters);
         std::unique_lock<std::mutex> lock(m_mutex);
-        return m_cv.wait_for(lock, t, [&](){ return m_signaled != false; });
+        return m_cv.wait_for(lock, t, [&](){ return is_signaled(); });
     }
- 
+
     template<typename T>
     bool wait_until(T t) noexcept
     {
+        if (is_signaled()) return true;
+        waiter_scope waiter(m_waiters);
         std::unique_lock<std::mutex> lock(m_mutex);
-        return m_cv.wait_until(lock, t, [&](){ return m_signaled != false; });
+        return m_cv.wait_until(lock, t, [&](){ return is_signaled(); });
     }
- 
+
     void reset() noexcept
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_signaled = false;
+        m_signaled.store(false, std::memory_order_seq_cst);
     }
- 
+
 private:
-    bool m_signaled = false;
+    bool is_signaled() const noexcept { return m_signaled.load(std::memory_order_seq_cst); }
+
+    //counts the blocked threads for signal()
+    struct waiter_scope
+    {
+        explicit waiter_scope(std::atomic<int>& waiters) noexcept : m_waiters(waiters) { m_waiters.fetch_add(1, std::memory_order_seq_cst); }
+        ~waiter_scope() { m_waiters.fetch_sub(1, std::memory_order_seq_cst); }
+        std::atomic<int>& m_waiters;
+    };
+
+    std::atomic<bool> m_signaled{false};
+    std::atomic<int> m_waiters{0};
     std::mutex m_mutex;
     std::condition_variable m_cv;
 };
@@ -310,6 +310,15 @@ function connected(jsonObj)
                 <div class="sdpi-item-label">Fade Curve</div>
                 <input type="number" step="0.1" min="-5" max="5" class="sdpi-item-value" id="fadeCurve" value="" onchange="saveSettings()">
             </div>
+            <div type="checkbox" class="sdpi-item" id="showLevelDiv">
+                <div class="sdpi-item-label">Show Level</div>
+                <div class="sdpi-item-value min100">
+                    <div class="sdpi-item-child">
+                        <input class="sdpi-item-value" id="showLevel" type="checkbox" onchange="saveSettings()">
+                        <label for="showLevel"><span></span></label>
+                    </div>
+                </div>
+            </div>
         </div>
         `;
         
@@ -326,6 +335,7 @@ function connected(jsonObj)
         document.getElementById("ccMode").value = settings.ccMode || 0;
         document.getElementById("fadeTime").value = settings.fadeTime || 1;
         document.getElementById("fadeCurve").value = settings.fadeCurve || 0;
+        document.getElementById("showLevel").checked = settings.showLevel || 0;
         
         switch (document.getElementById("ccMode").value)
         {
@@ -533,6 +543,15 @@ function connected(jsonObj)
                 <div class="sdpi-item-label">Fade Curve</div>
                 <input type="number" step="0.1" min="-5" max="5" class="sdpi-item-value" id="fadeCurve" value="" onchange="saveSettings()">
             </div>
+            <div type="checkbox" class="sdpi-item" id="showLevelDiv">
+                <div class="sdpi-item-label">Show Level</div>
+                <div class="sdpi-item-value min100">
+                    <div class="sdpi-item-child">
+                        <input class="sdpi-item-value" id="showLevel" type="checkbox" onchange="saveSettings()">
+                        <label for="showLevel"><span></span></label>
+                    </div>
+                </div>
+            </div>
         </div>
         `);
         document.getElementById("midiChannel").value = (settings.statusByte - CC) || 1;
@@ -546,6 +565,7 @@ function connected(jsonObj)
         document.getElementById("midiValueSec").value = settings.midiValueSec || 0;*/
 
         document.getElementById("toggleFade").checked = settings.toggleFade || 0;
+        document.getElementById("showLevel").checked = settings.showLevel || 0;
         document.getElementById("fadeTime").value = settings.fadeTime || 1;
         document.getElementById("fadeCurve").value = settings.fadeCurve || 0;
         document.getElementById("fadeTimeDiv").style.display = document.getElementById("toggleFade").checked ? "" : "none";
@@ -759,6 +779,7 @@ function saveSettings()
         settings.ccMode = parseInt(document.getElementById("ccMode").value);
         settings.fadeTime = parseFloat(document.getElementById("fadeTime").value);
         settings.fadeCurve = parseFloat(document.getElementById("fadeCurve").value);
+        settings.showLevel = document.getElementById("showLevel").checked;
         switch (document.getElementById("ccMode").value)
         {
             case "0":
@@ -798,6 +819,7 @@ function saveSettings()
         settings.fadeTime = parseFloat(document.getElementById("fadeTime").value);
         settings.fadeCurve = parseFloat(document.getElementById("fadeCurve").value);
         settings.toggleFade = document.getElementById("toggleFade").checked;
+        settings.showLevel = document.getElementById("showLevel").checked;
         document.getElementById("fadeTimeDiv").style.display = document.getElementById("toggleFade").checked ? "" : "none";
         document.getElementById("fadeCurveDiv").style.display = document.getElementById("toggleFade").checked ? "" : "none";
     }